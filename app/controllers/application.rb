@@ -67,6 +67,7 @@ class ApplicationController < ActionController::Base
     logger.debug "extract_headers"
     
     @contenttype = request.env["CONTENT_TYPE"]
+    @content_range = request.env["HTTP_CONTENT_RANGE"]
     
     @if_match = request.env["HTTP_IF_MATCH"]
     @if_modified_since = request.env["HTTP_IF_MODIFIED_SINCE"]
@@ -80,6 +80,18 @@ class HttpController < ApplicationController
   end
 
   def put
+    if @content_range.nil?
+      put_contents request.cgi.stdinput
+    else
+      put_segment
+    end
+  end
+
+  private
+
+  # writes +stream+ as the body of the resource at @path, creating it
+  # if necessary
+  def put_contents(stream)
     # todo:
     #   - incorrect file size in cadaver status mesg. -> bug in Mongrel
     
@@ -100,7 +112,7 @@ class HttpController < ApplicationController
         @resource.before_write_content(@principal, *@if_locktokens)
       end
 
-      Body.make(@contenttype, @resource, request.cgi.stdinput)
+      Body.make(@contenttype, @resource, stream)
 
       @resource.after_put if @resource.respond_to? :after_put
     end
@@ -109,7 +121,63 @@ class HttpController < ApplicationController
     render :nothing => true, :status => status
   end
 
-  private
+  # Partial PUT, for resumable uploads.  "Content-Range: bytes
+  # first-last/length" appends a segment to the upload staged for
+  # @path, and "bytes */length" with an empty body asks how much has
+  # been staged.  Until the last byte arrives the response is 202,
+  # with a Range header giving the bytes staged so far; a segment
+  # which does not start there gets 416, and one whose total length
+  # differs from that of the upload staged so far gets 400.  The
+  # resource itself is only written once the upload is complete.
+  def put_segment
+    first, last, length = parse_content_range
+    key = "#{@principal.id}:#{@path}"
+
+    if @resource.nil?
+      parent = Collection.parent_collection_raises_conflict(@path)
+      Privilege.priv_bind.assert_granted(parent, @principal)
+    else
+      @resource.before_write_content(@principal, *@if_locktokens)
+    end
+
+    staged = begin
+               if first.nil?
+                 Body.staged_size(key, length)
+               else
+                 Body.stage(key, first, last - first + 1, length,
+                            request.cgi.stdinput)
+               end
+             rescue RequestedRangeNotSatisfiableError
+               set_staged_range Body.staged_size(key, length)
+               raise
+             end
+
+    if staged == length && length > 0
+      Body.open_staged(key, length) { |f| put_contents f }
+    else
+      set_staged_range staged
+      render :nothing => true, :status => Status::HTTP_STATUS_ACCEPTED.code
+    end
+  end
+
+  # returns [first, last, length] from the Content-Range header, with
+  # first and last nil for "bytes */length"
+  def parse_content_range
+    case @content_range
+    when /^bytes (\d+)-(\d+)\/(\d+)$/
+      first, last, length = $1.to_i, $2.to_i, $3.to_i
+      raise BadRequestError unless first <= last && last < length
+      [first, last, length]
+    when /^bytes \*\/(\d+)$/
+      [nil, nil, $1.to_i]
+    else
+      raise BadRequestError
+    end
+  end
+
+  def set_staged_range(staged)
+    headers['Range'] = "bytes=0-#{staged - 1}" if staged > 0
+  end
 
   def set_validators
     headers['ETag'] = "\"#{@resource.etag}\""
@@ -36,6 +36,10 @@ class Body < ActiveRecord::Base
 
   TEMP_FOLDER = File.join(RAILS_ROOT,"tmp")
 
+  # seconds after its last segment at which a staged upload is
+  # considered abandoned
+  STAGING_EXPIRY = 24 * 60 * 60
+
   set_primary_key "resource_id"
 
   after_create :deplete_quota
@@ -121,6 +125,80 @@ class Body < ActiveRecord::Base
     resource.body
   end
 
+  # Resumable uploads: the segments of a partial PUT are appended to
+  # a staging file named for +key+ and the +total+ length of the
+  # upload, so each segment costs only its own length, and the body is
+  # made from the staging file once the last segment has arrived.  An
+  # upload of a different total length for the same +key+ must start
+  # again from byte 0.
+
+  # returns the number of bytes staged for +key+ of an upload of
+  # +total+ bytes
+  def self.staged_size(key, total)
+    check_staged_total(key, total)
+    path = staging_path(key, total)
+    File.exists?(path) ? File.size(path) : 0
+  end
+
+  # appends the +length+ bytes of +contents+ to the upload of +total+
+  # bytes staged for +key+, which must start at byte +first+ (0 starts
+  # a new upload); returns the number of bytes now staged.  A short
+  # segment is discarded.
+  def self.stage(key, first, length, total, contents)
+    if first == 0
+      Dir[staging_path(key, "*")].each { |p| File.delete(p) rescue nil }
+      expire_staged
+    else
+      check_staged_total(key, total)
+    end
+
+    File.open(staging_path(key, total),
+              File::WRONLY | File::CREAT, 0600) do |f|
+      f.flock(File::LOCK_EX)
+      f.truncate(0) if first == 0
+      raise RequestedRangeNotSatisfiableError unless first == f.stat.size
+
+      f.seek(first)
+      bsize = Utility.stream_blksize(contents, f)
+      while s = contents.read(bsize)
+        f.write s
+      end
+
+      unless f.pos == first + length
+        f.truncate(first)
+        raise BadRequestError
+      end
+      f.pos
+    end
+  end
+
+  # yields the staged upload of +total+ bytes for +key+ as a File,
+  # then discards it
+  def self.open_staged(key, total)
+    path = staging_path(key, total)
+    result = File.open(path, "rb") { |f| yield f }
+    discard_staged key, total
+    result
+  end
+
+  def self.discard_staged(key, total)
+    path = staging_path(key, total)
+    File.delete(path) if File.exists?(path)
+  end
+
+  # deletes staged uploads to which nothing has been appended for
+  # STAGING_EXPIRY seconds
+  def self.expire_staged
+    cutoff = Time.now - STAGING_EXPIRY
+    Dir[File.join(TEMP_FOLDER, "put-*")].each do |path|
+      begin
+        File.delete(path) if File.mtime(path) < cutoff
+      rescue SystemCallError
+        # already gone
+      end
+    end
+  end
+
   def self.get_diff_body(from_body, to_body)
     from_file = from_body.stream
     to_file = to_body.stream
@@ -154,6 +232,19 @@ class Body < ActiveRecord::Base
 
   private
 
+  def self.staging_path(key, total)
+    File.join(TEMP_FOLDER, "put-#{Digest::SHA1.hexdigest(key)}-#{total}")
+  end
+
+  # raises BadRequestError if an upload of other than +total+ bytes is
+  # staged for +key+
+  def self.check_staged_total(key, total)
+    own = staging_path(key, total)
+    unless Dir[staging_path(key, "*")].all? { |p| p == own }
+      raise BadRequestError
+    end
+  end
+
   def self.filestore_trash
     find_by_sql("SELECT b1.sha1 FROM bodies b1 INNER JOIN" +
                 " (SELECT sha1, COUNT(sha1) FROM bodies" +
@@ -100,6 +100,11 @@ class UnsupportedMediaTypeError < HttpError
   def status; Status::HTTP_STATUS_UNSUPPORTED_MEDIA_TYPE; end
 end
 
+# 416
+class RequestedRangeNotSatisfiableError < HttpError
+  def status; Status::HTTP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE; end
+end
+
 # 423
 class LockedError < HttpError
   def status; Status::HTTP_STATUS_LOCKED; end
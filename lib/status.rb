@@ -46,6 +46,7 @@ class Status
   HTTP_STATUS_CONFLICT = Status.new(409,"Conflict").freeze
   HTTP_STATUS_PRECONDITION_FAILED = Status.new(412,"Precondition Failed").freeze
   HTTP_STATUS_UNSUPPORTED_MEDIA_TYPE = Status.new(415,"Unsupported Media Type").freeze
+  HTTP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE = Status.new(416,"Requested Range Not Satisfiable").freeze
   HTTP_STATUS_LOCKED = Status.new(423,"Locked").freeze
   HTTP_STATUS_FAILED_DEPENDENCY = Status.new(424,"Failed Dependency").freeze
   HTTP_STATUS_INTERNAL_SERVER_ERROR = Status.new(500,"Internal Server Error").freeze
@@ -55,6 +56,7 @@ class Status
   HTTP_STATUS_LOOP_DETECTED = Status.new(506,"Loop Detected").freeze
   HTTP_STATUS_INSUFFICIENT_STORAGE = Status.new(507,"Insufficient Storage").freeze
   HTTP_STATUS_CREATED = Status.new(201,"Created").freeze
+  HTTP_STATUS_ACCEPTED = Status.new(202,"Accepted").freeze
   HTTP_STATUS_OK = Status.new(200,"OK").freeze
   HTTP_STATUS_NO_CONTENT = Status.new(204,"No Content").freeze
   HTTP_STATUS_MULTISTATUS = Status.new(207,"Multi-Status").freeze
@@ -417,5 +417,103 @@ class HttpControllerTest < DavFunctionalTestCase
     assert_response 204
   end
 
+
+  def test_put_segments
+    put_segment '/foo', 'bytes 0-3/10', 'test'
+    assert_response 202
+    assert_equal 'bytes=0-3', @response.headers['Range']
+
+    put_segment '/foo', 'bytes */10', ''
+    assert_response 202
+    assert_equal 'bytes=0-3', @response.headers['Range']
+
+    put_segment '/foo', 'bytes 4-9/10', 'segmnt'
+    assert_response 201
+    assert_content_equals 'testsegmnt', '/foo', true
+  end
+
+  def test_put_segment_not_staged_yet
+    put_segment '/foo', 'bytes */10', ''
+    assert_response 202
+    assert_nil @response.headers['Range']
+    assert_raise(NotFoundError) { Bind.locate('/foo') }
+  end
+
+  def test_put_segment_misaligned
+    put_segment '/foo', 'bytes 0-3/10', 'test'
+    put_segment '/foo', 'bytes 6-9/10', 'ment'
+    assert_response 416
+    assert_equal 'bytes=0-3', @response.headers['Range']
+  end
+
+  def test_put_segment_restart
+    put_segment '/foo', 'bytes 0-3/8', 'test'
+    put_segment '/foo', 'bytes 0-3/8', 'best'
+    assert_response 202
+    put_segment '/foo', 'bytes 4-7/8', 'case'
+    assert_response 201
+    assert_content_equals 'bestcase', '/foo', true
+  end
+
+  def test_put_segment_short
+    put_segment '/foo', 'bytes 0-3/10', 'tes'
+    assert_response 400
+
+    put_segment '/foo', 'bytes */10', ''
+    assert_nil @response.headers['Range']
+  end
+
+  def test_put_segment_bad_range
+    put_segment '/foo', 'bytes 4-3/10', ''
+    assert_response 400
+    put_segment '/foo', 'bytes 0-3', 'test'
+    assert_response 400
+  end
+
+  def test_put_segment_total_changed
+    put_segment '/foo', 'bytes 0-3/10', 'test'
+    put_segment '/foo', 'bytes 4-7/8', 'ment'
+    assert_response 400
+    put_segment '/foo', 'bytes */8', ''
+    assert_response 400
+
+    put_segment '/foo', 'bytes */10', ''
+    assert_response 202
+    assert_equal 'bytes=0-3', @response.headers['Range']
+
+    # starting again from byte 0 replaces the staged upload
+    put_segment '/foo', 'bytes 0-7/8', 'testment'
+    assert_response 201
+    assert_content_equals 'testment', '/foo', true
+  end
+
+  def test_put_segment_expired
+    put_segment '/foo', 'bytes 0-3/10', 'test'
+    old = Time.now - Body::STAGING_EXPIRY - 60
+    Dir[File.join(Body::TEMP_FOLDER, "put-*")].each do |path|
+      File.utime(old, old, path)
+    end
+
+    # the abandoned upload is removed when another one starts
+    put_segment '/bar', 'bytes 0-3/10', 'test'
+    assert_response 202
+    put_segment '/foo', 'bytes */10', ''
+    assert_response 202
+    assert_nil @response.headers['Range']
+  end
+
+  def test_put_segment_permission_denied
+    put_segment '/foo', 'bytes 0-3/10', 'test', 'ren'
+    assert_response 403
+  end
+
+  private
+
+  def put_segment(path, range, body, principal = 'limeberry')
+    @request.body = body
+    @request.env['HTTP_CONTENT_RANGE'] = range
+    put path, principal
+  end
+
   
 end
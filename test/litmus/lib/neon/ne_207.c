@@ -44,6 +44,8 @@ struct ne_207_parser_s {
     ne_xml_parser *parser;
     void *userdata;
 
+    const char *dav; /* the interned "DAV:" namespace */
+
     ne_buffer *cdata;
 
     /* remember whether we are in a response: the validation
@@ -132,8 +134,14 @@ static int start_element(void *userdata, int parent,
                          const char **atts) 
 {
     ne_207_parser *p = userdata;
-    int state = ne_xml_mapid(map207, NE_XML_MAPLEN(map207), nspace, name);
+    int state;
+
+    /* All the elements handled are in the DAV: namespace. */
+    if (nspace != p->dav)
+        return NE_XML_DECLINE;
 
+    state = ne_xml_parser_mapid(p->parser, map207, NE_XML_MAPLEN(map207),
+                                nspace, name);
     if (!can_handle(parent, state))
         return NE_XML_DECLINE;
 
@@ -223,6 +231,7 @@ ne_207_parser *ne_207_create(ne_xml_parser *parser, void *userdata)
 
     p->parser = parser;
     p->userdata = userdata;
+    p->dav = ne_xml_intern(parser, "DAV:");
     p->cdata = ne_buffer_create();
 
     /* Add handler for the standard 207 elements */
@@ -0,0 +1,116 @@
+/* 
+   Arena allocation
+   Copyright (C) 1999-2005, Joe Orton <joe@manyfish.co.uk>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+   
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public
+   License along with this library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+   MA 02111-1307, USA
+
+*/
+
+#include "config.h"
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include "ne_alloc.h"
+#include "ne_arena.h"
+
+/* Each block of an arena; the data area follows the header. */
+struct ne_arena {
+    struct ne_arena *next; /* next (older) block */
+    size_t size, used;
+};
+
+/* Size of the data area of a new arena block. */
+#define ARENA_SIZE (4096)
+/* Alignment of allocations from the arena. */
+#define ARENA_ALIGN (sizeof(void *) > sizeof(double) \
+                     ? sizeof(void *) : sizeof(double))
+#define ARENA_ROUND(n) (((n) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+/* Size of the block header, and the data area of block 'a'. */
+#define ARENA_HEADER ARENA_ROUND(sizeof(struct ne_arena))
+#define ARENA_DATA(a) ((char *)(a) + ARENA_HEADER)
+
+void *ne__arena_alloc(struct ne_arena **arena, size_t len)
+{
+    struct ne_arena *a = *arena;
+    void *ptr;
+
+    len = ARENA_ROUND(len);
+
+    if (a == NULL || a->size - a->used < len) {
+        size_t size = len > ARENA_SIZE ? len : ARENA_SIZE;
+
+        a = ne_malloc(ARENA_HEADER + size);
+        a->size = size;
+        a->used = 0;
+        a->next = *arena;
+        *arena = a;
+    }
+
+    ptr = ARENA_DATA(a) + a->used;
+    a->used += len;
+    return ptr;
+}
+
+char *ne__arena_strndup(struct ne_arena **arena, 
+                        const char *str, size_t len)
+{
+    char *ret = ne__arena_alloc(arena, len + 1);
+
+    memcpy(ret, str, len);
+    ret[len] = '\0';
+    return ret;
+}
+
+void ne__arena_reset(struct ne_arena **arena)
+{
+    struct ne_arena *a = *arena;
+
+    if (a == NULL) return;
+
+    if (a->next) {
+        size_t total = 0;
+
+        do {
+            struct ne_arena *next = a->next;
+            total += a->size;
+            ne_free(a);
+            a = next;
+        } while (a);
+
+        a = ne_malloc(ARENA_HEADER + total);
+        a->size = total;
+        a->next = NULL;
+        *arena = a;
+    }
+
+    a->used = 0;
+}
+
+void ne__arena_free(struct ne_arena **arena)
+{
+    struct ne_arena *a = *arena, *next;
+
+    for (; a; a = next) {
+        next = a->next;
+        ne_free(a);
+    }
+    *arena = NULL;
+}
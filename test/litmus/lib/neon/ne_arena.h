@@ -0,0 +1,55 @@
+/* 
+   Arena allocation
+   Copyright (C) 1999-2005, Joe Orton <joe@manyfish.co.uk>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+   
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public
+   License along with this library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+   MA 02111-1307, USA
+
+*/
+
+/* THIS IS NOT A PUBLIC INTERFACE. You CANNOT include this header file
+ * from an application.  */
+ 
+#ifndef NE_ARENA_H
+#define NE_ARENA_H
+
+#include <sys/types.h>
+
+/* An arena is a block of memory from which many small allocations
+ * are made and then released together, so that it can be reused
+ * from one response to the next; allocations which do not fit are
+ * made from overflow blocks.  An arena is referred to by a pointer
+ * which is NULL when it is empty; the functions below update it. */
+struct ne_arena;
+
+/* Allocate 'len' bytes from the arena '*arena', suitably aligned for
+ * any type. */
+void *ne__arena_alloc(struct ne_arena **arena, size_t len);
+
+/* Copy 'len' bytes of 'str' into the arena '*arena', as a
+ * NUL-terminated string. */
+char *ne__arena_strndup(struct ne_arena **arena, 
+                        const char *str, size_t len);
+
+/* Release all allocations from the arena '*arena'.  If it overflowed,
+ * the blocks are replaced by a single block big enough for the lot,
+ * so that allocations of a similar total size next time need only
+ * one block. */
+void ne__arena_reset(struct ne_arena **arena);
+
+/* Free the arena '*arena', and set '*arena' to NULL. */
+void ne__arena_free(struct ne_arena **arena);
+
+#endif /* NE_ARENA_H */
@@ -35,6 +35,13 @@
 #endif
 
 #include <errno.h>
+#include <stdio.h>
+
+#ifdef NE_USE_POLL
+#include <sys/poll.h>
+#elif defined(HAVE_SYS_SELECT_H)
+#include <sys/select.h>
+#endif
 
 #include "ne_request.h"
 #include "ne_alloc.h"
@@ -49,6 +56,7 @@
 
 #include "ne_dates.h"
 #include "ne_i18n.h"
+#include "ne_internal.h"
 
 int ne_getmodtime(ne_session *sess, const char *uri, time_t *modtime) 
 {
@@ -107,6 +115,188 @@ int ne_put(ne_session *sess, const char *uri, int fd)
     return ret;
 }
 
+/* Segment size used by ne_put_resumable if none is given. */
+#define PUT_SEGMENT (16 * 1024 * 1024)
+
+/* Reads checkpoint file 'checkpoint'; returns the offset it records
+ * for an upload to 'uri' of a file of 'size' bytes modified at
+ * 'mtime', or zero if it records some other upload or none. */
+static off_t read_checkpoint(const char *checkpoint, const char *uri,
+                             off_t size, time_t mtime)
+{
+    FILE *f = fopen(checkpoint, "r");
+    char line[BUFSIZ], *ptr;
+    off_t offset = 0;
+
+    if (f == NULL)
+        return 0;
+
+    /* Format is "<size> <mtime> <offset> <uri>". */
+    if (fgets(line, sizeof line, f) != NULL 
+        && ne_strtoff(line, &ptr, 10) == size
+        && strtol(ptr, &ptr, 10) == (long)mtime) {
+        offset = ne_strtoff(ptr, &ptr, 10);
+        if (*ptr++ != ' ' || strcmp(ne_shave(ptr, "\r\n"), uri) 
+            || offset < 0 || offset > size)
+            offset = 0;
+    }
+
+    fclose(f);
+    return offset;
+}
+
+/* Records in checkpoint file 'checkpoint' that the first 'offset'
+ * bytes of an upload have been confirmed. */
+static int write_checkpoint(ne_session *sess, const char *checkpoint, 
+                            const char *uri, off_t size, time_t mtime,
+                            off_t offset)
+{
+    char *tmp = ne_concat(checkpoint, ".new", NULL);
+    FILE *f = fopen(tmp, "w");
+    int ret = 0;
+
+    if (f == NULL 
+        || fprintf(f, "%" NE_FMT_OFF_T " %ld %" NE_FMT_OFF_T " %s\n",
+                   size, (long)mtime, offset, uri) < 0
+        || fclose(f) != 0 || rename(tmp, checkpoint) != 0) {
+        char err[200];
+        ne_strerror(errno, err, sizeof err);
+        ne_set_error(sess, _("Could not write checkpoint file: %s"), err);
+        ret = -1;
+    }
+
+    ne_free(tmp);
+    return ret;
+}
+
+/* Sends bytes 'first' to 'last' of the 'size' bytes of 'fd' as a
+ * segment of a resumable upload to 'uri', or only queries the
+ * upload if 'first' is negative.  On success, sets *staged to the
+ * number of bytes the server has staged, or to 'size' once the
+ * upload is complete.  Returns an NE_* error code. */
+static int put_segment(ne_session *sess, const char *uri, int fd,
+                       off_t first, off_t last, off_t size, off_t *staged)
+{
+    ne_request *req = ne_request_create(sess, "PUT", uri);
+    const ne_status *st = ne_get_status(req);
+    const char *value;
+    char *end;
+    int ret;
+
+#ifdef NE_HAVE_DAV
+    ne_lock_using_resource(req, uri, 0);
+    ne_lock_using_parent(req, uri);
+#endif
+
+    if (first < 0) {
+        ne_print_request_header(req, "Content-Range", 
+                                "bytes */%" NE_FMT_OFF_T, size);
+        ne_set_request_body_buffer(req, "", 0);
+    } else {
+        ne_print_request_header(req, "Content-Range", "bytes %" NE_FMT_OFF_T
+                                "-%" NE_FMT_OFF_T "/%" NE_FMT_OFF_T,
+                                first, last, size);
+        ne_set_request_body_fd(req, fd, first, last - first + 1);
+    }
+
+    ret = ne_request_dispatch(req);
+
+    if (ret == NE_OK && (st->code == 202 || st->code == 416)) {
+        /* The server gives the bytes staged so far, as a range
+         * which starts at zero. */
+        value = ne_get_response_header(req, "Range");
+        if (value == NULL) {
+            *staged = 0;
+        } else if (strncmp(value, "bytes=0-", 8) == 0) {
+            *staged = ne_strtoff(value + 8, &end, 10) + 1;
+            if (end == value + 8 || *end != '\0') ret = NE_ERROR;
+        } else {
+            ret = NE_ERROR;
+        }
+        if (ret) {
+            ne_set_error(sess, _("Could not parse staged range"));
+        }
+        if (ret == NE_OK && (*staged < 0 || *staged > size)) {
+            ne_set_error(sess, _("Invalid staged range"));
+            ret = NE_ERROR;
+        }
+    } 
+    else if (ret == NE_OK && st->klass == 2) {
+        /* A server which ignores Content-Range replaces the resource
+         * with the first segment, or with the empty body of a
+         * query. */
+        if (first < 0 || last != size - 1) {
+            ne_set_error(sess, _("Server does not support resumable PUT"));
+            ret = NE_ERROR;
+        } else {
+            *staged = size;
+        }
+    }
+    else if (ret == NE_OK) {
+        ret = NE_ERROR;
+    }
+
+    ne_request_destroy(req);
+    return ret;
+}
+
+int ne_put_resumable(ne_session *sess, const char *uri, int fd,
+                     off_t segment, const char *checkpoint)
+{
+    struct stat st;
+    off_t offset, last;
+    int ret;
+
+    if (fstat(fd, &st)) {
+        int errnum = errno;
+        char buf[200];
+
+        ne_set_error(sess, _("Could not determine file size: %s"),
+                     ne_strerror(errnum, buf, sizeof buf));
+        return NE_ERROR;
+    }
+
+    if (segment <= 0) segment = PUT_SEGMENT;
+
+    if (st.st_size <= segment) {
+        ret = ne_put(sess, uri, fd);
+        if (ret == NE_OK) unlink(checkpoint);
+        return ret;
+    }
+
+    /* Resume from the bytes the server has staged, if the checkpoint
+     * shows an earlier attempt to upload this file. */
+    offset = read_checkpoint(checkpoint, uri, st.st_size, st.st_mtime);
+    if (offset > 0) {
+        ret = put_segment(sess, uri, fd, -1, -1, st.st_size, &offset);
+        if (ret) return ret;
+        NE_DEBUG(NE_DBG_HTTP, "Resuming PUT at %" NE_FMT_OFF_T ".\n", offset);
+    }
+
+    while (offset < st.st_size) {
+        off_t first = offset;
+
+        last = offset + segment - 1;
+        if (last >= st.st_size) last = st.st_size - 1;
+
+        ret = put_segment(sess, uri, fd, first, last, st.st_size, &offset);
+        if (ret) return ret;
+
+        if (offset == first) {
+            ne_set_error(sess, _("Server did not accept segment"));
+            return NE_ERROR;
+        }
+
+        if (offset < st.st_size
+            && write_checkpoint(sess, checkpoint, uri, st.st_size, 
+                                st.st_mtime, offset))
+            return NE_ERROR;
+    }
+
+    unlink(checkpoint);
+    return NE_OK;
+}
+
 /* Dispatch a GET request REQ, writing the response body to FD fd.  If
  * RANGE is non-NULL, then it is the value of the Range request
  * header, e.g. "bytes=1-5".  Returns an NE_* error code. */
@@ -210,6 +400,332 @@ int ne_get(ne_session *sess, const char *uri, int fd)
 }
 
 
+/* Minimum number of bytes fetched over each connection by
+ * ne_get_range_parallel; smaller resources use fewer connections. */
+#define PARALLEL_MIN_RANGE (256 * 1024)
+
+/* Maximum number of connections used by ne_get_range_parallel. */
+#define PARALLEL_MAX_CONNS (64)
+
+/* One range fetched by ne_get_range_parallel. */
+struct range_part {
+    ne_request *req;
+    off_t start, end; /* first and last byte of the range */
+    off_t offset; /* file offset of the next byte received */
+    const char *etag; /* entity tag of the resource */
+    char brange[64]; /* value of the Range request header */
+    int fd, ready, done;
+    int mismatch; /* non-zero if the response was not for this range */
+    int whole; /* non-zero if the whole resource was sent instead */
+};
+
+/* Accepts a response for a range if it is a 206 giving the requested
+ * range of the same entity; a 200 response is marked as being for the
+ * whole resource, other 2xx responses as a mismatch, and non-2xx
+ * responses are left for the caller. */
+static int accept_part(void *userdata, ne_request *req, const ne_status *st)
+{
+    struct range_part *part = userdata;
+    const char *range = ne_get_response_header(req, "Content-Range");
+    const char *etag = ne_get_response_header(req, "ETag");
+    size_t len = strlen(part->brange + 6);
+
+    if (st->klass != 2)
+        return 0;
+
+    if (st->code == 200) {
+        part->whole = 1;
+        return 0;
+    }
+
+    if (st->code != 206 || range == NULL || strncmp(range, "bytes ", 6)
+        || strncmp(range + 6, part->brange + 6, len) || range[6 + len] != '/'
+        || etag == NULL || strcmp(etag, part->etag)) {
+        part->mismatch = 1;
+        return 0;
+    }
+
+    part->offset = part->start;
+    return 1;
+}
+
+/* Writes a block of a range at its offset in the file. */
+static int write_part(void *userdata, const char *buf, size_t len)
+{
+    struct range_part *part = userdata;
+
+    if (part->offset + (off_t)len > part->end + 1) {
+        ne_set_error(ne_get_session(part->req), 
+                     _("Response did not include requested range"));
+        return -1;
+    }
+
+    while (len > 0) {
+#ifdef HAVE_PWRITE
+        ssize_t ret = pwrite(part->fd, buf, len, part->offset);
+#else
+        ssize_t ret = lseek(part->fd, part->offset, SEEK_SET) == -1 ? -1
+            : write(part->fd, buf, len);
+#endif
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        } else if (ret < 0) {
+            char err[200];
+            ne_strerror(errno, err, sizeof err);
+            ne_set_error(ne_get_session(part->req), 
+                         _("Could not write to file: %s"), err);
+            return -1;
+        }
+        buf += ret;
+        len -= ret;
+        part->offset += ret;
+    }
+
+    return 0;
+}
+
+/* Finds the length and strong entity tag of the resource at 'uri'
+ * using a HEAD request; *etag is set to NULL if either is not
+ * given or ranges are not supported. */
+static int head_entity(ne_session *sess, const char *uri, 
+                       off_t *length, char **etag)
+{
+    ne_request *req = ne_request_create(sess, "HEAD", uri);
+    const char *value, *ranges;
+    int ret;
+
+    *etag = NULL;
+    ret = ne_request_dispatch(req);
+
+    if (ret == NE_OK && ne_get_status(req)->klass != 2) {
+        ret = NE_ERROR;
+    } else if (ret == NE_OK) {
+        value = ne_get_response_header(req, "Content-Length");
+        ranges = ne_get_response_header(req, "Accept-Ranges");
+        if (value && (ranges == NULL || strcmp(ranges, "none"))) {
+            *length = ne_strtoff(value, NULL, 10);
+            value = ne_get_response_header(req, "ETag");
+            if (value && *value == '"' && *length > 0)
+                *etag = ne_strdup(value);
+        }
+    }
+
+    ne_request_destroy(req);
+    return ret;
+}
+
+/* Truncates file 'fd' to 'length' bytes, and seeks to its start. */
+static int reset_file(ne_session *sess, int fd, off_t length)
+{
+    if (lseek(fd, 0, SEEK_SET) == -1 || ftruncate(fd, length)) {
+        char err[200];
+        ne_strerror(errno, err, sizeof err);
+        ne_set_error(sess, _("Could not write to file: %s"), err);
+        return NE_ERROR;
+    }
+    return NE_OK;
+}
+
+/* Drives the 'count' requests of 'parts' to completion, stepping
+ * each one as its connection is ready; returns NE_OK, NE_RETRY if
+ * the server sent the whole resource in response to a range, or the
+ * NE_* code of the first failure.  The remaining requests are
+ * abandoned unless NE_OK is returned. */
+static int step_parts(ne_session *sess, struct range_part *parts, int count)
+{
+    int left = count, n, ret, rdtimeout = ne_get_read_timeout(sess);
+
+    while (left > 0) {
+#ifdef NE_USE_POLL
+        struct pollfd pfds[PARALLEL_MAX_CONNS];
+        int map[PARALLEL_MAX_CONNS];
+#else
+        fd_set rdfds, wrfds;
+        struct timeval tv;
+        int maxfd = -1;
+#endif
+        int npfds = 0, timeout = rdtimeout > 0 ? rdtimeout * 1000 : -1;
+
+#ifndef NE_USE_POLL
+        FD_ZERO(&rdfds);
+        FD_ZERO(&wrfds);
+#endif
+
+        for (n = 0; n < count; n++) {
+            struct range_part *part = &parts[n];
+            int events, fd, msec;
+
+            if (part->done) continue;
+
+            if (part->ready) {
+                ret = ne_request_step(part->req);
+                if (part->whole) {
+                    return NE_RETRY;
+                } else if (part->mismatch) {
+                    ne_set_error(sess, _("Resource changed during "
+                                         "parallel GET"));
+                    return NE_ERROR;
+                } else if (ret == NE_OK 
+                           && ne_get_status(part->req)->klass != 2) {
+                    return NE_ERROR;
+                } else if (ret == NE_OK && part->offset != part->end + 1) {
+                    ne_set_error(sess, _("Response did not include "
+                                         "requested range"));
+                    return NE_ERROR;
+                } else if (ret != NE_AGAIN) {
+                    if (ret != NE_OK) return ret;
+                    part->done = 1;
+                    left--;
+                    continue;
+                }
+            }
+
+            fd = ne_request_fd(part->req);
+            events = ne_request_events(part->req);
+            msec = ne_request_timeout(part->req);
+            if (msec >= 0 && (timeout < 0 || msec < timeout))
+                timeout = msec;
+
+#ifdef NE_USE_POLL
+            pfds[npfds].fd = fd;
+            pfds[npfds].events = ((events & NE_SOCK_WANT_READ) ? POLLIN : 0)
+                | ((events & NE_SOCK_WANT_WRITE) ? POLLOUT : 0);
+            pfds[npfds].revents = 0;
+            map[npfds] = n;
+#else
+            if (events & NE_SOCK_WANT_READ) FD_SET(fd, &rdfds);
+            if (events & NE_SOCK_WANT_WRITE) FD_SET(fd, &wrfds);
+            if (fd > maxfd) maxfd = fd;
+#endif
+            npfds++;
+        }
+
+        if (left == 0) break;
+
+#ifdef NE_USE_POLL
+        do {
+            ret = poll(pfds, npfds, timeout);
+        } while (ret < 0 && errno == EINTR);
+#else
+        tv.tv_sec = timeout / 1000;
+        tv.tv_usec = (timeout % 1000) * 1000;
+        do {
+            ret = select(maxfd + 1, &rdfds, &wrfds, NULL, 
+                         timeout >= 0 ? &tv : NULL);
+        } while (ret < 0 && errno == EINTR);
+#endif
+
+        if (ret < 0) {
+            char err[200];
+            ne_strerror(errno, err, sizeof err);
+            ne_set_error(sess, _("Could not wait for connections: %s"), err);
+            return NE_ERROR;
+        }
+
+        for (n = 0; n < count; n++)
+            parts[n].ready = !parts[n].done 
+                && ne_request_timeout(parts[n].req) == 0;
+
+#ifdef NE_USE_POLL
+        for (n = 0; n < npfds; n++)
+            if (pfds[n].revents) parts[map[n]].ready = 1;
+#else
+        for (n = 0; n < count; n++) {
+            int fd = parts[n].done ? -1 : ne_request_fd(parts[n].req);
+            if (fd >= 0 && (FD_ISSET(fd, &rdfds) || FD_ISSET(fd, &wrfds)))
+                parts[n].ready = 1;
+        }
+#endif
+
+        /* Nothing happened within the read timeout. */
+        if (ret == 0) {
+            for (n = 0; n < count && !parts[n].ready; n++)
+                /* nothing */;
+            if (n == count) {
+                ne_set_error(sess, _("Connection timed out"));
+                return NE_TIMEOUT;
+            }
+        }
+    }
+
+    return NE_OK;
+}
+
+int ne_get_range_parallel(ne_session *sess, const char *uri, int fd,
+                          unsigned int count)
+{
+    struct range_part *parts;
+    off_t length, start;
+    unsigned int max = ne_get_max_connections(sess);
+    char *etag;
+    int n, ret;
+
+    ret = head_entity(sess, uri, &length, &etag);
+    if (ret) return ret;
+
+    ret = reset_file(sess, fd, etag ? length : 0);
+    if (ret) {
+        if (etag) ne_free(etag);
+        return ret;
+    }
+
+    /* Without a strong entity tag, changes to the resource between
+     * ranges cannot be detected, so fetch it in one piece. */
+    if (etag == NULL)
+        return ne_get(sess, uri, fd);
+
+    if (count > max) count = max;
+    if (count > PARALLEL_MAX_CONNS) count = PARALLEL_MAX_CONNS;
+    if (count > length / PARALLEL_MIN_RANGE)
+        count = length / PARALLEL_MIN_RANGE;
+    if (count == 0) count = 1;
+
+    NE_DEBUG(NE_DBG_HTTP, "Parallel GET of %" NE_FMT_OFF_T " bytes over "
+             "%u connections.\n", length, count);
+
+    parts = ne_calloc(count * sizeof *parts);
+
+    for (n = 0, start = 0; n < (int)count; n++) {
+        struct range_part *part = &parts[n];
+        
+        part->start = start;
+        part->end = n == (int)count - 1 ? length - 1
+            : start + length / count - 1;
+        part->offset = part->start;
+        part->etag = etag;
+        part->fd = fd;
+        part->ready = 1;
+        start = part->end + 1;
+
+        ne_snprintf(part->brange, sizeof part->brange,
+                    "bytes=%" NE_FMT_OFF_T "-%" NE_FMT_OFF_T,
+                    part->start, part->end);
+
+        part->req = ne_request_create(sess, "GET", uri);
+        ne_add_request_header(part->req, "Range", part->brange);
+        ne_add_request_header(part->req, "If-Match", etag);
+        ne_add_response_body_reader(part->req, accept_part, write_part, part);
+    }
+
+    ret = step_parts(sess, parts, count);
+
+    for (n = 0; n < (int)count; n++)
+        ne_request_destroy(parts[n].req);
+    ne_free(parts);
+    ne_free(etag);
+
+    /* The server ignored the Range header, so fetch the resource in
+     * one piece after all. */
+    if (ret == NE_RETRY) {
+        NE_DEBUG(NE_DBG_HTTP, "Range ignored; falling back to one GET.\n");
+        ret = reset_file(sess, fd, 0);
+        if (ret == NE_OK)
+            ret = ne_get(sess, uri, fd);
+    }
+
+    return ret;
+}
+
 /* Get to given fd */
 int ne_post(ne_session *sess, const char *uri, int fd, const char *buffer)
 {
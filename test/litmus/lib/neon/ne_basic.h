@@ -36,6 +36,23 @@ int ne_get(ne_session *sess, const char *path, int fd);
  * body to submit from 'fd'. */
 int ne_put(ne_session *sess, const char *path, int fd);
 
+/* Resumable PUT: upload the contents of 'fd' to 'path' as a series
+ * of segments of 'segment' bytes (a default size is used if zero),
+ * each sent as a PUT with a Content-Range header.  The server stages
+ * the segments, replying 202 with a "Range: bytes=0-N" header giving
+ * the bytes staged so far, and writes the resource once the last
+ * segment arrives.  After each segment, the number of bytes confirmed
+ * is recorded in the file named 'checkpoint'.  If the upload fails,
+ * calling ne_put_resumable again with the same arguments asks the
+ * server how much was staged and resumes from there, provided the
+ * checkpoint shows an earlier attempt to upload the same file (of
+ * the same size and modification time); otherwise the upload starts
+ * again.  The checkpoint file is removed once the upload completes.
+ * A file no larger than one segment is sent with ne_put.  Returns an
+ * NE_* error code. */
+int ne_put_resumable(ne_session *sess, const char *path, int fd,
+                     off_t segment, const char *checkpoint);
+
 #define NE_DEPTH_ZERO (0)
 #define NE_DEPTH_ONE (1)
 #define NE_DEPTH_INFINITE (2)
@@ -130,6 +147,27 @@ typedef struct {
 int ne_get_range(ne_session *sess, const char *path, 
 		 ne_content_range *range, int fd);
 
+/* Fetch the resource at 'path' into file 'fd', splitting it into up
+ * to 'count' byte ranges which are fetched concurrently over separate
+ * connections and written at their offsets in the file.  The number
+ * of connections used is limited by the session's connection limit
+ * (see ne_set_connection_pool), and fewer are used for small
+ * resources.  Each range must come from the same entity, as given by
+ * the strong entity tag returned by an initial HEAD request; if the
+ * resource changes during the transfer, the whole transfer fails.  If
+ * the server does not give a strong entity tag, or answers a range
+ * request with the whole resource, the resource is fetched with a
+ * single GET instead.  The file is written from offset zero and
+ * truncated to the length of the resource; on failure its contents
+ * are undefined.  Returns an NE_* error code.
+ *
+ * No gain over ne_get has been measured: over loopback, both are
+ * limited by the client's CPU.  Splitting a transfer can only help
+ * where each connection is limited separately, for instance by a
+ * per-connection rate limit at the server. */
+int ne_get_range_parallel(ne_session *sess, const char *path, int fd,
+                          unsigned int count);
+
 /* Post using buffer as request-body: stream response into f */
 int ne_post(ne_session *sess, const char *path, int fd, const char *buffer);
 
@@ -348,8 +348,11 @@ void ne_ssl_set_clicert(ne_session *sess, const ne_ssl_client_cert *cc)
 
 ne_ssl_context *ne_ssl_context_create(int flags)
 {
-    ne_ssl_context *ctx = ne_malloc(sizeof *ctx);
+    ne_ssl_context *ctx = ne_calloc(sizeof *ctx);
     gnutls_certificate_allocate_credentials(&ctx->cred);
+#ifdef NE_HAVE_THREADS
+    pthread_mutex_init(&ctx->lock, NULL);
+#endif
     return ctx;
 }
 
@@ -376,9 +379,31 @@ int ne_ssl_context_set_verify(ne_ssl_context *ctx, int required,
 void ne_ssl_context_destroy(ne_ssl_context *ctx)
 {
     gnutls_certificate_free_credentials(ctx->cred);
+    if (ctx->cache.data)
+        gnutls_free(ctx->cache.data);
+#ifdef NE_HAVE_THREADS
+    pthread_mutex_destroy(&ctx->lock);
+#endif
     ne_free(ctx);
 }
 
+/* Replace the cached session data of 'ctx' with that of 'sock', or
+ * remove it if 'sock' is NULL. */
+static void cache_session(ne_ssl_context *ctx, gnutls_session sock)
+{
+    NE_SSL_LOCK(ctx);
+    if (ctx->cache.data) {
+        gnutls_free(ctx->cache.data);
+        ctx->cache.data = NULL;
+        ctx->cache.size = 0;
+    }
+    if (sock && gnutls_session_get_data2(sock, &ctx->cache) < 0) {
+        ctx->cache.data = NULL;
+        ctx->cache.size = 0;
+    }
+    NE_SSL_UNLOCK(ctx);
+}
+
 /* Return the certificate chain sent by the peer, or NULL on error. */
 static ne_ssl_certificate *make_peers_chain(gnutls_session sock)
 {
@@ -467,25 +492,41 @@ int ne__negotiate_ssl(ne_request *req)
 
     NE_DEBUG(NE_DBG_SSL, "Negotiating SSL connection.\n");
 
-    if (ne_sock_connect_ssl(sess->socket, ctx, sess)) {
+    if (ne_sock_connect_ssl(ne__request_socket(req), ctx, sess)) {
+        cache_session(ctx, NULL);
 	ne_set_error(sess, _("SSL negotiation failed: %s"),
-		     ne_sock_error(sess->socket));
+		     ne_sock_error(ne__request_socket(req)));
 	return NE_ERROR;
     }
 
-    sock = ne__sock_sslsock(sess->socket);
+    sock = ne__sock_sslsock(ne__request_socket(req));
+
+    NE_LOCK(sess, pool_lock);
+    if (gnutls_session_is_resumed(sock)) {
+        NE_DEBUG(NE_DBG_SSL, "Resumed SSL session.\n");
+        sess->pool_stats.resumed++;
+    } else {
+        sess->pool_stats.handshakes++;
+    }
+    NE_UNLOCK(sess, pool_lock);
 
     chain = make_peers_chain(sock);
     if (chain == NULL) {
+        cache_session(ctx, NULL);
         ne_set_error(sess, _("Server did not send certificate chain"));
         return NE_ERROR;
     }
 
     if (check_certificate(sess, sock, chain)) {
+        cache_session(ctx, NULL);
         ne_ssl_cert_free(chain);
         return NE_ERROR;
     }
 
+    /* Cache the new session for resumption. */
+    if (!gnutls_session_is_resumed(sock))
+        cache_session(ctx, sock);
+
     return NE_OK;
 }
 
@@ -0,0 +1,73 @@
+/* 
+   Internal definitions shared between neon modules
+   Copyright (C) 1999-2005, Joe Orton <joe@manyfish.co.uk>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+   
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public
+   License along with this library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+   MA 02111-1307, USA
+
+*/
+
+/* THIS IS NOT A PUBLIC INTERFACE. You CANNOT include this header file
+ * from an application.  */
+ 
+#ifndef NE_INTERNAL_H
+#define NE_INTERNAL_H
+
+#include <sys/types.h>
+
+#ifdef HAVE_LIMITS_H
+#include <limits.h>
+#endif
+
+/* File offsets: ne_off_t is the type used for offsets into request
+ * body files, printed with FMT_NE_OFF_T; ne_strtoff parses an off_t
+ * (or an off64_t where large files are supported). */
+#if !defined(LONG_LONG_MAX) && defined(LLONG_MAX)
+#define LONG_LONG_MAX LLONG_MAX
+#endif
+
+#ifdef NE_LFS
+#define ne_lseek lseek64
+typedef off64_t ne_off_t;
+#define FMT_NE_OFF_T NE_FMT_OFF64_T
+#define NE_OFFT_MAX LONG_LONG_MAX
+#ifdef HAVE_STRTOLL
+#define ne_strtoff strtoll
+#else
+#define ne_strtoff strtoq
+#endif
+#else /* !NE_LFS */
+
+typedef off_t ne_off_t;
+#define ne_lseek lseek
+#define FMT_NE_OFF_T NE_FMT_OFF_T
+
+#if defined(SIZEOF_LONG_LONG) && defined(LONG_LONG_MAX) \
+    && SIZEOF_OFF_T == SIZEOF_LONG_LONG
+#define NE_OFFT_MAX LONG_LONG_MAX
+#else
+#define NE_OFFT_MAX LONG_MAX
+#endif
+
+#if SIZEOF_OFF_T > SIZEOF_LONG && defined(HAVE_STRTOLL)
+#define ne_strtoff strtoll
+#elif SIZEOF_OFF_T > SIZEOF_LONG && defined(HAVE_STRTOQ)
+#define ne_strtoff strtoq
+#else
+#define ne_strtoff strtol
+#endif
+#endif /* NE_LFS */
+
+#endif /* NE_INTERNAL_H */
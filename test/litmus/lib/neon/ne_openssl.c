@@ -348,7 +348,7 @@ static ne_ssl_certificate *make_chain(STACK_OF(X509) *chain)
         ne_ssl_certificate *cert = ne_malloc(sizeof *cert);
         populate_cert(cert, X509_dup(sk_X509_value(chain, n)));
 #ifdef NE_DEBUGGING
-        if (ne_debug_mask & NE_DBG_SSL) {
+        if ((ne_debug_mask & NE_DBG_SSL) && ne_debug_stream) {
             fprintf(ne_debug_stream, "Cert #%d:\n", n);
             X509_print_fp(ne_debug_stream, cert->subject);
         }
@@ -503,9 +503,30 @@ void ne_ssl_set_clicert(ne_session *sess, const ne_ssl_client_cert *cc)
     sess->client_cert = dup_client_cert(cc);
 }
 
+/* Called by OpenSSL when the server issues a new session, which for
+ * TLSv1.3 happens after the handshake: caches the session for
+ * resumption, replacing any previous one.  Returns 1 to keep the
+ * reference to the session. */
+static int cache_session(SSL *ssl, SSL_SESSION *sess)
+{
+    ne_ssl_context *ctx = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+
+    NE_DEBUG(NE_DBG_SSL, "Caching SSL session.\n");
+
+    NE_SSL_LOCK(ctx);
+    if (ctx->sess) SSL_SESSION_free(ctx->sess);
+    ctx->sess = sess;
+    NE_SSL_UNLOCK(ctx);
+
+    return 1;
+}
+
 ne_ssl_context *ne_ssl_context_create(int mode)
 {
     ne_ssl_context *ctx = ne_calloc(sizeof *ctx);
+#ifdef NE_HAVE_THREADS
+    pthread_mutex_init(&ctx->lock, NULL);
+#endif
     if (mode == NE_SSL_CTX_CLIENT) {
         ctx->ctx = SSL_CTX_new(SSLv23_client_method());
         ctx->sess = NULL;
@@ -513,6 +534,11 @@ ne_ssl_context *ne_ssl_context_create(int mode)
         SSL_CTX_set_client_cert_cb(ctx->ctx, provide_client_cert);
         /* enable workarounds for buggy SSL server implementations */
         SSL_CTX_set_options(ctx->ctx, SSL_OP_ALL);
+        /* cache sessions in the context, not in OpenSSL's cache. */
+        SSL_CTX_set_app_data(ctx->ctx, ctx);
+        SSL_CTX_set_session_cache_mode(ctx->ctx, SSL_SESS_CACHE_CLIENT
+                                       | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(ctx->ctx, cache_session);
     } else if (mode == NE_SSL_CTX_SERVER) {
         ctx->ctx = SSL_CTX_new(SSLv23_server_method());
     } else {
@@ -558,9 +584,24 @@ void ne_ssl_context_destroy(ne_ssl_context *ctx)
     SSL_CTX_free(ctx->ctx);
     if (ctx->sess)
         SSL_SESSION_free(ctx->sess);
+#ifdef NE_HAVE_THREADS
+    pthread_mutex_destroy(&ctx->lock);
+#endif
     ne_free(ctx);
 }
 
+/* Remove the cached session of 'ctx', so that it is not offered
+ * again after a failed negotiation. */
+static void forget_session(ne_ssl_context *ctx)
+{
+    NE_SSL_LOCK(ctx);
+    if (ctx->sess) {
+        SSL_SESSION_free(ctx->sess);
+        ctx->sess = NULL;
+    }
+    NE_SSL_UNLOCK(ctx);
+}
+
 /* For internal use only. */
 int ne__negotiate_ssl(ne_request *req)
 {
@@ -572,18 +613,23 @@ int ne__negotiate_ssl(ne_request *req)
 
     NE_DEBUG(NE_DBG_SSL, "Doing SSL negotiation.\n");
 
-    if (ne_sock_connect_ssl(sess->socket, ctx, sess)) {
-	if (ctx->sess) {
-	    /* remove cached session. */
-	    SSL_SESSION_free(ctx->sess);
-	    ctx->sess = NULL;
-	}
+    if (ne_sock_connect_ssl(ne__request_socket(req), ctx, sess)) {
+        forget_session(ctx);
 	ne_set_error(sess, _("SSL negotiation failed: %s"),
-		     ne_sock_error(sess->socket));
+		     ne_sock_error(ne__request_socket(req)));
 	return NE_ERROR;
     }	
     
-    ssl = ne__sock_sslsock(sess->socket);
+    ssl = ne__sock_sslsock(ne__request_socket(req));
+
+    NE_LOCK(sess, pool_lock);
+    if (SSL_session_reused(ssl)) {
+        NE_DEBUG(NE_DBG_SSL, "Resumed SSL session.\n");
+        sess->pool_stats.resumed++;
+    } else {
+        sess->pool_stats.handshakes++;
+    }
+    NE_UNLOCK(sess, pool_lock);
 
     chain = SSL_get_peer_cert_chain(ssl);
     /* For an SSLv2 connection, the cert chain will always be NULL. */
@@ -597,6 +643,7 @@ int ne__negotiate_ssl(ne_request *req)
     }
 
     if (chain == NULL || sk_X509_num(chain) == 0) {
+        forget_session(ctx);
 	ne_set_error(sess, _("SSL server did not present certificate"));
 	return NE_ERROR;
     }
@@ -605,6 +652,7 @@ int ne__negotiate_ssl(ne_request *req)
         int diff = X509_cmp(sk_X509_value(chain, 0), sess->server_cert->subject);
         if (freechain) sk_X509_free(chain); /* no longer need the chain */
 	if (diff) {
+            forget_session(ctx);
 	    /* This could be a MITM attack: fail the request. */
 	    ne_set_error(sess, _("Server certificate changed: "
 				 "connection intercepted?"));
@@ -622,24 +670,13 @@ int ne__negotiate_ssl(ne_request *req)
 	    NE_DEBUG(NE_DBG_SSL, "SSL certificate checks failed: %s\n",
 		     sess->error);
 	    ne_ssl_cert_free(cert);
+            forget_session(ctx);
 	    return NE_ERROR;
 	}
 	/* remember the chain. */
         sess->server_cert = cert;
     }
     
-    if (ctx->sess) {
-        SSL_SESSION *newsess = SSL_get0_session(ssl);
-        /* Replace the session if it has changed. */ 
-        if (newsess != ctx->sess || SSL_SESSION_cmp(ctx->sess, newsess)) {
-            SSL_SESSION_free(ctx->sess);
-            ctx->sess = SSL_get1_session(ssl); /* bumping the refcount */
-        }
-    } else {
-	/* Store the session. */
-	ctx->sess = SSL_get1_session(ssl);
-    }
-
     if (sess->notify_cb) {
 	sess->notify_cb(sess->notify_ud, ne_conn_secure,
                         SSL_get_version(ssl));
@@ -25,6 +25,12 @@
 #ifndef NE_PRIVATE_H
 #define NE_PRIVATE_H
 
+#include <time.h>
+
+#ifdef NE_HAVE_THREADS
+#include <pthread.h>
+#endif
+
 #include "ne_request.h"
 #include "ne_socket.h"
 #include "ne_ssl.h"
@@ -50,17 +56,51 @@ struct hook {
 #define HAVE_HOOK(st,func) (st->hook->hooks->func != NULL)
 #define HOOK_FUNC(st, func) (*st->hook->hooks->func)
 
-/* Session support. */
-struct ne_session_s {
-    /* Connection information */
+/* A connection to the next-hop server, owned by a request whilst it
+ * is being dispatched, and otherwise kept in the session's pool of
+ * idle connections. */
+struct ne_conn {
+    /* NULL until the connection has been established. */
     ne_socket *socket;
 
-    /* non-zero if connection has been established. */
-    int connected;
-    
     /* non-zero if connection has persisted beyond one request. */
     int persisted;
 
+    time_t idle_since; /* time at which connection last became idle */
+    int keepalive; /* seconds the server keeps it open when idle, or 0 */
+    unsigned int users; /* number of requests using the connection */
+#ifdef NE_HAVE_THREADS
+    pthread_t owner; /* thread which took the connection from the pool */
+#endif
+    /* next (less recently used) connection in the idle or busy list */
+    struct ne_conn *next;
+};
+
+/* Session support. */
+struct ne_session_s {
+    /* Connection pool: idle connections, most recently used first,
+     * and connections in use, most recently taken first. */
+    struct ne_conn *idle, *busy;
+    unsigned int conns; /* number of open connections (idle or not) */
+    unsigned int max_conns; /* maximum number of open connections */
+    int idle_timeout; /* seconds to keep an idle connection, or zero */
+    ne_pool_stats pool_stats;
+    unsigned long rdcalls; /* read system calls on closed connections. */
+    struct ne_arena *arena; /* spare response header arena, or NULL */
+
+#ifdef NE_HAVE_THREADS
+    /* pool_lock protects the connection pool, the spare header
+     * arena, what is known of the server (is_http11 and expect100),
+     * and the settings which may be changed while requests are in
+     * flight (pipelining, the rate limits, rdbufsize and
+     * expect100_timeout); pool_cond is signalled when a connection
+     * is returned to it.  conn_lock serializes establishing new
+     * connections (DNS, address and SSL session state), and
+     * hook_lock serializes running the hooks. */
+    pthread_mutex_t pool_lock, conn_lock, hook_lock;
+    pthread_cond_t pool_cond;
+#endif
+
     int is_http11; /* >0 if connected server is known to be
 		    * HTTP/1.1 compliant. */
 
@@ -75,7 +115,6 @@ struct ne_session_s {
     unsigned int use_proxy:1; /* do we have a proxy server? */
     unsigned int no_persist:1; /* set to disable persistent connections */
     unsigned int use_ssl:1; /* whether a secure connection is required */
-    unsigned int in_connect:1; /* doing a proxy CONNECT */
 
     ne_progress progress_cb;
     void *progress_ud;
@@ -84,6 +123,22 @@ struct ne_session_s {
     void *notify_ud;
 
     int rdtimeout; /* read timeout. */
+    size_t rdbufsize; /* socket read buffer size, or zero for default. */
+
+    /* milliseconds to wait for a 100-continue response before sending
+     * the request body anyway, or zero to wait indefinitely. */
+    int expect100_timeout;
+    enum {
+        NE_E100_UNKNOWN = 0,
+        NE_E100_HONOURED, /* server has answered the Expect header */
+        NE_E100_IGNORED /* server has failed to send a 100-continue in
+                         * time; the wait stays bounded */
+    } expect100;
+
+    int pipelining; /* maximum number of requests to pipeline. */
+
+    /* rate limits on request and response bodies, if non-NULL. */
+    ne_ratelimit *upload, *download;
 
     struct hook *create_req_hooks, *pre_send_hooks, *post_send_hooks;
     struct hook *destroy_req_hooks, *destroy_sess_hooks, *private;
@@ -111,6 +166,54 @@ struct ne_session_s {
  * error. */
 typedef int (*ne_push_fn)(void *userdata, const char *buf, size_t count);
 
+#ifdef NE_HAVE_THREADS
+#define NE_LOCK(sess, lock) pthread_mutex_lock(&(sess)->lock)
+#define NE_UNLOCK(sess, lock) pthread_mutex_unlock(&(sess)->lock)
+#else
+#define NE_LOCK(sess, lock) do { } while (0)
+#define NE_UNLOCK(sess, lock) do { } while (0)
+#endif
+
+/* Take a connection from the session's pool: returns the most
+ * recently used idle connection if there is one, otherwise a new
+ * connection object with a NULL ->socket, which the caller must
+ * establish.  If the connection limit has been reached, the
+ * connection most recently taken by the calling thread is shared, as
+ * a session used to share its only socket between overlapping
+ * requests; in a threaded build, if the thread holds no connection,
+ * blocks until one is released.  Returns NULL, setting the session
+ * error, if no connection can be had. */
+struct ne_conn *ne__conn_acquire(ne_session *sess);
+
+/* Return connection 'conn' to the session's pool of idle
+ * connections, once no other request is using it. */
+void ne__conn_release(ne_session *sess, struct ne_conn *conn);
+
+/* Close and destroy connection 'conn', freeing its slot in the
+ * session's pool; if another request shares it, only the socket is
+ * closed. */
+void ne__conn_close(ne_session *sess, struct ne_conn *conn);
+
+/* Returns the current time in seconds, from a monotonic clock if
+ * available. */
+double ne__time_now(void);
+
+/* Reserve up to 'len' bytes from limiter 'rl', but no more than it
+ * grants at once; sets *ready to the time at which they may be
+ * transferred, and returns the number of bytes reserved. */
+size_t ne__ratelimit_reserve(ne_ratelimit *rl, size_t len, double *ready);
+
+/* Give back to limiter 'rl' 'len' reserved bytes which were not
+ * transferred. */
+void ne__ratelimit_return(ne_ratelimit *rl, size_t len);
+
+/* Returns the socket of the connection used by 'req'. */
+ne_socket *ne__request_socket(ne_request *req);
+
+/* Close the connection used by 'req', if any, such as after a
+ * response which could not be parsed. */
+void ne__request_close(ne_request *req);
+
 /* Do the SSL negotiation. */
 int ne__negotiate_ssl(ne_request *req);
 
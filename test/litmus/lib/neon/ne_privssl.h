@@ -32,13 +32,30 @@
 #include "ne_ssl.h"
 #include "ne_socket.h"
 
+#ifdef NE_HAVE_THREADS
+#include <pthread.h>
+
+/* The cached session of an SSL context may be used by several
+ * connections of a session at once. */
+#define NE_SSL_LOCK(ctx) pthread_mutex_lock(&(ctx)->lock)
+#define NE_SSL_UNLOCK(ctx) pthread_mutex_unlock(&(ctx)->lock)
+#else
+#define NE_SSL_LOCK(ctx) do { } while (0)
+#define NE_SSL_UNLOCK(ctx) do { } while (0)
+#endif
+
 #ifdef HAVE_OPENSSL
 
 #include <openssl/ssl.h>
 
 struct ne_ssl_context_s {
     SSL_CTX *ctx;
+    /* Session offered for resumption when connecting; replaced
+     * whenever the server issues a new one. */
     SSL_SESSION *sess;
+#ifdef NE_HAVE_THREADS
+    pthread_mutex_t lock; /* protects 'sess' */
+#endif
 };
 
 typedef SSL *ne_ssl_socket;
@@ -51,7 +68,11 @@ typedef SSL *ne_ssl_socket;
 
 struct ne_ssl_context_s {
     gnutls_certificate_credentials cred;
-    /* TODO: store session here too */
+    /* Session data offered for resumption when connecting. */
+    gnutls_datum cache;
+#ifdef NE_HAVE_THREADS
+    pthread_mutex_t lock; /* protects 'cache' */
+#endif
 };
 
 typedef gnutls_session ne_ssl_socket;
@@ -34,6 +34,7 @@
 #include "ne_basic.h"
 #include "ne_locks.h"
 #include "ne_i18n.h"
+#include "ne_arena.h"
 
 /* don't store flat props with a value > 10K */
 #define MAX_FLATPROP_LEN (102400)
@@ -63,6 +64,16 @@ struct ne_propfind_handler_s {
 
     ne_props_result callback;
     void *userdata;
+
+    /* Streaming interface state: the callback, and the properties of
+     * the current propstat, which like the href of the current
+     * response are stored in the arena. */
+    ne_props_stream stream;
+    struct ne_arena *arena;
+    char *href;
+    struct stream_prop *props, **lastprop, *cur;
+    int counter; /* number of properties in current response */
+    int aborted; /* non-zero if the callback aborted the parse */
 };
 
 #define ELM_flatprop (NE_207_STATE_TOP - 1)
@@ -93,6 +104,14 @@ struct ne_prop_result_set_s {
 
 #define MAX_PROP_COUNTER (1024)
 
+/* A property in the streaming interface; held until the status of
+ * its propstat is known. */
+struct stream_prop {
+    ne_propname pname;
+    char *value;
+    struct stream_prop *next;
+};
+
 static int 
 startelm(void *userdata, int state, const char *name, const char *nspace,
 	 const char **atts);
@@ -145,7 +164,7 @@ static int propfind(ne_propfind_handler *handler,
 
     if (ret == NE_OK && ne_get_status(req)->klass != 2) {
 	ret = NE_ERROR;
-    } else if (ne_xml_failed(handler->parser)) {
+    } else if (ne_xml_failed(handler->parser) || handler->aborted) {
 	ne_set_error(handler->sess, "%s", ne_xml_get_error(handler->parser));
 	ret = NE_ERROR;
     }
@@ -201,6 +220,35 @@ int ne_propfind_named(ne_propfind_handler *handler, const ne_propname *props,
     return propfind(handler, results, userdata);
 }
 
+static void *stream_start_response(void *userdata, const char *href);
+static void *stream_start_propstat(void *userdata, void *response);
+static void stream_end_propstat(void *userdata, void *propstat,
+                                const ne_status *status,
+                                const char *description);
+static void stream_end_response(void *userdata, void *resource,
+                                const ne_status *status,
+                                const char *description);
+
+int ne_propfind_stream(ne_propfind_handler *handler, const ne_propname *props,
+                       ne_props_stream results, void *userdata)
+{
+    if (props != NULL) {
+        set_body(handler, props);
+        ne_buffer_zappend(handler->body, "</prop></propfind>" EOL);
+    } else {
+        ne_buffer_zappend(handler->body, "<allprop/></propfind>" EOL);
+    }
+
+    handler->stream = results;
+    handler->lastprop = &handler->props;
+    ne_207_set_response_handlers(handler->parser207, stream_start_response,
+                                 stream_end_response);
+    ne_207_set_propstat_handlers(handler->parser207, stream_start_propstat,
+                                 stream_end_propstat);
+
+    return propfind(handler, NULL, userdata);
+}
+
 
 /* The easy one... PROPPATCH */
 int ne_proppatch(ne_session *sess, const char *uri, 
@@ -422,6 +470,30 @@ static int startelm(void *userdata, int parent,
         return ELM_flatprop;
     }        
 
+    if (hdl->stream) {
+        struct stream_prop *sp;
+
+        if (hdl->aborted)
+            return NE_XML_ABORT;
+
+        if (++hdl->counter == MAX_PROP_COUNTER) {
+            ne_xml_set_error(hdl->parser, _("Response exceeds maximum property count"));
+            return NE_XML_ABORT;
+        }
+
+        sp = ne__arena_alloc(&hdl->arena, sizeof *sp);
+        sp->pname.name = ne__arena_strndup(&hdl->arena, name, strlen(name));
+        sp->pname.nspace = nspace[0] == '\0' ? NULL 
+            : ne__arena_strndup(&hdl->arena, nspace, strlen(nspace));
+        sp->value = NULL;
+        sp->next = NULL;
+        *hdl->lastprop = hdl->cur = sp;
+        hdl->lastprop = &sp->next;
+
+        hdl->depth = 0;
+        return ELM_flatprop;
+    }
+
     /* Enforce maximum number of properties per resource to prevent a
      * memory exhaustion attack by a hostile server. */
     if (++hdl->current->counter == MAX_PROP_COUNTER) {
@@ -479,6 +551,11 @@ static int endelm(void *userdata, int state,
         if (hdl->value->used < MAX_FLATPROP_LEN)
             ne_buffer_concat(hdl->value, "</", name, ">", NULL);
         hdl->depth--;
+    } else if (hdl->stream) {
+        /* end of the current property value */
+        hdl->cur->value = ne__arena_strndup(&hdl->arena, hdl->value->data, 
+                                        ne_buffer_size(hdl->value));
+        ne_buffer_clear(hdl->value);
     } else {
         /* end of the current property value */
         n = pstat->numprops - 1;
@@ -567,6 +644,67 @@ static void end_response(void *userdata, void *resource,
     handler->current = NULL;
 }
 
+static void *stream_start_response(void *userdata, const char *href)
+{
+    ne_propfind_handler *hdl = userdata;
+
+    hdl->href = ne__arena_strndup(&hdl->arena, href, strlen(href));
+    hdl->counter = 0;
+    return hdl;
+}
+
+static void *stream_start_propstat(void *userdata, void *response)
+{
+    ne_propfind_handler *hdl = userdata;
+
+    if (hdl->aborted)
+        return NULL;
+
+    if (++hdl->counter == MAX_PROP_COUNTER) {
+        ne_xml_set_error(hdl->parser, _("Response exceeds maximum property count"));
+        return NULL;
+    }
+
+    hdl->props = NULL;
+    hdl->lastprop = &hdl->props;
+    return hdl;
+}
+
+/* Deliver the properties of a propstat, now its status is known. */
+static void stream_end_propstat(void *userdata, void *propstat,
+                                const ne_status *status,
+                                const char *description)
+{
+    ne_propfind_handler *hdl = userdata;
+    const char *href = hdl->href ? hdl->href : "";
+    struct stream_prop *sp;
+
+    for (sp = hdl->props; sp && !hdl->aborted; sp = sp->next) {
+        const char *value = status && status->klass != 2 ? NULL : sp->value;
+
+        hdl->aborted = hdl->stream(hdl->userdata, href, &sp->pname,
+                                   value, status);
+        if (hdl->aborted)
+            ne_xml_set_error(hdl->parser, _("PROPFIND aborted by caller"));
+    }
+
+    hdl->props = NULL;
+    hdl->lastprop = &hdl->props;
+}
+
+/* Empty the arena at the end of each response. */
+static void stream_end_response(void *userdata, void *resource,
+                                const ne_status *status,
+                                const char *description)
+{
+    ne_propfind_handler *hdl = userdata;
+
+    ne__arena_reset(&hdl->arena);
+    hdl->href = NULL;
+    hdl->props = NULL;
+    hdl->lastprop = &hdl->props;
+}
+
 ne_propfind_handler *
 ne_report_create(ne_session *sess, const char *uri, int depth)
 {
@@ -628,6 +766,7 @@ void ne_propfind_destroy(ne_propfind_handler *handler)
     ne_buffer_destroy(handler->value);
     if (handler->current)
         free_propset(handler->current);
+    ne__arena_free(&handler->arena);
     ne_207_destroy(handler->parser207);
     ne_xml_destroy(handler->parser);
     ne_buffer_destroy(handler->body);
@@ -673,6 +812,20 @@ int ne_simple_propfind(ne_session *sess, const char *href, int depth,
     return ret;
 }
 
+int ne_simple_propfind_stream(ne_session *sess, const char *href, int depth,
+                              const ne_propname *props,
+                              ne_props_stream results, void *userdata)
+{
+    ne_propfind_handler *hdl;
+    int ret;
+
+    hdl = ne_propfind_create(sess, href, depth, "PROPFIND");
+    ret = ne_propfind_stream(hdl, props, results, userdata);
+    ne_propfind_destroy(hdl);
+
+    return ret;
+}
+
 int ne_propnames(ne_session *sess, const char *href, int depth,
 		  ne_props_result results, void *userdata)
 {
@@ -130,6 +130,27 @@ int ne_simple_report(ne_session *sess, const char *path, int depth,
 			const ne_propname *props,
 			ne_props_result results, void *userdata);
 
+/* The streaming interface. ***
+ *
+ * For a large tree of resources, building a result set for each
+ * resource is costly; the streaming interface instead passes each
+ * property to a callback as it is parsed, along with the URI of the
+ * resource and the status of its propstat.  The strings passed are
+ * valid only for the duration of the callback.  As with
+ * ne_propset_iterate, 'value' is NULL if the property could not be
+ * fetched, in which case 'status' gives the error; 'status' may be
+ * NULL if the server gave no status.  If the callback returns
+ * non-zero, the PROPFIND is aborted and fails with NE_ERROR. */
+typedef int (*ne_props_stream)(void *userdata, const char *href,
+                               const ne_propname *pname,
+                               const char *value,
+                               const ne_status *status);
+
+/* As ne_simple_propfind, but passing each property to 'results'. */
+int ne_simple_propfind_stream(ne_session *sess, const char *path, int depth,
+                              const ne_propname *props,
+                              ne_props_stream results, void *userdata);
+
 /* The properties of a resource can be manipulated using ne_proppatch.
  * A single proppatch request may include any number of individual
  * "set" and "remove" operations, and is defined to have
@@ -247,6 +268,17 @@ int ne_reportfind_named(ne_propfind_handler *handler,
 		      const ne_propname *names,
 		      ne_props_result result, void *userdata);
 
+/* Fetch the properties with names listed in array 'names' as for
+ * ne_propfind_named, or if 'names' is NULL, all properties; but pass
+ * each property to 'results' as for ne_simple_propfind_stream.
+ * Complex property handlers may be used, but private structures are
+ * not created.
+ *
+ * Returns NE_*. */
+int ne_propfind_stream(ne_propfind_handler *handler, 
+                       const ne_propname *names,
+                       ne_props_stream results, void *userdata);
+
 /* Destroy a propfind handler after use. */
 void ne_propfind_destroy(ne_propfind_handler *handler);
 
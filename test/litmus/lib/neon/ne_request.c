@@ -46,6 +46,37 @@
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef HAVE_SYS_SELECT_H
+#include <sys/select.h>
+#endif
+#ifdef WIN32
+#include <windows.h>
+#endif
+
+/* The message head is scanned using SSE2 or AVX2 vector instructions
+ * where the compiler targets them. */
+#if defined(__GNUC__) && defined(__AVX2__)
+#include <immintrin.h>
+#define SCAN_VECTOR
+#define SCAN_WIDTH (32)
+typedef __m256i scan_vec;
+#define SCAN_SPLAT(ch) _mm256_set1_epi8(ch)
+#define SCAN_LOAD(p) _mm256_loadu_si256((const __m256i *)(p))
+#define SCAN_MATCH(v, c) \
+    ((unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8((v), (c))))
+#elif defined(__GNUC__) && defined(__SSE2__)
+#include <emmintrin.h>
+#define SCAN_VECTOR
+#define SCAN_WIDTH (16)
+typedef __m128i scan_vec;
+#define SCAN_SPLAT(ch) _mm_set1_epi8(ch)
+#define SCAN_LOAD(p) _mm_loadu_si128((const __m128i *)(p))
+#define SCAN_MATCH(v, c) \
+    ((unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8((v), (c))))
+#endif
 
 #include "ne_i18n.h"
 
@@ -57,6 +88,8 @@
 #include "ne_uri.h"
 
 #include "ne_private.h"
+#include "ne_internal.h"
+#include "ne_arena.h"
 
 #define SOCK_ERR(req, op, msg) do { ssize_t sret = (op); \
 if (sret < 0) return aborted(req, msg, sret); } while (0)
@@ -65,66 +98,56 @@ if (sret < 0) return aborted(req, msg, sret); } while (0)
 
 struct body_reader {
     ne_block_reader handler;
+    ne_block_borrower borrower; /* used instead of handler if non-NULL */
     ne_accept_response accept_response;
     unsigned int use:1;
     void *userdata;
+    /* data not yet consumed by the borrower */
+    char *held;
+    size_t heldlen, heldsize;
     struct body_reader *next;
 };
 
-#if !defined(LONG_LONG_MAX) && defined(LLONG_MAX)
-#define LONG_LONG_MAX LLONG_MAX
-#endif
-
-#ifdef NE_LFS
-#define ne_lseek lseek64
-typedef off64_t ne_off_t;
-#define FMT_NE_OFF_T NE_FMT_OFF64_T
-#define NE_OFFT_MAX LONG_LONG_MAX
-#ifdef HAVE_STRTOLL
-#define ne_strtoff strtoll
-#else
-#define ne_strtoff strtoq
-#endif
-#else /* !NE_LFS */
-
-typedef off_t ne_off_t;
-#define ne_lseek lseek
-#define FMT_NE_OFF_T NE_FMT_OFF_T
-
-#if defined(SIZEOF_LONG_LONG) && defined(LONG_LONG_MAX) \
-    && SIZEOF_OFF_T == SIZEOF_LONG_LONG
-#define NE_OFFT_MAX LONG_LONG_MAX
-#else
-#define NE_OFFT_MAX LONG_MAX
-#endif
-
-#if SIZEOF_OFF_T > SIZEOF_LONG && defined(HAVE_STRTOLL)
-#define ne_strtoff strtoll
-#elif SIZEOF_OFF_T > SIZEOF_LONG && defined(HAVE_STRTOQ)
-#define ne_strtoff strtoq
-#else
-#define ne_strtoff strtol
-#endif
-#endif /* NE_LFS */
-
+/* A response header field; stored in the header arena. */
 struct field {
     char *name, *value;
     size_t vlen;
-    struct field *next;
+    unsigned int hash; /* hash value of name */
+    struct field *next; /* next field in order received */
 };
 
 /* Maximum number of header fields per response: */
 #define MAX_HEADER_FIELDS (100)
-/* Size of hash table; 43 is the smallest prime for which the common
- * header names hash uniquely using the *33 hash function. */
-#define HH_HASHSIZE (43)
+/* Maximum number of lines in a message head, including the
+ * Status-Line, continuation lines and the terminating empty line. */
+#define MAX_HEAD_LINES (2 * MAX_HEADER_FIELDS)
+
+/* A line of the message head buffered from the connection, as
+ * located by scan_head; offsets are relative to the start of the
+ * buffered data. */
+struct head_line {
+    unsigned int start; /* first character */
+    unsigned int colon; /* first ':', or 'end' if there is none */
+    unsigned int end; /* terminating LF */
+};
+
+/* Returns non-zero if 'line' of the head at 'data' is empty. */
+#define EMPTY_LINE(data, line) ((line)->end == (line)->start || \
+    ((line)->end == (line)->start + 1 && (data)[(line)->start] == '\r'))
+/* Size of the open-addressed hash index of header fields; must be a
+ * power of two, and greater than the number of fields which can be
+ * stored: MAX_HEADER_FIELDS in both the headers and the trailers. */
+#define HH_HASHSIZE (256)
 /* Hash iteration step: *33 known to be a good hash for ASCII, see RSE. */
-#define HH_ITERATE(hash, ch) (((hash)*33 + (unsigned char)(ch)) % HH_HASHSIZE)
+#define HH_ITERATE(hash, ch) ((hash)*33 + (unsigned char)(ch))
+/* Index of the first slot probed for hash value 'hash'. */
+#define HH_SLOT(hash) ((hash) & (HH_HASHSIZE - 1))
 
 /* pre-calculated hash values for given header names: */
-#define HH_HV_CONNECTION        (0x14)
-#define HH_HV_CONTENT_LENGTH    (0x13)
-#define HH_HV_TRANSFER_ENCODING (0x07)
+#define HH_HV_CONNECTION        (0x9cb49d90U)
+#define HH_HV_CONTENT_LENGTH    (0x096383aaU)
+#define HH_HV_TRANSFER_ENCODING (0x935e2b19U)
+#define HH_HV_KEEP_ALIVE        (0xf90743c3U)
 
 struct ne_request_s {
     char *method, *uri; /* method and Request-URI */
@@ -150,7 +173,7 @@ struct ne_request_s {
 	} buf;
     } body;
 	    
-    ne_off_t body_length; /* length of request body */
+    ne_off_t body_length; /* length of request body, or -1 if unknown */
 
     /* temporary store for response lines. */
     char respbuf[NE_BUFSIZ];
@@ -171,10 +194,13 @@ struct ne_request_s {
             struct {
                 ne_off_t total, remain;
             } clen;
-            /* chunk: used if mode == R_CHUNKED; total and bytes
-             * remaining to be read of current chunk */
+            /* chunk: used if mode == R_CHUNKED; bytes remaining to
+             * be read of current chunk, whether the CRLF following
+             * the previous chunk remains to be read, and whether the
+             * last-chunk has been read */
             struct {
-                size_t total, remain;
+                size_t remain;
+                int crlf, last;
             } chunk;
         } body;
         ne_off_t progress; /* number of bytes read of response */
@@ -182,10 +208,18 @@ struct ne_request_s {
     
     struct hook *private, *pre_send_hooks;
 
-    /* response header fields */
+    /* response header fields: hash index, and list in order
+     * received.  Removed fields leave a placeholder in the index. */
     struct field *response_headers[HH_HASHSIZE];
-    
-    unsigned int current_index; /* response_headers cursor for iterator */
+    struct field *first_header, **last_header;
+    unsigned int nheaders; /* number of occupied index slots */
+    struct ne_arena *arena; /* storage for header fields */
+
+    /* The lines of the message head buffered so far; 'scanned' is the
+     * offset of the first incomplete line, and 'headlen' is the
+     * length of the head once it is complete. */
+    struct head_line lines[MAX_HEAD_LINES];
+    unsigned int nlines, scanned, headlen;
 
     /* List of callbacks which are passed response body blocks */
     struct body_reader *body_readers;
@@ -194,12 +228,168 @@ struct ne_request_s {
     unsigned int method_is_head:1;
     unsigned int use_expect100:1;
     unsigned int can_persist:1;
+    unsigned int is_connect:1; /* CONNECT request for an SSL tunnel */
+
+    /*** State of the request, as advanced by ne_request_step ***/
+    enum {
+        RS_START = 0, /* not yet started */
+        RS_RESOLVE, /* looking up the server hostname */
+        RS_CONNECT, /* connecting to the server */
+        RS_SEND, /* sending Request-Line and headers */
+        RS_SENDBODY, /* sending request body */
+        RS_STATUS, /* reading Status-Line and headers */
+        RS_BODY, /* reading response body */
+        RS_TRAILER /* reading chunked trailers */
+    } state;
+    ne_buffer *reqbuf; /* Request-Line and headers, whilst sending */
+    size_t sent; /* bytes sent of reqbuf (and any coalesced body) */
+    char *blk; /* block of request body being sent (BODY_BLOCK bytes) */
+    size_t blklen, blkpos; /* end of the block in blk, and bytes sent */
+    ne_off_t body_progress; /* bytes of request body sent */
+    int events; /* NE_SOCK_WANT_* events awaited */
+    ne_addr_query *query; /* hostname lookup in progress */
+#define MAX_ADDRS (16)
+    const ne_inet_addr *addrs[MAX_ADDRS]; /* addresses to connect to */
+    int naddrs, addrpos; /* number of addrs, and the one in use */
+    unsigned int blocking:1; /* driven by a blocking interface */
+    unsigned int retry:1; /* retry after persistent connection timeout */
+    unsigned int retried:1; /* already retried after a timeout */
+    unsigned int coalesce:1; /* buffer body sent with the headers */
+    unsigned int sentbody:1; /* request body has been sent */
+    unsigned int body_eof:1; /* body provider has reached the end */
+    unsigned int expect_wait:1; /* awaiting 100-continue for a time */
+    double expect_sent; /* time headers sent, if expect_wait */
+    int expect_timeout; /* msecs to await 100-continue, or zero */
+    double started; /* time at which the request was started */
+    ne_request_timings timings;
+    /* Rate limiting state for the request and response bodies;
+     * 'resume' is the time awaited if 'throttled' is set. */
+    struct throttle {
+        ne_ratelimit *rl; /* limiter in use, or NULL */
+        size_t credit; /* bytes reserved but not yet transferred */
+        double ready; /* time at which they may be transferred */
+    } upload, download;
+    unsigned int throttled:1;
+    double resume;
 
     ne_session *session;
+    struct ne_conn *conn; /* connection in use, if any */
     ne_status status;
 };
 
 static int open_connection(ne_request *req);
+static int start_connect(ne_request *req);
+static int finish_lookup(ne_request *req);
+static int use_address(ne_request *req, ne_sock_addr *addr);
+static int finish_connect(ne_request *req);
+
+/* Record the completion of 'phase' of request 'req'. */
+#define MARK_TIME(req, phase) \
+    ((req)->timings.phase = ne__time_now() - (req)->started)
+
+/* Start the timings of an attempt to send 'req'. */
+static void start_timings(ne_request *req)
+{
+    req->started = ne__time_now();
+    req->timings.lookup = req->timings.connect = req->timings.handshake = -1;
+    req->timings.sent = req->timings.first_byte = -1;
+    req->timings.headers = req->timings.body = -1;
+}
+
+#ifdef NE_DEBUGGING
+/* Write the timings of 'req' as a single line to the debug stream, in
+ * milliseconds, giving '-' for any phase which did not take place. */
+static void debug_timings(const ne_request *req)
+{
+    static const char *const names[] = {
+        "lookup", "connect", "handshake", "sent", "first_byte", "headers",
+        "body"
+    };
+    const double times[] = {
+        req->timings.lookup, req->timings.connect, req->timings.handshake,
+        req->timings.sent, req->timings.first_byte, req->timings.headers,
+        req->timings.body
+    };
+    char buf[256];
+    size_t n, len = 0;
+
+    for (n = 0; n < sizeof times / sizeof times[0]; n++) {
+        if (times[n] < 0)
+            ne_snprintf(buf + len, sizeof buf - len, " %s=-", names[n]);
+        else
+            ne_snprintf(buf + len, sizeof buf - len, " %s=%.3f", names[n],
+                        times[n] * 1000);
+        len += strlen(buf + len);
+    }
+
+    NE_DEBUG(NE_DBG_TIMING, "timing: method=%s uri=%s status=%d%s\n",
+             req->method, req->uri, req->status.code, buf);
+}
+#endif
+
+/* Give back to its limiter the bytes reserved by 'th' which were not
+ * transferred. */
+static void return_rate(struct throttle *th)
+{
+    if (th->rl && th->credit)
+        ne__ratelimit_return(th->rl, th->credit);
+    th->credit = 0;
+}
+
+/* Reduce '*len' to the number of bytes which 'req' may transfer now
+ * under limiter 'rl', using state 'th'; the caller must deduct the
+ * bytes transferred from th->credit.  Returns NE_OK, or NE_AGAIN if
+ * the request must wait, in which case it awaits no events until
+ * req->resume. */
+static int throttle(ne_request *req, ne_ratelimit *rl, struct throttle *th,
+                    size_t *len)
+{
+    if (th->credit == 0)
+        th->credit = ne__ratelimit_reserve(rl, *len, &th->ready);
+
+    if (th->ready > ne__time_now()) {
+        req->throttled = 1;
+        req->resume = th->ready;
+        req->events = 0;
+        return NE_AGAIN;
+    }
+
+    req->throttled = 0;
+    if (*len > th->credit) *len = th->credit;
+    return NE_OK;
+}
+
+/* Returns the number of milliseconds until a throttled request may
+ * continue. */
+static int throttle_remaining(const ne_request *req)
+{
+    double delay = req->resume - ne__time_now();
+
+    return delay > 0 ? (int)(delay * 1000 + 0.999) : 0;
+}
+
+/* Sleep for 'msec' milliseconds. */
+static void sleep_msec(int msec)
+{
+#ifdef WIN32
+    Sleep(msec);
+#else
+    struct timeval tv;
+
+    tv.tv_sec = msec / 1000;
+    tv.tv_usec = (msec % 1000) * 1000;
+    select(0, NULL, NULL, NULL, &tv);
+#endif
+}
+
+/* Close the connection used by request 'req', if any. */
+static void close_connection(ne_request *req)
+{
+    if (req->conn) {
+        ne__conn_close(req->session, req->conn);
+        req->conn = NULL;
+    }
+}
 
 /* Returns hash value for header 'name', converting it to lower-case
  * in-place. */
@@ -216,6 +406,22 @@ static inline unsigned int hash_and_lower(char *name)
     return hash;
 }
 
+/* Allocate 'len' bytes from the header arena of 'req'.  The arena,
+ * and the header fields allocated from it, are reused from response
+ * to response, and passed between the requests of a session. */
+static void *arena_alloc(ne_request *req, size_t len)
+{
+    if (req->arena == NULL) {
+        /* Take the spare arena from the session, if there is one. */
+        NE_LOCK(req->session, pool_lock);
+        req->arena = req->session->arena;
+        req->session->arena = NULL;
+        NE_UNLOCK(req->session, pool_lock);
+    }
+
+    return ne__arena_alloc(&req->arena, len);
+}
+
 /* Abort a request due to an non-recoverable HTTP protocol error,
  * whilst doing 'doing'.  'code', if non-zero, is the socket error
  * code, NE_SOCK_*, or if zero, is ignored. */
@@ -244,14 +450,14 @@ static int aborted(ne_request *req, const char *doing, ssize_t code)
     case NE_SOCK_ERROR:
     case NE_SOCK_RESET:
     case NE_SOCK_TRUNC:
-        ne_set_error(sess, "%s: %s", doing, ne_sock_error(sess->socket));
+        ne_set_error(sess, "%s: %s", doing, ne_sock_error(req->conn->socket));
         break;
     case 0:
 	ne_set_error(sess, "%s", doing);
 	break;
     }
 
-    ne_close_connection(sess);
+    close_connection(req);
     return ret;
 }
 
@@ -372,11 +578,15 @@ static ssize_t body_fd_send(void *userdata, char *buffer, size_t count)
     ne_request *req = userdata;
 
     if (count) {
+        ssize_t ret;
+
         if (req->body.file.remain == 0)
             return 0;
         if ((off_t)count > req->body.file.remain)
             count = req->body.file.remain;
-	return read(req->body.file.fd, buffer, count);
+	ret = read(req->body.file.fd, buffer, count);
+        if (ret > 0) req->body.file.remain -= ret;
+        return ret;
     } else {
         ne_off_t newoff;
 
@@ -418,6 +628,145 @@ static ssize_t body_fd_send(void *userdata, char *buffer, size_t count)
 ((((code) == NE_SOCK_CLOSED || (code) == NE_SOCK_RESET || \
  (code) == NE_SOCK_TRUNC) && retry) ? NE_RETRY : (acode))
 
+/* Maximum number of bytes passed to the socket layer at a time when
+ * sending a request body from a file descriptor; bounds the interval
+ * between progress callbacks. */
+#define SENDFILE_CHUNK (1024 * 1024)
+
+/* Send the request body directly from the file descriptor given by
+ * ne_set_request_body_fd, avoiding a copy through a user-space
+ * buffer where possible.  Returns NE_* code. */
+static int send_body_file(ne_request *req, int retry)
+{
+    ne_session *const sess = req->session;
+    ne_off_t progress = 0;
+    ssize_t bytes;
+
+    NE_DEBUG(NE_DBG_HTTP, "Sending request body from file:\n");
+
+    /* rewind to the start of the body. */
+    if (body_fd_send(req, NULL, 0) != 0) {
+        close_connection(req);
+        return NE_ERROR;
+    }
+
+    while (req->body.file.remain > 0) {
+        size_t count = SENDFILE_CHUNK;
+
+        if ((ne_off_t)count > req->body.file.remain)
+            count = req->body.file.remain;
+
+        bytes = ne_sock_sendfile(req->conn->socket, req->body.file.fd, count);
+        if (bytes < 0) {
+            int aret = aborted(req, _("Could not send request body"), bytes);
+            return RETRY_RET(retry, bytes, aret);
+        } else if (bytes == 0) {
+            ne_set_error(sess, _("Premature end of request body file"));
+            close_connection(req);
+            return NE_ERROR;
+        }
+
+        req->body.file.remain -= bytes;
+
+        NE_DEBUG(NE_DBG_HTTPBODY, "Sent %" NE_FMT_SSIZE_T " bytes "
+                 "of request body.\n", bytes);
+
+        /* invoke progress callback */
+        if (sess->progress_cb) {
+            progress += bytes;
+            sess->progress_cb(sess->progress_ud, progress, req->body_length);
+        }
+    }
+
+    return NE_OK;
+}
+
+/* Space reserved in the request body block before the data, for the
+ * chunk-size line of a chunk (up to 8 hex digits plus CRLF), and
+ * after it, for the CRLF ending the chunk plus the last-chunk. */
+#define CHUNK_PREFIX (10)
+#define CHUNK_SUFFIX (7)
+/* Size of the request body block buffer. */
+#define BODY_BLOCK (CHUNK_PREFIX + NE_BUFSIZ + CHUNK_SUFFIX)
+
+/* Tell the body provider to start again from the beginning, ready to
+ * send the body a block at a time.  Returns NE_* code; the connection
+ * is closed on error. */
+static int rewind_body(ne_request *req)
+{
+    if (req->blk == NULL) req->blk = ne_malloc(BODY_BLOCK);
+
+    if (req->body_cb(req->body_ud, NULL, 0) != 0) {
+        close_connection(req);
+        return NE_ERROR;
+    }
+
+    req->blklen = req->blkpos = 0;
+    req->body_progress = 0;
+    req->body_eof = 0;
+    return NE_OK;
+}
+
+/* Fetch the next block of the request body from the provider into
+ * req->blk, setting blkpos and blklen to the bytes to be sent.  For a
+ * body of unknown length, the provider is called until the block is
+ * full (so small writes by the provider are coalesced), and the data
+ * is framed as a chunk, with the last-chunk appended once the
+ * provider reaches the end.  Returns the number of bytes to send, 0
+ * once the body is complete, or <0 if the provider fails, in which
+ * case the connection is closed. */
+static ssize_t fetch_body_block(ne_request *req)
+{
+    char *const data = req->blk + CHUNK_PREFIX;
+    size_t len = 0;
+    ssize_t bytes = 1;
+
+    if (req->body_eof)
+        return 0;
+
+    do {
+        bytes = req->body_cb(req->body_ud, data + len, NE_BUFSIZ - len);
+        if (bytes > 0) len += bytes;
+    } while (bytes > 0 && req->body_length < 0 && len < NE_BUFSIZ);
+
+    if (bytes < 0) {
+        NE_DEBUG(NE_DBG_HTTP, "Request body provider failed with "
+                 "%" NE_FMT_SSIZE_T "\n", bytes);
+        close_connection(req);
+        return bytes;
+    }
+
+    if (len) {
+        NE_DEBUG(NE_DBG_HTTPBODY, 
+                 "Body block (%" NE_FMT_SIZE_T " bytes):\n[%.*s]\n",
+                 len, (int)len, data);
+    }
+
+    req->body_eof = bytes == 0;
+    req->blkpos = CHUNK_PREFIX;
+    req->blklen = CHUNK_PREFIX + len;
+
+    if (req->body_length < 0) {
+        /* Frame the data as a chunk. */
+        if (len) {
+            char size[CHUNK_PREFIX + 1];
+            int slen = ne_snprintf(size, sizeof size, "%x" EOL, 
+                                   (unsigned int)len);
+            
+            req->blkpos -= slen;
+            memcpy(req->blk + req->blkpos, size, slen);
+            memcpy(req->blk + req->blklen, EOL, 2);
+            req->blklen += 2;
+        }
+        if (req->body_eof) {
+            memcpy(req->blk + req->blklen, "0" EOL EOL, 5);
+            req->blklen += 5;
+        }
+    }
+
+    return req->blklen - req->blkpos;
+}
+
 /* Sends the request body; returns 0 on success or an NE_* error code.
  * If retry is non-zero; will return NE_RETRY on persistent connection
  * timeout.  On error, the session error string is set and the
@@ -425,46 +774,36 @@ static ssize_t body_fd_send(void *userdata, char *buffer, size_t count)
 static int send_request_body(ne_request *req, int retry)
 {
     ne_session *const sess = req->session;
-    ne_off_t progress = 0;
-    char buffer[NE_BUFSIZ];
     ssize_t bytes;
+    int ret;
+
+    if (req->body_cb == body_fd_send)
+        return send_body_file(req, retry);
 
     NE_DEBUG(NE_DBG_HTTP, "Sending request body:\n");
     
     /* tell the source to start again from the beginning. */
-    if (req->body_cb(req->body_ud, NULL, 0) != 0) {
-        ne_close_connection(sess);
-        return NE_ERROR;
-    }
+    ret = rewind_body(req);
+    if (ret) return ret;
     
-    while ((bytes = req->body_cb(req->body_ud, buffer, sizeof buffer)) > 0) {
-	int ret = ne_sock_fullwrite(sess->socket, buffer, bytes);
+    while ((bytes = fetch_body_block(req)) > 0) {
+	ret = ne_sock_fullwrite(req->conn->socket, req->blk + req->blkpos,
+                                bytes);
         if (ret < 0) {
             int aret = aborted(req, _("Could not send request body"), ret);
             return RETRY_RET(retry, ret, aret);
         }
 
-	NE_DEBUG(NE_DBG_HTTPBODY, 
-		 "Body block (%" NE_FMT_SSIZE_T " bytes):\n[%.*s]\n",
-		 bytes, (int)bytes, buffer);
-
         /* invoke progress callback */
         if (sess->progress_cb) {
-            progress += bytes;
+            req->body_progress += bytes;
             /* TODO: progress_cb offset type mismatch ick */
-            req->session->progress_cb(sess->progress_ud, progress,
+            req->session->progress_cb(sess->progress_ud, req->body_progress,
                                       req->body_length);
         }
     }
 
-    if (bytes == 0) {
-        return NE_OK;
-    } else {
-        NE_DEBUG(NE_DBG_HTTP, "Request body provider failed with "
-                 "%" NE_FMT_SSIZE_T "\n", bytes);
-        ne_close_connection(sess);
-        return NE_ERROR;
-    }
+    return bytes == 0 ? NE_OK : NE_ERROR;
 }
 
 /* Lob the User-Agent, connection and host headers in to the request
@@ -483,7 +822,8 @@ static void add_fixed_headers(ne_request *req)
        ne_buffer_czappend(req->headers,
                           "Connection: TE, close" EOL
                           "TE: trailers" EOL);
-    } else if (!req->session->is_http11 && !req->session->use_proxy) {
+    } else if (ne_version_pre_http11(req->session) 
+               && !req->session->use_proxy) {
         ne_buffer_czappend(req->headers, 
                           "Keep-Alive: " EOL
                           "Connection: TE, Keep-Alive" EOL
@@ -512,6 +852,8 @@ ne_request *ne_request_create(ne_session *sess,
 
     req->session = sess;
     req->headers = ne_buffer_create();
+    req->last_header = &req->first_header;
+    start_timings(req);
 
     /* Add in the fixed headers */
     add_fixed_headers(req);
@@ -531,20 +873,29 @@ ne_request *ne_request_create(ne_session *sess,
     {
 	struct hook *hk;
 
+	NE_LOCK(sess, hook_lock);
 	for (hk = sess->create_req_hooks; hk != NULL; hk = hk->next) {
 	    ne_create_request_fn fn = (ne_create_request_fn)hk->fn;
 	    fn(req, hk->userdata, method, req->uri);
 	}
+	NE_UNLOCK(sess, hook_lock);
     }
 
     return req;
 }
 
-/* Set the request body length to 'length' */
+/* Set the request body length to 'length'; if negative, the length
+ * is unknown and chunked encoding is used. */
 static void set_body_length(ne_request *req, ne_off_t length)
 {
-    req->body_length = length;
-    ne_print_request_header(req, "Content-Length", "%" FMT_NE_OFF_T, length);
+    if (length < 0) {
+        req->body_length = -1;
+        ne_add_request_header(req, "Transfer-Encoding", "chunked");
+    } else {
+        req->body_length = length;
+        ne_print_request_header(req, "Content-Length", "%" FMT_NE_OFF_T,
+                                length);
+    }
 }
 
 void ne_set_request_body_buffer(ne_request *req, const char *buffer,
@@ -621,27 +972,57 @@ void ne_print_request_header(ne_request *req, const char *name,
     ne_buffer_concat(req->headers, name, ": ", buf, EOL, NULL);
 }
 
+/* Placeholder left in the header index by a removed field. */
+static struct field removed_field;
+
+/* Returns a pointer to the header index slot of the response header
+ * 'name' of length 'len', which has hash value 'h', or to the empty
+ * slot where it would be stored if it is not found.  'name' need not
+ * be in lower case, or NUL-terminated. */
+static struct field **find_response_header(ne_request *req, unsigned int h,
+                                           const char *name, size_t len)
+{
+    unsigned int n = HH_SLOT(h);
+    struct field *f;
+
+    while ((f = req->response_headers[n]) != NULL) {
+        if (f->hash == h && f != &removed_field) {
+            const char *q = f->name;
+            size_t m;
+
+            for (m = 0; m < len && tolower(name[m]) == q[m]; m++)
+                /* nothing */;
+
+            if (m == len && q[m] == '\0')
+                break;
+        }
+        n = HH_SLOT(n + 1);
+    }
+
+    return &req->response_headers[n];
+}
+
 /* Returns the value of the response header 'name', for which the hash
  * value is 'h', or NULL if the header is not found. */
 static inline char *get_response_header_hv(ne_request *req, unsigned int h,
                                            const char *name)
 {
-    struct field *f;
-
-    for (f = req->response_headers[h]; f; f = f->next)
-        if (strcmp(f->name, name) == 0)
-            return f->value;
+    struct field *f = *find_response_header(req, h, name, strlen(name));
 
-    return NULL;
+    return f ? f->value : NULL;
 }
 
 const char *ne_get_response_header(ne_request *req, const char *name)
 {
-    char *lcname = ne_strdup(name);
-    unsigned int hash = hash_and_lower(lcname);
-    char *value = get_response_header_hv(req, hash, lcname);
-    ne_free(lcname);
-    return value;
+    const char *pnt;
+    unsigned int hash = 0;
+    struct field *f;
+
+    for (pnt = name; *pnt != '\0'; pnt++)
+	hash = HH_ITERATE(hash, tolower(*pnt));
+
+    f = *find_response_header(req, hash, name, pnt - name);
+    return f ? f->value : NULL;
 }
 
 /* The return value of the iterator function is a pointer to the
@@ -650,25 +1031,14 @@ void *ne_response_header_iterate(ne_request *req, void *iterator,
                                  const char **name, const char **value)
 {
     struct field *f = iterator;
-    unsigned int n;
 
-    if (f == NULL) {
-        n = 0;
-    } else if ((f = f->next) == NULL) {
-        n = req->current_index + 1;
-    }
+    f = f ? f->next : req->first_header;
 
-    if (f == NULL) {
-        while (n < HH_HASHSIZE && req->response_headers[n] == NULL)
-            n++;
-        if (n == HH_HASHSIZE)
-            return NULL; /* no more headers */
-        f = req->response_headers[n];
-        req->current_index = n;
+    if (f) {
+        *name = f->name;
+        *value = f->value;
     }
-    
-    *name = f->name;
-    *value = f->value;
+
     return f;
 }
 
@@ -676,45 +1046,39 @@ void *ne_response_header_iterate(ne_request *req, void *iterator,
 static void remove_response_header(ne_request *req, const char *name, 
                                    unsigned int hash)
 {
-    struct field **ptr = req->response_headers + hash;
+    struct field **slot = find_response_header(req, hash, name, strlen(name));
+    struct field **ptr;
 
-    while (*ptr) {
-        struct field *const f = *ptr;
+    if (*slot == NULL) return;
 
-        if (strcmp(f->name, name) == 0) {
-            *ptr = f->next;
-            ne_free(f->name);
-            ne_free(f->value);
-            ne_free(f);
-            return;
-        }
-        
-        ptr = &f->next;
-    }
+    for (ptr = &req->first_header; *ptr != *slot; ptr = &(*ptr)->next)
+        /* nothing */;
+
+    *ptr = (*slot)->next;
+    if (req->last_header == &(*slot)->next)
+        req->last_header = ptr;
+
+    /* Keep the slot occupied so later fields remain reachable. */
+    *slot = &removed_field;
 }
 
 /* Free all stored response headers. */
 static void free_response_headers(ne_request *req)
 {
-    int n;
-
-    for (n = 0; n < HH_HASHSIZE; n++) {
-        struct field **ptr = req->response_headers + n;
-
-        while (*ptr) {
-            struct field *const f = *ptr;
-            *ptr = f->next;
-            ne_free(f->name);
-            ne_free(f->value);
-            ne_free(f);
-	}
+    if (req->nheaders) {
+        memset(req->response_headers, 0, sizeof req->response_headers);
+        req->nheaders = 0;
     }
+
+    req->first_header = NULL;
+    req->last_header = &req->first_header;
+    ne__arena_reset(&req->arena);
 }
 
 void ne_add_response_body_reader(ne_request *req, ne_accept_response acpt,
 				 ne_block_reader rdr, void *userdata)
 {
-    struct body_reader *new = ne_malloc(sizeof *new);
+    struct body_reader *new = ne_calloc(sizeof *new);
     new->accept_response = acpt;
     new->handler = rdr;
     new->userdata = userdata;
@@ -722,28 +1086,60 @@ void ne_add_response_body_reader(ne_request *req, ne_accept_response acpt,
     req->body_readers = new;
 }
 
+void ne_add_response_body_borrower(ne_request *req, ne_accept_response acpt,
+                                   ne_block_borrower rdr, void *userdata)
+{
+    struct body_reader *new = ne_calloc(sizeof *new);
+    new->accept_response = acpt;
+    new->borrower = rdr;
+    new->userdata = userdata;
+    new->next = req->body_readers;
+    req->body_readers = new;
+}
+
 void ne_request_destroy(ne_request *req) 
 {
     struct body_reader *rdr, *next_rdr;
     struct hook *hk, *next_hk;
 
+    /* Close the connection if the response was not read. */
+    close_connection(req);
+    return_rate(&req->upload);
+    return_rate(&req->download);
+
     ne_free(req->uri);
     ne_free(req->method);
 
     for (rdr = req->body_readers; rdr != NULL; rdr = next_rdr) {
 	next_rdr = rdr->next;
+        if (rdr->held) ne_free(rdr->held);
 	ne_free(rdr);
     }
 
-    free_response_headers(req);
+    /* Pass the header arena back to the session for reuse. */
+    if (req->arena) {
+        free_response_headers(req);
+        NE_LOCK(req->session, pool_lock);
+        if (req->session->arena == NULL) {
+            req->session->arena = req->arena;
+            req->arena = NULL;
+        }
+        NE_UNLOCK(req->session, pool_lock);
+        ne__arena_free(&req->arena);
+    }
 
     ne_buffer_destroy(req->headers);
+    if (req->reqbuf) ne_buffer_destroy(req->reqbuf);
+    if (req->blk) ne_free(req->blk);
+    if (req->query) ne_addr_destroy(ne_addr_query_finish(req->query));
 
     NE_DEBUG(NE_DBG_HTTP, "Running destroy hooks.\n");
+    NE_LOCK(req->session, hook_lock);
     for (hk = req->session->destroy_req_hooks; hk; hk = hk->next) {
 	ne_destroy_req_fn fn = (ne_destroy_req_fn)hk->fn;
 	fn(req, hk->userdata);
     }
+    NE_UNLOCK(req->session, hook_lock);
 
     for (hk = req->private; hk; hk = next_hk) {
 	next_hk = hk->next;
@@ -762,47 +1158,153 @@ void ne_request_destroy(ne_request *req)
 }
 
 
+/* Maximum length of a chunk-size line, including any chunk
+ * extensions. */
+#define MAX_CHUNK_LINE (NE_BUFSIZ)
+
+/* Parse the chunk-size line at 'line', which is terminated by a line
+ * feed, storing the chunk size in *size.  Returns non-zero if the
+ * line is invalid. */
+static int parse_chunk_size(const char *line, size_t *size)
+{
+    unsigned long len = 0;
+    const char *p;
+
+    for (p = line; isxdigit((unsigned char)*p); p++) {
+        unsigned int digit = isdigit((unsigned char)*p) ? *p - '0'
+            : tolower((unsigned char)*p) - 'a' + 10;
+        /* limit chunk size to <= UINT_MAX, so it will probably fit in
+         * a size_t; checked before multiplying, since an unsigned
+         * long may be no wider than an unsigned int. */
+        if (len > (UINT_MAX - digit) / 16)
+            return -1;
+        len = len * 16 + digit;
+    }
+
+    if (p == line || (*p != ';' && *p != ' ' && *p != '\t' 
+                      && *p != '\r' && *p != '\n'))
+        return -1;
+
+    *size = len;
+    return 0;
+}
+
+/* Decode the chunked response body into 'buffer', which is of size
+ * *buflen, as for read_response_block.  The chunk-size lines, chunk
+ * data and delimiters are parsed directly from the socket's read
+ * buffer, so the data of as many chunks as are already buffered is
+ * returned at once; the socket is read only when nothing has yet
+ * been decoded. */
+static int read_chunked(ne_request *req, struct ne_response *resp,
+                        char *buffer, size_t *buflen)
+{
+    ne_socket *const sock = req->conn->socket;
+    size_t count = 0;
+
+    while (count < *buflen && !resp->body.chunk.last) {
+        const char *data, *lf;
+        const char *doing;
+        size_t len;
+        ssize_t ret;
+
+        data = ne_sock_buffered(sock, &len);
+
+        if (resp->body.chunk.remain) {
+            /* Copy out chunk data. */
+            size_t n = resp->body.chunk.remain;
+
+            if (n > *buflen - count) n = *buflen - count;
+
+            if (len) {
+                if (n > len) n = len;
+                memcpy(buffer + count, data, n);
+                ne_sock_consume(sock, n);
+            } else if (count) {
+                break;
+            } else {
+                /* Nothing buffered: read directly into the caller's
+                 * buffer, if it is large enough. */
+                ret = ne_sock_read(sock, buffer, n);
+                if (ret == NE_SOCK_RETRY)
+                    return NE_AGAIN;
+                else if (ret < 0)
+                    return aborted(req, _("Could not read response body"),
+                                   ret);
+                n = ret;
+            }
+            
+            count += n;
+            resp->body.chunk.remain -= n;
+            if (resp->body.chunk.remain == 0)
+                resp->body.chunk.crlf = 1;
+            continue;
+        }
+
+        if (resp->body.chunk.crlf) {
+            /* The CRLF which follows the previous chunk. */
+            if (len >= 2) {
+                if (data[0] != '\r' || data[1] != '\n')
+                    return aborted(req, _("Chunk delimiter was invalid"), 0);
+                ne_sock_consume(sock, 2);
+                resp->body.chunk.crlf = 0;
+                continue;
+            }
+            doing = _("Could not read chunk delimiter");
+        }
+        else if ((lf = memchr(data, '\n', len)) != NULL) {
+            /* A complete chunk-size line. */
+            size_t size;
+
+            if (parse_chunk_size(data, &size))
+                return aborted(req, _("Could not parse chunk size"), 0);
+            NE_DEBUG(NE_DBG_HTTP, "Got chunk size: %" NE_FMT_SIZE_T "\n",
+                     size);
+            ne_sock_consume(sock, lf - data + 1);
+            resp->body.chunk.remain = size;
+            resp->body.chunk.last = size == 0;
+            continue;
+        }
+        else {
+            doing = _("Could not read chunk size");
+        }
+
+        /* More data is needed: return what has been decoded so far,
+         * otherwise read from the socket. */
+        if (count)
+            break;
+        
+        ret = ne_sock_fill(sock, MAX_CHUNK_LINE);
+        if (ret == NE_SOCK_RETRY)
+            return NE_AGAIN;
+        else if (ret < 0)
+            return aborted(req, doing, ret);
+    }
+
+    NE_DEBUG(NE_DBG_HTTPBODY,
+	     "Read block (%" NE_FMT_SIZE_T " bytes):\n[%.*s]\n",
+	     count, (int)count, buffer);
+    *buflen = count;
+    resp->progress += count;
+    return NE_OK;
+}
+
 /* Reads a block of the response into BUFFER, which is of size
  * *BUFLEN.  Returns zero on success or non-zero on error.  On
  * success, *BUFLEN is updated to be the number of bytes read into
  * BUFFER (which will be 0 to indicate the end of the repsonse).  On
  * error, the connection is closed and the session error string is
- * set.  */
+ * set.  Returns NE_AGAIN, leaving *BUFLEN unchanged, if the
+ * connection is in non-blocking mode and no data is available. */
 static int read_response_block(ne_request *req, struct ne_response *resp, 
 			       char *buffer, size_t *buflen) 
 {
-    ne_socket *const sock = req->session->socket;
+    ne_socket *const sock = req->conn->socket;
     size_t willread;
     ssize_t readlen;
     
     switch (resp->mode) {
     case R_CHUNKED:
-        /* Chunked transfer-encoding: chunk syntax is "SIZE CRLF CHUNK
-         * CRLF SIZE CRLF CHUNK CRLF ..." followed by zero-length
-         * chunk: "CHUNK CRLF 0 CRLF".  resp.chunk.remain contains the
-         * number of bytes left to read in the current chunk. */
-	if (resp->body.chunk.remain == 0) {
-	    unsigned long chunk_len;
-	    char *ptr;
-
-            /* Read the chunk size line into a temporary buffer. */
-            SOCK_ERR(req,
-                     ne_sock_readline(sock, req->respbuf, sizeof req->respbuf),
-                     _("Could not read chunk size"));
-            NE_DEBUG(NE_DBG_HTTP, "[chunk] < %s", req->respbuf);
-            chunk_len = strtoul(req->respbuf, &ptr, 16);
-	    /* limit chunk size to <= UINT_MAX, so it will probably
-	     * fit in a size_t. */
-	    if (ptr == req->respbuf || 
-		chunk_len == ULONG_MAX || chunk_len > UINT_MAX) {
-		return aborted(req, _("Could not parse chunk size"), 0);
-	    }
-	    NE_DEBUG(NE_DBG_HTTP, "Got chunk size: %lu\n", chunk_len);
-	    resp->body.chunk.remain = chunk_len;
-	}
-	willread = resp->body.chunk.remain > *buflen
-            ? *buflen : resp->body.chunk.remain;
-	break;
+        return read_chunked(req, resp, buffer, buflen);
     case R_CLENGTH:
 	willread = resp->body.clen.remain > (off_t)*buflen 
             ? *buflen : (size_t)resp->body.clen.remain;
@@ -822,6 +1324,8 @@ static int read_response_block(ne_request *req, struct ne_response *resp,
     NE_DEBUG(NE_DBG_HTTP,
 	     "Reading %" NE_FMT_SIZE_T " bytes of response body.\n", willread);
     readlen = ne_sock_read(sock, buffer, willread);
+    if (readlen == NE_SOCK_RETRY)
+        return NE_AGAIN;
 
     /* EOF is only valid when response body is delimited by it.
      * Strictly, an SSL truncation should not be treated as an EOF in
@@ -841,71 +1345,358 @@ static int read_response_block(ne_request *req, struct ne_response *resp,
     NE_DEBUG(NE_DBG_HTTPBODY,
 	     "Read block (%" NE_FMT_SSIZE_T " bytes):\n[%.*s]\n",
 	     readlen, (int)readlen, buffer);
-    if (resp->mode == R_CHUNKED) {
-	resp->body.chunk.remain -= readlen;
-	if (resp->body.chunk.remain == 0) {
-	    char crlfbuf[2];
-	    /* If we've read a whole chunk, read a CRLF */
-	    readlen = ne_sock_fullread(sock, crlfbuf, 2);
-            if (readlen < 0)
-                return aborted(req, _("Could not read chunk delimiter"),
-                               readlen);
-            else if (crlfbuf[0] != '\r' || crlfbuf[1] != '\n')
-                return aborted(req, _("Chunk delimiter was invalid"), 0);
-	}
-    } else if (resp->mode == R_CLENGTH) {
+    if (resp->mode == R_CLENGTH) {
 	resp->body.clen.remain -= readlen;
     }
     resp->progress += readlen;
     return NE_OK;
 }
 
-ssize_t ne_read_response_block(ne_request *req, char *buffer, size_t buflen)
+/* Return 'req' to its initial state, ready to be sent again. */
+static void reset_request(ne_request *req)
+{
+    req->state = RS_START;
+    req->retried = 0;
+    req->throttled = 0;
+    return_rate(&req->upload);
+    return_rate(&req->download);
+    if (req->reqbuf) {
+        ne_buffer_destroy(req->reqbuf);
+        req->reqbuf = NULL;
+    }
+}
+
+/* Pass the 'len' bytes of response body at 'data' to borrowing body
+ * reader 'rdr', preceded by any bytes it did not consume from
+ * previous blocks; bytes which it does not consume now are held for
+ * the next block.  Returns non-zero on error. */
+static int borrow_block(ne_request *req, struct body_reader *rdr,
+                        const char *data, size_t len)
+{
+    ssize_t used;
+
+    if (rdr->heldlen) {
+        if (len == 0) {
+            /* At the end of the body, all the data must be consumed. */
+            used = rdr->borrower(rdr->userdata, rdr->held, rdr->heldlen);
+            if (used < 0) {
+                return -1;
+            } else if ((size_t)used != rdr->heldlen) {
+                ne_set_error(req->session, 
+                             _("Response body was not consumed"));
+                return -1;
+            }
+            rdr->heldlen = 0;
+        } else {
+            /* Append the block to the held data, and pass that. */
+            if (rdr->heldlen + len > rdr->heldsize) {
+                rdr->heldsize = rdr->heldlen + len;
+                rdr->held = ne_realloc(rdr->held, rdr->heldsize);
+            }
+            memcpy(rdr->held + rdr->heldlen, data, len);
+            data = rdr->held;
+            len += rdr->heldlen;
+        }
+    }
+
+    used = rdr->borrower(rdr->userdata, data, len);
+    if (used < 0 || (size_t)used > len)
+        return -1;
+    len -= used;
+
+    /* Hold on to any data which was not consumed. */
+    if (data == rdr->held) {
+        memmove(rdr->held, rdr->held + used, len);
+    } else if (len) {
+        if (len > rdr->heldsize) {
+            rdr->heldsize = len;
+            rdr->held = ne_realloc(rdr->held, rdr->heldsize);
+        }
+        memcpy(rdr->held, data + used, len);
+    }
+    rdr->heldlen = len;
+
+    return 0;
+}
+
+/* Pass the 'len' bytes of response body at 'data' to the body
+ * readers, a 'len' of zero marking the end of the body, after which
+ * any trailers are read.  Returns NE_OK, or NE_ERROR if a reader
+ * fails (having closed the connection). */
+static int deliver_body(ne_request *req, const char *data, size_t len)
 {
     struct body_reader *rdr;
-    size_t readlen = buflen;
     struct ne_response *const resp = &req->resp;
 
-    if (read_response_block(req, resp, buffer, &readlen))
-	return -1;
-
     if (req->session->progress_cb) {
 	req->session->progress_cb(req->session->progress_ud, resp->progress, 
 				  resp->mode==R_CLENGTH ? resp->body.clen.total:-1);
     }
 
     for (rdr = req->body_readers; rdr!=NULL; rdr=rdr->next) {
-	if (rdr->use && rdr->handler(rdr->userdata, buffer, readlen) != 0) {
-            ne_close_connection(req->session);
-            return -1;
+        if (!rdr->use)
+            continue;
+	if (rdr->borrower ? borrow_block(req, rdr, data, len) != 0
+            : rdr->handler(rdr->userdata, data, len) != 0) {
+            close_connection(req);
+            reset_request(req);
+            return NE_ERROR;
         }
     }
+
+    if (len == 0) {
+        MARK_TIME(req, body);
+        return_rate(&req->download);
+        req->state = RS_TRAILER;
+    }
     
-    return readlen;
+    return NE_OK;
 }
 
-/* Build the request string, returning the buffer. */
-static ne_buffer *build_request(ne_request *req) 
+/* Returns non-zero if bytes of the response body to 'req' remain to
+ * be read. */
+static int body_pending(const ne_request *req)
 {
-    struct hook *hk;
-    ne_buffer *buf = ne_buffer_create();
+    const struct ne_response *const resp = &req->resp;
 
-    /* Add Request-Line and Host header: */
-    ne_buffer_concat(buf, req->method, " ", req->uri, " HTTP/1.1" EOL,
-		     "Host: ", req->session->server.hostport, EOL, NULL);
-    
-    /* Add custom headers: */
-    ne_buffer_append(buf, req->headers->data, ne_buffer_size(req->headers));
+    switch (resp->mode) {
+    case R_CLENGTH:
+        return resp->body.clen.remain > 0;
+    case R_CHUNKED:
+        return !resp->body.chunk.last;
+    case R_TILLEOF:
+        return 1;
+    default:
+        return 0;
+    }
+}
 
-#define E100 "Expect: 100-continue" EOL
-    if (req->use_expect100)
-	ne_buffer_append(buf, E100, strlen(E100));
+/* Reads a block of the response body into 'buffer' as for
+ * read_response_block, and passes it to the body readers; at the end
+ * of the body, moves on to reading any trailers.  Returns NE_OK,
+ * NE_AGAIN, or NE_* on error (having closed the connection). */
+static int read_body_block(ne_request *req, char *buffer, size_t *buflen)
+{
+    ne_ratelimit *const rl = req->download.rl;
+    int ret;
+
+    if (rl && body_pending(req)
+        && throttle(req, rl, &req->download, buflen) == NE_AGAIN)
+        return NE_AGAIN;
+
+    ret = read_response_block(req, &req->resp, buffer, buflen);
+    if (ret == NE_AGAIN) {
+        req->events = NE_SOCK_WANT_READ;
+        return ret;
+    } else if (ret) {
+        reset_request(req);
+        return ret;
+    }
+
+    if (rl) req->download.credit -= *buflen;
+
+    return deliver_body(req, buffer, *buflen);
+}
+
+/* Passes a block of a response body which is not chunked to the
+ * body readers without an intermediate copy: data already buffered
+ * for the connection is passed in place, otherwise the socket is
+ * read directly into req->respbuf.  Returns as for
+ * read_body_block. */
+static int borrow_body_block(ne_request *req)
+{
+    ne_socket *const sock = req->conn->socket;
+    struct ne_response *const resp = &req->resp;
+    ne_ratelimit *const rl = req->download.rl;
+    const char *data = req->respbuf;
+    size_t len = 0, allow = sizeof req->respbuf;
+
+    if (resp->mode == R_TILLEOF
+        || (resp->mode == R_CLENGTH && resp->body.clen.remain > 0)) {
+        if (resp->mode == R_CLENGTH 
+            && resp->body.clen.remain < (ne_off_t)allow)
+            allow = resp->body.clen.remain;
+        if (rl && throttle(req, rl, &req->download, &allow) == NE_AGAIN)
+            return NE_AGAIN;
+
+        data = ne_sock_buffered(sock, &len);
+        if (len) {
+            if (len > allow)
+                len = allow;
+            /* The data remains in place until the socket is next
+             * read. */
+            ne_sock_consume(sock, len);
+        } else {
+            ssize_t ret = ne_sock_read(sock, req->respbuf, allow);
+
+            data = req->respbuf;
+            if (ret == NE_SOCK_RETRY) {
+                req->events = NE_SOCK_WANT_READ;
+                return NE_AGAIN;
+            } else if (resp->mode == R_TILLEOF && 
+                       (ret == NE_SOCK_CLOSED || ret == NE_SOCK_TRUNC)) {
+                /* EOF delimits the body, as in read_response_block. */
+                NE_DEBUG(NE_DBG_HTTP, "Got EOF.\n");
+                req->can_persist = 0;
+            } else if (ret < 0) {
+                ret = aborted(req, _("Could not read response body"), ret);
+                reset_request(req);
+                return ret;
+            } else {
+                len = ret;
+            }
+        }
+    }
+
+    if (len) {
+        NE_DEBUG(NE_DBG_HTTPBODY,
+                 "Read block (%" NE_FMT_SIZE_T " bytes):\n[%.*s]\n",
+                 len, (int)len, data);
+        if (resp->mode == R_CLENGTH)
+            resp->body.clen.remain -= len;
+        resp->progress += len;
+        if (rl) req->download.credit -= len;
+    }
+
+    return deliver_body(req, data, len);
+}
+
+/* Returns the number of milliseconds left to wait for a 100-continue
+ * response before sending the request body anyway, or -1 if not
+ * waiting for one for a limited time. */
+static int expect_remaining(const ne_request *req)
+{
+    long elapsed;
+
+    if (!req->expect_wait)
+        return -1;
+
+    elapsed = (long)((ne__time_now() - req->expect_sent) * 1000);
+
+    return elapsed < req->expect_timeout
+        ? (int)(req->expect_timeout - elapsed) : 0;
+}
+
+/* Returns what is known of the server's handling of 100-continue, as
+ * one of the NE_E100_* values. */
+static int get_expect100(ne_session *sess)
+{
+    int ret;
+
+    NE_LOCK(sess, pool_lock);
+    ret = sess->expect100;
+    NE_UNLOCK(sess, pool_lock);
+    return ret;
+}
+
+/* Records the server's handling of 100-continue as 'state'. */
+static void set_expect100(ne_session *sess, int state)
+{
+    NE_LOCK(sess, pool_lock);
+    sess->expect100 = state;
+    NE_UNLOCK(sess, pool_lock);
+}
+
+/* Block until the connection used by 'req' is ready for the events
+ * it awaits.  Returns NE_OK, or an NE_* code on error, having closed
+ * the connection and reset the request. */
+static int await_request(ne_request *req)
+{
+    const char *doing;
+    int ret, msec;
+
+    /* Sleep until a rate-limited request may continue. */
+    if (req->throttled) {
+        msec = throttle_remaining(req);
+        if (msec > 0) sleep_msec(msec);
+        return NE_OK;
+    }
+
+    /* A lookup started by ne_request_step has no socket yet; it is
+     * completed, blocking, when the request is next run. */
+    if (req->query)
+        return NE_OK;
+
+    if (req->conn == NULL || req->conn->socket == NULL) {
+        ne_set_error(req->session, _("Request has no connection to await"));
+        reset_request(req);
+        return NE_ERROR;
+    }
+
+    msec = expect_remaining(req);
+
+    if (msec >= 0)
+        ret = ne_sock_wait_timeout(req->conn->socket, req->events, msec);
+    else
+        ret = ne_sock_wait(req->conn->socket, req->events);
+    if (ret == 0 || (ret == NE_SOCK_TIMEOUT && msec >= 0))
+        return NE_OK;
+
+    switch (req->state) {
+    case RS_CONNECT:
+        doing = _("Could not connect to server");
+        break;
+    case RS_SEND:
+        doing = _("Could not send request");
+        break;
+    case RS_SENDBODY:
+        doing = _("Could not send request body");
+        break;
+    case RS_BODY:
+        doing = _("Could not read response body");
+        break;
+    case RS_TRAILER:
+        doing = _("Error reading response headers");
+        break;
+    default:
+        doing = _("Could not read status line");
+        break;
+    }
+
+    ret = aborted(req, doing, ret);
+    reset_request(req);
+    return ret;
+}
+
+ssize_t ne_read_response_block(ne_request *req, char *buffer, size_t buflen)
+{
+    int ret;
+
+    if (req->state != RS_BODY)
+        return 0;
+
+    while ((ret = read_body_block(req, buffer, &buflen)) == NE_AGAIN) {
+        if (await_request(req))
+            return -1;
+    }
+    
+    return ret == NE_OK ? (ssize_t)buflen : -1;
+}
+
+/* Build the request string, returning the buffer. */
+static ne_buffer *build_request(ne_request *req) 
+{
+    struct hook *hk;
+    ne_buffer *buf = ne_buffer_create();
+
+    /* Add Request-Line and Host header: */
+    ne_buffer_concat(buf, req->method, " ", req->uri, " HTTP/1.1" EOL,
+		     "Host: ", req->session->server.hostport, EOL, NULL);
+    
+    /* Add custom headers: */
+    ne_buffer_append(buf, req->headers->data, ne_buffer_size(req->headers));
+
+#define E100 "Expect: 100-continue" EOL
+    if (req->use_expect100)
+	ne_buffer_append(buf, E100, strlen(E100));
 
     NE_DEBUG(NE_DBG_HTTP, "Running pre_send hooks\n");
+    NE_LOCK(req->session, hook_lock);
     for (hk = req->session->pre_send_hooks; hk!=NULL; hk = hk->next) {
 	ne_pre_send_fn fn = (ne_pre_send_fn)hk->fn;
 	fn(req, hk->userdata, buf);
     }
+    NE_UNLOCK(req->session, hook_lock);
     for (hk = req->pre_send_hooks; hk!=NULL; hk = hk->next) {
 	ne_pre_send_fn fn = (ne_pre_send_fn)hk->fn;
 	fn(req, hk->userdata, buf);
@@ -940,321 +1731,290 @@ static void dump_request(const char *request)
 #define DEBUG_DUMP_REQUEST(x)
 #endif /* DEBUGGING */
 
-/* remove trailing EOL from 'buf', where strlen(buf) == *len.  *len is
- * adjusted in accordance with any changes made to the string to
- * remain equal to strlen(buf). */
-static inline void strip_eol(char *buf, ssize_t *len)
+/* Returns the data buffered from the connection, which begins with
+ * the message head. */
+static inline const char *head_data(ne_request *req)
 {
-    char *pnt = buf + *len - 1;
-    while (pnt >= buf && (*pnt == '\r' || *pnt == '\n')) {
-	*pnt-- = '\0';
-	(*len)--;
-    }
+    size_t len;
+    return ne_sock_buffered(req->conn->socket, &len);
 }
 
-/* Read and parse response status-line into 'status'.  'retry' is non-zero
- * if an NE_RETRY should be returned if an EOF is received. */
-static int read_status_line(ne_request *req, ne_status *status, int retry)
+/* Forget the message head buffered for 'req'. */
+static void reset_head(ne_request *req)
 {
-    char *buffer = req->respbuf;
-    ssize_t ret;
+    req->nlines = req->scanned = req->headlen = 0;
+}
 
-    ret = ne_sock_readline(req->session->socket, buffer, sizeof req->respbuf);
-    if (ret <= 0) {
-	int aret = aborted(req, _("Could not read status line"), ret);
-	return RETRY_RET(retry, ret, aret);
-    }
+/* Discard the message head, having parsed it. */
+static void consume_head(ne_request *req)
+{
+    ne_sock_consume(req->conn->socket, req->headlen);
+    reset_head(req);
+}
+
+/* Parse the Status-Line at the start of the buffered message head
+ * into 'status'.  Returns NE_* code. */
+static int parse_status_line(ne_request *req, ne_status *status)
+{
+    const struct head_line *line = &req->lines[0];
+    const char *data = head_data(req) + line->start;
+    size_t len = line->end - line->start;
+
+    while (len && data[len - 1] == '\r')
+        len--;
+
+    if (len >= sizeof req->respbuf)
+	return aborted(req, _("Could not parse response status line."), 0);
+
+    memcpy(req->respbuf, data, len);
+    req->respbuf[len] = '\0';
     
-    NE_DEBUG(NE_DBG_HTTP, "[status-line] < %s", buffer);
-    strip_eol(buffer, &ret);
+    NE_DEBUG(NE_DBG_HTTP, "[status-line] < %s\n", req->respbuf);
     
     if (status->reason_phrase) ne_free(status->reason_phrase);
     memset(status, 0, sizeof *status);
 
-    if (ne_parse_statusline(buffer, status))
+    if (ne_parse_statusline(req->respbuf, status))
 	return aborted(req, _("Could not parse response status line."), 0);
 
     return 0;
 }
 
-/* Discard a set of message headers. */
-static int discard_headers(ne_request *req)
-{
-    do {
-	SOCK_ERR(req, ne_sock_readline(req->session->socket, req->respbuf, 
-				       sizeof req->respbuf),
-		 _("Could not read interim response headers"));
-	NE_DEBUG(NE_DBG_HTTP, "[discard] < %s", req->respbuf);
-    } while (strcmp(req->respbuf, EOL) != 0);
-    return NE_OK;
-}
-
-/* Send the request, and read the response Status-Line. Returns:
- *   NE_RETRY   connection closed by server; persistent connection
- *		timeout
- *   NE_OK	success
- *   NE_*	error
- * On NE_RETRY and NE_* responses, the connection will have been 
- * closed already.
- */
-static int send_request(ne_request *req, const ne_buffer *request)
+/* Write the Request-Line and headers given in 'request' to the open
+ * connection, which must be in blocking mode, followed by the request
+ * body unless 100-continue is in use.  Returns NE_OK on success,
+ * NE_RETRY after a persistent connection timeout if 'retry' is
+ * non-zero, or NE_*; the connection is closed on error. */
+static int write_request(ne_request *req, const ne_buffer *request, int retry)
 {
     ne_session *const sess = req->session;
-    ne_status *const status = &req->status;
-    int sentbody = 0; /* zero until body has been sent. */
-    int ret, retry; /* retry non-zero whilst the request should be retried */
+    struct ne_iovec vec[2];
+    int count = 1;
     ssize_t sret;
 
-    /* Send the Request-Line and headers */
-    NE_DEBUG(NE_DBG_HTTP, "Sending request-line and headers:\n");
-    /* Open the connection if necessary */
-    ret = open_connection(req);
-    if (ret) return ret;
+    vec[0].base = request->data;
+    vec[0].len = ne_buffer_size(request);
 
-    /* Allow retry if a persistent connection has been used. */
-    retry = sess->persisted;
-    
-    sret = ne_sock_fullwrite(req->session->socket, request->data, 
-                             ne_buffer_size(request));
+    /* A request body held in a buffer is written together with the
+     * request headers, if not using 100-continue. */
+    if (!req->use_expect100 && req->body_cb == body_string_send
+        && req->body.buf.length > 0) {
+        vec[1].base = req->body.buf.buffer;
+        vec[1].len = req->body.buf.length;
+        count = 2;
+    }
+
+    sret = ne_sock_fullwritev(req->conn->socket, vec, count);
     if (sret < 0) {
-	int aret = aborted(req, _("Could not send request"), ret);
+	int aret = aborted(req, _("Could not send request"), sret);
 	return RETRY_RET(retry, sret, aret);
     }
-    
-    if (!req->use_expect100 && req->body_length > 0) {
-	/* Send request body, if not using 100-continue. */
-	ret = send_request_body(req, retry);
-	if (ret) {
-            return ret;
-	}
-    }
-    
-    NE_DEBUG(NE_DBG_HTTP, "Request sent; retry is %d.\n", retry);
 
-    /* Loop eating interim 1xx responses (RFC2616 says these MAY be
-     * sent by the server, even if 100-continue is not used). */
-    while ((ret = read_status_line(req, status, retry)) == NE_OK 
-	   && status->klass == 1) {
-	NE_DEBUG(NE_DBG_HTTP, "Interim %d response.\n", status->code);
-	retry = 0; /* successful read() => never retry now. */
-	/* Discard headers with the interim response. */
-	if ((ret = discard_headers(req)) != NE_OK) break;
+    if (count == 2) {
+	NE_DEBUG(NE_DBG_HTTPBODY, 
+		 "Request body (%" NE_FMT_SIZE_T " bytes):\n[%.*s]\n",
+		 vec[1].len, (int)vec[1].len, req->body.buf.buffer);
 
-	if (req->use_expect100 && (status->code == 100)
-            && req->body_length > 0 && !sentbody) {
-	    /* Send the body after receiving the first 100 Continue */
-	    if ((ret = send_request_body(req, 0)) != NE_OK) break;	    
-	    sentbody = 1;
-	}
+        if (sess->progress_cb)
+            sess->progress_cb(sess->progress_ud, req->body_length,
+                              req->body_length);
+    } else if (!req->use_expect100 && req->body_length != 0) {
+	/* Send request body, if not using 100-continue. */
+	return send_request_body(req, retry);
     }
 
-    return ret;
+    return NE_OK;
 }
 
-/* Read a message header from sock into buf, which has size 'buflen'.
- *
- * Returns:
- *   NE_RETRY: Success, read a header into buf.
- *   NE_OK: End of headers reached.
- *   NE_ERROR: Error (session error is set, connection closed).
- */
-static int read_message_header(ne_request *req, char *buf, size_t buflen)
-{
-    ssize_t n;
-    ne_socket *sock = req->session->socket;
-
-    n = ne_sock_readline(sock, buf, buflen);
-    if (n <= 0)
-	return aborted(req, _("Error reading response headers"), n);
-    NE_DEBUG(NE_DBG_HTTP, "[hdr] %s", buf);
-
-    strip_eol(buf, &n);
+#define MAX_HEADER_LEN (8192)
 
-    if (n == 0) {
-	NE_DEBUG(NE_DBG_HTTP, "End of headers.\n");
-	return NE_OK;
+/* Add a response header field for the given request, with name
+ * 'name' of length 'nlen' (not necessarily in lower case), and value
+ * 'value' of length 'vlen'. */
+static void add_response_header(ne_request *req, const char *name, size_t nlen,
+                                const char *value, size_t vlen)
+{
+    struct field **slot, *f;
+    unsigned int hash = 0;
+    size_t n;
+
+    for (n = 0; n < nlen; n++)
+        hash = HH_ITERATE(hash, tolower(name[n]));
+
+    slot = find_response_header(req, hash, name, nlen);
+    f = *slot;
+
+    if (f) {
+        if (vlen + f->vlen < MAX_HEADER_LEN) {
+            /* merge the header field; the old value is left in the
+             * arena. */
+            char *merged = arena_alloc(req, f->vlen + vlen + 3);
+            memcpy(merged, f->value, f->vlen);
+            memcpy(merged + f->vlen, ", ", 2);
+            memcpy(merged + f->vlen + 2, value, vlen);
+            merged[f->vlen + 2 + vlen] = '\0';
+            f->value = merged;
+            f->vlen += vlen + 2;
+        }
+        return;
     }
 
-    buf += n;
-    buflen -= n;
-
-    while (buflen > 0) {
-	char ch;
-
-	/* Collect any extra lines into buffer */
-	SOCK_ERR(req, ne_sock_peek(sock, &ch, 1),
-		 _("Error reading response headers"));
-
-	if (ch != ' ' && ch != '\t') {
-	    /* No continuation of this header: stop reading. */
-	    return NE_RETRY;
-	}
-
-	/* Otherwise, read the next line onto the end of 'buf'. */
-	n = ne_sock_readline(sock, buf, buflen);
-	if (n <= 0) {
-	    return aborted(req, _("Error reading response headers"), n);
-	}
-
-	NE_DEBUG(NE_DBG_HTTP, "[cont] %s", buf);
-
-	strip_eol(buf, &n);
-	
-	/* assert(buf[0] == ch), which implies len(buf) > 0.
-	 * Otherwise the TCP stack is lying, but we'll be paranoid.
-	 * This might be a \t, so replace it with a space to be
-	 * friendly to applications (2616 says we MAY do this). */
-	if (n) buf[0] = ' ';
+    if (req->nheaders == HH_HASHSIZE - 1)
+        return; /* index full; can only happen after removals. */
 
-	/* ready for the next header. */
-	buf += n;
-	buflen -= n;
+    {
+        char *data = arena_alloc(req, sizeof *f + nlen + vlen + 2);
+
+        f = (struct field *)data;
+        f->name = data + sizeof *f;
+        f->value = f->name + nlen + 1;
+        for (n = 0; n < nlen; n++)
+            f->name[n] = tolower(name[n]);
+        f->name[nlen] = '\0';
+        memcpy(f->value, value, vlen);
+        f->value[vlen] = '\0';
     }
-
-    ne_set_error(req->session, _("Response header too long"));
-    return NE_ERROR;
+    f->vlen = vlen;
+    f->hash = hash;
+    f->next = NULL;
+
+    *slot = f;
+    req->nheaders++;
+    *req->last_header = f;
+    req->last_header = &f->next;
 }
 
-#define MAX_HEADER_LEN (8192)
-
-/* Add a respnose header field for the given request, using
- * precalculated hash value. */
-static void add_response_header(ne_request *req, unsigned int hash,
-                                char *name, char *value)
-{
-    struct field **nextf = &req->response_headers[hash];
-    size_t vlen = strlen(value);
-
-    while (*nextf) {
-        struct field *const f = *nextf;
-        if (strcmp(f->name, name) == 0) {
-            if (vlen + f->vlen < MAX_HEADER_LEN) {
-                /* merge the header field */
-                f->value = ne_realloc(f->value, f->vlen + vlen + 3);
-                memcpy(f->value + f->vlen, ", ", 2);
-                memcpy(f->value + f->vlen + 2, value, vlen + 1);
-                f->vlen += vlen + 2;
-            }
-            return;
-        }
-        nextf = &f->next;
-    }
-    
-    (*nextf) = ne_malloc(sizeof **nextf);
-    (*nextf)->name = ne_strdup(name);
-    (*nextf)->value = ne_strdup(value);
-    (*nextf)->vlen = vlen;
-    (*nextf)->next = NULL;
-}
+#define IS_LWS(ch) ((ch) == ' ' || (ch) == '\t')
 
-/* Read response headers.  Returns NE_* code, sets session error and
- * closes connection on error. */
-static int read_response_headers(ne_request *req) 
+/* Parse the header fields from the buffered message head, starting
+ * at line 'first', then discard the head.  Returns NE_* code, sets
+ * session error and closes connection on error. */
+static int parse_headers(ne_request *req, unsigned int first)
 {
-    char hdr[MAX_HEADER_LEN];
-    int ret, count = 0;
-    
-    while ((ret = read_message_header(req, hdr, sizeof hdr)) == NE_RETRY 
-	   && ++count < MAX_HEADER_FIELDS) {
-	char *pnt;
-	unsigned int hash = 0;
-	
-	/* Strip any trailing whitespace */
-	pnt = hdr + strlen(hdr) - 1;
-	while (pnt > hdr && (*pnt == ' ' || *pnt == '\t'))
-	    *pnt-- = '\0';
-
-	/* Convert the header name to lower case and hash it. */
-	for (pnt = hdr; (*pnt != '\0' && *pnt != ':' && 
-			 *pnt != ' ' && *pnt != '\t'); pnt++) {
-	    *pnt = tolower(*pnt);
-	    hash = HH_ITERATE(hash,*pnt);
-	}
+    const struct head_line *const lines = req->lines;
+    const char *data = head_data(req);
+    unsigned int n, next, count = 0;
+
+    /* The head must have ended with an empty line. */
+    if (req->nlines == 0 || !EMPTY_LINE(data, &lines[req->nlines - 1]))
+	return aborted(
+	    req, _("Response exceeded maximum number of header fields."), 0);
 
-	/* Skip over any whitespace before the colon. */
-	while (*pnt == ' ' || *pnt == '\t')
-	    *pnt++ = '\0';
+    for (n = first; n + 1 < req->nlines; n = next) {
+        const char *name = data + lines[n].start;
+        const char *colon = data + lines[n].colon;
+        const char *pnt, *value, *end;
+        char buf[MAX_HEADER_LEN];
+        size_t nlen;
+
+        /* Find any continuation lines. */
+        for (next = n + 1; next + 1 < req->nlines 
+                 && IS_LWS(data[lines[next].start]); next++)
+            /* nothing */;
+
+        if (++count == MAX_HEADER_FIELDS)
+            return aborted(
+                req, _("Response exceeded maximum number of header fields."),
+                0);
+
+        if (lines[next - 1].end - lines[n].start >= MAX_HEADER_LEN)
+            return aborted(req, _("Response header too long"), 0);
+
+        /* The name ends at the colon, or any whitespace before it. */
+        for (pnt = name; pnt < colon && !IS_LWS(*pnt); pnt++)
+            /* nothing */;
+        nlen = pnt - name;
+        while (pnt < colon && IS_LWS(*pnt))
+            pnt++;
 
 	/* ignore header lines which lack a ':'. */
-	if (*pnt != ':')
-	    continue;
-	
-	/* NUL-terminate at the colon (when no whitespace before) */
-	*pnt++ = '\0';
+        if (pnt != colon || lines[n].colon == lines[n].end)
+            continue;
+
+        /* Skip any whitespace after the colon... */
+        for (value = colon + 1; IS_LWS(*value); value++)
+            /* nothing */;
+        end = data + lines[n].end;
+
+        if (next > n + 1) {
+            /* Join the continuation lines, replacing the leading
+             * whitespace with a single space (2616 says we MAY do
+             * this). */
+            unsigned int m;
+            char *ptr = buf;
+
+            while (end > value && (end[-1] == '\r' || end[-1] == '\n'))
+                end--;
+            memcpy(ptr, value, end - value);
+            ptr += end - value;
+
+            for (m = n + 1; m < next; m++) {
+                const char *cont = data + lines[m].start;
+
+                end = data + lines[m].end;
+                while (end > cont && (end[-1] == '\r' || end[-1] == '\n'))
+                    end--;
+                *ptr++ = ' ';
+                memcpy(ptr, cont + 1, end - cont - 1);
+                ptr += end - cont - 1;
+            }
 
-	/* Skip any whitespace after the colon... */
-	while (*pnt == ' ' || *pnt == '\t')
-	    pnt++;
+            value = buf;
+            end = ptr;
+        }
 
-	/* pnt now points to the header value. */
-	NE_DEBUG(NE_DBG_HTTP, "Header Name: [%s], Value: [%s]\n", hdr, pnt);
-        add_response_header(req, hash, hdr, pnt);
-    }
+	/* Strip the EOL and any trailing whitespace */
+        while (end > value && (end[-1] == '\r' || end[-1] == '\n' 
+                               || IS_LWS(end[-1])))
+            end--;
 
-    if (count == MAX_HEADER_FIELDS)
-	ret = aborted(
-	    req, _("Response exceeded maximum number of header fields."), 0);
+	NE_DEBUG(NE_DBG_HTTP, "Header Name: [%.*s], Value: [%.*s]\n",
+                 (int)nlen, name, (int)(end - value), value);
+        add_response_header(req, name, nlen, value, end - value);
+    }
 
-    return ret;
+    NE_DEBUG(NE_DBG_HTTP, "End of headers.\n");
+    consume_head(req);
+    return NE_OK;
 }
 
-/* Perform any necessary DNS lookup for the host given by *info;
- * return NE_ code. */
-static int lookup_host(ne_session *sess, struct host_info *info)
+/* Store 'address', the result of looking up the hostname of the
+ * host given by *info; returns NE_ code. */
+static int set_address(ne_session *sess, struct host_info *info,
+                       ne_sock_addr *address)
 {
-    if (sess->addrlist) return NE_OK;
-
-    NE_DEBUG(NE_DBG_HTTP, "Doing DNS lookup on %s...\n", info->hostname);
-    if (sess->notify_cb)
-	sess->notify_cb(sess->notify_ud, ne_conn_namelookup, info->hostname);
-    info->address = ne_addr_resolve(info->hostname, 0);
-    if (ne_addr_result(info->address)) {
+    if (ne_addr_result(address)) {
 	char buf[256];
 	ne_set_error(sess, _("Could not resolve hostname `%s': %s"), 
 		     info->hostname,
-		     ne_addr_error(info->address, buf, sizeof buf));
-	ne_addr_destroy(info->address);
-	info->address = NULL;
+		     ne_addr_error(address, buf, sizeof buf));
+	ne_addr_destroy(address);
 	return NE_LOOKUP;
     } else {
+        info->address = address;
 	return NE_OK;
     }
 }
 
-int ne_begin_request(ne_request *req)
+/* Process the response headers following a Status-Line which has
+ * been read into req->status, and prepare to read the response body.
+ * Returns NE_* code; on error, the connection has been closed. */
+static int read_response_head(ne_request *req)
 {
     struct body_reader *rdr;
-    struct host_info *host;
-    ne_buffer *data;
     const ne_status *const st = &req->status;
     const char *value;
-    int ret;
-
-    /* Resolve hostname if necessary. */
-    host = req->session->use_proxy?&req->session->proxy:&req->session->server;
-    if (host->address == NULL) {
-        ret = lookup_host(req->session, host);
-        if (ret) return ret;
-    }    
-    
-    /* Build the request string, and send it */
-    data = build_request(req);
-    DEBUG_DUMP_REQUEST(data->data);
-    ret = send_request(req, data);
-    /* Retry this once after a persistent connection timeout. */
-    if (ret == NE_RETRY && !req->session->no_persist) {
-	NE_DEBUG(NE_DBG_HTTP, "Persistent connection timed out, retrying.\n");
-	ret = send_request(req, data);
-    }
-    ne_buffer_destroy(data);
-    if (ret != NE_OK) return ret == NE_RETRY ? NE_ERROR : ret;
+    int ret, http11;
 
     /* Determine whether server claims HTTP/1.1 compliance. */
-    req->session->is_http11 = (st->major_version == 1 && 
-                               st->minor_version > 0) || st->major_version > 1;
+    http11 = (st->major_version == 1 && st->minor_version > 0) 
+        || st->major_version > 1;
+    NE_LOCK(req->session, pool_lock);
+    req->session->is_http11 = http11;
+    NE_UNLOCK(req->session, pool_lock);
 
     /* Persistent connections supported implicitly in HTTP/1.1 */
-    if (req->session->is_http11) req->can_persist = 1;
+    if (http11) req->can_persist = 1;
 
     ne_set_error(req->session, "%d %s", st->code, st->reason_phrase);
     
@@ -1263,7 +2023,7 @@ int ne_begin_request(ne_request *req)
     free_response_headers(req);
 
     /* Read the headers */
-    ret = read_response_headers(req);
+    ret = parse_headers(req, 1);
     if (ret) return ret;
 
     /* check the Connection header */
@@ -1279,8 +2039,7 @@ int ne_begin_request(ne_request *req)
                 req->can_persist = 0;
             } else if (strcmp(token, "keep-alive") == 0) {
                 req->can_persist = 1;
-            } else if (!req->session->is_http11
-                       && strcmp(token, "connection")) {
+            } else if (!http11 && strcmp(token, "connection")) {
                 /* Strip the header per 2616§14.10, last para.  Avoid
                  * danger from "Connection: connection". */
                 remove_response_header(req, token, hash);
@@ -1290,13 +2049,34 @@ int ne_begin_request(ne_request *req)
         ne_free(vcopy);
     }
 
+    /* Note how long the server will keep the connection open. */
+    req->conn->keepalive = 0;
+    value = get_response_header_hv(req, HH_HV_KEEP_ALIVE, "keep-alive");
+    if (value && req->can_persist) {
+        char *vcopy = ne_strdup(value), *ptr = vcopy;
+
+        do {
+            char *param = ne_shave(ne_token(&ptr, ','), " \t");
+
+            if (strncasecmp(param, "timeout=", 8) == 0) {
+                int secs = atoi(param + 8);
+
+                req->conn->keepalive = secs > 0 ? secs : 0;
+                NE_DEBUG(NE_DBG_HTTP, "Server keeps connection for %d "
+                         "seconds.\n", req->conn->keepalive);
+            }
+        } while (ptr);
+
+        ne_free(vcopy);
+    }
+
     /* Decide which method determines the response message-length per
      * 2616§4.4 (multipart/byteranges is not supported): */
 
 #ifdef NE_HAVE_SSL
     /* Special case for CONNECT handling: the response has no body,
      * and the connection can persist. */
-    if (req->session->in_connect && st->klass == 2) {
+    if (req->is_connect && st->klass == 2) {
 	req->resp.mode = R_NO_BODY;
 	req->can_persist = 1;
     } else
@@ -1312,6 +2092,8 @@ int ne_begin_request(ne_request *req)
          * statement in the manual. */
         req->resp.mode = R_CHUNKED;
         req->resp.body.chunk.remain = 0;
+        req->resp.body.chunk.crlf = 0;
+        req->resp.body.chunk.last = 0;
     } else if ((value = get_response_header_hv(req, HH_HV_CONTENT_LENGTH,
                                                "content-length")) != NULL) {
         ne_off_t len = ne_strtoff(value, NULL, 10);
@@ -1331,100 +2113,903 @@ int ne_begin_request(ne_request *req)
      * response or not. */
     for (rdr = req->body_readers; rdr != NULL; rdr=rdr->next) {
 	rdr->use = rdr->accept_response(rdr->userdata, req, st);
+        rdr->heldlen = 0;
     }
-    
+
+    req->state = RS_BODY;
     return NE_OK;
 }
 
-int ne_end_request(ne_request *req)
+/* Maximum size of a message head or chunked trailer, which is
+ * buffered in its entirety before being parsed. */
+#define MAX_HEAD_SIZE (MAX_HEADER_FIELDS * MAX_HEADER_LEN)
+
+/* Record the line of the message head which ends at offset 'lf',
+ * with its first colon at offset 'colon' (or none if beyond 'lf').
+ * Returns non-zero if the head is now complete: the line is empty,
+ * or no more lines can be recorded. */
+static int add_line(ne_request *req, const char *data, size_t colon, size_t lf)
 {
-    struct hook *hk;
-    int ret;
+    struct head_line *line = &req->lines[req->nlines++];
 
-    /* Read headers in chunked trailers */
-    if (req->resp.mode == R_CHUNKED) {
-	ret = read_response_headers(req);
-        if (ret) return ret;
-    } else {
-        ret = NE_OK;
-    }
-    
-    NE_DEBUG(NE_DBG_HTTP, "Running post_send hooks\n");
-    for (hk = req->session->post_send_hooks; 
-	 ret == NE_OK && hk != NULL; hk = hk->next) {
-	ne_post_send_fn fn = (ne_post_send_fn)hk->fn;
-	ret = fn(req, hk->userdata, &req->status);
+    line->start = req->scanned;
+    line->colon = colon < lf ? colon : lf;
+    line->end = lf;
+    req->scanned = lf + 1;
+
+    if (EMPTY_LINE(data, line) || req->nlines == MAX_HEAD_LINES) {
+        req->headlen = req->scanned;
+        return 1;
     }
-    
-    /* Close the connection if persistent connections are disabled or
-     * not supported by the server. */
-    if (req->session->no_persist || !req->can_persist)
-	ne_close_connection(req->session);
-    else
-	req->session->persisted = 1;
-    
-    return ret;
+
+    return 0;
 }
 
-int ne_read_response_to_fd(ne_request *req, int fd)
+/* Locate the line feeds and colons in the 'len' bytes at 'data',
+ * beginning at the first line not yet scanned, recording each
+ * complete line in req->lines.  Returns non-zero once the head is
+ * complete. */
+static int scan_head(ne_request *req, const char *data, size_t len)
 {
-    ssize_t len;
+    size_t pos = req->scanned, colon = (size_t)-1;
 
-    while ((len = ne_read_response_block(req, req->respbuf, 
-                                         sizeof req->respbuf)) > 0) {
-        const char *block = req->respbuf;
+    if (req->headlen)
+        return 1;
 
-        do {
-            ssize_t ret = write(fd, block, len);
-            if (ret == -1 && errno == EINTR) {
-                continue;
-            } else if (ret < 0) {
-                char err[200];
-                ne_strerror(errno, err, sizeof err);
-                ne_set_error(ne_get_session(req), 
-                             _("Could not write to file: %s"), err);
-                return NE_ERROR;
-            } else {
-                len -= ret;
-                block += ret;
+#ifdef SCAN_VECTOR
+    {
+        const scan_vec lfs = SCAN_SPLAT('\n'), colons = SCAN_SPLAT(':');
+
+        /* Find the LFs and colons in each block of bytes at once. */
+        for (; pos + SCAN_WIDTH <= len; pos += SCAN_WIDTH) {
+            scan_vec block = SCAN_LOAD(data + pos);
+            unsigned int lfmask = SCAN_MATCH(block, lfs);
+            unsigned int mask = lfmask | SCAN_MATCH(block, colons);
+
+            while (mask) {
+                unsigned int bit = __builtin_ctz(mask);
+                size_t offset = pos + bit;
+
+                if (lfmask & (1U << bit)) {
+                    if (add_line(req, data, colon, offset))
+                        return 1;
+                    colon = (size_t)-1;
+                } else if (colon == (size_t)-1) {
+                    colon = offset;
+                }
+                mask &= mask - 1;
             }
-        } while (len > 0);
+        }
     }
-    
-    return len == 0 ? NE_OK : NE_ERROR;
-}
+#endif
 
-int ne_discard_response(ne_request *req)
-{
-    ssize_t len;
+    /* Otherwise, and for any remaining bytes, search for each line
+     * feed, and then the colon before it. */
+    while (pos < len) {
+        const char *lf = memchr(data + pos, '\n', len - pos), *cp;
 
-    do {
-        len = ne_read_response_block(req, req->respbuf, sizeof req->respbuf);
-    } while (len > 0);
-    
-    return len == 0 ? NE_OK : NE_ERROR;
-}
+        if (lf == NULL)
+            break;
 
-int ne_request_dispatch(ne_request *req) 
-{
-    int ret;
-    
-    do {
-	ret = ne_begin_request(req);
-        if (ret == NE_OK) ret = ne_discard_response(req);
-        if (ret == NE_OK) ret = ne_end_request(req);
-    } while (ret == NE_RETRY);
+        if (colon == (size_t)-1 
+            && (cp = memchr(data + pos, ':', lf - data - pos)) != NULL)
+            colon = cp - data;
 
-    NE_DEBUG(NE_DBG_HTTP | NE_DBG_FLUSH, 
-             "Request ends, status %d class %dxx, error line:\n%s\n", 
-             req->status.code, req->status.klass, req->session->error);
+        if (add_line(req, data, colon, lf - data))
+            return 1;
 
-    return ret;
+        colon = (size_t)-1;
+        pos = req->scanned;
+    }
+
+    return 0;
 }
 
-const ne_status *ne_get_status(const ne_request *req)
+/* Buffer a complete message head (or chunked trailer) from the
+ * connection, so that it can then be parsed without blocking.
+ * Returns NE_OK once buffered, NE_AGAIN if no more data is available
+ * yet, or NE_RETRY/NE_* on error, having closed the connection. */
+static int fill_head(ne_request *req, const char *doing)
 {
-    return &req->status;
+    ne_socket *const sock = req->conn->socket;
+    const char *data;
+    size_t len;
+
+    for (;;) {
+        ssize_t ret;
+
+        data = ne_sock_buffered(sock, &len);
+        if (len && req->timings.first_byte < 0)
+            MARK_TIME(req, first_byte);
+        if (scan_head(req, data, len))
+            break;
+
+        ret = ne_sock_fill(sock, MAX_HEAD_SIZE);
+        if (ret == NE_SOCK_RETRY) {
+            req->events = NE_SOCK_WANT_READ;
+            return NE_AGAIN;
+        } else if (ret < 0) {
+            int aret = aborted(req, doing, ret);
+            return RETRY_RET(req->retry, ret, aret);
+        }
+    }
+    
+    return NE_OK;
+}
+
+/* Take the session settings which apply to the exchange about to
+ * start for 'req'; they may be changed by other threads meanwhile. */
+static void take_settings(ne_request *req)
+{
+    ne_session *const sess = req->session;
+
+    NE_LOCK(sess, pool_lock);
+    req->upload.rl = sess->upload;
+    req->download.rl = sess->download;
+    req->expect_timeout = sess->expect100_timeout;
+    NE_UNLOCK(sess, pool_lock);
+}
+
+/* Prepare to send the request over the connection which has been
+ * established for it. */
+static void begin_send(ne_request *req)
+{
+    ne_sock_nonblock(req->conn->socket, 1);
+    take_settings(req);
+
+    /* Allow retry if a persistent connection has been used. */
+    req->retry = req->conn->persisted;
+    req->sent = 0;
+    req->sentbody = 0;
+    req->expect_wait = 0;
+    reset_head(req);
+    /* A request body held in a buffer is written together with the
+     * request headers, if not using 100-continue. */
+    req->coalesce = !req->use_expect100 && req->body_cb == body_string_send
+        && req->body.buf.length > 0 && req->upload.rl == NULL;
+    req->state = RS_SEND;
+
+    NE_DEBUG(NE_DBG_HTTP, "Sending request-line and headers:\n");
+}
+
+/* Start the request: build the request, and take a connection. */
+static int start_request(ne_request *req)
+{
+    int ret;
+
+    /* The request is built once, and re-sent as-is after a
+     * persistent connection timeout. */
+    if (req->reqbuf == NULL) {
+        req->reqbuf = build_request(req);
+        DEBUG_DUMP_REQUEST(req->reqbuf->data);
+    }
+
+    start_timings(req);
+
+    ret = start_connect(req);
+    if (ret == NE_OK) begin_send(req);
+    return ret;
+}
+
+/* Rewind the request body and begin sending it.  Returns NE_* code. */
+static int start_body(ne_request *req)
+{
+    int ret;
+
+    if (req->body_cb == body_fd_send) {
+        NE_DEBUG(NE_DBG_HTTP, "Sending request body from file:\n");
+    } else {
+        NE_DEBUG(NE_DBG_HTTP, "Sending request body:\n");
+    }
+
+    /* tell the source to start again from the beginning. */
+    ret = rewind_body(req);
+    if (ret) return ret;
+
+    req->state = RS_SENDBODY;
+    return NE_OK;
+}
+
+/* The request has been sent; move on to reading the response. */
+static void end_send(ne_request *req)
+{
+    NE_DEBUG(NE_DBG_HTTP, "Request sent; retry is %d.\n", req->retry);
+    MARK_TIME(req, sent);
+    req->state = RS_STATUS;
+}
+
+/* Write as much of the Request-Line and headers as possible, along
+ * with a buffer request body if coalesced.  Returns NE_OK, NE_AGAIN,
+ * or NE_RETRY/NE_* on error as for send_request_body. */
+static int send_head(ne_request *req)
+{
+    ne_session *const sess = req->session;
+    const size_t hlen = ne_buffer_size(req->reqbuf);
+    const size_t total = hlen + (req->coalesce ? req->body.buf.length : 0);
+
+    while (req->sent < total) {
+        struct ne_iovec vec[2];
+        int count = 0;
+        ssize_t ret;
+
+        if (req->sent < hlen) {
+            vec[count].base = req->reqbuf->data + req->sent;
+            vec[count++].len = hlen - req->sent;
+        }
+        if (req->coalesce) {
+            size_t off = req->sent > hlen ? req->sent - hlen : 0;
+            vec[count].base = req->body.buf.buffer + off;
+            vec[count++].len = req->body.buf.length - off;
+        }
+
+        ret = ne_sock_writev(req->conn->socket, vec, count);
+        if (ret == NE_SOCK_RETRY) {
+            req->events = NE_SOCK_WANT_WRITE;
+            return NE_AGAIN;
+        } else if (ret < 0) {
+            int aret = aborted(req, _("Could not send request"), ret);
+            return RETRY_RET(req->retry, ret, aret);
+        }
+
+        req->sent += ret;
+    }
+
+    if (req->coalesce) {
+	NE_DEBUG(NE_DBG_HTTPBODY, 
+		 "Request body (%" NE_FMT_SIZE_T " bytes):\n[%.*s]\n",
+		 req->body.buf.length, (int)req->body.buf.length, 
+                 req->body.buf.buffer);
+
+        if (sess->progress_cb)
+            sess->progress_cb(sess->progress_ud, req->body_length,
+                              req->body_length);
+        req->sentbody = 1;
+    } 
+
+    if (!req->sentbody && req->body_length != 0) {
+        /* Send request body, if not using 100-continue. */
+        if (!req->use_expect100)
+            return start_body(req);
+
+        /* Otherwise, unless the server is known to send 100-continue,
+         * only wait for it for a limited time. */
+        if (req->expect_timeout > 0
+            && get_expect100(sess) != NE_E100_HONOURED) {
+            req->expect_sent = ne__time_now();
+            req->expect_wait = 1;
+        }
+    }
+
+    end_send(req);
+    return NE_OK;
+}
+
+/* Write as much of the request body as possible, either from the
+ * file descriptor given by ne_set_request_body_fd, or a block at a
+ * time from the body provider.  Returns NE_OK, NE_AGAIN, or
+ * NE_RETRY/NE_* as for send_request_body. */
+static int send_body(ne_request *req)
+{
+    ne_session *const sess = req->session;
+    ne_socket *const sock = req->conn->socket;
+    ne_ratelimit *const rl = req->upload.rl;
+    ssize_t ret;
+
+    for (;;) {
+        if (req->body_cb == body_fd_send) {
+            size_t count = SENDFILE_CHUNK;
+
+            if (req->body.file.remain == 0)
+                break;
+            if ((ne_off_t)count > req->body.file.remain)
+                count = req->body.file.remain;
+            if (rl && throttle(req, rl, &req->upload, &count) == NE_AGAIN)
+                return NE_AGAIN;
+
+            ret = ne_sock_sendfile(sock, req->body.file.fd, count);
+            if (ret == 0) {
+                ne_set_error(sess, _("Premature end of request body file"));
+                close_connection(req);
+                return NE_ERROR;
+            }
+        } else {
+            struct ne_iovec vec;
+
+            if (req->blkpos == req->blklen) {
+                /* Fetch the next block of the body. */
+                ssize_t bytes = fetch_body_block(req);
+                if (bytes == 0) {
+                    break;
+                } else if (bytes < 0) {
+                    return NE_ERROR;
+                }
+            }
+
+            vec.base = req->blk + req->blkpos;
+            vec.len = req->blklen - req->blkpos;
+            if (rl && throttle(req, rl, &req->upload, &vec.len) == NE_AGAIN)
+                return NE_AGAIN;
+            ret = ne_sock_writev(sock, &vec, 1);
+        }
+
+        if (ret == NE_SOCK_RETRY) {
+            req->events = NE_SOCK_WANT_WRITE;
+            return NE_AGAIN;
+        } else if (ret < 0) {
+            int aret = aborted(req, _("Could not send request body"), ret);
+            return RETRY_RET(req->retry, ret, aret);
+        }
+
+        if (req->body_cb == body_fd_send)
+            req->body.file.remain -= ret;
+        else
+            req->blkpos += ret;
+        if (rl) req->upload.credit -= ret;
+
+        /* invoke progress callback */
+        if (sess->progress_cb) {
+            req->body_progress += ret;
+            sess->progress_cb(sess->progress_ud, req->body_progress,
+                              req->body_length);
+        }
+    }
+
+    return_rate(&req->upload);
+    req->sentbody = 1;
+    end_send(req);
+    return NE_OK;
+}
+
+/* Read the response Status-Line and headers, eating any interim
+ * responses, and moving on to send the request body after a
+ * 100-continue if necessary.  Returns NE_OK, NE_AGAIN, or
+ * NE_RETRY/NE_* as for read_status. */
+static int read_head(ne_request *req)
+{
+    ne_status *const status = &req->status;
+    int ret;
+
+    for (;;) {
+        ret = fill_head(req, _("Could not read status line"));
+        if (ret == NE_AGAIN && expect_remaining(req) == 0) {
+            NE_DEBUG(NE_DBG_HTTP, "No 100-continue after %dms; sending "
+                     "body.\n", req->expect_timeout);
+            set_expect100(req->session, NE_E100_IGNORED);
+            req->expect_wait = 0;
+            return start_body(req);
+        }
+        if (ret) return ret;
+
+        ret = parse_status_line(req, status);
+        if (ret) return ret;
+
+        req->retry = 0; /* successful read() => never retry now. */
+
+        if (req->use_expect100
+            && (!req->sentbody || status->code == 100)) {
+            /* The server has answered the Expect header, if only
+             * after the body was sent anyway. */
+            set_expect100(req->session, NE_E100_HONOURED);
+            req->expect_wait = 0;
+        }
+
+        if (status->klass != 1)
+            break;
+
+        /* Eat interim 1xx responses (RFC2616 says these MAY be sent
+         * by the server, even if 100-continue is not used). */
+	NE_DEBUG(NE_DBG_HTTP, "Interim %d response.\n", status->code);
+	/* Discard headers with the interim response. */
+        consume_head(req);
+
+	if (req->use_expect100 && (status->code == 100)
+            && req->body_length != 0 && !req->sentbody) {
+	    /* Send the body after receiving the first 100 Continue */
+            return start_body(req);
+	}
+    }
+
+    ret = read_response_head(req);
+    if (ret == NE_OK) MARK_TIME(req, headers);
+    return ret;
+}
+
+/* Read as much of the response body as possible. */
+static int read_body(ne_request *req)
+{
+    int ret;
+
+    do {
+        if (req->resp.mode == R_CHUNKED) {
+            /* Many small chunks are coalesced into one block. */
+            size_t len = sizeof req->respbuf;
+            ret = read_body_block(req, req->respbuf, &len);
+        } else {
+            ret = borrow_body_block(req);
+        }
+    } while (ret == NE_OK && req->state == RS_BODY);
+
+    return ret;
+}
+
+/* Finish the response to 'req' without giving up the connection:
+ * reads any chunked trailers and runs the post_send hooks.  Returns
+ * NE_* code. */
+static int finish_response(ne_request *req)
+{
+    struct hook *hk;
+    int ret;
+
+    /* Read headers in chunked trailers */
+    if (req->resp.mode == R_CHUNKED) {
+        ret = fill_head(req, _("Error reading response headers"));
+        if (ret == NE_OK) ret = parse_headers(req, 0);
+        if (ret) return ret;
+    } else {
+        ret = NE_OK;
+    }
+    
+    NE_DEBUG(NE_DBG_HTTP, "Running post_send hooks\n");
+    NE_LOCK(req->session, hook_lock);
+    for (hk = req->session->post_send_hooks; 
+	 ret == NE_OK && hk != NULL; hk = hk->next) {
+	ne_post_send_fn fn = (ne_post_send_fn)hk->fn;
+	ret = fn(req, hk->userdata, &req->status);
+    }
+    NE_UNLOCK(req->session, hook_lock);
+    
+    /* Close the connection if persistent connections are disabled or
+     * not supported by the server. */
+    if (req->session->no_persist || !req->can_persist)
+	close_connection(req);
+
+#ifdef NE_DEBUGGING
+    if (ne_debug_mask & NE_DBG_TIMING)
+        debug_timings(req);
+#endif
+    
+    return ret;
+}
+
+/* Read any chunked trailers and finish the response, returning the
+ * connection to the pool.  Returns NE_OK, NE_AGAIN, NE_RETRY if the
+ * request must be sent again, or NE_* on error. */
+static int end_response(ne_request *req)
+{
+    int ret;
+
+    if (req->resp.mode == R_CHUNKED) {
+        ret = fill_head(req, _("Error reading response headers"));
+        if (ret == NE_AGAIN) {
+            return ret;
+        } else if (ret) {
+            reset_request(req);
+            return ret;
+        }
+    }
+
+    ret = finish_response(req);
+
+    /* Return the connection to the pool for use by later requests;
+     * the connection used by a CONNECT request is handed back to the
+     * request which is tunnelling over it. */
+    if (req->conn && !req->is_connect) {
+        ne__conn_release(req->session, req->conn);
+        req->conn = NULL;
+    }
+
+    reset_request(req);
+    return ret;
+}
+
+/* Advance the request as far as possible without blocking; if
+ * 'head_only' is non-zero, stop once the response headers have been
+ * read.  Returns NE_OK once done, NE_AGAIN if the request is waiting
+ * for the events given by req->events, NE_RETRY if the request must
+ * be sent again, or an NE_* error code. */
+static int run_request(ne_request *req, int head_only)
+{
+    int ret;
+
+    do {
+        switch (req->state) {
+        case RS_START:
+            ret = start_request(req);
+            break;
+        case RS_RESOLVE:
+            ret = finish_lookup(req);
+            if (ret == NE_OK) begin_send(req);
+            break;
+        case RS_CONNECT:
+            ret = finish_connect(req);
+            if (ret == NE_OK) begin_send(req);
+            break;
+        case RS_SEND:
+            ret = send_head(req);
+            break;
+        case RS_SENDBODY:
+            ret = send_body(req);
+            break;
+        case RS_STATUS:
+            ret = read_head(req);
+            break;
+        case RS_BODY:
+            ret = read_body(req);
+            break;
+        case RS_TRAILER:
+        default:
+            return end_response(req);
+        }
+
+        /* Retry this once after a persistent connection timeout. */
+        if (ret == NE_RETRY && !req->session->no_persist && !req->retried) {
+            NE_DEBUG(NE_DBG_HTTP, "Persistent connection timed out, "
+                     "retrying.\n");
+            req->retried = 1;
+            req->state = RS_START;
+            ret = NE_OK;
+        }
+    } while (ret == NE_OK && !(head_only && req->state == RS_BODY));
+
+    if (ret != NE_OK && ret != NE_AGAIN) {
+        reset_request(req);
+        if (ret == NE_RETRY) ret = NE_ERROR;
+    }
+
+    return ret;
+}
+
+int ne_begin_request(ne_request *req)
+{
+    int ret;
+
+    req->blocking = 1;
+
+    while ((ret = run_request(req, 1)) == NE_AGAIN) {
+        if ((ret = await_request(req)) != NE_OK)
+            break;
+    }
+
+    return ret;
+}
+
+int ne_end_request(ne_request *req)
+{
+    int ret;
+
+    /* As ever, any response body which was not read is ignored. */
+    if (req->state == RS_BODY)
+        req->state = RS_TRAILER;
+    else if (req->state != RS_TRAILER)
+        return NE_ERROR;
+
+    while ((ret = run_request(req, 0)) == NE_AGAIN) {
+        if ((ret = await_request(req)) != NE_OK)
+            break;
+    }
+    
+    return ret;
+}
+
+int ne_read_response_to_fd(ne_request *req, int fd)
+{
+    ssize_t len;
+
+    while ((len = ne_read_response_block(req, req->respbuf, 
+                                         sizeof req->respbuf)) > 0) {
+        const char *block = req->respbuf;
+
+        do {
+            ssize_t ret = write(fd, block, len);
+            if (ret == -1 && errno == EINTR) {
+                continue;
+            } else if (ret < 0) {
+                char err[200];
+                ne_strerror(errno, err, sizeof err);
+                ne_set_error(ne_get_session(req), 
+                             _("Could not write to file: %s"), err);
+                return NE_ERROR;
+            } else {
+                len -= ret;
+                block += ret;
+            }
+        } while (len > 0);
+    }
+    
+    return len == 0 ? NE_OK : NE_ERROR;
+}
+
+int ne_discard_response(ne_request *req)
+{
+    ssize_t len;
+
+    do {
+        len = ne_read_response_block(req, req->respbuf, sizeof req->respbuf);
+    } while (len > 0);
+    
+    return len == 0 ? NE_OK : NE_ERROR;
+}
+
+/* Advance the request as for ne_request_step. */
+static int step_request(ne_request *req)
+{
+    int ret;
+
+    do {
+        ret = run_request(req, 0);
+    } while (ret == NE_RETRY);
+
+    if (ret != NE_AGAIN) {
+        NE_DEBUG(NE_DBG_HTTP | NE_DBG_FLUSH, 
+                 "Request ends, status %d class %dxx, error line:\n%s\n", 
+                 req->status.code, req->status.klass, req->session->error);
+    }
+
+    return ret;
+}
+
+int ne_request_step(ne_request *req)
+{
+    req->blocking = 0;
+    return step_request(req);
+}
+
+int ne_request_fd(const ne_request *req)
+{
+    if (req->query)
+        return ne_addr_query_fd(req->query);
+    else if (req->conn && req->conn->socket)
+        return ne_sock_fd(req->conn->socket);
+    else
+        return -1;
+}
+
+int ne_request_events(const ne_request *req)
+{
+    return req->events;
+}
+
+int ne_request_timeout(const ne_request *req)
+{
+    if (req->throttled)
+        return throttle_remaining(req);
+    else
+        return expect_remaining(req);
+}
+
+int ne_request_dispatch(ne_request *req) 
+{
+    int ret;
+
+    req->blocking = 1;
+    while ((ret = step_request(req)) == NE_AGAIN) {
+        if ((ret = await_request(req)) != NE_OK)
+            break;
+    }
+
+    return ret;
+}
+
+/* Returns non-zero if 'req' may be sent in a pipeline behind other
+ * requests: only idempotent methods are pipelined, and never with
+ * 100-continue since the body must wait for the interim response.
+ * 'limited' is non-zero if request bodies are rate limited. */
+static int can_pipeline(const ne_request *req, int limited)
+{
+    static const char *const methods[] = {
+        "GET", "HEAD", "PROPFIND", "OPTIONS", NULL
+    };
+    int n;
+
+    if (req->use_expect100)
+        return 0;
+
+    /* The body is sent with the headers, so not rate limited. */
+    if (limited && req->body_length != 0)
+        return 0;
+
+    for (n = 0; methods[n] != NULL; n++)
+        if (strcmp(req->method, methods[n]) == 0)
+            return 1;
+
+    return 0;
+}
+
+/* Returns the number of requests from reqs[0..count-1] which can be
+ * sent together in a single pipeline. */
+static size_t pipeline_depth(ne_session *sess, ne_request **reqs,
+                             size_t count)
+{
+    size_t n;
+    int limit, limited;
+
+    /* Only pipeline to servers known to be HTTP/1.1 compliant, and
+     * never when the connection would be closed after each
+     * response. */
+    NE_LOCK(sess, pool_lock);
+    limit = sess->pipelining;
+    limited = sess->upload != NULL;
+    NE_UNLOCK(sess, pool_lock);
+
+    if (limit < 2 || ne_version_pre_http11(sess) || sess->no_persist)
+        return 0;
+
+    if (count > (size_t)limit)
+        count = limit;
+
+    for (n = 0; n < count && can_pipeline(reqs[n], limited); n++)
+        /* nullop */;
+
+    return n;
+}
+
+/* Bytes of requests which may be written down a pipelined connection
+ * ahead of the response being read.  Kept well within the socket
+ * buffers, so that writing never blocks on a server which has itself
+ * stopped reading until its responses are read. */
+#define PIPELINE_WINDOW (16384)
+
+/* Returns the bytes written for request 'req' whose head is 'data'.
+ * A body of unknown length counts as the whole window. */
+static size_t pipelined_bytes(const ne_request *req, const ne_buffer *data)
+{
+    if (req->body_length < 0 || req->body_length > PIPELINE_WINDOW)
+        return PIPELINE_WINDOW;
+    return ne_buffer_size(data) + (size_t)req->body_length;
+}
+
+/* Send the 'depth' requests reqs[0..depth-1] down the connection,
+ * writing ahead of the responses as far as PIPELINE_WINDOW allows,
+ * and read the responses in order.  On return, *done is set to the
+ * number of requests for which the response was read successfully.
+ * Returns NE_RETRY if the remaining requests should be retried
+ * serially (the connection has been closed), or another NE_* code. */
+static int dispatch_pipeline(ne_session *sess, ne_request **reqs,
+                             size_t depth, size_t *done)
+{
+    struct ne_conn *conn;
+    ne_buffer *data = NULL;
+    size_t *sizes, outstanding = 0, sent = 0, n;
+    int ret, retry;
+
+    *done = 0;
+
+    for (n = 0; n < depth; n++)
+        start_timings(reqs[n]);
+
+    ret = open_connection(reqs[0]);
+    if (ret) return ret;
+
+    /* The connection is passed along the pipeline: each request holds
+     * it only while writing or reading its own message, and on error
+     * it has been closed. */
+    conn = reqs[0]->conn;
+    reqs[0]->conn = NULL;
+
+    /* An EOF or RST from a persistent connection is a timeout for the
+     * first request; for any later request in the pipeline, it means
+     * the server decided to close the connection part-way through. */
+    retry = conn->persisted;
+
+    NE_DEBUG(NE_DBG_HTTP, "Pipelining %" NE_FMT_SIZE_T " requests.\n", depth);
+
+    sizes = ne_malloc(depth * sizeof *sizes);
+
+    for (n = 0; n < depth; n++) {
+        ne_request *const req = reqs[n];
+
+        /* Write the requests which fit in the window, and always the
+         * request whose response is read next. */
+        while (sent < depth) {
+            if (data == NULL) {
+                take_settings(reqs[sent]);
+                data = build_request(reqs[sent]);
+                sizes[sent] = pipelined_bytes(reqs[sent], data);
+            }
+            if (sent > n && outstanding + sizes[sent] > PIPELINE_WINDOW)
+                break;
+
+            DEBUG_DUMP_REQUEST(data->data);
+            reqs[sent]->conn = conn;
+            ret = write_request(reqs[sent], data, retry || sent > 0);
+            ne_buffer_destroy(data);
+            data = NULL;
+            reqs[sent]->conn = NULL;
+            if (ret) break;
+            MARK_TIME(reqs[sent], sent);
+            outstanding += sizes[sent++];
+        }
+        if (ret) break;
+
+        req->conn = conn;
+        req->retry = retry || n > 0;
+        reset_head(req);
+        ret = read_head(req);
+        if (ret == NE_OK) ret = ne_discard_response(req);
+        if (ret == NE_OK) ret = finish_response(req);
+        conn = req->conn;
+        req->conn = NULL;
+        req->state = RS_START;
+        outstanding -= sizes[n];
+
+        if (ret) {
+            /* On NE_RETRY the response must be re-requested (e.g. for
+             * authentication); drop the rest of the pipeline to
+             * preserve ordering. */
+            if (conn) ne__conn_close(sess, conn);
+            break;
+        }
+
+        NE_DEBUG(NE_DBG_HTTP | NE_DBG_FLUSH,
+                 "Pipelined request ends, status %d class %dxx.\n",
+                 req->status.code, req->status.klass);
+
+        (*done)++;
+
+        if (conn == NULL && n + 1 < depth) {
+            NE_DEBUG(NE_DBG_HTTP, "Connection closed mid-pipeline.\n");
+            ret = NE_RETRY;
+            break;
+        }
+    }
+
+    if (data) ne_buffer_destroy(data);
+    ne_free(sizes);
+
+    if (ret == NE_OK && conn) ne__conn_release(sess, conn);
+
+    return ret;
+}
+
+int ne_pipeline_dispatch(ne_session *sess, ne_request **reqs, size_t count)
+{
+    size_t n = 0;
+    int ret = NE_OK;
+
+    while (ret == NE_OK && n < count) {
+        size_t depth = pipeline_depth(sess, reqs + n, count - n), done;
+
+        if (depth < 2) {
+            ret = ne_request_dispatch(reqs[n++]);
+            continue;
+        }
+
+        ret = dispatch_pipeline(sess, reqs + n, depth, &done);
+        n += done;
+        depth -= done;
+
+        if (ret == NE_RETRY) {
+            /* Fall back to sending the rest of this pipeline serially,
+             * which retries after a persistent connection timeout. */
+            NE_DEBUG(NE_DBG_HTTP, "Pipeline broken, retrying %"
+                     NE_FMT_SIZE_T " requests serially.\n", depth);
+            ret = NE_OK;
+            while (ret == NE_OK && depth-- > 0)
+                ret = ne_request_dispatch(reqs[n++]);
+        }
+    }
+
+    return ret;
+}
+
+ne_socket *ne__request_socket(ne_request *req)
+{
+    return req->conn->socket;
+}
+
+void ne__request_close(ne_request *req)
+{
+    close_connection(req);
+}
+
+const ne_request_timings *ne_get_request_timings(const ne_request *req)
+{
+    return &req->timings;
+}
+
+const ne_status *ne_get_status(const ne_request *req)
+{
+    return &req->status;
 }
 
 ne_session *ne_get_session(const ne_request *req)
@@ -1435,8 +3020,9 @@ ne_session *ne_get_session(const ne_request *req)
 #ifdef NE_HAVE_SSL
 /* Create a CONNECT tunnel through the proxy server.
  * Returns HTTP_* */
-static int proxy_tunnel(ne_session *sess)
+static int proxy_tunnel(ne_request *outer)
 {
+    ne_session *const sess = outer->session;
     /* Hack up an HTTP CONNECT request... */
     ne_request *req;
     int ret = NE_OK;
@@ -1447,13 +3033,15 @@ static int proxy_tunnel(ne_session *sess)
 		sess->server.port);
     req = ne_request_create(sess, "CONNECT", ruri);
 
-    sess->in_connect = 1;
+    /* Send the CONNECT over the new connection, and take it back
+     * afterwards (unless it was closed). */
+    req->is_connect = 1;
+    req->conn = outer->conn;
     ret = ne_request_dispatch(req);
-    sess->in_connect = 0;
-
-    sess->persisted = 0; /* don't treat this is a persistent connection. */
+    outer->conn = req->conn;
+    req->conn = NULL;
 
-    if (ret != NE_OK || !sess->connected || req->status.klass != 2) {
+    if (ret != NE_OK || !outer->conn || req->status.klass != 2) {
 	ne_set_error
 	    (sess, _("Could not create SSL connection through proxy server"));
 	ret = NE_ERROR;
@@ -1482,7 +3070,7 @@ static const ne_inet_addr *resolve_next(ne_session *sess,
                                         struct host_info *host)
 {
     if (sess->addrlist) {
-        if (sess->curaddr++ < sess->numaddrs)
+        if (++sess->curaddr < sess->numaddrs)
             return sess->addrlist[sess->curaddr];
         else
             return NULL;
@@ -1491,82 +3079,310 @@ static const ne_inet_addr *resolve_next(ne_session *sess,
     }
 }
 
-/* Make new TCP connection to server at 'host' of type 'name'.  Note
- * that once a connection to a particular network address has
- * succeeded, that address will be used first for the next attempt to
- * connect. */
-static int do_connect(ne_request *req, struct host_info *host, const char *err)
+/* Returns the host_info for the next-hop server. */
+#define NEXT_HOP(sess) ((sess)->use_proxy ? &(sess)->proxy : &(sess)->server)
+
+/* Fail the connection attempt for 'req'. */
+static int connect_failed(ne_request *req)
+{
+    ne_session *const sess = req->session;
+
+    ne_set_error(sess, "%s: %s", 
+                 sess->use_proxy ? _("Could not connect to proxy server")
+                 : _("Could not connect to server"), 
+                 ne_sock_error(req->conn->socket));
+    close_connection(req);
+    return NE_CONNECT;
+}
+
+/* Build the list of addresses of the next-hop server to which
+ * connections are attempted, in order: the address last connected to
+ * comes first, and the remainder alternate between address
+ * families. */
+static void connect_order(ne_request *req)
+{
+    ne_session *const sess = req->session;
+    struct host_info *const host = NEXT_HOP(sess);
+    const ne_inet_addr *addr, *other[MAX_ADDRS];
+    int n = 0, nother = 0, m, family = -1;
+
+    NE_LOCK(sess, conn_lock);
+    if (host->current)
+        req->addrs[n++] = host->current;
+    for (addr = resolve_first(sess, host); addr && n + nother < MAX_ADDRS;
+         addr = resolve_next(sess, host)) {
+        if (addr == host->current)
+            continue;
+        if (family == -1)
+            family = ne_iaddr_typeof(addr);
+        if ((int)ne_iaddr_typeof(addr) == family)
+            req->addrs[n++] = addr;
+        else
+            other[nother++] = addr;
+    }
+    NE_UNLOCK(sess, conn_lock);
+
+    /* Interleave the addresses of the second family. */
+    for (m = 0; m < nother; m++) {
+        int pos = 2 * m + (req->addrs[0] == host->current ? 2 : 1);
+
+        if (pos > n) pos = n;
+        memmove(&req->addrs[pos + 1], &req->addrs[pos],
+                (n - pos) * sizeof req->addrs[0]);
+        req->addrs[pos] = other[m];
+        n++;
+    }
+
+    req->naddrs = n;
+    req->addrpos = 0;
+}
+
+/* Move on to the next address of the next-hop server after a failed
+ * connection attempt; returns non-zero if there is one. */
+static int next_address(ne_request *req)
+{
+    return ++req->addrpos < req->naddrs;
+}
+
+/* Complete the setup of a newly connected socket, negotiating the SSL
+ * layer if required.  Returns NE_* code. */
+static int connected(ne_request *req)
 {
     ne_session *const sess = req->session;
+    ne_socket *const sock = req->conn->socket;
+    size_t rdbufsize;
+    int ret = NE_OK;
+
+    /* Remember the address which worked, to be tried first next time. */
+    NE_LOCK(sess, conn_lock);
+    NEXT_HOP(sess)->current = req->addrs[req->addrpos];
+    NE_UNLOCK(sess, conn_lock);
+
+    MARK_TIME(req, connect);
+
+    notify_status(sess, ne_conn_connected, NEXT_HOP(sess)->hostport);
+    
+    if (sess->rdtimeout)
+	ne_sock_read_timeout(sock, sess->rdtimeout);
+
+    NE_LOCK(sess, pool_lock);
+    rdbufsize = sess->rdbufsize;
+    NE_UNLOCK(sess, pool_lock);
+
+    if (rdbufsize)
+        ne_sock_read_buffer(sock, rdbufsize);
+
+#ifdef NE_HAVE_SSL
+    /* Negotiate SSL layer if required; this blocks. */
+    if (sess->use_ssl && !req->is_connect) {
+        /* CONNECT tunnel */
+        if (sess->use_proxy)
+            ret = proxy_tunnel(req);
+        
+        if (ret == NE_OK) {
+            ne_sock_nonblock(req->conn->socket, 0);
+            ret = ne__negotiate_ssl(req);
+            if (ret == NE_OK) MARK_TIME(req, handshake);
+        }
+
+        if (ret != NE_OK)
+            close_connection(req);
+    }
+#endif
+
+    return ret;
+}
+
+/* Delay in milliseconds before a connection attempt to the next
+ * address is started alongside one still in progress. */
+#define CONNECT_DELAY (250)
+
+/* Start connecting to the next-hop server, trying each address in
+ * turn until one succeeds or an attempt is in progress.  Note that
+ * once a connection to a particular network address has succeeded,
+ * that address will be used first for the next attempt to connect.
+ * In blocking mode, attempts to further addresses are started in
+ * parallel if an attempt is slow to complete.  Returns NE_OK if
+ * connected, NE_AGAIN, or NE_* on error. */
+static int connect_socket(ne_request *req)
+{
+    ne_session *const sess = req->session;
+    struct host_info *const host = NEXT_HOP(sess);
+    ne_socket *const sock = req->conn->socket;
     int ret;
 
-    if ((sess->socket = ne_sock_create()) == NULL) {
-        ne_set_error(sess, _("Could not create socket"));
-        return NE_ERROR;
+    if (req->naddrs == 0) {
+        ne_set_error(sess, _("Could not resolve hostname `%s'"),
+                     host->hostname);
+        close_connection(req);
+        return NE_LOOKUP;
     }
 
-    if (host->current == NULL)
-	host->current = resolve_first(sess, host);
+    notify_status(sess, ne_conn_connecting, host->hostport);
+
+    if (req->blocking) {
+        ret = ne_sock_connect_any(sock, req->addrs + req->addrpos,
+                                  req->naddrs - req->addrpos, host->port,
+                                  CONNECT_DELAY);
+        if (ret < 0)
+            return connect_failed(req);
+        req->addrpos += ret;
+        return connected(req);
+    }
 
     do {
-	notify_status(sess, ne_conn_connecting, host->hostport);
 #ifdef NE_DEBUGGING
 	if (ne_debug_mask & NE_DBG_HTTP) {
 	    char buf[150];
 	    NE_DEBUG(NE_DBG_HTTP, "Connecting to %s\n",
-		     ne_iaddr_print(host->current, buf, sizeof buf));
+		     ne_iaddr_print(req->addrs[req->addrpos], buf, sizeof buf));
 	}
 #endif
-	ret = ne_sock_connect(sess->socket, host->current, host->port);
-    } while (ret && /* try the next address... */
-	     (host->current = resolve_next(sess, host)) != NULL);
+	ret = ne_sock_connect_start(sock, req->addrs[req->addrpos], host->port);
+        if (ret == NE_SOCK_RETRY) {
+            req->state = RS_CONNECT;
+            req->events = NE_SOCK_WANT_WRITE;
+            return NE_AGAIN;
+        }
+    } while (ret && next_address(req)); /* try the next address... */
 
-    if (ret) {
-        ne_set_error(sess, "%s: %s", err, ne_sock_error(sess->socket));
-        ne_sock_close(sess->socket);
-	return NE_CONNECT;
-    }
+    if (ret)
+        return connect_failed(req);
 
-    notify_status(sess, ne_conn_connected, host->hostport);
-    
-    if (sess->rdtimeout)
-	ne_sock_read_timeout(sess->socket, sess->rdtimeout);
+    return connected(req);
+}
+
+/* Create the socket for a new connection and start connecting it.
+ * Returns NE_* code as for start_connect. */
+static int create_socket(ne_request *req)
+{
+    if ((req->conn->socket = ne_sock_create()) == NULL) {
+        ne_set_error(req->session, _("Could not create socket"));
+        close_connection(req);
+        return NE_ERROR;
+    }
 
-    sess->connected = 1;
     /* clear persistent connection flag. */
-    sess->persisted = 0;
-    return NE_OK;
+    req->conn->persisted = 0;
+    connect_order(req);
+    return connect_socket(req);
 }
 
-static int open_connection(ne_request *req) 
+/* Take a connection for 'req' from the pool: either an idle
+ * persistent connection, or a new one, in which case the connection
+ * is started, beginning with a lookup of the server hostname if
+ * necessary.  Returns NE_OK if the connection is ready, NE_AGAIN if
+ * it is in progress, or NE_* on error. */
+static int start_connect(ne_request *req)
 {
-    ne_session *sess = req->session;
-    int ret;
-    
-    if (sess->connected) return NE_OK;
+    ne_session *const sess = req->session;
+    struct host_info *const host = NEXT_HOP(sess);
+    int pending;
+
+    if (req->conn == NULL) {
+        req->conn = ne__conn_acquire(sess);
+        if (req->conn == NULL) return NE_ERROR;
+    }
+
+    if (req->conn->socket) return NE_OK;
+
+    NE_LOCK(sess, conn_lock);
+    pending = sess->addrlist == NULL && host->address == NULL;
+    NE_UNLOCK(sess, conn_lock);
+
+    if (!pending)
+        return create_socket(req);
+
+    /* The lookup is done without conn_lock held, so that it does not
+     * hold up other threads establishing connections.  Several
+     * requests may look up the host at once; the session keeps the
+     * first result (see use_address). */
+    if (req->blocking) {
+        NE_DEBUG(NE_DBG_HTTP, "Doing DNS lookup on %s...\n",
+                 host->hostname);
+        notify_status(sess, ne_conn_namelookup, host->hostname);
+        return use_address(req, ne_addr_resolve(host->hostname, 0));
+    }
+
+    NE_DEBUG(NE_DBG_HTTP, "Starting DNS lookup on %s...\n",
+             host->hostname);
+    notify_status(sess, ne_conn_namelookup, host->hostname);
+    req->query = ne_addr_resolve_async(host->hostname, 0);
+    if (ne_addr_query_fd(req->query) != -1) {
+        req->state = RS_RESOLVE;
+        req->events = NE_SOCK_WANT_READ;
+        return NE_AGAIN;
+    }
+    return finish_lookup(req);
+}
 
-    if (!sess->use_proxy)
-	ret = do_connect(req, &sess->server, _("Could not connect to server"));
+/* Complete the hostname lookup started by start_connect, and start
+ * the connection.  Returns NE_* code as for start_connect. */
+static int finish_lookup(ne_request *req)
+{
+    ne_sock_addr *addr = ne_addr_query_finish(req->query);
+
+    req->query = NULL;
+    return use_address(req, addr);
+}
+
+/* Record 'addr', the result of looking up the next-hop server for
+ * 'req', and start the connection.  Returns NE_* code as for
+ * start_connect. */
+static int use_address(ne_request *req, ne_sock_addr *addr)
+{
+    ne_session *const sess = req->session;
+    struct host_info *const host = NEXT_HOP(sess);
+    int ret = NE_OK;
+
+    MARK_TIME(req, lookup);
+
+    /* Another request may have completed a lookup meanwhile. */
+    NE_LOCK(sess, conn_lock);
+    if (host->address == NULL)
+        ret = set_address(sess, host, addr);
     else
-	ret = do_connect(req, &sess->proxy,
-			 _("Could not connect to proxy server"));
+        ne_addr_destroy(addr);
+    NE_UNLOCK(sess, conn_lock);
 
-    if (ret != NE_OK) return ret;
+    if (ret != NE_OK) {
+        close_connection(req);
+        return ret;
+    }
 
-#ifdef NE_HAVE_SSL
-    /* Negotiate SSL layer if required. */
-    if (sess->use_ssl && !sess->in_connect) {
-        /* CONNECT tunnel */
-        if (req->session->use_proxy)
-            ret = proxy_tunnel(sess);
-        
-        if (ret == NE_OK) {
-            ret = ne__negotiate_ssl(req);
-            if (ret != NE_OK)
-                ne_close_connection(sess);
-        }
+    return create_socket(req);
+}
+
+/* Complete a connection started by start_connect once the socket is
+ * writable.  Returns NE_OK, NE_AGAIN or NE_* as for start_connect. */
+static int finish_connect(ne_request *req)
+{
+    if (ne_sock_connect_finish(req->conn->socket) == 0)
+        return connected(req);
+    else if (next_address(req))
+        return connect_socket(req);
+    else
+        return connect_failed(req);
+}
+
+/* Open a connection for 'req', blocking until it is ready; the
+ * connection is left in blocking mode.  Returns NE_* code. */
+static int open_connection(ne_request *req) 
+{
+    int ret;
+
+    req->blocking = 1;
+    ret = start_connect(req);
+
+    while (ret == NE_AGAIN) {
+        ret = await_request(req);
+        if (ret == NE_OK) ret = finish_connect(req);
     }
-#endif
+
+    req->state = RS_START;
+
+    if (ret == NE_OK)
+        ne_sock_nonblock(req->conn->socket, 0);
     
     return ret;
 }
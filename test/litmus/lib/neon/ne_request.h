@@ -38,6 +38,7 @@ BEGIN_NEON_DECLS
 #define NE_FAILED (7) /* The precondition failed */
 #define NE_RETRY (8) /* Retry request (ne_end_request ONLY) */
 #define NE_REDIRECT (9) /* See ne_redirect.h */
+#define NE_AGAIN (10) /* Request in progress (ne_request_step ONLY) */
 
 /* Opaque object representing a single HTTP request. */
 typedef struct ne_request_s ne_request;
@@ -55,7 +56,10 @@ void ne_set_request_body_buffer(ne_request *req, const char *buffer,
 				size_t size);
 
 /* The request body will be taken from 'length' bytes read from the
- * file descriptor 'fd', starting from file offset 'offset'. */
+ * file descriptor 'fd', starting from file offset 'offset'.  Unless
+ * SSL is in use, the body is passed to the socket using sendfile()
+ * or splice() where available, without copying it through
+ * user-space. */
 void ne_set_request_body_fd(ne_request *req, int fd,
                             off_t offset, off_t length);
 
@@ -85,7 +89,11 @@ typedef ssize_t (*ne_provide_body)(void *userdata,
 /* Install a callback which is invoked as needed to provide the
  * request body, a block at a time.  The total size of the request
  * body is 'length'; the callback must ensure that it returns no more
- * than 'length' bytes in total. */
+ * than 'length' bytes in total.  If 'length' is negative, the size
+ * of the body is not known in advance: it is sent using the chunked
+ * transfer-coding (which requires an HTTP/1.1 server), and ends when
+ * the callback returns zero.  Blocks returned by the callback are
+ * then collected into chunks of up to NE_BUFSIZ bytes. */
 void ne_set_request_body_provider(ne_request *req, off_t length,
 				  ne_provide_body provider, void *userdata);
 
@@ -135,10 +143,29 @@ typedef int (*ne_block_reader)(void *userdata, const char *buf, size_t len);
  * non-zero, blocks of the response body will be passed to the reader
  * callback as the response is read.  After all the response body has
  * been read, the callback will be called with a 'len' argument of
- * zero.  */
+ * zero.  The block passed to the reader may point into the
+ * connection's read buffer, so is valid only until it returns. */
 void ne_add_response_body_reader(ne_request *req, ne_accept_response accpt,
 				 ne_block_reader reader, void *userdata);
 
+/* Callback for reading a block of data which is only borrowed: 'buf'
+ * is valid only until the callback returns.  Returns the number of
+ * bytes consumed, between zero and 'len'; any bytes not consumed are
+ * passed again at the start of the next block.  Returns a negative
+ * value on error, as for ne_block_reader. */
+typedef ssize_t (*ne_block_borrower)(void *userdata, const char *buf, 
+                                     size_t len);
+
+/* Add a response reader for the given request which may consume only
+ * part of each block, as for ne_add_response_body_reader.  At the end
+ * of the response body, any bytes left unconsumed are passed again
+ * and must then be consumed, before the callback is called with a
+ * 'len' argument of zero.  Unless the reader leaves data unconsumed,
+ * blocks are passed directly from the connection's read buffer
+ * without being copied. */
+void ne_add_response_body_borrower(ne_request *req, ne_accept_response accpt,
+                                   ne_block_borrower reader, void *userdata);
+
 /* Retrieve the value of the response header field with given name;
  * returns NULL if no response header with given name was found.  The
  * return value is valid only until the next call to either
@@ -180,10 +207,90 @@ void ne_print_request_header(ne_request *req, const char *name,
  * ne_get_status(). */
 int ne_request_dispatch(ne_request *req);
 
+/* Dispatch each of the 'count' requests in 'reqs' in order, as for
+ * ne_request_dispatch, which must all be created in session 'sess'.
+ * If pipelining is enabled for the session (see ne_set_pipelining),
+ * consecutive GET, HEAD, PROPFIND and OPTIONS requests are pipelined;
+ * response bodies are passed to the response body readers of each
+ * request in order.  If the server closes the connection part-way
+ * through a pipeline, the outstanding requests are retried serially.
+ * Returns NE_OK if every request was dispatched successfully,
+ * otherwise the NE_* code of the first failure, in which case any
+ * later requests have not been dispatched. */
+int ne_pipeline_dispatch(ne_session *sess, ne_request **reqs, size_t count);
+
+/* Non-blocking request interface, for driving many requests from a
+ * single event loop.  ne_request_step advances the request as far as
+ * is possible without blocking: connecting, sending the request,
+ * reading the response status-line, headers and body (which is
+ * passed to the response body readers), and retrying after an
+ * authentication challenge.  Returns NE_AGAIN if the request is still
+ * in progress; the caller must then wait until the file descriptor
+ * given by ne_request_fd is ready for the events given by
+ * ne_request_events (NE_SOCK_WANT_READ and/or NE_SOCK_WANT_WRITE;
+ * see ne_socket.h), and call ne_request_step again.  Otherwise,
+ * returns as for ne_request_dispatch.  Note that the read timeout is
+ * not applied; the caller is responsible for enforcing any timeout.
+ *
+ * Each request in progress requires its own connection, so the
+ * session connection limit (see ne_set_connection_pool) must allow
+ * for as many connections as requests in progress.  SSL negotiation
+ * and proxy tunnel setup are performed blocking; the hostname lookup
+ * is not, where ne_addr_resolve_async can avoid it.  A request which
+ * has been stepped may be finished by ne_request_dispatch, which
+ * completes any lookup in progress.
+ *
+ * This interface lets requests overlap without a thread for each; it
+ * does not make a request any cheaper.  Each response is read and
+ * parsed as by ne_request_dispatch, so where the client or server is
+ * CPU-bound (as over loopback), many requests stepped at once
+ * complete no faster than the same requests dispatched in turn. */
+int ne_request_step(ne_request *req);
+
+/* Returns the file descriptor awaited by a request for which
+ * ne_request_step has returned NE_AGAIN, or -1 if no connection is
+ * in use. */
+int ne_request_fd(const ne_request *req);
+
+/* Returns the events awaited by a request for which ne_request_step
+ * has returned NE_AGAIN; zero if the request awaits only the timeout
+ * given by ne_request_timeout, as when held back by a rate limit. */
+int ne_request_events(const ne_request *req);
+
+/* Returns the number of milliseconds after which ne_request_step
+ * must be called again for a request for which it has returned
+ * NE_AGAIN, even if the awaited events have not occurred; or -1 if
+ * there is no such deadline. */
+int ne_request_timeout(const ne_request *req);
+
 /* Returns a pointer to the response status information for the given
  * request; pointer is valid until request object is destroyed. */
 const ne_status *ne_get_status(const ne_request *req) ne_attribute((const));
 
+/* Timings of the phases of a request, for the most recent attempt at
+ * sending it: each is the time in seconds at which the phase
+ * completed, relative to the start of the request, measured using a
+ * monotonic clock where available.  A phase which did not take place
+ * is given as -1; for example, no hostname lookup or connection is
+ * made if a persistent connection is reused.  The first byte may be
+ * that of an interim (1xx) response. */
+typedef struct {
+    double lookup; /* hostname lookup complete */
+    double connect; /* TCP connection established */
+    double handshake; /* SSL handshake complete */
+    double sent; /* request sent, including any body */
+    double first_byte; /* first byte of response received */
+    double headers; /* response headers read */
+    double body; /* response body read */
+} ne_request_timings;
+
+/* Returns a pointer to the timings of the given request; pointer is
+ * valid until request object is destroyed.  If the NE_DBG_TIMING
+ * debug channel is enabled, the timings are also written as a single
+ * line to the debug stream at the end of each response. */
+const ne_request_timings *ne_get_request_timings(const ne_request *req)
+    ne_attribute((const));
+
 /* Returns pointer to session associated with request. */
 ne_session *ne_get_session(const ne_request *req) ne_attribute((const));
 
@@ -225,9 +332,12 @@ int ne_read_response_to_fd(ne_request *req, int fd);
 
 /* If 'flag' is non-zer, enable the HTTP/1.1 "Expect: 100-continue"
  * feature for the request, which allows the server to send an error
- * response before the request body is sent.  This should only be used
- * if the server is known to support the feature (not all HTTP/1.1
- * servers do); the request will time out and fail otherwise. */
+ * response before the request body is sent.  Not all HTTP/1.1 servers
+ * support the feature: until the server has been seen to answer the
+ * Expect header, the body is sent anyway if no interim response
+ * arrives within the time set by ne_set_expect100_timeout.  Once the
+ * server has answered it, even late, later requests wait for the
+ * interim response indefinitely. */
 void ne_set_request_expect100(ne_request *req, int flag);
 
 /**** Request hooks handling *****/
@@ -32,6 +32,12 @@
 #ifdef HAVE_ERRNO_H
 #include <errno.h>
 #endif
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef HAVE_CLOCK_GETTIME
+#include <time.h>
+#endif
 
 #include "ne_session.h"
 #include "ne_alloc.h"
@@ -40,6 +46,7 @@
 #include "ne_string.h"
 
 #include "ne_private.h"
+#include "ne_arena.h"
 
 /* Destroy a a list of hooks. */
 static void destroy_hooks(struct hook *hooks)
@@ -79,10 +86,16 @@ void ne_session_destroy(ne_session *sess)
     if (sess->proxy.address) ne_addr_destroy(sess->proxy.address);
     if (sess->proxy.hostname) ne_free(sess->proxy.hostname);
     if (sess->user_agent) ne_free(sess->user_agent);
+    ne__arena_free(&sess->arena);
 
-    if (sess->connected) {
-	ne_close_connection(sess);
-    }
+    ne_close_connection(sess);
+
+#ifdef NE_HAVE_THREADS
+    pthread_mutex_destroy(&sess->pool_lock);
+    pthread_mutex_destroy(&sess->conn_lock);
+    pthread_mutex_destroy(&sess->hook_lock);
+    pthread_cond_destroy(&sess->pool_cond);
+#endif
 
 #ifdef NE_HAVE_SSL
     if (sess->ssl_context)
@@ -100,7 +113,12 @@ void ne_session_destroy(ne_session *sess)
 
 int ne_version_pre_http11(ne_session *s)
 {
-    return !s->is_http11;
+    int ret;
+
+    NE_LOCK(s, pool_lock);
+    ret = !s->is_http11;
+    NE_UNLOCK(s, pool_lock);
+    return ret;
 }
 
 /* Stores the "hostname[:port]" segment */
@@ -122,6 +140,10 @@ set_hostinfo(struct host_info *info, const char *hostname, unsigned int port)
     info->port = port;
 }
 
+/* Default time to wait for a 100-continue response, in
+ * milliseconds. */
+#define EXPECT100_TIMEOUT (1000)
+
 ne_session *ne_session_create(const char *scheme,
 			      const char *hostname, unsigned int port)
 {
@@ -132,6 +154,15 @@ ne_session *ne_session_create(const char *scheme,
 
     strcpy(sess->error, "Unknown error.");
 
+    sess->max_conns = 1;
+    sess->expect100_timeout = EXPECT100_TIMEOUT;
+#ifdef NE_HAVE_THREADS
+    pthread_mutex_init(&sess->pool_lock, NULL);
+    pthread_mutex_init(&sess->conn_lock, NULL);
+    pthread_mutex_init(&sess->hook_lock, NULL);
+    pthread_cond_init(&sess->pool_cond, NULL);
+#endif
+
     /* use SSL if scheme is https */
     sess->use_ssl = !strcmp(scheme, "https");
     
@@ -198,6 +229,145 @@ void ne_set_read_timeout(ne_session *sess, int timeout)
     sess->rdtimeout = timeout;
 }
 
+int ne_get_read_timeout(ne_session *sess)
+{
+    return sess->rdtimeout;
+}
+
+void ne_set_expect100_timeout(ne_session *sess, int msec)
+{
+    NE_LOCK(sess, pool_lock);
+    sess->expect100_timeout = msec > 0 ? msec : 0;
+    NE_UNLOCK(sess, pool_lock);
+}
+
+double ne__time_now(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+    {
+        struct timeval tv;
+
+        gettimeofday(&tv, NULL);
+        return tv.tv_sec + tv.tv_usec / 1e6;
+    }
+}
+
+/* A rate limiter is a token bucket implemented as a "virtual
+ * scheduling" algorithm: 'tat' is the time at which all the bytes
+ * reserved so far will have been paid for at 'rate' bytes per second,
+ * and new bytes may be transferred once 'tat' is no more than 'tau'
+ * seconds (the time to fill the bucket) ahead of the current time.
+ * Reservations are granted in the order they are made, so requests
+ * sharing a limiter take turns. */
+struct ne_ratelimit_s {
+    double rate, tau, tat;
+    size_t quantum; /* most bytes reserved at once */
+#ifdef NE_HAVE_THREADS
+    pthread_mutex_t lock;
+#endif
+};
+
+/* Largest block reserved by a request at once from a limiter. */
+#define RATE_QUANTUM (16384)
+
+#ifdef NE_HAVE_THREADS
+#define RATE_LOCK(rl) pthread_mutex_lock(&(rl)->lock)
+#define RATE_UNLOCK(rl) pthread_mutex_unlock(&(rl)->lock)
+#else
+#define RATE_LOCK(rl) do { } while (0)
+#define RATE_UNLOCK(rl) do { } while (0)
+#endif
+
+ne_ratelimit *ne_ratelimit_create(unsigned long rate, size_t burst)
+{
+    ne_ratelimit *rl = ne_calloc(sizeof *rl);
+
+    if (rate == 0) rate = 1;
+    if (burst == 0) burst = rate / 10;
+    if (burst == 0) burst = 1;
+
+    rl->rate = rate;
+    rl->tau = burst / rl->rate;
+    rl->quantum = burst < RATE_QUANTUM ? burst : RATE_QUANTUM;
+#ifdef NE_HAVE_THREADS
+    pthread_mutex_init(&rl->lock, NULL);
+#endif
+    return rl;
+}
+
+void ne_ratelimit_destroy(ne_ratelimit *rl)
+{
+#ifdef NE_HAVE_THREADS
+    pthread_mutex_destroy(&rl->lock);
+#endif
+    ne_free(rl);
+}
+
+size_t ne__ratelimit_reserve(ne_ratelimit *rl, size_t len, double *ready)
+{
+    double now = ne__time_now(), when;
+
+    if (len > rl->quantum) len = rl->quantum;
+
+    RATE_LOCK(rl);
+    if (rl->tat < now) rl->tat = now;
+    rl->tat += len / rl->rate;
+    when = rl->tat - rl->tau;
+    RATE_UNLOCK(rl);
+
+    *ready = when > now ? when : now;
+    return len;
+}
+
+void ne__ratelimit_return(ne_ratelimit *rl, size_t len)
+{
+    RATE_LOCK(rl);
+    rl->tat -= len / rl->rate;
+    RATE_UNLOCK(rl);
+}
+
+void ne_set_rate_limit(ne_session *sess, ne_ratelimit *upload, 
+                       ne_ratelimit *download)
+{
+    NE_LOCK(sess, pool_lock);
+    sess->upload = upload;
+    sess->download = download;
+    NE_UNLOCK(sess, pool_lock);
+}
+
+void ne_set_read_buffer_size(ne_session *sess, size_t size)
+{
+    NE_LOCK(sess, pool_lock);
+    sess->rdbufsize = size;
+    NE_UNLOCK(sess, pool_lock);
+}
+
+unsigned long ne_get_read_calls(ne_session *sess)
+{
+    struct ne_conn *conn;
+    unsigned long calls;
+
+    NE_LOCK(sess, pool_lock);
+    calls = sess->rdcalls;
+    for (conn = sess->idle; conn; conn = conn->next)
+        calls += ne_sock_read_calls(conn->socket);
+    NE_UNLOCK(sess, pool_lock);
+
+    return calls;
+}
+
+void ne_set_pipelining(ne_session *sess, int depth)
+{
+    NE_LOCK(sess, pool_lock);
+    sess->pipelining = depth;
+    NE_UNLOCK(sess, pool_lock);
+}
+
 #define UAHDR "User-Agent: "
 #define AGENT " neon/" NEON_VERSION "\r\n"
 
@@ -235,17 +405,259 @@ const char *ne_get_error(ne_session *sess)
     return ne_strclean(sess->error);
 }
 
-void ne_close_connection(ne_session *sess)
+/* Close the socket of connection 'conn', if any; must be called with
+ * the pool lock held. */
+static void close_socket(ne_session *sess, struct ne_conn *conn)
 {
-    if (sess->connected) {
+    if (conn->socket) {
+        sess->rdcalls += ne_sock_read_calls(conn->socket);
 	NE_DEBUG(NE_DBG_SOCKET, "Closing connection.\n");
-	ne_sock_close(sess->socket);
-	sess->socket = NULL;
+	ne_sock_close(conn->socket);
 	NE_DEBUG(NE_DBG_SOCKET, "Connection closed.\n");
+        conn->socket = NULL;
+    }
+}
+
+/* Close and destroy connection 'conn'; must be called with the pool
+ * lock held. */
+static void destroy_conn(ne_session *sess, struct ne_conn *conn)
+{
+    close_socket(sess, conn);
+    ne_free(conn);
+    sess->conns--;
+#ifdef NE_HAVE_THREADS
+    pthread_cond_signal(&sess->pool_cond);
+#endif
+}
+
+/* Close any idle connections which have timed out; must be called
+ * with the pool lock held. */
+static void evict_idle(ne_session *sess)
+{
+    struct ne_conn **ptr = &sess->idle;
+    time_t now;
+
+    if (sess->idle_timeout <= 0)
+        return;
+
+    now = time(NULL);
+
+    while (*ptr) {
+        struct ne_conn *const conn = *ptr;
+
+        if (now - conn->idle_since >= sess->idle_timeout) {
+            NE_DEBUG(NE_DBG_SOCKET, "Evicting connection idle for %ld "
+                     "seconds.\n", (long)(now - conn->idle_since));
+            *ptr = conn->next;
+            destroy_conn(sess, conn);
+            sess->pool_stats.evictions++;
+        } else {
+            ptr = &conn->next;
+        }
+    }
+}
+
+/* An idle connection is not reused if the server will close it
+ * within this many seconds, per its Keep-Alive timeout. */
+#define KEEPALIVE_MARGIN (1)
+
+/* Take the most recently used idle connection which is still fit to
+ * use, closing any found to have been closed by the server, or about
+ * to be; must be called with the pool lock held.  Returns NULL if
+ * there is no such connection. */
+static struct ne_conn *take_idle(ne_session *sess)
+{
+    struct ne_conn *conn;
+    time_t now = time(NULL);
+
+    while ((conn = sess->idle) != NULL) {
+        int limit = conn->keepalive > KEEPALIVE_MARGIN 
+            ? conn->keepalive - KEEPALIVE_MARGIN : conn->keepalive;
+
+        sess->idle = conn->next;
+        conn->next = NULL;
+
+        if (conn->keepalive && now - conn->idle_since >= limit) {
+            NE_DEBUG(NE_DBG_SOCKET, "Connection idle for %ld seconds is "
+                     "due to time out.\n", (long)(now - conn->idle_since));
+        } else if (conn->socket && ne_sock_stale(conn->socket)) {
+            NE_DEBUG(NE_DBG_SOCKET, "Idle connection closed by server.\n");
+        } else {
+            return conn;
+        }
+
+        destroy_conn(sess, conn);
+        sess->pool_stats.stale++;
+    }
+
+    return NULL;
+}
+
+/* Returns the connection in use most recently taken by the calling
+ * thread, or NULL; must be called with the pool lock held. */
+static struct ne_conn *find_busy(ne_session *sess)
+{
+#ifdef NE_HAVE_THREADS
+    pthread_t self = pthread_self();
+    struct ne_conn *conn;
+
+    for (conn = sess->busy; conn; conn = conn->next)
+        if (pthread_equal(conn->owner, self))
+            break;
+
+    return conn;
+#else
+    return sess->busy;
+#endif
+}
+
+/* Remove connection 'conn' from the list of connections in use; must
+ * be called with the pool lock held. */
+static void unlink_busy(ne_session *sess, struct ne_conn *conn)
+{
+    struct ne_conn **ptr;
+
+    for (ptr = &sess->busy; *ptr; ptr = &(*ptr)->next) {
+        if (*ptr == conn) {
+            *ptr = conn->next;
+            break;
+        }
+    }
+
+    conn->next = NULL;
+}
+
+struct ne_conn *ne__conn_acquire(ne_session *sess)
+{
+    struct ne_conn *conn;
+
+    NE_LOCK(sess, pool_lock);
+
+    for (;;) {
+        evict_idle(sess);
+
+        if ((conn = take_idle(sess)) != NULL) {
+            /* Reuse the most recently used connection. */
+            sess->pool_stats.hits++;
+            break;
+        } else if (sess->conns < sess->max_conns) {
+            conn = ne_calloc(sizeof *conn);
+            sess->conns++;
+            sess->pool_stats.misses++;
+            break;
+        } else if ((conn = find_busy(sess)) != NULL) {
+            /* Share the connection with the request still using it,
+             * rather than wait for a request which cannot finish
+             * until this one does. */
+            NE_DEBUG(NE_DBG_SOCKET, "Sharing connection in use.\n");
+            conn->users++;
+            sess->pool_stats.hits++;
+            NE_UNLOCK(sess, pool_lock);
+            return conn;
+        }
+
+#ifdef NE_HAVE_THREADS
+        NE_DEBUG(NE_DBG_SOCKET, "Waiting for a free connection.\n");
+        pthread_cond_wait(&sess->pool_cond, &sess->pool_lock);
+#else
+        ne_set_error(sess, _("Connection limit reached"));
+        NE_UNLOCK(sess, pool_lock);
+        return NULL;
+#endif
+    }
+
+    conn->users = 1;
+#ifdef NE_HAVE_THREADS
+    conn->owner = pthread_self();
+#endif
+    conn->next = sess->busy;
+    sess->busy = conn;
+
+    NE_UNLOCK(sess, pool_lock);
+
+    return conn;
+}
+
+void ne__conn_release(ne_session *sess, struct ne_conn *conn)
+{
+    NE_LOCK(sess, pool_lock);
+
+    if (--conn->users > 0) {
+        /* Still in use by another request. */
+        NE_UNLOCK(sess, pool_lock);
+        return;
+    }
+
+    unlink_busy(sess, conn);
+    conn->persisted = 1;
+    conn->idle_since = time(NULL);
+    conn->next = sess->idle;
+    sess->idle = conn;
+
+#ifdef NE_HAVE_THREADS
+    pthread_cond_signal(&sess->pool_cond);
+#endif
+
+    NE_UNLOCK(sess, pool_lock);
+}
+
+void ne__conn_close(ne_session *sess, struct ne_conn *conn)
+{
+    NE_LOCK(sess, pool_lock);
+    if (--conn->users > 0) {
+        close_socket(sess, conn);
     } else {
+        unlink_busy(sess, conn);
+        destroy_conn(sess, conn);
+    }
+    NE_UNLOCK(sess, pool_lock);
+}
+
+void ne_close_connection(ne_session *sess)
+{
+    NE_LOCK(sess, pool_lock);
+
+    if (sess->idle == NULL) {
 	NE_DEBUG(NE_DBG_SOCKET, "(Not closing closed connection!).\n");
     }
-    sess->connected = 0;
+
+    while (sess->idle) {
+        struct ne_conn *const conn = sess->idle;
+        sess->idle = conn->next;
+        destroy_conn(sess, conn);
+    }
+
+    NE_UNLOCK(sess, pool_lock);
+}
+
+void ne_set_connection_pool(ne_session *sess, unsigned int max,
+                            int idle_timeout)
+{
+    NE_LOCK(sess, pool_lock);
+    sess->max_conns = max > 0 ? max : 1;
+    sess->idle_timeout = idle_timeout;
+#ifdef NE_HAVE_THREADS
+    /* Threads waiting for a connection may now open one. */
+    pthread_cond_broadcast(&sess->pool_cond);
+#endif
+    NE_UNLOCK(sess, pool_lock);
+}
+
+unsigned int ne_get_max_connections(ne_session *sess)
+{
+    unsigned int max;
+
+    NE_LOCK(sess, pool_lock);
+    max = sess->max_conns;
+    NE_UNLOCK(sess, pool_lock);
+    return max;
+}
+
+void ne_get_pool_stats(ne_session *sess, ne_pool_stats *stats)
+{
+    NE_LOCK(sess, pool_lock);
+    *stats = sess->pool_stats;
+    NE_UNLOCK(sess, pool_lock);
 }
 
 void ne_ssl_set_verify(ne_session *sess, ne_ssl_verify_fn fn, void *userdata)
@@ -35,17 +35,65 @@ typedef struct ne_session_s ne_session;
 
 /* Create a session to the given server, using the given scheme.  If
  * "https" is passed as the scheme, SSL will be used to connect to the
- * server. */
+ * server.  The most recent SSL session issued by the server is cached
+ * in the session and offered when connecting again, so that new
+ * connections can resume it rather than performing a full
+ * handshake. */
 ne_session *ne_session_create(const char *scheme,
 			      const char *hostname, unsigned int port);
 
 /* Finish an HTTP session */
 void ne_session_destroy(ne_session *sess);
 
-/* Prematurely force the connection to be closed for the given
- * session. */
+/* Prematurely force the idle persistent connections to be closed for
+ * the given session. */
 void ne_close_connection(ne_session *sess);
 
+/* Configure the session's connection pool: up to 'max' connections
+ * to the server may be open at once (the default is one), and an
+ * idle persistent connection is closed rather than reused once it has
+ * been idle for 'idle_timeout' seconds (or never, if zero).  Idle
+ * connections are reused most-recently-used first.  Before reuse, an
+ * idle connection is checked (without blocking) in case the server
+ * has closed it, and is not reused if it is within a second of the
+ * timeout given in a "Keep-Alive: timeout=N" response header; a new
+ * connection is opened instead, rather than the request failing and
+ * being sent again.
+ *
+ * If neon was built with thread support, requests created in the
+ * same session may be dispatched concurrently from different
+ * threads, each on its own connection; a request blocks until a
+ * connection becomes available if 'max' connections are in use.
+ * A request dispatched whilst another request in the session is
+ * still open from the same thread shares that request's connection
+ * if no other connection may be opened, as a session did before it
+ * had a pool.
+ * New connections are established one at a time, and the session
+ * hooks are run with a session-wide lock held.  The session error
+ * string, progress and status notification callbacks remain shared
+ * between all threads. */
+void ne_set_connection_pool(ne_session *sess, unsigned int max,
+                            int idle_timeout);
+
+/* Returns the maximum number of connections which may be open at
+ * once for the session, as set by ne_set_connection_pool. */
+unsigned int ne_get_max_connections(ne_session *sess);
+
+/* Connection pool statistics. */
+typedef struct {
+    unsigned long hits; /* requests which reused an idle connection */
+    unsigned long misses; /* requests which opened a new connection */
+    unsigned long evictions; /* idle connections closed after timeout */
+    unsigned long stale; /* idle connections closed by the server, or
+                          * about to be, found when reusing them */
+    unsigned long handshakes; /* full SSL handshakes */
+    unsigned long resumed; /* SSL handshakes which resumed a session */
+} ne_pool_stats;
+
+/* Copy the current connection pool statistics for the session into
+ * *stats. */
+void ne_get_pool_stats(ne_session *sess, ne_pool_stats *stats);
+
 /* Set the proxy server to be used for the session. */
 void ne_session_proxy(ne_session *sess,
 		      const char *hostname, unsigned int port);
@@ -54,6 +102,13 @@ void ne_session_proxy(ne_session *sess,
  * enable (the default). */
 void ne_set_persist(ne_session *sess, int flag);
 
+/* Enable HTTP/1.1 pipelining for the session if 'depth' is greater
+ * than one: up to 'depth' requests passed to ne_pipeline_dispatch are
+ * sent down the persistent connection ahead of the responses, as far
+ * as a window of some kilobytes of request data allows.  Pipelining is disabled by default, and is only used once the
+ * server is known to be HTTP/1.1 compliant. */
+void ne_set_pipelining(ne_session *sess, int depth);
+
 /* Bypass the normal name resolution; force the use of specific set of
  * addresses for this session, addrs[0]...addrs[n-1].  The addrs array
  * must remain valid until the session is destroyed. */
@@ -151,6 +206,51 @@ void ne_ssl_provide_clicert(ne_session *sess,
  * timeout value must be greater than zero. */
 void ne_set_read_timeout(ne_session *sess, int timeout);
 
+/* Returns the read timeout of the session, in seconds. */
+int ne_get_read_timeout(ne_session *sess);
+
+/* Set the time, in milliseconds, for which a request using
+ * 100-continue (see ne_set_request_expect100) waits for the interim
+ * response before sending the request body anyway; the default is
+ * one second.  If 'msec' is zero, the request waits indefinitely
+ * (subject to the read timeout). */
+void ne_set_expect100_timeout(ne_session *sess, int msec);
+
+/* A token-bucket rate limiter, which may be shared between sessions
+ * to divide its rate between them. */
+typedef struct ne_ratelimit_s ne_ratelimit;
+
+/* Create a rate limiter allowing an average of 'rate' bytes per
+ * second, with bursts of up to 'burst' bytes; if 'burst' is zero, a
+ * tenth of a second's worth is used. */
+ne_ratelimit *ne_ratelimit_create(unsigned long rate, size_t burst);
+
+/* Destroy a rate limiter; it must no longer be in use by any
+ * session. */
+void ne_ratelimit_destroy(ne_ratelimit *rl);
+
+/* Limit the rate at which request bodies are sent in session 'sess'
+ * to that of 'upload', and the rate at which response bodies are read
+ * to that of 'download'; either may be NULL for no limit.  The same
+ * limiter may be used for both directions, and by many sessions, in
+ * which case the requests using it take turns to transfer a block
+ * at a time.  A request which must wait for its turn sleeps, or, if
+ * driven by ne_request_step, awaits no events and gives the time to
+ * wait as its ne_request_timeout.  A change of limiter applies to
+ * requests sent afterwards. */
+void ne_set_rate_limit(ne_session *sess, ne_ratelimit *upload, 
+                       ne_ratelimit *download);
+
+/* Set the size of the read buffer used for each new connection to
+ * 'size' bytes; the default is 4096.  A larger buffer reduces the
+ * number of system calls needed to read a large response. */
+void ne_set_read_buffer_size(ne_session *sess, size_t size);
+
+/* Returns the number of system calls made to read from, or wait on,
+ * the session's connections, excluding any connection in use by a
+ * request. */
+unsigned long ne_get_read_calls(ne_session *sess);
+
 /* Sets the user-agent string. neon/VERSION will be appended, to make
  * the full header "User-Agent: product neon/VERSION".
  * If this function is not called, the User-Agent header is not sent.
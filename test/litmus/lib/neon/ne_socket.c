@@ -94,6 +94,22 @@
 #include <socks.h>
 #endif
 
+#include <time.h>
+
+#ifdef NE_HAVE_THREADS
+#include <pthread.h>
+#endif
+
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h> /* for writev */
+#endif
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+#ifndef WIN32
+#include <fcntl.h> /* for O_NONBLOCK and splice */
+#endif
+
 #ifdef HAVE_OPENSSL
 #include <openssl/ssl.h>
 #include <openssl/err.h>
@@ -153,6 +169,8 @@ typedef struct in_addr ne_inet_addr;
                        (e) == WSAECONNRESET || (e) == WSAENETRESET)
 #define NE_ISCLOSED(e) ((e) == WSAESHUTDOWN || (e) == WSAENOTCONN)
 #define NE_ISINTR(e) (0)
+#define NE_ISAGAIN(e) ((e) == WSAEWOULDBLOCK)
+#define NE_ISINPROGRESS(e) ((e) == WSAEWOULDBLOCK)
 #else /* Unix */
 /* Also treat ECONNABORTED and ENOTCONN as "connection reset" errors;
  * both can be returned by Winsock-based sockets layers e.g. CygWin */
@@ -165,6 +183,8 @@ typedef struct in_addr ne_inet_addr;
 #define NE_ISRESET(e) ((e) == ECONNRESET || (e) == ECONNABORTED || (e) == ENOTCONN)
 #define NE_ISCLOSED(e) ((e) == EPIPE)
 #define NE_ISINTR(e) ((e) == EINTR)
+#define NE_ISAGAIN(e) ((e) == EAGAIN || (e) == EWOULDBLOCK)
+#define NE_ISINPROGRESS(e) ((e) == EINPROGRESS)
 #endif
 
 /* Socket read timeout */
@@ -179,6 +199,10 @@ struct iofns {
     /* Write up to 'len' bytes from 'buf' to socket.  Return number of
      * bytes written on success, or <0 on error. */
     ssize_t (*swrite)(ne_socket *s, const char *buf, size_t len);
+    /* Write up to the total length of the 'count' buffers described
+     * by 'vec' to socket.  Return number of bytes written on success,
+     * or <0 on error. */
+    ssize_t (*swritev)(ne_socket *s, const struct ne_iovec *vec, int count);
     /* Wait up to 'n' seconds for socket to become readable.  Returns
      * 0 when readable, otherwise NE_SOCK_TIMEOUT or NE_SOCK_ERROR. */
     int (*readable)(ne_socket *s, int n);
@@ -189,6 +213,7 @@ struct ne_socket_s {
     char error[200];
     void *progress_ud;
     int rdtimeout; /* read timeout. */
+    int nonblock; /* non-zero if in non-blocking mode. */
     const struct iofns *ops;
 #ifdef NE_HAVE_SSL
     ne_ssl_socket ssl;
@@ -197,11 +222,13 @@ struct ne_socket_s {
      * these are consumed and passed back to the caller, bufpos
      * advances through ->buffer.  ->bufavail gives the number of
      * bytes which remain to be consumed in ->buffer (from ->bufpos),
-     * and is hence always <= RDBUFSIZ. */
+     * and is hence always <= ->bufsize. */
 #define RDBUFSIZ 4096
-    char buffer[RDBUFSIZ];
+    char *buffer;
+    size_t bufsize;
     char *bufpos;
     size_t bufavail;
+    unsigned long rdcalls; /* number of read system calls. */
 };
 
 /* ne_sock_addr represents an Internet address. */
@@ -213,6 +240,8 @@ struct ne_sock_addr_s {
     size_t cursor, count;
 #endif
     int errnum;
+    /* If non-NULL, the cache entry which owns the result. */
+    struct addr_entry *entry;
 };
 
 /* set_error: set socket error string to 'str'. */
@@ -352,6 +381,8 @@ int ne_sock_init(void)
 
 void ne_sock_exit(void)
 {
+    ne_addr_cache_flush();
+
 #ifdef WIN32
     WSACleanup();
 #endif
@@ -373,6 +404,19 @@ int ne_sock_block(ne_socket *sock, int n)
     return sock->ops->readable(sock, n);
 }
 
+int ne_sock_stale(ne_socket *sock)
+{
+    int nonblock = sock->nonblock;
+    ssize_t ret;
+    char ch;
+
+    ne_sock_nonblock(sock, 1);
+    ret = ne_sock_peek(sock, &ch, 1);
+    ne_sock_nonblock(sock, nonblock);
+
+    return ret != NE_SOCK_RETRY;
+}
+
 /* Cast address object AD to type 'sockaddr_TY' */ 
 #define SACAST(ty, ad) ((struct sockaddr_##ty *)(ad))
 
@@ -393,12 +437,13 @@ ssize_t ne_sock_read(ne_socket *sock, char *buffer, size_t buflen)
 	sock->bufpos += buflen;
 	sock->bufavail -= buflen;
 	return buflen;
-    } else if (buflen >= sizeof sock->buffer) {
-	/* No need for read buffer. */
+    } else if (buflen >= sock->bufsize) {
+	/* No need for read buffer: read directly into the caller's
+	 * buffer, avoiding a copy. */
 	return sock->ops->sread(sock, buffer, buflen);
     } else {
 	/* Fill read buffer. */
-	bytes = sock->ops->sread(sock, sock->buffer, sizeof sock->buffer);
+	bytes = sock->ops->sread(sock, sock->buffer, sock->bufsize);
 	if (bytes <= 0)
 	    return bytes;
 
@@ -420,7 +465,7 @@ ssize_t ne_sock_peek(ne_socket *sock, char *buffer, size_t buflen)
 	bytes = sock->bufavail;
     } else {
 	/* fill the buffer. */
-	bytes = sock->ops->sread(sock, sock->buffer, sizeof sock->buffer);
+	bytes = sock->ops->sread(sock, sock->buffer, sock->bufsize);
 	if (bytes <= 0)
 	    return bytes;
 
@@ -449,6 +494,7 @@ static int readable_raw(ne_socket *sock, int secs)
     fds.revents = 0;
 
     do {
+        sock->rdcalls++;
         ret = poll(&fds, 1, timeout);
     } while (ret < 0 && NE_ISINTR(ne_errno));
 #else
@@ -464,6 +510,7 @@ static int readable_raw(ne_socket *sock, int secs)
 	    tvp->tv_sec = secs;
 	    tvp->tv_usec = 0;
 	}
+	sock->rdcalls++;
 	ret = select(fdno + 1, &rdfds, NULL, NULL, tvp);
     } while (ret < 0 && NE_ISINTR(ne_errno));
 #endif
@@ -479,10 +526,13 @@ static ssize_t read_raw(ne_socket *sock, char *buffer, size_t len)
 {
     ssize_t ret;
     
-    ret = readable_raw(sock, sock->rdtimeout);
-    if (ret) return ret;
+    if (!sock->nonblock) {
+        ret = readable_raw(sock, sock->rdtimeout);
+        if (ret) return ret;
+    }
 
     do {
+        sock->rdcalls++;
 	ret = recv(sock->fd, buffer, len, 0);
     } while (ret == -1 && NE_ISINTR(ne_errno));
 
@@ -491,6 +541,8 @@ static ssize_t read_raw(ne_socket *sock, char *buffer, size_t len)
 	ret = NE_SOCK_CLOSED;
     } else if (ret < 0) {
 	int errnum = ne_errno;
+        if (sock->nonblock && NE_ISAGAIN(errnum))
+            return NE_SOCK_RETRY;
 	ret = NE_ISRESET(errnum) ? NE_SOCK_RESET : NE_SOCK_ERROR;
 	set_strerror(sock, errnum);
     }
@@ -498,8 +550,10 @@ static ssize_t read_raw(ne_socket *sock, char *buffer, size_t len)
     return ret;
 }
 
-#define MAP_ERR(e) (NE_ISCLOSED(e) ? NE_SOCK_CLOSED : \
-                    (NE_ISRESET(e) ? NE_SOCK_RESET : NE_SOCK_ERROR))
+/* Map a write error 'e' on socket 's' to an NE_SOCK_* code. */
+#define MAP_ERR(s, e) (((s)->nonblock && NE_ISAGAIN(e)) ? NE_SOCK_RETRY : \
+                       (NE_ISCLOSED(e) ? NE_SOCK_CLOSED : \
+                        (NE_ISRESET(e) ? NE_SOCK_RESET : NE_SOCK_ERROR)))
 
 static ssize_t write_raw(ne_socket *sock, const char *data, size_t length) 
 {
@@ -512,12 +566,76 @@ static ssize_t write_raw(ne_socket *sock, const char *data, size_t length)
     if (ret < 0) {
 	int errnum = ne_errno;
 	set_strerror(sock, errnum);
-	return MAP_ERR(errnum);
+	return MAP_ERR(sock, errnum);
     }
     return ret;
 }
 
-static const struct iofns iofns_raw = { read_raw, write_raw, readable_raw };
+#if !defined(HAVE_SYS_UIO_H) || defined(NE_HAVE_SSL)
+/* Maximum number of bytes coalesced into a single write by
+ * writev_dense: the maximum size of an SSL/TLS record. */
+#define DENSE_SIZE (16384)
+
+/* Emulate writev using ->swrite: leading buffers in 'vec' are copied
+ * into a single block so that small buffers, such as request headers
+ * and a short body, go out in one write (and one SSL record). */
+static ssize_t writev_dense(ne_socket *sock, const struct ne_iovec *vec,
+                            int count)
+{
+    char buffer[DENSE_SIZE];
+    size_t len = 0;
+    int n;
+
+    if (count == 1 || vec[0].len + vec[1].len > sizeof buffer)
+        return sock->ops->swrite(sock, vec[0].base, vec[0].len);
+
+    for (n = 0; n < count && len + vec[n].len <= sizeof buffer; n++) {
+        memcpy(buffer + len, vec[n].base, vec[n].len);
+        len += vec[n].len;
+    }
+
+    return sock->ops->swrite(sock, buffer, len);
+}
+#endif
+
+#ifdef HAVE_SYS_UIO_H
+/* Maximum number of buffers passed to a single writev call by
+ * writev_raw; any further buffers are left for the caller. */
+#define RAW_IOVECS (16)
+
+static ssize_t writev_raw(ne_socket *sock, const struct ne_iovec *vec,
+                          int count)
+{
+    struct iovec vecs[RAW_IOVECS];
+    ssize_t ret;
+    int n;
+
+    if (count > RAW_IOVECS)
+        count = RAW_IOVECS;
+
+    for (n = 0; n < count; n++) {
+        vecs[n].iov_base = (void *)vec[n].base;
+        vecs[n].iov_len = vec[n].len;
+    }
+
+    do {
+        ret = writev(sock->fd, vecs, count);
+    } while (ret == -1 && NE_ISINTR(ne_errno));
+
+    if (ret < 0) {
+	int errnum = ne_errno;
+	set_strerror(sock, errnum);
+	return MAP_ERR(sock, errnum);
+    }
+    return ret;
+}
+#else
+#define writev_raw writev_dense
+#endif
+
+static const struct iofns iofns_raw = { 
+    read_raw, write_raw, writev_raw, readable_raw
+};
 
 #ifdef HAVE_OPENSSL
 /* OpenSSL I/O function implementations. */
@@ -538,6 +656,10 @@ static int error_ossl(ne_socket *sock, int sret)
 	set_error(sock, _("Connection closed"));
         return NE_SOCK_CLOSED;
     }
+    else if (sock->nonblock && (errnum == SSL_ERROR_WANT_READ
+                                || errnum == SSL_ERROR_WANT_WRITE)) {
+        return NE_SOCK_RETRY;
+    }
     
     /* for all other errors, look at the OpenSSL error stack */
     err = ERR_get_error();
@@ -551,7 +673,7 @@ static int error_ossl(ne_socket *sock, int sret)
             /* Other socket error. */
             errnum = ne_errno;
             set_strerror(sock, errnum);
-            return MAP_ERR(errnum);
+            return MAP_ERR(sock, errnum);
         }
     }
 
@@ -576,8 +698,10 @@ static ssize_t read_ossl(ne_socket *sock, char *buffer, size_t len)
 {
     int ret;
 
-    ret = readable_ossl(sock, sock->rdtimeout);
-    if (ret) return ret;
+    if (!sock->nonblock) {
+        ret = readable_ossl(sock, sock->rdtimeout);
+        if (ret) return ret;
+    }
     
     ret = SSL_read(sock->ssl, buffer, CAST2INT(len));
     if (ret <= 0)
@@ -601,6 +725,7 @@ static ssize_t write_ossl(ne_socket *sock, const char *data, size_t len)
 static const struct iofns iofns_ssl = {
     read_ossl,
     write_ossl,
+    writev_dense,
     readable_ossl
 };
 
@@ -636,6 +761,9 @@ static ssize_t error_gnutls(ne_socket *sock, ssize_t sret)
     ssize_t ret;
 
     switch (sret) {
+    case GNUTLS_E_AGAIN:
+        ret = NE_SOCK_RETRY;
+        break;
     case 0:
 	ret = NE_SOCK_CLOSED;
 	set_error(sock, _("Connection closed"));
@@ -654,15 +782,18 @@ static ssize_t error_gnutls(ne_socket *sock, ssize_t sret)
 }
 
 #define RETRY_GNUTLS(sock, ret) ((ret < 0) \
-    && (ret == GNUTLS_E_INTERRUPTED || ret == GNUTLS_E_AGAIN \
+    && (ret == GNUTLS_E_INTERRUPTED \
+        || (ret == GNUTLS_E_AGAIN && !(sock)->nonblock) \
         || check_alert(sock, ret) == 0))
 
 static ssize_t read_gnutls(ne_socket *sock, char *buffer, size_t len)
 {
     ssize_t ret;
 
-    ret = readable_gnutls(sock, sock->rdtimeout);
-    if (ret) return ret;
+    if (!sock->nonblock) {
+        ret = readable_gnutls(sock, sock->rdtimeout);
+        if (ret) return ret;
+    }
     
     do {
         ret = gnutls_record_recv(sock->ssl, buffer, len);
@@ -691,6 +822,7 @@ static ssize_t write_gnutls(ne_socket *sock, const char *data, size_t len)
 static const struct iofns iofns_ssl = {
     read_gnutls,
     write_gnutls,
+    writev_dense,
     readable_gnutls
 };
 
@@ -711,13 +843,137 @@ int ne_sock_fullwrite(ne_socket *sock, const char *data, size_t len)
     return ret < 0 ? ret : 0;
 }
 
+int ne_sock_fullwritev(ne_socket *sock, const struct ne_iovec *vec, int count)
+{
+    ssize_t ret = 0;
+
+    do {
+        /* Skip empty buffers, which would otherwise be "written"
+         * with a return value of zero. */
+        while (count && vec[0].len == 0) {
+            count--;
+            vec++;
+        }
+        if (count == 0)
+            break;
+
+        ret = sock->ops->swritev(sock, vec, count);
+        if (ret == 0) {
+            set_error(sock, _("Could not write to socket"));
+            ret = NE_SOCK_ERROR;
+        } else if (ret > 0) {
+            /* Skip the buffers which were written completely. */
+            while (count && (size_t)ret >= vec[0].len) {
+                ret -= vec[0].len;
+                count--;
+                vec++;
+            }
+
+            if (count && ret > 0) {
+                /* Complete a partially written buffer. */
+                ret = ne_sock_fullwrite(sock, 
+                                        (const char *)vec[0].base + ret,
+                                        vec[0].len - ret);
+                count--;
+                vec++;
+            }
+        }
+    } while (count && ret >= 0);
+
+    return ret < 0 ? ret : 0;
+}
+
+ssize_t ne_sock_writev(ne_socket *sock, const struct ne_iovec *vec, int count)
+{
+    return sock->ops->swritev(sock, vec, count);
+}
+
+/* Copy up to 'count' bytes from 'fd' to the socket through a
+ * user-space buffer.  In non-blocking mode, any data which could not
+ * be written is "unread" by seeking back in 'fd'. */
+static ssize_t copy_file(ne_socket *sock, int fd, size_t count)
+{
+    char buffer[8192];
+    ssize_t ret;
+
+    if (count > sizeof buffer)
+        count = sizeof buffer;
+
+    do {
+        ret = read(fd, buffer, count);
+    } while (ret == -1 && NE_ISINTR(errno));
+
+    if (ret < 0) {
+        set_strerror(sock, errno);
+        return NE_SOCK_ERROR;
+    } else if (ret > 0 && sock->nonblock) {
+        ssize_t wret = 0, len = ret;
+
+        for (ret = 0; ret < len; ret += wret) {
+            wret = sock->ops->swrite(sock, buffer + ret, len - ret);
+            if (wret < 0) break;
+        }
+
+        if (ret < len && lseek(fd, ret - len, SEEK_CUR) == (off_t)-1) {
+            set_strerror(sock, errno);
+            return NE_SOCK_ERROR;
+        }
+        if (ret == 0) return wret;
+    } else if (ret > 0) {
+        int wret = ne_sock_fullwrite(sock, buffer, ret);
+        if (wret < 0) return wret;
+    }
+
+    return ret;
+}
+
+ssize_t ne_sock_sendfile(ne_socket *sock, int fd, size_t count)
+{
+#if defined(HAVE_SENDFILE) || defined(HAVE_SPLICE)
+    if (sock->ops == &iofns_raw) {
+        ssize_t ret;
+        int errnum;
+
+#ifdef HAVE_SENDFILE
+        do {
+            ret = sendfile(sock->fd, fd, NULL, count);
+        } while (ret == -1 && NE_ISINTR(ne_errno));
+        if (ret >= 0) return ret;
+
+        errnum = ne_errno;
+        if (errnum != EINVAL && errnum != ENOSYS) {
+            set_strerror(sock, errnum);
+            return MAP_ERR(sock, errnum);
+        }
+#endif
+
+#ifdef HAVE_SPLICE
+        /* sendfile() can't read from a pipe, but splice() can. */
+        do {
+            ret = splice(fd, NULL, sock->fd, NULL, count, SPLICE_F_MORE);
+        } while (ret == -1 && NE_ISINTR(ne_errno));
+        if (ret >= 0) return ret;
+
+        errnum = ne_errno;
+        if (errnum != EINVAL && errnum != ENOSYS) {
+            set_strerror(sock, errnum);
+            return MAP_ERR(sock, errnum);
+        }
+#endif
+        /* otherwise, fall back on copying. */
+    }
+#endif
+
+    return copy_file(sock, fd, count);
+}
+
 ssize_t ne_sock_readline(ne_socket *sock, char *buf, size_t buflen)
 {
     char *lf;
     size_t len;
     
     if ((lf = memchr(sock->bufpos, '\n', sock->bufavail)) == NULL
-	&& sock->bufavail < RDBUFSIZ) {
+	&& sock->bufavail < sock->bufsize) {
 	/* The buffered data does not contain a complete line: move it
 	 * to the beginning of the buffer. */
 	if (sock->bufavail)
@@ -729,11 +985,11 @@ ssize_t ne_sock_readline(ne_socket *sock, char *buf, size_t buflen)
 	do {
 	    /* Read more data onto end of buffer. */
 	    ssize_t ret = sock->ops->sread(sock, sock->buffer + sock->bufavail,
-                                           RDBUFSIZ - sock->bufavail);
+                                           sock->bufsize - sock->bufavail);
 	    if (ret < 0) return ret;
 	    sock->bufavail += ret;
 	} while ((lf = memchr(sock->buffer, '\n', sock->bufavail)) == NULL
-		 && sock->bufavail < RDBUFSIZ);
+		 && sock->bufavail < sock->bufsize);
     }
 
     if (lf)
@@ -754,6 +1010,51 @@ ssize_t ne_sock_readline(ne_socket *sock, char *buf, size_t buflen)
     return len;
 }
 
+ssize_t ne_sock_fill(ne_socket *sock, size_t limit)
+{
+    ssize_t ret;
+
+    if (sock->bufavail == 0) {
+        sock->bufpos = sock->buffer;
+    } 
+    else if (sock->bufpos + sock->bufavail == sock->buffer + sock->bufsize) {
+        /* No space left at the end of the buffer: first reclaim the
+         * space of consumed data, otherwise grow the buffer. */
+        if (sock->bufpos > sock->buffer) {
+            memmove(sock->buffer, sock->bufpos, sock->bufavail);
+        }
+        else if (sock->bufsize < limit) {
+            sock->bufsize = sock->bufsize * 2 > limit 
+                ? limit : sock->bufsize * 2;
+            sock->buffer = ne_realloc(sock->buffer, sock->bufsize);
+        }
+        else {
+            set_error(sock, _("Line too long"));
+            return NE_SOCK_ERROR;
+        }
+        sock->bufpos = sock->buffer;
+    }
+
+    ret = sock->ops->sread(sock, sock->bufpos + sock->bufavail,
+                           sock->buffer + sock->bufsize 
+                           - (sock->bufpos + sock->bufavail));
+    if (ret > 0)
+        sock->bufavail += ret;
+    return ret;
+}
+
+const char *ne_sock_buffered(const ne_socket *sock, size_t *len)
+{
+    *len = sock->bufavail;
+    return sock->bufpos;
+}
+
+void ne_sock_consume(ne_socket *sock, size_t len)
+{
+    sock->bufpos += len;
+    sock->bufavail -= len;
+}
+
 ssize_t ne_sock_fullread(ne_socket *sock, char *buffer, size_t buflen) 
 {
     ssize_t len;
@@ -779,7 +1080,7 @@ extern int h_errno;
 
 /* This implemementation does not attempt to support IPv6 using
  * gethostbyname2 et al.  */
-ne_sock_addr *ne_addr_resolve(const char *hostname, int flags)
+static ne_sock_addr *resolve_name(const char *hostname, int flags)
 {
     ne_sock_addr *addr = ne_calloc(sizeof *addr);
 #ifdef USE_GETADDRINFO
@@ -923,7 +1224,8 @@ char *ne_iaddr_print(const ne_inet_addr *ia, char *buf, size_t bufsiz)
     return buf;
 }
 
-void ne_addr_destroy(ne_sock_addr *addr)
+/* Free an address object and its result. */
+static void free_addr(ne_sock_addr *addr)
 {
 #ifdef USE_GETADDRINFO
     if (addr->result)
@@ -935,6 +1237,294 @@ void ne_addr_destroy(ne_sock_addr *addr)
     ne_free(addr);
 }
 
+/* The resolver cache: the results of recent calls to ne_addr_resolve,
+ * most recently used first.  Each entry is referenced by the cache
+ * (until it expires or is evicted) and by each address object
+ * sharing its result. */
+struct addr_entry {
+    char *hostname;
+    int flags;
+    ne_sock_addr *addr; /* the result */
+    time_t expires;
+    unsigned int refs;
+    struct addr_entry *next;
+};
+
+/* Maximum number of entries in the resolver cache. */
+#define ADDR_CACHE_SIZE (32)
+
+static struct addr_entry *addr_cache;
+static int addr_ttl = 60, addr_negative_ttl = 10;
+
+#ifdef NE_HAVE_THREADS
+static pthread_mutex_t addr_lock = PTHREAD_MUTEX_INITIALIZER;
+#define ADDR_LOCK() pthread_mutex_lock(&addr_lock)
+#define ADDR_UNLOCK() pthread_mutex_unlock(&addr_lock)
+#else
+#define ADDR_LOCK() do { } while (0)
+#define ADDR_UNLOCK() do { } while (0)
+#endif
+
+/* Drop a reference to cache entry 'e'; must be called with the cache
+ * locked. */
+static void entry_unref(struct addr_entry *e)
+{
+    if (--e->refs == 0) {
+        free_addr(e->addr);
+        ne_free(e->hostname);
+        ne_free(e);
+    }
+}
+
+/* Remove cache entries which have expired, or all entries if 'all'
+ * is non-zero; must be called with the cache locked. */
+static void expire_entries(int all)
+{
+    struct addr_entry **ptr = &addr_cache, *e;
+    time_t now = time(NULL);
+
+    while ((e = *ptr) != NULL) {
+        if (all || e->expires <= now) {
+            *ptr = e->next;
+            entry_unref(e);
+        } else {
+            ptr = &e->next;
+        }
+    }
+}
+
+/* Returns an address object sharing the result of cache entry 'e',
+ * taking a reference to it; must be called with the cache locked. */
+static ne_sock_addr *share_entry(struct addr_entry *e)
+{
+    ne_sock_addr *addr = ne_calloc(sizeof *addr);
+
+#ifdef USE_GETADDRINFO
+    addr->result = e->addr->result;
+#else
+    addr->addrs = e->addr->addrs;
+    addr->count = e->addr->count;
+#endif
+    addr->errnum = e->addr->errnum;
+    addr->entry = e;
+    e->refs++;
+    return addr;
+}
+
+/* Returns an address object sharing the cached result of resolving
+ * 'hostname' with 'flags', or NULL if no result is cached. */
+static ne_sock_addr *cache_lookup(const char *hostname, int flags)
+{
+    struct addr_entry *e, **ptr;
+    ne_sock_addr *addr = NULL;
+
+    ADDR_LOCK();
+    expire_entries(0);
+    for (ptr = &addr_cache; (e = *ptr) != NULL; ptr = &e->next) {
+        if (e->flags == flags && strcmp(e->hostname, hostname) == 0) {
+            /* Move the entry to the front of the cache. */
+            *ptr = e->next;
+            e->next = addr_cache;
+            addr_cache = e;
+            addr = share_entry(e);
+            break;
+        }
+    }
+    ADDR_UNLOCK();
+
+    if (addr)
+        NE_DEBUG(NE_DBG_SOCKET, "Resolved %s from cache.\n", hostname);
+    return addr;
+}
+
+/* Returns non-zero if the failed lookup 'addr' found that the name
+ * does not exist or has no addresses, rather than failing for a
+ * reason which may pass, such as a server which did not answer. */
+static int lookup_definitive(const ne_sock_addr *addr)
+{
+#ifdef USE_GETADDRINFO
+    if (addr->errnum == EAI_NONAME) return 1;
+#ifdef EAI_NODATA
+    if (addr->errnum == EAI_NODATA) return 1;
+#endif
+    return 0;
+#elif defined(WIN32)
+    return addr->errnum == WSAHOST_NOT_FOUND || addr->errnum == WSANO_DATA;
+#else
+    return addr->errnum == HOST_NOT_FOUND || addr->errnum == NO_DATA;
+#endif
+}
+
+/* Add 'addr', the result of resolving 'hostname' with 'flags', to the
+ * cache if caching is enabled for the result; failures are cached
+ * only if definitive.  Returns the address
+ * object to be used by the caller. */
+static ne_sock_addr *cache_insert(const char *hostname, int flags,
+                                  ne_sock_addr *addr)
+{
+    struct addr_entry *e, **ptr;
+    int ttl, n;
+
+    if (addr->errnum && !lookup_definitive(addr))
+        return addr;
+
+    ADDR_LOCK();
+    ttl = addr->errnum ? addr_negative_ttl : addr_ttl;
+    if (ttl <= 0) {
+        ADDR_UNLOCK();
+        return addr;
+    }
+
+    e = ne_malloc(sizeof *e);
+    e->hostname = ne_strdup(hostname);
+    e->flags = flags;
+    e->addr = addr;
+    e->expires = time(NULL) + ttl;
+    e->refs = 1;
+
+    /* Add the entry to the front of the cache, replacing any entry
+     * added meanwhile and evicting the least recently used entry if
+     * the cache is full. */
+    e->next = addr_cache;
+    addr_cache = e;
+    for (n = 1, ptr = &e->next; *ptr != NULL; ) {
+        struct addr_entry *old = *ptr;
+
+        if ((old->flags == flags && strcmp(old->hostname, hostname) == 0)
+            || n == ADDR_CACHE_SIZE) {
+            *ptr = old->next;
+            entry_unref(old);
+        } else {
+            ptr = &old->next;
+            n++;
+        }
+    }
+    addr = share_entry(e);
+    ADDR_UNLOCK();
+
+    return addr;
+}
+
+ne_sock_addr *ne_addr_resolve(const char *hostname, int flags)
+{
+    ne_sock_addr *addr = cache_lookup(hostname, flags);
+
+    if (addr == NULL)
+        addr = cache_insert(hostname, flags, resolve_name(hostname, flags));
+
+    return addr;
+}
+
+void ne_addr_cache_ttl(int ttl, int negative_ttl)
+{
+    ADDR_LOCK();
+    addr_ttl = ttl;
+    addr_negative_ttl = negative_ttl;
+    ADDR_UNLOCK();
+}
+
+void ne_addr_cache_flush(void)
+{
+    ADDR_LOCK();
+    expire_entries(1);
+    ADDR_UNLOCK();
+}
+
+void ne_addr_destroy(ne_sock_addr *addr)
+{
+    if (addr->entry) {
+        ADDR_LOCK();
+        entry_unref(addr->entry);
+        ADDR_UNLOCK();
+        ne_free(addr);
+    } else {
+        free_addr(addr);
+    }
+}
+
+struct ne_addr_query_s {
+    char *hostname;
+    int flags;
+    ne_sock_addr *result; /* set once the query completes */
+#ifdef NE_HAVE_THREADS
+    pthread_t thread;
+    int pipe[2]; /* written to by the thread on completion; or -1 */
+#endif
+};
+
+#ifdef NE_HAVE_THREADS
+/* Resolver thread for an asynchronous query. */
+static void *query_thread(void *userdata)
+{
+    ne_addr_query *q = userdata;
+    ssize_t ret;
+
+    q->result = ne_addr_resolve(q->hostname, q->flags);
+
+    do {
+        ret = write(q->pipe[1], "", 1);
+    } while (ret < 0 && NE_ISINTR(errno));
+
+    return NULL;
+}
+#endif
+
+ne_addr_query *ne_addr_resolve_async(const char *hostname, int flags)
+{
+    ne_addr_query *q = ne_calloc(sizeof *q);
+
+    q->hostname = ne_strdup(hostname);
+    q->flags = flags;
+
+#ifdef NE_HAVE_THREADS
+    q->pipe[0] = q->pipe[1] = -1;
+
+    q->result = cache_lookup(hostname, flags);
+    if (q->result)
+        return q;
+
+    if (pipe(q->pipe) == 0) {
+        if (pthread_create(&q->thread, NULL, query_thread, q) == 0)
+            return q;
+
+        close(q->pipe[0]);
+        close(q->pipe[1]);
+        q->pipe[0] = q->pipe[1] = -1;
+    }
+#endif
+
+    /* Otherwise, resolve synchronously. */
+    q->result = ne_addr_resolve(hostname, flags);
+    return q;
+}
+
+int ne_addr_query_fd(const ne_addr_query *q)
+{
+#ifdef NE_HAVE_THREADS
+    return q->pipe[0];
+#else
+    return -1;
+#endif
+}
+
+ne_sock_addr *ne_addr_query_finish(ne_addr_query *q)
+{
+    ne_sock_addr *addr;
+
+#ifdef NE_HAVE_THREADS
+    if (q->pipe[0] >= 0) {
+        pthread_join(q->thread, NULL);
+        close(q->pipe[0]);
+        close(q->pipe[1]);
+    }
+#endif
+
+    addr = q->result;
+    ne_free(q->hostname);
+    ne_free(q);
+    return addr;
+}
+
 /* Connect socket 'fd' to address 'addr' on given 'port': */
 static int raw_connect(int fd, const ne_inet_addr *addr, unsigned int port)
 {
@@ -972,14 +1562,17 @@ ne_socket *ne_sock_create(void)
 {
     ne_socket *sock = ne_calloc(sizeof *sock);
     sock->rdtimeout = SOCKET_READ_TIMEOUT;
+    sock->buffer = ne_malloc(RDBUFSIZ);
+    sock->bufsize = RDBUFSIZ;
     sock->bufpos = sock->buffer;
     sock->ops = &iofns_raw;
     sock->fd = -1;
     return sock;
 }
 
-int ne_sock_connect(ne_socket *sock,
-                    const ne_inet_addr *addr, unsigned int port)
+/* Create a TCP socket for connecting to address 'addr'; returns the
+ * descriptor, or -1 on error having set the socket error string. */
+static int create_fd(ne_socket *sock, const ne_inet_addr *addr)
 {
     int fd;
 
@@ -999,7 +1592,7 @@ int ne_sock_connect(ne_socket *sock,
     if (fd > FD_SETSIZE) {
         ne_close(fd);
         set_error(sock, _("Socket descriptor number exceeds FD_SETSIZE"));
-        return NE_SOCK_ERROR;
+        return -1;
     }
 #endif
 
@@ -1011,6 +1604,17 @@ int ne_sock_connect(ne_socket *sock,
     }
 #endif
 
+    return fd;
+}
+
+int ne_sock_connect(ne_socket *sock,
+                    const ne_inet_addr *addr, unsigned int port)
+{
+    int fd = create_fd(sock, addr);
+
+    if (fd < 0)
+        return NE_SOCK_ERROR;
+
     if (raw_connect(fd, addr, htons(port))) {
         set_strerror(sock, ne_errno);
 	ne_close(fd);
@@ -1018,9 +1622,256 @@ int ne_sock_connect(ne_socket *sock,
     }
 
     sock->fd = fd;
+    sock->nonblock = 0;
+    return 0;
+}
+
+int ne_sock_connect_start(ne_socket *sock, const ne_inet_addr *addr,
+                          unsigned int port)
+{
+    int fd = create_fd(sock, addr), errnum;
+
+    if (fd < 0)
+        return NE_SOCK_ERROR;
+
+    sock->fd = fd;
+    sock->nonblock = 0;
+    ne_sock_nonblock(sock, 1);
+
+    if (raw_connect(fd, addr, htons(port)) == 0)
+        return 0;
+
+    errnum = ne_errno;
+    if (NE_ISINPROGRESS(errnum))
+        return NE_SOCK_RETRY;
+
+    set_strerror(sock, errnum);
+    ne_close(fd);
+    sock->fd = -1;
+    return NE_SOCK_ERROR;
+}
+
+int ne_sock_connect_finish(ne_socket *sock)
+{
+    int errnum = 0;
+#ifdef WIN32
+    int len = sizeof errnum;
+#else
+    socklen_t len = sizeof errnum;
+#endif
+
+    if (getsockopt(sock->fd, SOL_SOCKET, SO_ERROR, (void *)&errnum, &len))
+        errnum = ne_errno;
+
+    if (errnum) {
+        set_strerror(sock, errnum);
+        ne_close(sock->fd);
+        sock->fd = -1;
+        return NE_SOCK_ERROR;
+    }
+
     return 0;
 }
 
+/* Maximum number of addresses tried by ne_sock_connect_any. */
+#define MAX_CONNECT_ADDRS (16)
+
+int ne_sock_connect_any(ne_socket *sock, const ne_inet_addr **addrs,
+                        int count, unsigned int port, int delay)
+{
+    int fds[MAX_CONNECT_ADDRS], next = 0, pending = 0, found = -1;
+    int expired = 0, n;
+
+    if (count > MAX_CONNECT_ADDRS)
+        count = MAX_CONNECT_ADDRS;
+
+    while (found < 0 && (next < count || pending > 0)) {
+        int ret;
+
+        /* Start the next attempt once the last attempt has failed or
+         * has not completed within 'delay' milliseconds. */
+        if (next < count && (pending == 0 || expired)) {
+            int fd = fds[next] = create_fd(sock, addrs[next]);
+
+            expired = 0;
+            if (fd < 0) {
+                next++;
+                continue;
+            }
+            sock->fd = fd;
+            sock->nonblock = 0;
+            ne_sock_nonblock(sock, 1);
+
+            if (raw_connect(fd, addrs[next], htons(port)) == 0) {
+                found = next++;
+            } else if (NE_ISINPROGRESS(ne_errno)) {
+                pending++;
+                next++;
+            } else {
+                set_strerror(sock, ne_errno);
+                ne_close(fd);
+                fds[next++] = -1;
+            }
+            continue;
+        }
+
+        /* Wait for a pending attempt to complete. */
+        {
+#ifdef NE_USE_POLL
+            struct pollfd pfds[MAX_CONNECT_ADDRS];
+            int map[MAX_CONNECT_ADDRS], npfds = 0;
+
+            for (n = 0; n < next; n++) {
+                if (fds[n] >= 0) {
+                    pfds[npfds].fd = fds[n];
+                    pfds[npfds].events = POLLOUT;
+                    pfds[npfds].revents = 0;
+                    map[npfds++] = n;
+                }
+            }
+
+            do {
+                ret = poll(pfds, npfds, next < count ? delay : -1);
+            } while (ret < 0 && NE_ISINTR(ne_errno));
+#else
+            fd_set wrfds;
+            struct timeval timeout;
+            int maxfd = -1;
+
+            FD_ZERO(&wrfds);
+            for (n = 0; n < next; n++) {
+                if (fds[n] >= 0) {
+                    FD_SET(fds[n], &wrfds);
+                    if (fds[n] > maxfd) maxfd = fds[n];
+                }
+            }
+            timeout.tv_sec = delay / 1000;
+            timeout.tv_usec = (delay % 1000) * 1000;
+
+            do {
+                ret = select(maxfd + 1, NULL, &wrfds, NULL, 
+                             next < count ? &timeout : NULL);
+            } while (ret < 0 && NE_ISINTR(ne_errno));
+#endif
+
+            if (ret < 0) {
+                set_strerror(sock, ne_errno);
+                break;
+            } else if (ret == 0) {
+                expired = 1;
+                continue;
+            }
+
+#ifdef NE_USE_POLL
+            for (ret = 0; ret < npfds; ret++) {
+                if (pfds[ret].revents == 0) continue;
+                n = map[ret];
+#else
+            for (n = 0; n < next; n++) {
+                if (fds[n] < 0 || !FD_ISSET(fds[n], &wrfds)) continue;
+#endif
+                sock->fd = fds[n];
+                if (ne_sock_connect_finish(sock) == 0) {
+                    found = n;
+                    break;
+                }
+                /* Attempt failed: move on to the next address. */
+                fds[n] = -1;
+                pending--;
+                expired = 1;
+            }
+        }
+    }
+
+    /* Abandon any other attempts still in progress. */
+    for (n = 0; n < next; n++) {
+        if (n != found && fds[n] >= 0)
+            ne_close(fds[n]);
+    }
+
+    if (found < 0) {
+        sock->fd = -1;
+        return NE_SOCK_ERROR;
+    }
+
+    sock->fd = fds[found];
+    ne_sock_nonblock(sock, 0);
+    return found;
+}
+
+void ne_sock_nonblock(ne_socket *sock, int flag)
+{
+    flag = flag != 0;
+
+    if (sock->nonblock == flag || sock->fd < 0) {
+        sock->nonblock = flag;
+        return;
+    }
+
+#ifdef WIN32
+    {
+        u_long mode = flag;
+        ioctlsocket(sock->fd, FIONBIO, &mode);
+    }
+#else
+    {
+        int flags = fcntl(sock->fd, F_GETFL);
+        
+        if (flags != -1)
+            fcntl(sock->fd, F_SETFL, 
+                  flag ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK));
+    }
+#endif
+    sock->nonblock = flag;
+}
+
+int ne_sock_wait(ne_socket *sock, int events)
+{
+    int secs = (events & NE_SOCK_WANT_READ) ? sock->rdtimeout : -1;
+
+    return ne_sock_wait_timeout(sock, events, secs > 0 ? secs * 1000 : -1);
+}
+
+int ne_sock_wait_timeout(ne_socket *sock, int events, int msec)
+{
+    int ret;
+#ifdef NE_USE_POLL
+    struct pollfd fds;
+    int timeout = msec >= 0 ? msec : -1;
+
+    fds.fd = sock->fd;
+    fds.events = ((events & NE_SOCK_WANT_READ) ? POLLIN : 0)
+        | ((events & NE_SOCK_WANT_WRITE) ? POLLOUT : 0);
+    fds.revents = 0;
+
+    do {
+        ret = poll(&fds, 1, timeout);
+    } while (ret < 0 && NE_ISINTR(ne_errno));
+#else
+    int fdno = sock->fd;
+    fd_set rdfds, wrfds;
+    struct timeval timeout, *tvp = (msec >= 0 ? &timeout : NULL);
+
+    do {
+        FD_ZERO(&rdfds);
+        FD_ZERO(&wrfds);
+        if (events & NE_SOCK_WANT_READ) FD_SET(fdno, &rdfds);
+        if (events & NE_SOCK_WANT_WRITE) FD_SET(fdno, &wrfds);
+	if (tvp) {
+	    tvp->tv_sec = msec / 1000;
+	    tvp->tv_usec = (msec % 1000) * 1000;
+	}
+	ret = select(fdno + 1, &rdfds, &wrfds, NULL, tvp);
+    } while (ret < 0 && NE_ISINTR(ne_errno));
+#endif
+
+    if (ret < 0) {
+	set_strerror(sock, ne_errno);
+	return NE_SOCK_ERROR;
+    }
+    return (ret == 0) ? NE_SOCK_TIMEOUT : 0;
+}
+
 ne_inet_addr *ne_iaddr_make(ne_iaddr_type type, const unsigned char *raw)
 {
     ne_inet_addr *ia;
@@ -1112,6 +1963,30 @@ int ne_sock_fd(const ne_socket *sock)
     return sock->fd;
 }
 
+void ne_sock_read_buffer(ne_socket *sock, size_t size)
+{
+    char *buffer;
+
+    /* Keep any data which has already been buffered. */
+    if (size < sock->bufavail)
+        size = sock->bufavail;
+    if (size == 0)
+        size = RDBUFSIZ;
+
+    buffer = ne_malloc(size);
+    if (sock->bufavail)
+        memcpy(buffer, sock->bufpos, sock->bufavail);
+    ne_free(sock->buffer);
+
+    sock->buffer = sock->bufpos = buffer;
+    sock->bufsize = size;
+}
+
+unsigned long ne_sock_read_calls(const ne_socket *sock)
+{
+    return sock->rdcalls;
+}
+
 void ne_sock_read_timeout(ne_socket *sock, int timeout)
 {
     sock->rdtimeout = timeout;
@@ -1176,12 +2051,18 @@ int ne_sock_connect_ssl(ne_socket *sock, ne_ssl_context *ctx, void *userdata)
     }
     
     SSL_set_app_data(ssl, userdata);
-    SSL_set_mode(ssl, SSL_MODE_AUTO_RETRY);
+    /* In non-blocking mode, a write may be retried from a different
+     * buffer (see writev_dense). */
+    SSL_set_mode(ssl, SSL_MODE_AUTO_RETRY 
+                 | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
     SSL_set_fd(ssl, sock->fd);
     sock->ops = &iofns_ssl;
     
+    /* Offer the cached session for resumption. */
+    NE_SSL_LOCK(ctx);
     if (ctx->sess)
 	SSL_set_session(ssl, ctx->sess);
+    NE_SSL_UNLOCK(ctx);
 
     ret = SSL_connect(ssl);
     if (ret != 1) {
@@ -1200,6 +2081,12 @@ int ne_sock_connect_ssl(ne_socket *sock, ne_ssl_context *ctx, void *userdata)
     gnutls_transport_set_ptr(sock->ssl, (gnutls_transport_ptr) sock->fd);
     sock->ops = &iofns_ssl;
 
+    /* Offer the cached session for resumption. */
+    NE_SSL_LOCK(ctx);
+    if (ctx->cache.data)
+        gnutls_session_set_data(sock->ssl, ctx->cache.data, ctx->cache.size);
+    NE_SSL_UNLOCK(ctx);
+
     ret = gnutls_handshake(sock->ssl);
     if (ret < 0) {
 	error_gnutls(sock, ret);
@@ -1233,6 +2120,7 @@ int ne_sock_close(ne_socket *sock)
     }
 #elif defined(HAVE_GNUTLS)
     if (sock->ssl) {
+        ne_sock_nonblock(sock, 0);
         do {
             ret = gnutls_bye(sock->ssl, GNUTLS_SHUT_RDWR);
         } while (ret < 0
@@ -1244,6 +2132,7 @@ int ne_sock_close(ne_socket *sock)
         ret = 0;
     else
         ret = ne_close(sock->fd);
+    ne_free(sock->buffer);
     ne_free(sock);
     return ret;
 }
@@ -38,6 +38,8 @@ BEGIN_NEON_DECLS
 #define NE_SOCK_RESET (-4)
 /* Secure connection was closed without proper SSL shutdown. */
 #define NE_SOCK_TRUNC (-5)
+/* Operation would block; socket is in non-blocking mode. */
+#define NE_SOCK_RETRY (-6)
 
 /* ne_socket represents a TCP socket. */
 typedef struct ne_socket_s ne_socket;
@@ -86,6 +88,34 @@ char *ne_addr_error(const ne_sock_addr *addr, char *buffer, size_t bufsiz);
 /* Destroys an address object created by ne_addr_resolve. */
 void ne_addr_destroy(ne_sock_addr *addr);
 
+/* The results of ne_addr_resolve are cached process-wide: a
+ * successful result is reused for 'ttl' seconds, and a failure for
+ * 'negative_ttl' seconds; zero disables caching of the respective
+ * results.  The defaults are 60 and 10 seconds.  Only failures which
+ * show that the name does not exist, or has no addresses, are
+ * cached; a temporary failure is not. */
+void ne_addr_cache_ttl(int ttl, int negative_ttl);
+
+/* Discard all cached resolver results. */
+void ne_addr_cache_flush(void);
+
+/* An asynchronous hostname resolution query. */
+typedef struct ne_addr_query_s ne_addr_query;
+
+/* Begin resolving 'hostname' as for ne_addr_resolve, without
+ * blocking the caller where threads are supported (the lookup runs
+ * in a separate thread unless a cached result is available).  The
+ * returned query object must be passed to ne_addr_query_finish. */
+ne_addr_query *ne_addr_resolve_async(const char *hostname, int flags);
+
+/* Returns a file descriptor which becomes readable once the query
+ * has completed, or -1 if the query completed immediately. */
+int ne_addr_query_fd(const ne_addr_query *query);
+
+/* Returns the result of the query, as for ne_addr_resolve, waiting
+ * for it to complete if necessary; the query object is destroyed. */
+ne_sock_addr *ne_addr_query_finish(ne_addr_query *query);
+
 /* Network address type; IPv4 or IPv6 */
 typedef enum {
     ne_iaddr_ipv4 = 0,
@@ -120,6 +150,53 @@ ne_socket *ne_sock_create(void);
 int ne_sock_connect(ne_socket *sock, const ne_inet_addr *addr, 
                     unsigned int port);
 
+/* Begin connecting the socket to server at address 'addr' on port
+ * 'port', placing the socket in non-blocking mode.  Returns 0 if the
+ * connection was established immediately, NE_SOCK_RETRY if the
+ * connection is in progress, in which case ne_sock_connect_finish
+ * must be called once the socket becomes writable; or NE_SOCK_ERROR
+ * if the connection failed. */
+int ne_sock_connect_start(ne_socket *sock, const ne_inet_addr *addr,
+                          unsigned int port);
+
+/* Complete a connection begun by ne_sock_connect_start.  Returns 0 if
+ * the connection was established, or NE_SOCK_ERROR on failure. */
+int ne_sock_connect_finish(ne_socket *sock);
+
+/* Connect the socket to the first of the 'count' addresses in
+ * 'addrs' to accept a connection on port 'port'.  A connection
+ * attempt is started to each address in turn, either once the
+ * previous attempt has failed, or if it has not succeeded within
+ * 'delay' milliseconds, leaving earlier attempts running ("Happy
+ * Eyeballs", RFC 6555); at most 16 addresses are tried.  Returns the
+ * index of the address connected to, or NE_SOCK_ERROR if all
+ * attempts failed. */
+int ne_sock_connect_any(ne_socket *sock, const ne_inet_addr **addrs,
+                        int count, unsigned int port, int delay);
+
+/* If 'flag' is non-zero, place the socket in non-blocking mode,
+ * otherwise in blocking mode.  In non-blocking mode, the read
+ * functions do not wait for data to arrive (or the read timeout to
+ * expire), and the read and write functions return NE_SOCK_RETRY if
+ * the operation would block; ne_sock_fullwrite, ne_sock_fullwritev
+ * and ne_sock_fullread must not be used in this mode. */
+void ne_sock_nonblock(ne_socket *sock, int flag);
+
+/* Events which can be awaited using ne_sock_wait. */
+#define NE_SOCK_WANT_READ (0x01)
+#define NE_SOCK_WANT_WRITE (0x02)
+
+/* Wait until the socket becomes readable (if 'events' includes
+ * NE_SOCK_WANT_READ), or writable (NE_SOCK_WANT_WRITE).  When waiting
+ * to read, the read timeout applies.  Returns 0 when ready,
+ * NE_SOCK_TIMEOUT on timeout, or NE_SOCK_ERROR. */
+int ne_sock_wait(ne_socket *sock, int events);
+
+/* As ne_sock_wait, but waits for at most 'msec' milliseconds (or
+ * indefinitely, if negative) rather than applying the read
+ * timeout. */
+int ne_sock_wait_timeout(ne_socket *sock, int events, int msec);
+
 /* ne_sock_read reads up to 'count' bytes into 'buffer'.
  * Returns:
  *   NE_SOCK_* on error,
@@ -144,10 +221,62 @@ ssize_t ne_sock_peek(ne_socket *sock, char *buffer, size_t count);
  */
 int ne_sock_block(ne_socket *sock, int n);
 
+/* Check, without blocking, whether an idle connection is no longer
+ * fit to send a request over: returns non-zero if the peer has
+ * closed it, or has sent data which was not asked for. */
+int ne_sock_stale(ne_socket *sock);
+
 /* Writes 'count' bytes of 'data' to the socket.
  * Returns 0 on success, NE_SOCK_* on error. */
 int ne_sock_fullwrite(ne_socket *sock, const char *data, size_t count); 
 
+/* Writes up to 'count' bytes read from file descriptor 'fd', starting
+ * at the current file offset of 'fd', to the socket.  Where the
+ * platform supports it and the socket is not using SSL, the data is
+ * passed from 'fd' to the socket within the kernel (sendfile/splice)
+ * rather than copied through a user-space buffer.  The file offset of
+ * 'fd' is advanced by the number of bytes written.  Returns:
+ *   NE_SOCK_* on error,
+ *   0 if the end of file was reached,
+ *  >0 number of bytes written. */
+ssize_t ne_sock_sendfile(ne_socket *sock, int fd, size_t count);
+
+/* Describes a buffer of 'len' bytes at 'base' to be written. */
+struct ne_iovec {
+    const void *base;
+    size_t len;
+};
+
+/* Writes the 'count' buffers described by 'vec' to the socket, in
+ * order; where possible, using a single system call (writev).
+ * Returns 0 on success, NE_SOCK_* on error. */
+int ne_sock_fullwritev(ne_socket *sock, const struct ne_iovec *vec,
+                       int count);
+
+/* Writes up to the total length of the 'count' buffers described by
+ * 'vec' to the socket, in order.  Returns:
+ *   NE_SOCK_* on error,
+ *  >0 number of bytes written. */
+ssize_t ne_sock_writev(ne_socket *sock, const struct ne_iovec *vec,
+                       int count);
+
+/* Reads whatever data is available from the socket onto the end of
+ * the read buffer, growing the buffer up to 'limit' bytes if it is
+ * full.  Returns:
+ *   NE_SOCK_* on error (NE_SOCK_ERROR if the buffer is full),
+ *  >0 number of bytes read. */
+ssize_t ne_sock_fill(ne_socket *sock, size_t limit);
+
+/* Returns a pointer to the data buffered for reading from the socket
+ * (which will be returned by subsequent reads), and sets '*len' to
+ * its length. */
+const char *ne_sock_buffered(const ne_socket *sock, size_t *len);
+
+/* Discards the first 'len' bytes of the data buffered for reading
+ * from the socket; 'len' must not exceed the length returned by
+ * ne_sock_buffered. */
+void ne_sock_consume(ne_socket *sock, size_t len);
+
 /* Reads an LF-terminated line into 'buffer', and NUL-terminate it.
  * At most 'len' bytes are read (including the NUL terminator).
  * Returns:
@@ -176,6 +305,16 @@ const char *ne_sock_error(const ne_socket *sock);
 /* Set read timeout for socket. */
 void ne_sock_read_timeout(ne_socket *sock, int timeout);
 
+/* Set the size of the socket's read buffer to 'size' bytes (the
+ * default is 4096).  A read of at least 'size' bytes when the buffer
+ * is empty reads directly into the caller's buffer. */
+void ne_sock_read_buffer(ne_socket *sock, size_t size);
+
+/* Returns the number of system calls made so far to read from the
+ * socket, or wait for it to become readable.  Reads done internally
+ * by the SSL library are not included. */
+unsigned long ne_sock_read_calls(const ne_socket *sock);
+
 /* Negotiate an SSL connection on socket as an SSL server, using given
  * SSL context. */
 int ne_sock_accept_ssl(ne_socket *sock, ne_ssl_context *ctx);
@@ -0,0 +1,795 @@
+/* 
+   Binary tracing of debug output
+   Copyright (C) 1999-2005, Joe Orton <joe@manyfish.co.uk>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+   
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public
+   License along with this library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+   MA 02111-1307, USA
+
+*/
+
+#include "config.h"
+
+#include <sys/types.h>
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_LIMITS_H
+#include <limits.h>
+#endif
+
+#include <stdio.h>
+#include <stddef.h> /* ptrdiff_t */
+#include <errno.h>
+
+#ifdef NE_HAVE_THREADS
+#include <pthread.h>
+#endif
+
+#include "ne_trace.h"
+#include "ne_utils.h"
+#include "ne_alloc.h"
+#include "ne_string.h"
+#include "ne_internal.h"
+
+/* Debug output may be recorded in binary form by ne_debug_trace:
+ * each thread has a ring buffer holding messages as a struct
+ * trace_rec followed by the encoded arguments, stored end to end and
+ * wrapping around the end of the buffer.  The ring size is a power of
+ * two; 'head' and 'tail' count bytes written since the ring was set
+ * up, so the oldest message held starts at 'tail' and the next is
+ * written at 'head'.  The ring is only written by its thread, which
+ * holds 'lock' whilst changing it, so that ne_debug_dump can read it
+ * at any time. */
+struct trace_ring {
+    char *buf; /* the ring, followed by 'size' / 4 bytes of scratch */
+    size_t size;
+    unsigned long head, tail;
+    unsigned int gen; /* value of trace_gen when 'buf' was set up */
+    int owned; /* non-zero if in use by a thread */
+#ifdef NE_HAVE_THREADS
+    pthread_mutex_t lock;
+#endif
+    struct trace_ring *next;
+};
+
+/* The widest integers recorded: long long where the compiler has
+ * it, for the C99 "ll" length modifier and its relatives. */
+#if defined(SIZEOF_LONG_LONG) && defined(LONG_LONG_MAX)
+#define TRACE_LONG_LONG
+#endif
+
+#ifdef TRACE_LONG_LONG
+typedef long long trace_int;
+typedef unsigned long long trace_uint;
+#define TRACE_INT_MOD "ll"
+#else
+typedef long trace_int;
+typedef unsigned long trace_uint;
+#define TRACE_INT_MOD "l"
+#endif
+
+struct trace_rec {
+    size_t len; /* length of encoded arguments */
+    unsigned long seq; /* order in which messages were produced */
+    int ch;
+    const char *fmt;
+};
+
+/* Header of a message written by ne_debug_dump, followed by the
+ * format string including its NUL terminator, and the encoded
+ * arguments. */
+struct dump_rec {
+    unsigned long seq;
+    int ch;
+    unsigned int fmtlen;
+    size_t len;
+};
+
+#define TRACE_MAGIC "NETRACE1"
+#define TRACE_MIN (4096)
+
+static size_t trace_size; /* size of each ring; zero if not tracing */
+static unsigned int trace_gen; /* incremented each time rings reset */
+static unsigned long trace_seq;
+static struct trace_ring *trace_rings;
+
+#ifdef NE_HAVE_THREADS
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static pthread_key_t trace_key;
+
+#define TRACE_LOCK() pthread_mutex_lock(&trace_lock)
+#define TRACE_UNLOCK() pthread_mutex_unlock(&trace_lock)
+#define RING_LOCK(r) pthread_mutex_lock(&(r)->lock)
+#define RING_UNLOCK(r) pthread_mutex_unlock(&(r)->lock)
+
+/* Give up the ring of an exiting thread, to be taken over by the
+ * next new thread; the messages it holds are kept. */
+static void trace_release(void *userdata)
+{
+    struct trace_ring *ring = userdata;
+
+    TRACE_LOCK();
+    ring->owned = 0;
+    TRACE_UNLOCK();
+}
+
+static void trace_key_create(void)
+{
+    pthread_key_create(&trace_key, trace_release);
+}
+#else
+#define TRACE_LOCK() do { } while (0)
+#define TRACE_UNLOCK() do { } while (0)
+#define RING_LOCK(r) do { } while (0)
+#define RING_UNLOCK(r) do { } while (0)
+#endif
+
+/* Returns the sequence number for a new message. */
+static unsigned long trace_next_seq(void)
+{
+#if defined(NE_HAVE_THREADS) && defined(__GNUC__)
+    return __sync_fetch_and_add(&trace_seq, 1);
+#else
+    unsigned long seq;
+
+    TRACE_LOCK();
+    seq = trace_seq++;
+    TRACE_UNLOCK();
+    return seq;
+#endif
+}
+
+/* Returns the ring of the calling thread, ready for use. */
+static struct trace_ring *trace_ring(void)
+{
+    struct trace_ring *ring;
+
+#ifdef NE_HAVE_THREADS
+    pthread_once(&trace_once, trace_key_create);
+    ring = pthread_getspecific(trace_key);
+#else
+    ring = trace_rings;
+#endif
+
+    if (ring == NULL) {
+        TRACE_LOCK();
+        for (ring = trace_rings; ring && ring->owned; ring = ring->next)
+            /* nothing */;
+        if (ring == NULL) {
+            ring = ne_calloc(sizeof *ring);
+#ifdef NE_HAVE_THREADS
+            pthread_mutex_init(&ring->lock, NULL);
+#endif
+            ring->next = trace_rings;
+            trace_rings = ring;
+        }
+        ring->owned = 1;
+        TRACE_UNLOCK();
+#ifdef NE_HAVE_THREADS
+        pthread_setspecific(trace_key, ring);
+#endif
+    }
+
+    if (ring->buf == NULL || ring->gen != trace_gen) {
+        RING_LOCK(ring);
+        if (ring->buf) ne_free(ring->buf);
+        ring->size = trace_size;
+        ring->buf = ne_malloc(ring->size + ring->size / 4);
+        ring->head = ring->tail = 0;
+        ring->gen = trace_gen;
+        RING_UNLOCK(ring);
+    }
+
+    return ring;
+}
+
+/* Copy 'len' bytes between 'data' and the ring at position 'pos'. */
+static void ring_put(struct trace_ring *ring, unsigned long pos,
+                     const void *data, size_t len)
+{
+    size_t off = pos & (ring->size - 1), n = ring->size - off;
+
+    if (n > len) n = len;
+    memcpy(ring->buf + off, data, n);
+    memcpy(ring->buf, (const char *)data + n, len - n);
+}
+
+static void ring_get(const struct trace_ring *ring, unsigned long pos,
+                     void *data, size_t len)
+{
+    size_t off = pos & (ring->size - 1), n = ring->size - off;
+
+    if (n > len) n = len;
+    memcpy(data, ring->buf + off, n);
+    memcpy((char *)data + n, ring->buf, len - n);
+}
+
+/* A conversion specification in a format string. */
+struct conv {
+    enum {
+        CV_INT, CV_UINT, CV_CHAR, CV_DOUBLE, CV_LDOUBLE, CV_STRING,
+        CV_POINTER, CV_PERCENT, CV_UNKNOWN
+    } type;
+    char size; /* length modifier; 'H' for hh and 'q' for ll */
+    int stars; /* number of '*' int arguments */
+    int prec; /* precision, or -1 if none or given by an argument */
+    int prec_star; /* non-zero if the last '*' is the precision */
+    const char *mods; /* start of length modifier, if any */
+    const char *end; /* character following the conversion */
+};
+
+/* Parse the conversion specification beginning with the '%' at 'pct'
+ * into 'cv'. */
+static void parse_conv(const char *pct, struct conv *cv)
+{
+    const char *p = pct + 1;
+
+    cv->size = 0;
+    cv->stars = cv->prec_star = 0;
+    cv->prec = -1;
+
+    p += strspn(p, "-+ #0'");
+    if (*p == '*') {
+        cv->stars++;
+        p++;
+    } else {
+        p += strspn(p, "0123456789");
+    }
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            cv->stars++;
+            cv->prec_star = 1;
+            p++;
+        } else {
+            cv->prec = atoi(p);
+            p += strspn(p, "0123456789");
+        }
+    }
+
+    cv->mods = p;
+    switch (*p) {
+    case 'h': case 'l':
+        cv->size = *p++;
+        if (*p == cv->size) {
+            cv->size = cv->size == 'h' ? 'H' : 'q';
+            p++;
+        }
+        break;
+    case 'q': case 'L': case 'j': case 'z': case 't':
+        cv->size = *p++;
+        break;
+    }
+
+#ifndef TRACE_LONG_LONG
+    /* Arguments of long long type cannot be recorded. */
+    if (cv->size == 'q' || cv->size == 'j') {
+        cv->type = CV_UNKNOWN;
+        cv->end = *p ? p + 1 : p;
+        return;
+    }
+#endif
+
+    switch (*p) {
+    case 'd': case 'i':
+        cv->type = CV_INT;
+        break;
+    case 'u': case 'o': case 'x': case 'X':
+        cv->type = CV_UINT;
+        break;
+    case 'e': case 'E': case 'f': case 'F': case 'g': case 'G':
+    case 'a': case 'A':
+        cv->type = cv->size == 'L' ? CV_LDOUBLE : CV_DOUBLE;
+        break;
+    case 'c':
+        cv->type = cv->size ? CV_UNKNOWN : CV_CHAR;
+        break;
+    case 's':
+        cv->type = cv->size ? CV_UNKNOWN : CV_STRING;
+        break;
+    case 'p':
+        cv->type = CV_POINTER;
+        break;
+    case '%':
+        cv->type = CV_PERCENT;
+        break;
+    default: /* including %n, which is never recorded */
+        cv->type = CV_UNKNOWN;
+        break;
+    }
+
+    cv->end = *p ? p + 1 : p;
+}
+
+/* Append 'len' bytes at 'data' to the 'max' bytes of encoded
+ * arguments at 'buf', of which '*pos' are used.  Returns zero if
+ * there is no room. */
+static int encode(char *buf, size_t max, size_t *pos, 
+                  const void *data, size_t len)
+{
+    if (max - *pos < len)
+        return 0;
+    memcpy(buf + *pos, data, len);
+    *pos += len;
+    return 1;
+}
+
+#define ENCODE(v) do { \
+    if (!encode(buf, max, &pos, &(v), sizeof (v))) return pos; } while (0)
+
+/* Length of an encoded NULL string argument. */
+#define NULL_STRING (UINT_MAX)
+
+/* Encode the arguments 'ap' for format string 'fmt' into at most
+ * 'max' bytes at 'buf'; integers are stored after conversion to the
+ * type given by the length modifier, and strings are copied.
+ * Arguments after one which does not fit, or of an unknown
+ * conversion, are dropped.  Returns the number of bytes used. */
+static size_t trace_encode(char *buf, size_t max, const char *fmt,
+                           va_list ap)
+{
+    const char *pct;
+    struct conv cv;
+    size_t pos = 0;
+
+    for (pct = strchr(fmt, '%'); pct; pct = strchr(cv.end, '%')) {
+        int n, prec;
+
+        parse_conv(pct, &cv);
+        prec = cv.prec;
+
+        for (n = 0; n < cv.stars; n++) {
+            int star = va_arg(ap, int);
+            
+            if (cv.prec_star && n == cv.stars - 1) prec = star;
+            ENCODE(star);
+        }
+
+        switch (cv.type) {
+        case CV_INT: {
+            trace_int v;
+
+            switch (cv.size) {
+            case 'H': v = (signed char)va_arg(ap, int); break;
+            case 'h': v = (short)va_arg(ap, int); break;
+            case 'l': v = va_arg(ap, long); break;
+#ifdef TRACE_LONG_LONG
+            case 'q': case 'j': v = va_arg(ap, long long); break;
+#endif
+            case 'z': v = (ssize_t)va_arg(ap, size_t); break;
+            case 't': v = va_arg(ap, ptrdiff_t); break;
+            default: v = va_arg(ap, int); break;
+            }
+            ENCODE(v);
+        } break;
+        case CV_UINT: {
+            trace_uint v;
+
+            switch (cv.size) {
+            case 'H': v = (unsigned char)va_arg(ap, unsigned int); break;
+            case 'h': v = (unsigned short)va_arg(ap, unsigned int); break;
+            case 'l': v = va_arg(ap, unsigned long); break;
+#ifdef TRACE_LONG_LONG
+            case 'q': case 'j': v = va_arg(ap, unsigned long long); break;
+#endif
+            case 'z': v = va_arg(ap, size_t); break;
+            case 't': v = (size_t)va_arg(ap, ptrdiff_t); break;
+            default: v = va_arg(ap, unsigned int); break;
+            }
+            ENCODE(v);
+        } break;
+        case CV_CHAR: {
+            int v = va_arg(ap, int);
+            ENCODE(v);
+        } break;
+        case CV_DOUBLE: {
+            double v = va_arg(ap, double);
+            ENCODE(v);
+        } break;
+        case CV_LDOUBLE: {
+            long double v = va_arg(ap, long double);
+            ENCODE(v);
+        } break;
+        case CV_POINTER: {
+            void *v = va_arg(ap, void *);
+            ENCODE(v);
+        } break;
+        case CV_STRING: {
+            const char *str = va_arg(ap, const char *), *nul;
+            unsigned int len;
+
+            if (str == NULL) {
+                len = NULL_STRING;
+            } else if (prec >= 0) {
+                nul = memchr(str, '\0', prec);
+                len = nul ? nul - str : prec;
+            } else {
+                len = strlen(str);
+            }
+
+            if (max - pos < sizeof len)
+                return pos;
+            if (str && len > max - pos - sizeof len)
+                len = max - pos - sizeof len; /* truncated */
+            ENCODE(len);
+            if (str) {
+                memcpy(buf + pos, str, len);
+                pos += len;
+            }
+        } break;
+        case CV_PERCENT:
+            break;
+        default:
+            return pos;
+        }
+    }
+
+    return pos;
+}
+
+#undef ENCODE
+
+/* Record the message with format 'fmt' and arguments 'ap' in the ring
+ * of the calling thread, overwriting the oldest messages as
+ * necessary. */
+int ne__trace_record(int ch, const char *fmt, va_list ap)
+{
+    struct trace_ring *ring;
+    char *scratch;
+    struct trace_rec rec;
+    size_t total;
+
+    if (trace_size == 0)
+        return -1;
+
+    /* The arguments are encoded into the scratch space, which only
+     * this thread uses, before the ring is locked. */
+    ring = trace_ring();
+    scratch = ring->buf + ring->size;
+    rec.len = trace_encode(scratch, ring->size / 4, fmt, ap);
+    rec.seq = trace_next_seq();
+    rec.ch = ch;
+    rec.fmt = fmt;
+    total = sizeof rec + rec.len;
+
+    RING_LOCK(ring);
+
+    while (ring->head - ring->tail + total > ring->size) {
+        struct trace_rec old;
+
+        ring_get(ring, ring->tail, &old, sizeof old);
+        ring->tail += sizeof old + old.len;
+    }
+
+    ring_put(ring, ring->head, &rec, sizeof rec);
+    ring_put(ring, ring->head + sizeof rec, scratch, rec.len);
+    ring->head += total;
+
+    RING_UNLOCK(ring);
+    return 0;
+}
+
+int ne_debug_trace(size_t size)
+{
+    struct trace_ring *ring;
+    size_t pow2;
+
+    if (size && size < TRACE_MIN)
+        return -1;
+
+    /* Round down to a power of two. */
+    for (pow2 = size ? TRACE_MIN : 0; pow2 && pow2 * 2 <= size; pow2 *= 2)
+        /* nothing */;
+
+    TRACE_LOCK();
+    for (ring = trace_rings; ring; ring = ring->next) {
+        RING_LOCK(ring);
+        if (ring->buf) ne_free(ring->buf);
+        ring->buf = NULL;
+        RING_UNLOCK(ring);
+    }
+    trace_size = pow2;
+    trace_gen++;
+    TRACE_UNLOCK();
+
+    return 0;
+}
+
+/* Write 'len' bytes at 'data' to 'fd'; returns non-zero on error. */
+static int full_write(int fd, const char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t ret = write(fd, data, len);
+
+        if (ret < 0 && errno == EINTR)
+            continue;
+        else if (ret <= 0)
+            return -1;
+        data += ret;
+        len -= ret;
+    }
+
+    return 0;
+}
+
+int ne_debug_dump(int fd)
+{
+    ne_buffer *out = ne_buffer_create();
+    struct trace_ring *ring;
+    int ret;
+
+    ne_buffer_append(out, TRACE_MAGIC, strlen(TRACE_MAGIC));
+
+    TRACE_LOCK();
+    for (ring = trace_rings; ring; ring = ring->next) {
+        unsigned long pos;
+        struct trace_rec rec;
+
+        RING_LOCK(ring);
+        if (ring->buf == NULL || ring->gen != trace_gen) {
+            RING_UNLOCK(ring);
+            continue;
+        }
+
+        for (pos = ring->tail; ring->head - pos >= sizeof rec; 
+             pos += sizeof rec + rec.len) {
+            struct dump_rec drec;
+            size_t used;
+
+            ring_get(ring, pos, &rec, sizeof rec);
+            if (rec.len > ring->head - pos - sizeof rec)
+                break;
+
+            memset(&drec, 0, sizeof drec);
+            drec.seq = rec.seq;
+            drec.ch = rec.ch;
+            drec.fmtlen = strlen(rec.fmt) + 1;
+            drec.len = rec.len;
+            ne_buffer_append(out, (const char *)&drec, sizeof drec);
+            ne_buffer_append(out, rec.fmt, drec.fmtlen);
+
+            used = ne_buffer_size(out);
+            ne_buffer_grow(out, used + rec.len + 1);
+            ring_get(ring, pos + sizeof rec, out->data + used, rec.len);
+            out->used += rec.len;
+            out->data[out->used - 1] = '\0';
+        }
+        RING_UNLOCK(ring);
+    }
+    TRACE_UNLOCK();
+
+    ret = full_write(fd, out->data, ne_buffer_size(out));
+    ne_buffer_destroy(out);
+    return ret;
+}
+
+/* Fetch 'len' bytes of the 'max' bytes of encoded arguments at 'args'
+ * into 'data', from offset '*pos'.  Returns zero if there are not
+ * enough left. */
+static int decode(const char *args, size_t max, size_t *pos,
+                  void *data, size_t len)
+{
+    if (max - *pos < len)
+        return 0;
+    memcpy(data, args + *pos, len);
+    *pos += len;
+    return 1;
+}
+
+#define DECODE(v) do { \
+    if (!decode(args, max, pos, &(v), sizeof (v))) return 0; } while (0)
+
+/* Write the argument of conversion 'cv', which begins at 'pct', from
+ * the encoded arguments 'args' as for decode.  Returns zero if the
+ * argument was not recorded. */
+static int format_conv(FILE *stream, const struct conv *cv, const char *pct,
+                       const char *args, size_t max, size_t *pos)
+{
+    char spec[100], *sp = spec;
+    const char *p;
+    int stars[2], n;
+
+    if (cv->type == CV_UNKNOWN || cv->mods - pct > 50)
+        return 0;
+
+    for (n = 0; n < cv->stars; n++)
+        DECODE(stars[n]);
+
+    /* Rebuild the specification, with any '*' replaced by the value
+     * given and the length modifier replaced by that of the stored
+     * type. */
+    for (p = pct, n = 0; p < cv->mods; p++) {
+        if (*p == '*')
+            sp += sprintf(sp, "%d", stars[n++]);
+        else
+            *sp++ = *p;
+    }
+    if (cv->type == CV_INT || cv->type == CV_UINT) {
+        strcpy(sp, TRACE_INT_MOD);
+        sp += strlen(TRACE_INT_MOD);
+    } else if (cv->type == CV_LDOUBLE) {
+        *sp++ = 'L';
+    }
+    *sp++ = cv->end[-1];
+    *sp = '\0';
+
+    switch (cv->type) {
+    case CV_INT: {
+        trace_int v;
+        DECODE(v);
+        fprintf(stream, spec, v);
+    } break;
+    case CV_UINT: {
+        trace_uint v;
+        DECODE(v);
+        fprintf(stream, spec, v);
+    } break;
+    case CV_CHAR: {
+        int v;
+        DECODE(v);
+        fprintf(stream, spec, v);
+    } break;
+    case CV_DOUBLE: {
+        double v;
+        DECODE(v);
+        fprintf(stream, spec, v);
+    } break;
+    case CV_LDOUBLE: {
+        long double v;
+        DECODE(v);
+        fprintf(stream, spec, v);
+    } break;
+    case CV_POINTER: {
+        void *v;
+        DECODE(v);
+        fprintf(stream, spec, v);
+    } break;
+    default: { /* CV_STRING */
+        unsigned int len;
+        char *str;
+
+        DECODE(len);
+        if (len == NULL_STRING) {
+            fprintf(stream, spec, "(null)");
+            break;
+        } else if (max - *pos < len) {
+            return 0;
+        }
+        str = ne_strndup(args + *pos, len);
+        *pos += len;
+        fprintf(stream, spec, str);
+        ne_free(str);
+    } break;
+    }
+
+    return 1;
+}
+
+#undef DECODE
+
+/* Write the message with format 'fmt' and 'len' bytes of encoded
+ * arguments 'args' to 'stream'.  Any part of the message for which
+ * arguments were not recorded is written as the format string. */
+static void trace_format(FILE *stream, const char *fmt, 
+                         const char *args, size_t len)
+{
+    const char *pnt = fmt, *pct;
+    struct conv cv;
+    size_t pos = 0;
+
+    while ((pct = strchr(pnt, '%')) != NULL) {
+        fwrite(pnt, 1, pct - pnt, stream);
+        pnt = pct;
+        parse_conv(pct, &cv);
+        if (cv.type == CV_PERCENT)
+            putc('%', stream);
+        else if (!format_conv(stream, &cv, pct, args, len, &pos))
+            break;
+        pnt = cv.end;
+    }
+
+    fputs(pnt, stream);
+}
+
+/* A message read from a dumped trace. */
+struct dumped {
+    unsigned long seq;
+    const char *fmt, *args;
+    size_t len;
+};
+
+static int cmp_dumped(const void *a, const void *b)
+{
+    const struct dumped *da = a, *db = b;
+
+    return da->seq < db->seq ? -1 : da->seq > db->seq;
+}
+
+int ne_debug_decode(int fd, FILE *stream)
+{
+    const size_t mlen = strlen(TRACE_MAGIC);
+    ne_buffer *in = ne_buffer_create();
+    struct dumped *msgs = NULL;
+    size_t count = 0, alloc = 0, pos, n;
+    char block[BUFSIZ];
+    ssize_t ret;
+    int failed = 0;
+
+    while ((ret = read(fd, block, sizeof block)) != 0) {
+        if (ret < 0 && errno == EINTR)
+            continue;
+        else if (ret < 0) {
+            ne_buffer_destroy(in);
+            return -1;
+        }
+        ne_buffer_append(in, block, ret);
+    }
+
+    for (pos = 0; pos < ne_buffer_size(in); ) {
+        struct dump_rec drec;
+
+        if (ne_buffer_size(in) - pos >= mlen
+            && memcmp(in->data + pos, TRACE_MAGIC, mlen) == 0) {
+            pos += mlen;
+            continue;
+        } else if (pos == 0 || ne_buffer_size(in) - pos < sizeof drec) {
+            failed = 1;
+            break;
+        }
+
+        memcpy(&drec, in->data + pos, sizeof drec);
+        pos += sizeof drec;
+        if (drec.fmtlen == 0 || ne_buffer_size(in) - pos < drec.fmtlen
+            || in->data[pos + drec.fmtlen - 1] != '\0'
+            || ne_buffer_size(in) - pos - drec.fmtlen < drec.len) {
+            failed = 1;
+            break;
+        }
+
+        if (count == alloc) {
+            alloc = alloc ? alloc * 2 : 256;
+            msgs = ne_realloc(msgs, alloc * sizeof *msgs);
+        }
+        msgs[count].seq = drec.seq;
+        msgs[count].fmt = in->data + pos;
+        msgs[count].args = in->data + pos + drec.fmtlen;
+        msgs[count].len = drec.len;
+        count++;
+        pos += drec.fmtlen + drec.len;
+    }
+
+    /* Messages from all threads are written in the order they were
+     * produced; a message found in more than one dump is written
+     * once. */
+    if (count) 
+        qsort(msgs, count, sizeof *msgs, cmp_dumped);
+    for (n = 0; n < count; n++) {
+        if (n == 0 || msgs[n].seq != msgs[n - 1].seq)
+            trace_format(stream, msgs[n].fmt, msgs[n].args, msgs[n].len);
+    }
+    fflush(stream);
+
+    if (msgs) ne_free(msgs);
+    ne_buffer_destroy(in);
+    return failed ? -1 : 0;
+}
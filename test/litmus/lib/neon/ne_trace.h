@@ -0,0 +1,69 @@
+/* 
+   Binary tracing of debug output
+   Copyright (C) 1999-2005, Joe Orton <joe@manyfish.co.uk>
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+   
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public
+   License along with this library; if not, write to the Free
+   Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+   MA 02111-1307, USA
+
+*/
+
+#ifndef NE_TRACE_H
+#define NE_TRACE_H
+
+#include <sys/types.h>
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "ne_defs.h"
+
+BEGIN_NEON_DECLS
+
+/* Record debug output in binary form in a ring buffer of 'size'
+ * bytes for each thread, rather than writing it to the debug stream;
+ * the channels recorded are still those enabled by ne_debug_init.
+ * Arguments are copied when a message is recorded, and formatting is
+ * deferred until the trace is decoded; once a ring is full, the
+ * oldest messages in it are overwritten.  Passing 'size' as zero
+ * discards the rings and returns to writing to the debug stream.
+ * This must not be called whilst other threads may be producing
+ * debug output or calling ne_debug_dump.  Returns non-zero if 'size'
+ * is too small. */
+int ne_debug_trace(size_t size);
+
+/* Append the messages held in the trace rings to file descriptor
+ * 'fd', in a binary form which can be decoded by ne_debug_decode on
+ * the same platform.  The rings are not emptied, and other threads
+ * may go on producing debug output meanwhile.  Returns zero on
+ * success, or non-zero if the trace could not be written. */
+int ne_debug_dump(int fd);
+
+/* Read a trace written by one or more calls to ne_debug_dump from
+ * file descriptor 'fd', and write the messages in the order they were
+ * produced to 'stream', formatted exactly as ne_debug would have
+ * written them.  Returns zero on success, or non-zero if the trace
+ * could not be read or is corrupt. */
+int ne_debug_decode(int fd, FILE *stream);
+
+/* For internal use by ne_debug: records the message with format
+ * 'fmt' and arguments 'ap' on channel 'ch' if tracing is enabled.
+ * Returns zero if the message was recorded, or non-zero if it should
+ * be written to the debug stream, in which case 'ap' may have been
+ * consumed. */
+int ne__trace_record(int ch, const char *fmt, va_list ap);
+
+END_NEON_DECLS
+
+#endif /* NE_TRACE_H */
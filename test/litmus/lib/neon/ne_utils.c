@@ -50,6 +50,7 @@
 #endif
 
 #include "ne_utils.h"
+#include "ne_trace.h"
 #include "ne_string.h" /* for ne_strdup */
 #include "ne_dates.h"
 
@@ -71,12 +72,17 @@ void ne_debug(int ch, const char *template, ...)
 {
     va_list params;
     if ((ch & ne_debug_mask) == 0) return;
-    fflush(stdout);
     va_start(params, template);
-    vfprintf(ne_debug_stream, template, params);
+    if (ne__trace_record(ch, template, params)) {
+        /* The arguments may have been consumed; start again. */
+        va_end(params);
+        va_start(params, template);
+        fflush(stdout);
+        vfprintf(ne_debug_stream, template, params);
+        if ((ch & NE_DBG_FLUSH) == NE_DBG_FLUSH)
+            fflush(ne_debug_stream);
+    }
     va_end(params);
-    if ((ch & NE_DBG_FLUSH) == NE_DBG_FLUSH)
-	fflush(ne_debug_stream);
 }
 
 #define NE_STRINGIFY(x) # x
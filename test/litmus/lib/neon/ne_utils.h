@@ -62,6 +62,10 @@ int ne_has_support(int feature);
 
 #ifndef NE_DEBUGGING
 #define NE_DEBUG if (0) ne_debug
+#elif defined(__GNUC__) || (defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L)
+/* The channel mask is checked before the arguments are evaluated. */
+#define NE_DEBUG(ch, ...) \
+    do { if ((ch) & ne_debug_mask) ne_debug((ch), __VA_ARGS__); } while (0)
 #else /* DEBUGGING */
 #define NE_DEBUG ne_debug
 #endif /* DEBUGGING */
@@ -75,6 +79,7 @@ int ne_has_support(int feature);
 #define NE_DBG_XMLPARSE (1<<6)
 #define NE_DBG_HTTPBODY (1<<7)
 #define NE_DBG_SSL (1<<8)
+#define NE_DBG_TIMING (1<<9)
 #define NE_DBG_FLUSH (1<<30)
 
 /* Send debugging output to 'stream', for all of the given debug
@@ -31,6 +31,8 @@
 #include <strings.h>
 #endif
 
+#include <stddef.h>
+
 #include "ne_i18n.h"
 
 #include "ne_alloc.h"
@@ -83,30 +85,97 @@ static void sax_error(void *ctx, const char *msg, ...);
 #endif
 
 struct element {
-    const ne_xml_char *nspace;
-    ne_xml_char *name;
+    const ne_xml_char *nspace; /* interned namespace URI */
+    const ne_xml_char *name; /* interned local name */
 
     int state; /* opaque state integer */
     
-    /* Namespaces declared in this element */
-    ne_xml_char *default_ns; /* A default namespace */
-    struct namespace *nspaces; /* List of other namespace scopes */
+    /* Namespaces declared in this element, which are undone at its
+     * end: the default namespace it replaced, if it declared one, and
+     * the prefix bindings from index 'nsbase' of the parser's binding
+     * stack. */
+    unsigned int has_default:1;
+    const ne_xml_char *prev_default;
+    unsigned int nsbase;
 
     struct handler *handler; /* Handler for this element */
+};
+
+/* An interned string.  If the string is used as a namespace prefix,
+ * 'uri' is the (interned) namespace URI now bound to the prefix, or
+ * NULL if it is not bound. */
+struct atom {
+    struct atom *next; /* next atom in hash chain */
+    unsigned int hash;
+    size_t len;
+    const ne_xml_char *uri;
+    unsigned int pinned:1; /* interned by ne_xml_intern */
+    unsigned int live:1; /* in use by the current branch, when sweeping */
+    ne_xml_char str[1];
+};
 
-    struct element *parent; /* parent element, or NULL */    
+/* Return the atom of interned string 'str'. */
+#define ATOM_OF(str) \
+    ((struct atom *)((char *)(str) - offsetof(struct atom, str)))
+
+/* Initial number of hash chains for interned strings; must be a power
+ * of two.  The table is doubled when there are more strings than
+ * chains. */
+#define ATOM_CHAINS (64)
+
+/* Once more strings than this have been interned, those not in use by
+ * the current branch nor interned by ne_xml_intern are discarded at
+ * the next start-tag. */
+#define ATOM_LIMIT (4096)
+/* Hash iteration step: *33 known to be a good hash for ASCII, see RSE. */
+#define ATOM_ITERATE(hash, ch) ((hash)*33 + (unsigned char)(ch))
+
+/* An index of an idmap array used with a parser: an open-addressed
+ * hash table of the positions of the map entries, by the hash of
+ * their names and namespaces.  The names of the first and last
+ * entries are kept to catch a different map at the same address. */
+struct idindex {
+    const struct ne_xml_idmap *map;
+    size_t maplen;
+    const char *first, *last;
+    unsigned int mask;
+    struct idindex *next;
+    size_t slots[1]; /* position in map + 1, or zero if empty */
 };
 
+/* Maps smaller than this are scanned rather than indexed. */
+#define IDINDEX_MIN (4)
+
+/* Initial sizes of the element and namespace binding stacks, which
+ * are doubled as needed, and never shrunk. */
+#define ELEMENTS_INIT (16)
+#define NSPACES_INIT (8)
+
 /* We pass around a ne_xml_parser as the userdata in the parsing
  * library.  This maintains the current state of the parse and various
  * other bits and bobs. Within the parse, we store the current branch
  * of the tree, i.e., the current element and all its parents, up to
- * the root, but nothing other than that.  */
+ * the root, but nothing other than that.  The branch is held in an
+ * array reused from element to element, so elements are not
+ * allocated individually; likewise the namespace bindings. */
 struct ne_xml_parser_s {
-    struct element *root; /* the root of the document */
-    struct element *current; /* current element in the branch */
+    /* the current branch: elements[0] is a placeholder for the root
+     * of the document, and elements[depth] the current element;
+     * 'nelements' are allocated. */
+    struct element *elements;
+    unsigned int depth, nelements;
+    /* stack of 'nnspaces' namespace bindings; 'nsalloc' allocated. */
+    struct namespace *nspaces;
+    unsigned int nnspaces, nsalloc;
     struct handler *top_handlers; /* always points at the 
 					   * handler on top of the stack. */
+    /* Interned namespace URIs, prefixes and local names: hash table
+     * of 'atommask' + 1 chains, holding 'natoms' strings. */
+    struct atom **atoms;
+    unsigned int atommask, natoms;
+    unsigned int atomlimit; /* number of atoms at which to sweep */
+    struct idindex *idindexes; /* indexes of idmaps used with parser */
+    const ne_xml_char *default_ns; /* current default namespace */
     int failure; /* zero whilst parse should continue */
     int prune; /* if non-zero, depth within a dead branch */
 
@@ -127,14 +196,14 @@ struct ne_xml_parser_s {
 static void start_element(void *userdata, const ne_xml_char *name, const ne_xml_char **atts);
 static void end_element(void *userdata, const ne_xml_char *name);
 static void char_data(void *userdata, const ne_xml_char *cdata, int len);
-static const char *resolve_nspace(const struct element *elm, 
+static const char *resolve_nspace(ne_xml_parser *p,
                                   const char *prefix, size_t pfxlen);
 
-/* Linked list of namespace scopes */
+/* A namespace prefix binding made by an element: the prefix, and the
+ * URI previously bound to it, if any. */
 struct namespace {
-    ne_xml_char *name;
-    ne_xml_char *uri;
-    struct namespace *next;
+    struct atom *prefix;
+    const ne_xml_char *prev_uri;
 };
 
 #ifdef HAVE_LIBXML
@@ -223,6 +292,136 @@ const char *ne_xml_doc_encoding(const ne_xml_parser *p)
  * also be rejected but will be allowed for the time being. */
 #define invalid_ncname(xn) (invalid_ncname_ch1((xn)[0]))
 
+/* Return the hash value of 'len' bytes of 'str'. */
+static unsigned int hash_string(const ne_xml_char *str, size_t len)
+{
+    unsigned int hash = 0;
+
+    while (len--)
+        hash = ATOM_ITERATE(hash, *str++);
+    return hash;
+}
+
+/* Return the atom for 'len' bytes of 'str', which have hash value
+ * 'hash', or NULL if they have not been interned. */
+static struct atom *find_atom(const ne_xml_parser *p, const ne_xml_char *str,
+                              size_t len, unsigned int hash)
+{
+    struct atom *a;
+
+    for (a = p->atoms[hash & p->atommask]; a; a = a->next)
+        if (a->hash == hash && a->len == len 
+            && memcmp(a->str, str, len) == 0)
+            return a;
+
+    return NULL;
+}
+
+/* Return the atom for 'len' bytes of 'str', interning them if
+ * necessary. */
+static struct atom *intern(ne_xml_parser *p, const ne_xml_char *str,
+                           size_t len)
+{
+    unsigned int hash = hash_string(str, len);
+    struct atom *a = find_atom(p, str, len, hash);
+
+    if (a) return a;
+
+    if (p->natoms > p->atommask) {
+        /* Double the number of chains. */
+        unsigned int n, mask = p->atommask * 2 + 1;
+        struct atom **atoms = ne_calloc((mask + 1) * sizeof *atoms);
+
+        for (n = 0; n <= p->atommask; n++) {
+            struct atom *next;
+
+            for (a = p->atoms[n]; a; a = next) {
+                next = a->next;
+                a->next = atoms[a->hash & mask];
+                atoms[a->hash & mask] = a;
+            }
+        }
+        ne_free(p->atoms);
+        p->atoms = atoms;
+        p->atommask = mask;
+    }
+
+    a = ne_malloc(sizeof *a + len);
+    memcpy(a->str, str, len);
+    a->str[len] = '\0';
+    a->len = len;
+    a->hash = hash;
+    a->uri = NULL;
+    a->pinned = a->live = 0;
+    a->next = p->atoms[hash & p->atommask];
+    p->atoms[hash & p->atommask] = a;
+    p->natoms++;
+
+    return a;
+}
+
+const char *ne_xml_intern(ne_xml_parser *p, const char *str)
+{
+    struct atom *a = intern(p, (const ne_xml_char *)str, strlen(str));
+
+    a->pinned = 1;
+    return a->str;
+}
+
+/* Mark interned string 'str' as in use, if non-NULL. */
+static void mark_atom(const ne_xml_char *str)
+{
+    if (str) ATOM_OF(str)->live = 1;
+}
+
+/* Discard the interned strings which are neither in use by the
+ * current branch nor pinned, so the table does not grow with every
+ * distinct name in the document. */
+static void sweep_atoms(ne_xml_parser *p)
+{
+    unsigned int n;
+
+    mark_atom(p->default_ns);
+    for (n = 1; n <= p->depth; n++) {
+        const struct element *elm = &p->elements[n];
+
+        mark_atom(elm->nspace);
+        mark_atom(elm->name);
+        if (elm->has_default) mark_atom(elm->prev_default);
+    }
+    for (n = 0; n < p->nnspaces; n++) {
+        const struct namespace *ns = &p->nspaces[n];
+
+        ns->prefix->live = 1;
+        mark_atom(ns->prefix->uri);
+        mark_atom(ns->prev_uri);
+    }
+
+    for (n = 0; n <= p->atommask; n++) {
+        struct atom **ptr = &p->atoms[n];
+
+        while (*ptr) {
+            struct atom *a = *ptr;
+
+            if (a->live || a->pinned) {
+                a->live = 0;
+                ptr = &a->next;
+            } else {
+                *ptr = a->next;
+                ne_free(a);
+                p->natoms--;
+            }
+        }
+    }
+
+    NE_DEBUG(NE_DBG_XML, "XML: %u strings interned after sweep.\n",
+             p->natoms);
+
+    /* If most strings are still in use, wait for twice as many before
+     * sweeping again. */
+    p->atomlimit = p->natoms * 2 > ATOM_LIMIT ? p->natoms * 2 : ATOM_LIMIT;
+}
+
 /* Extract the namespace prefix declarations from 'atts'. */
 static int declare_nspaces(ne_xml_parser *p, struct element *elm,
                            const ne_xml_char **atts)
@@ -232,7 +431,11 @@ static int declare_nspaces(ne_xml_parser *p, struct element *elm,
     for (n = 0; atts && atts[n]; n += 2) {
         if (strcmp(atts[n], "xmlns") == 0) {
             /* New default namespace */
-            elm->default_ns = ne_strdup(atts[n+1]);
+            if (!elm->has_default) {
+                elm->has_default = 1;
+                elm->prev_default = p->default_ns;
+            }
+            p->default_ns = intern(p, atts[n+1], strlen(atts[n+1]))->str;
         } else if (strncmp(atts[n], "xmlns:", 6) == 0) {
             struct namespace *ns;
             
@@ -245,12 +448,16 @@ static int declare_nspaces(ne_xml_parser *p, struct element *elm,
                 return -1;
             }
 
-            /* New namespace scope */
-            ns = ne_calloc(sizeof(*ns));
-            ns->next = elm->nspaces;
-            elm->nspaces = ns;
-            ns->name = ne_strdup(atts[n]+6); /* skip the xmlns= */
-            ns->uri = ne_strdup(atts[n+1]);
+            /* New namespace scope; skip the xmlns: */
+            if (p->nnspaces == p->nsalloc) {
+                p->nsalloc *= 2;
+                p->nspaces = ne_realloc(p->nspaces, 
+                                        p->nsalloc * sizeof *p->nspaces);
+            }
+            ns = &p->nspaces[p->nnspaces++];
+            ns->prefix = intern(p, atts[n] + 6, strlen(atts[n] + 6));
+            ns->prev_uri = ns->prefix->uri;
+            ns->prefix->uri = intern(p, atts[n+1], strlen(atts[n+1]))->str;
         }
     }
     
@@ -266,25 +473,18 @@ static int expand_qname(ne_xml_parser *p, struct element *elm,
 
     pfx = strchr(qname, ':');
     if (pfx == NULL) {
-        struct element *e = elm;
-
-        /* Find default namespace; guaranteed to terminate as the root
-         * element always has default_ns="". */
-        while (e->default_ns == NULL)
-            e = e->parent;
-        
-        elm->name = ne_strdup(qname);
-        elm->nspace = e->default_ns;
+        elm->name = intern(p, qname, strlen(qname))->str;
+        elm->nspace = p->default_ns;
     } else if (invalid_ncname(pfx + 1) || qname == pfx) {
         ne_snprintf(p->error, ERR_SIZE, 
                     _("XML parse error at line %d: invalid element name"), 
                     ne_xml_currentline(p));
         return -1;
     } else {
-        const char *uri = resolve_nspace(elm, qname, pfx-qname);
+        const char *uri = resolve_nspace(p, qname, pfx-qname);
 
 	if (uri) {
-	    elm->name = ne_strdup(pfx+1);
+	    elm->name = intern(p, pfx + 1, strlen(pfx + 1))->str;
             elm->nspace = uri;
 	} else {
 	    ne_snprintf(p->error, ERR_SIZE, 
@@ -301,7 +501,7 @@ static void start_element(void *userdata, const ne_xml_char *name,
 			  const ne_xml_char **atts) 
 {
     ne_xml_parser *p = userdata;
-    struct element *elm;
+    struct element *elm, *parent;
     struct handler *hand;
     int state = NE_XML_DECLINE;
 
@@ -312,10 +512,21 @@ static void start_element(void *userdata, const ne_xml_char *name,
         return;
     }
 
-    /* Create a new element */
-    elm = ne_calloc(sizeof *elm);
-    elm->parent = p->current;
-    p->current = elm;
+    if (p->natoms >= p->atomlimit)
+        sweep_atoms(p);
+
+    /* Push a new element */
+    if (p->depth + 1 == p->nelements) {
+        p->nelements *= 2;
+        p->elements = ne_realloc(p->elements,
+                                 p->nelements * sizeof *p->elements);
+    }
+    parent = &p->elements[p->depth++];
+    elm = parent + 1;
+    elm->state = 0;
+    elm->has_default = 0;
+    elm->nsbase = p->nnspaces;
+    elm->handler = NULL;
 
     if (declare_nspaces(p, elm, atts) || expand_qname(p, elm, name)) {
         p->failure = 1;
@@ -323,15 +534,15 @@ static void start_element(void *userdata, const ne_xml_char *name,
     }
 
     /* Find a handler which will accept this element (or abort the parse) */
-    for (hand = elm->parent->handler; hand && state == NE_XML_DECLINE;
+    for (hand = parent->handler; hand && state == NE_XML_DECLINE;
          hand = hand->next) {
         elm->handler = hand;
-        state = hand->startelm_cb(hand->userdata, elm->parent->state,
+        state = hand->startelm_cb(hand->userdata, parent->state,
                                   elm->nspace, elm->name, PASS_ATTS(atts));
     }
 
     NE_DEBUG(NE_DBG_XML, "XML: start-element (%d, {%s, %s}) => %d\n", 
-             elm->parent->state, elm->nspace, elm->name, state);             
+             parent->state, elm->nspace, elm->name, state);             
     
     if (state > 0)
         elm->state = state;
@@ -342,30 +553,25 @@ static void start_element(void *userdata, const ne_xml_char *name,
         p->failure = state;
 }
 
-/* Destroys an element structure. */
-static void destroy_element(struct element *elm) 
+/* Pops the current element, undoing its namespace declarations. */
+static void pop_element(ne_xml_parser *p) 
 {
-    struct namespace *this_ns, *next_ns;
-    ne_free(elm->name);
-    /* Free the namespaces */
-    this_ns = elm->nspaces;
-    while (this_ns != NULL) {
-	next_ns = this_ns->next;
-	ne_free(this_ns->name);
-	ne_free(this_ns->uri);
-	ne_free(this_ns);
-	this_ns = next_ns;
+    struct element *elm = &p->elements[p->depth--];
+
+    /* Restore the bindings in the reverse order they were made. */
+    while (p->nnspaces > elm->nsbase) {
+        struct namespace *ns = &p->nspaces[--p->nnspaces];
+        ns->prefix->uri = ns->prev_uri;
     }
-    if (elm->default_ns)
-        ne_free(elm->default_ns);
-    ne_free(elm);
+    if (elm->has_default)
+        p->default_ns = elm->prev_default;
 }
 
 /* cdata SAX callback */
 static void char_data(void *userdata, const ne_xml_char *data, int len) 
 {
     ne_xml_parser *p = userdata;
-    struct element *elm = p->current;
+    struct element *elm = &p->elements[p->depth];
 
     if (p->failure || p->prune) return;
     
@@ -380,7 +586,7 @@ static void char_data(void *userdata, const ne_xml_char *data, int len)
 static void end_element(void *userdata, const ne_xml_char *name) 
 {
     ne_xml_parser *p = userdata;
-    struct element *elm = p->current;
+    struct element *elm = &p->elements[p->depth];
 
     if (p->failure) return;
 	
@@ -399,40 +605,34 @@ static void end_element(void *userdata, const ne_xml_char *name)
              elm->state, elm->nspace, elm->name);
 
     /* move back up the tree */
-    p->current = elm->parent;
     p->prune = 0;
-
-    destroy_element(elm);
+    pop_element(p);
 }
 
-/* Find a namespace definition for 'prefix' in given element, where
- * length of prefix is 'pfxlen'.  Returns the URI or NULL. */
-static const char *resolve_nspace(const struct element *elm, 
+/* Find the namespace now bound to 'prefix', where length of prefix
+ * is 'pfxlen'.  Returns the URI or NULL. */
+static const char *resolve_nspace(ne_xml_parser *p,
                                   const char *prefix, size_t pfxlen)
 {
-    const struct element *s;
-
-    /* Search up the tree. */
-    for (s = elm; s != NULL; s = s->parent) {
-	const struct namespace *ns;
-	/* Iterate over defined spaces on this node. */
-	for (ns = s->nspaces; ns != NULL; ns = ns->next) {
-	    if (strlen(ns->name) == pfxlen && 
-		memcmp(ns->name, prefix, pfxlen) == 0)
-		return ns->uri;
-	}
-    }
+    struct atom *a = find_atom(p, prefix, pfxlen, 
+                               hash_string(prefix, pfxlen));
 
-    return NULL;
+    return a ? a->uri : NULL;
 }
 
 ne_xml_parser *ne_xml_create(void) 
 {
     ne_xml_parser *p = ne_calloc(sizeof *p);
     /* Placeholder for the root element */
-    p->current = p->root = ne_calloc(sizeof *p->root);
-    p->root->default_ns = "";
-    p->root->state = 0;
+    p->nelements = ELEMENTS_INIT;
+    p->elements = ne_calloc(ELEMENTS_INIT * sizeof *p->elements);
+    p->elements[0].state = 0;
+    p->nsalloc = NSPACES_INIT;
+    p->nspaces = ne_malloc(NSPACES_INIT * sizeof *p->nspaces);
+    p->atommask = ATOM_CHAINS - 1;
+    p->atoms = ne_calloc(ATOM_CHAINS * sizeof *p->atoms);
+    p->atomlimit = ATOM_LIMIT;
+    p->default_ns = ne_xml_intern(p, "");
     strcpy(p->error, _("Unknown error"));
 #ifdef HAVE_EXPAT
     p->parser = XML_ParserCreate(NULL);
@@ -470,7 +670,7 @@ void ne_xml_push_handler(ne_xml_parser *p,
     /* If this is the first handler registered, update the
      * base pointer too. */
     if (p->top_handlers == NULL) {
-	p->root->handler = hand;
+	p->elements[0].handler = hand;
 	p->top_handlers = hand;
     } else {
 	p->top_handlers->next = hand;
@@ -559,24 +759,34 @@ int ne_xml_failed(ne_xml_parser *p)
 
 void ne_xml_destroy(ne_xml_parser *p) 
 {
-    struct element *elm, *parent;
     struct handler *hand, *next;
+    unsigned int n;
 
     /* Free up the handlers on the stack: the root element has the
      * pointer to the base of the handler stack. */
-    for (hand = p->root->handler; hand!=NULL; hand=next) {
+    for (hand = p->elements[0].handler; hand!=NULL; hand=next) {
 	next = hand->next;
 	ne_free(hand);
     }
 
-    /* Clean up remaining elements */
-    for (elm = p->current; elm != p->root; elm = parent) {
-	parent = elm->parent;
-	destroy_element(elm);
+    ne_free(p->elements);
+    ne_free(p->nspaces);
+
+    for (n = 0; n <= p->atommask; n++) {
+        struct atom *a, *next;
+
+        for (a = p->atoms[n]; a; a = next) {
+            next = a->next;
+            ne_free(a);
+        }
     }
+    ne_free(p->atoms);
 
-    /* free root element */
-    ne_free(p->root);
+    while (p->idindexes) {
+        struct idindex *idx = p->idindexes;
+        p->idindexes = idx->next;
+        ne_free(idx);
+    }
 
 #ifdef HAVE_EXPAT
     XML_ParserFree(p->parser);
@@ -633,8 +843,7 @@ ne_xml_get_attr(ne_xml_parser *p, const char **attrs,
 	    /* If a namespace is given, and the local part matches,
 	     * then resolve the namespace and compare that too. */
 	    if (strcmp(pnt + 1, name) == 0) {
-		const char *uri = resolve_nspace(p->current, 
-						 attrs[n], pnt - attrs[n]);
+		const char *uri = resolve_nspace(p, attrs[n], pnt - attrs[n]);
 		if (uri && strcmp(uri, nspace) == 0)
 		    return attrs[n+1];
 	    }
@@ -644,6 +853,64 @@ ne_xml_get_attr(ne_xml_parser *p, const char **attrs,
     return NULL;
 }
 
+/* Return the hash value of the name 'name' in namespace 'nspace'. */
+static unsigned int hash_idname(const char *nspace, const char *name)
+{
+    unsigned int hash = 0;
+
+    for (; *name; name++)
+        hash = ATOM_ITERATE(hash, *name);
+    hash = ATOM_ITERATE(hash, ' ');
+    for (; *nspace; nspace++)
+        hash = ATOM_ITERATE(hash, *nspace);
+    return hash;
+}
+
+/* Return parser p's index of 'map', of length 'maplen', creating it
+ * if necessary. */
+static struct idindex *get_idindex(ne_xml_parser *p,
+                                   const struct ne_xml_idmap map[],
+                                   size_t maplen)
+{
+    struct idindex **ptr, *idx;
+    unsigned int size;
+    size_t n;
+
+    for (ptr = &p->idindexes; (idx = *ptr) != NULL; ptr = &idx->next) {
+        if (idx->map == map && idx->maplen == maplen) {
+            if (idx->first == map[0].name 
+                && idx->last == map[maplen-1].name)
+                return idx;
+            /* Another map now lives at this address. */
+            *ptr = idx->next;
+            ne_free(idx);
+            break;
+        }
+    }
+
+    for (size = 8; size < maplen * 2; size *= 2)
+        /* nothing */;
+
+    idx = ne_calloc(sizeof *idx + (size - 1) * sizeof idx->slots[0]);
+    idx->map = map;
+    idx->maplen = maplen;
+    idx->first = map[0].name;
+    idx->last = map[maplen-1].name;
+    idx->mask = size - 1;
+
+    for (n = 0; n < maplen; n++) {
+        unsigned int slot = hash_idname(map[n].nspace, map[n].name);
+
+        while (idx->slots[slot & idx->mask])
+            slot++;
+        idx->slots[slot & idx->mask] = n + 1;
+    }
+
+    idx->next = p->idindexes;
+    p->idindexes = idx;
+    return idx;
+}
+
 int ne_xml_mapid(const struct ne_xml_idmap map[], size_t maplen,
                  const char *nspace, const char *name)
 {
@@ -656,3 +923,24 @@ int ne_xml_mapid(const struct ne_xml_idmap map[], size_t maplen,
     
     return 0;
 }
+
+int ne_xml_parser_mapid(ne_xml_parser *p, const struct ne_xml_idmap map[],
+                        size_t maplen, const char *nspace, const char *name)
+{
+    const struct idindex *idx;
+    unsigned int slot;
+    size_t n;
+    
+    if (maplen < IDINDEX_MIN)
+        return ne_xml_mapid(map, maplen, nspace, name);
+
+    idx = get_idindex(p, map, maplen);
+
+    for (slot = hash_idname(nspace, name); 
+         (n = idx->slots[slot & idx->mask]) != 0; slot++)
+        if (strcmp(name, map[n-1].name) == 0 &&
+            strcmp(nspace, map[n-1].nspace) == 0)
+            return map[n-1].id;
+    
+    return 0;
+}
@@ -125,6 +125,15 @@ const char *ne_xml_get_attr(ne_xml_parser *parser,
 			    const char **attrs, const char *nspace, 
 			    const char *name);
 
+/* Return the interned copy of string 'str' for parser 'p'.  The
+ * namespace URIs and element names passed to the callbacks of a
+ * parser are interned, so are equal to an interned string only if
+ * they are the same pointer.  A string returned by ne_xml_intern
+ * remains valid until the parser is destroyed; the names passed to
+ * the callbacks for an element only until its end-element callback
+ * returns. */
+const char *ne_xml_intern(ne_xml_parser *p, const char *str);
+
 /* Return the encoding of the document being parsed.  May return NULL
  * if no encoding is defined or if the XML declaration has not yet
  * been parsed. */
@@ -143,6 +152,12 @@ struct ne_xml_idmap {
 int ne_xml_mapid(const struct ne_xml_idmap map[], size_t maplen,
                  const char *nspace, const char *name);
 
+/* As ne_xml_mapid, using an index of 'map' which parser 'p' builds
+ * on first use and keeps until it is destroyed; the map must not be
+ * modified whilst in use with the parser. */
+int ne_xml_parser_mapid(ne_xml_parser *p, const struct ne_xml_idmap map[],
+                        size_t maplen, const char *nspace, const char *name);
+
 /* media type, appropriate for adding to a Content-Type header */
 #define NE_XML_MEDIA_TYPE "application/xml"
 
@@ -22,15 +22,16 @@
 #include "config.h"
 
 #include "ne_xmlreq.h"
+#include "ne_private.h"
 #include "ne_i18n.h"
 
 /* Handle an XML response parse error, setting session error string
- * and closing the connection. */
-static int parse_error(ne_session *sess, ne_xml_parser *parser)
+ * and closing the connection used by 'req'. */
+static int parse_error(ne_request *req, ne_xml_parser *parser)
 {
-    ne_set_error(sess, _("Could not parse response: %s"),
+    ne_set_error(ne_get_session(req), _("Could not parse response: %s"),
                  ne_xml_get_error(parser));
-    ne_close_connection(sess);
+    ne__request_close(req);
     return NE_ERROR;
 }
 
@@ -43,7 +44,7 @@ int ne_xml_parse_response(ne_request *req, ne_xml_parser *parser)
     while ((bytes = ne_read_response_block(req, buf, sizeof buf)) > 0) {
         ret = ne_xml_parse(parser, buf, bytes);
         if (ret)
-            return parse_error(ne_get_session(req), parser);
+            return parse_error(req, parser);
     }
 
     if (bytes == 0) {
@@ -51,7 +52,7 @@ int ne_xml_parse_response(ne_request *req, ne_xml_parser *parser)
         if (ne_xml_parse(parser, NULL, 0) == 0)
             return NE_OK;
         else
-            return parse_error(ne_get_session(req), parser);
+            return parse_error(req, parser);
     } else {
         return NE_ERROR;
     }    
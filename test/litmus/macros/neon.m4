@@ -560,7 +560,8 @@ dnl Is strerror_r present; if so, which variant
 AC_REQUIRE([AC_FUNC_STRERROR_R])
 
 AC_CHECK_HEADERS([sys/time.h limits.h sys/select.h arpa/inet.h \
-	signal.h sys/socket.h netinet/in.h netinet/tcp.h netdb.h sys/poll.h],,,
+	signal.h sys/socket.h netinet/in.h netinet/tcp.h netdb.h sys/poll.h \
+	sys/sendfile.h sys/uio.h],,,
 [AC_INCLUDES_DEFAULT
 /* netinet/tcp.h requires netinet/in.h on some platforms. */
 #ifdef HAVE_NETINET_IN_H
@@ -574,7 +575,7 @@ NE_LARGEFILE
 
 AC_REPLACE_FUNCS(strcasecmp)
 
-AC_CHECK_FUNCS(signal setvbuf setsockopt stpcpy poll)
+AC_CHECK_FUNCS(signal setvbuf setsockopt stpcpy poll sendfile splice pwrite clock_gettime)
 
 if test "x${ac_cv_func_poll}${ac_cv_header_sys_poll_h}y" = "xyesyesy"; then
   AC_DEFINE([NE_USE_POLL], 1, [Define if poll() should be used])
@@ -664,6 +665,7 @@ fi
 
 NEON_SSL()
 NEON_SOCKS()
+NEON_THREADS()
 NEON_GSSAPI()
 
 AC_SUBST(NEON_CFLAGS)
@@ -1021,6 +1023,27 @@ else
   NE_DISABLE_SUPPORT(SOCKS, [SOCKSv5 support is not enabled])
 fi])
 
+dnl Macro to optionally enable thread-safe connection pooling
+AC_DEFUN([NEON_THREADS], [
+
+AC_ARG_ENABLE([threads], 
+AS_HELP_STRING([--enable-threads],[allow concurrent requests per session]))
+
+if test "$enable_threads" = "yes"; then
+  ne_save_LIBS=$LIBS
+
+  AC_CHECK_HEADERS(pthread.h,
+    [AC_CHECK_LIB(pthread, pthread_create, [:],
+      [AC_MSG_ERROR([could not find libpthread for thread support])])],
+    [AC_MSG_ERROR([could not find pthread.h for thread support])])
+
+  NE_ENABLE_SUPPORT(THREADS, [Thread support is enabled])
+  NEON_LIBS="$NEON_LIBS -lpthread"
+  LIBS=$ne_save_LIBS
+else
+  NE_DISABLE_SUPPORT(THREADS, [Thread support is not enabled])
+fi])
+
 AC_DEFUN([NEON_WITH_LIBS], [
 AC_ARG_WITH([libs],
 [[  --with-libs=DIR[:DIR2...] look for support libraries in DIR/{bin,lib,include}]],
@@ -441,3 +441,32 @@ int compare_contents(const char *fn, const char *contents)
 
     return ret;
 }
+
+void bench_start(struct timeval *start)
+{
+    gettimeofday(start, NULL);
+}
+
+double bench_elapsed(const struct timeval *start)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start->tv_sec)
+        + (now.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+void bench_report(const char *format, ...)
+{
+    char buf[BUFSIZ];
+    va_list ap;
+
+    va_start(ap, format);
+    ne_vsnprintf(buf, sizeof buf, format, ap);
+    va_end(ap);
+
+    NE_DEBUG(NE_DBG_HTTP, "Benchmark: %s\n", buf);
+    /* align the test result column after the report. */
+    printf("%s\n%27s", buf, "");
+    fflush(stdout);
+}
@@ -25,6 +25,10 @@
 #include <ne_basic.h>
 #include <ne_socket.h> /* for ne_sock_addr */
 
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h> /* for struct timeval */
+#endif
+
 #include "tests.h"
 
 /* always use O_BINARY for cygwin/windows compatibility. */
@@ -81,6 +85,21 @@ char *get_etag(const char *path);
 char *create_temp(const char *contents);
 
 int compare_contents(const char *fn, const char *contents);
+
+/* Benchmark support: bench_start() records the start time of a timed
+ * operation in *start; bench_elapsed() returns the number of seconds
+ * elapsed since then. */
+void bench_start(struct timeval *start);
+double bench_elapsed(const struct timeval *start);
+
+/* Print a benchmark result for the current test; printf-like format
+ * string.  The result is also logged to debug.log. */
+void bench_report(const char *format, ...)
+#ifdef __GNUC__
+                __attribute__ ((format (printf, 1, 2)))
+#endif /* __GNUC__ */
+;
+
 /* BINARYMODE() enables binary file I/O on cygwin. */
 #ifdef __CYGWIN__
 #define BINARYMODE(fd) do { setmode(fd, O_BINARY); } while (0)
@@ -22,8 +22,34 @@
 #ifdef HAVE_STRING_H
 #include <string.h>
 #endif
+#include <stdlib.h>
+#include <stdio.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_SYS_SELECT_H
+#include <sys/select.h>
+#endif
+
+#ifdef NE_HAVE_THREADS
+#include <pthread.h>
+#endif
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <signal.h>
+
+#include <ne_props.h>
+#include <ne_basic.h>
+#include <ne_trace.h>
 
 #include "common.h"
+#include "child.h"
 
 #define EOL "\r\n"
 
@@ -93,10 +119,3036 @@ static int expect100(void)
     return OK;
 }
 
+/* Check that empty buffers are skipped by ne_sock_fullwritev rather
+ * than written forever. */
+static int writev_empty(void)
+{
+    ne_socket *sock = ne_sock_create();
+    struct ne_iovec vec[5];
+    char req[BUFSIZ], buf[BUFSIZ];
+    ne_status status = {0};
+    const ne_inet_addr *ia;
+    int success = 0;
+
+    if (strcmp(ne_get_scheme(i_session), "https") == 0) {
+        t_context("skipping for SSL server");
+        return SKIP;
+    }
+
+    for (ia = ne_addr_first(i_address); ia && !success; 
+	 ia = ne_addr_next(i_address))
+	success = ne_sock_connect(sock, ia, i_port) == 0;
+
+    ONN("could not connect to server", !success);
+
+    ne_snprintf(req, sizeof req, "OPTIONS %s HTTP/1.1" EOL "Host: %s" EOL,
+                i_path, ne_get_server_hostport(i_session));
+
+    vec[0].base = vec[2].base = vec[4].base = "";
+    vec[0].len = vec[2].len = vec[4].len = 0;
+    vec[1].base = req;
+    vec[1].len = strlen(req);
+    vec[3].base = "Connection: close" EOL EOL;
+    vec[3].len = strlen(vec[3].base);
+
+    ONS("writing nothing", ne_sock_fullwritev(sock, vec, 1));
+    ONS("sending request", ne_sock_fullwritev(sock, vec, 5));
+    ONS("reading status line", ne_sock_readline(sock, buf, sizeof buf));
+    ONN("parse status line", ne_parse_statusline(buf, &status));
+    ONV(status.klass != 2, ("OPTIONS failed: %s", buf));
+
+    ne_sock_close(sock);
+    return OK;
+}
+
+/* Number of GET requests issued by the pipelining benchmark. */
+#define SWEEP_COUNT (200)
+
+/* Body reader which counts the response body length. */
+static int count_body(void *userdata, const char *buf, size_t len)
+{
+    off_t *count = userdata;
+    *count += len;
+    return 0;
+}
+
+/* Fetch 'path' SWEEP_COUNT times using pipeline depth 'depth',
+ * storing the elapsed time in *secs. */
+static int sweep(const char *path, int depth, double *secs)
+{
+    ne_request *reqs[SWEEP_COUNT];
+    off_t lengths[SWEEP_COUNT];
+    struct timeval start;
+    int n, ret;
+
+    ne_set_pipelining(i_session, depth);
+
+    for (n = 0; n < SWEEP_COUNT; n++) {
+        reqs[n] = ne_request_create(i_session, "GET", path);
+        lengths[n] = 0;
+        ne_add_response_body_reader(reqs[n], ne_accept_2xx, count_body,
+                                    &lengths[n]);
+    }
+
+    bench_start(&start);
+    ret = ne_pipeline_dispatch(i_session, reqs, SWEEP_COUNT);
+    *secs = bench_elapsed(&start);
+
+    if (ret)
+        t_context("pipelined dispatch failed: %s", ne_get_error(i_session));
+
+    for (n = 0; n < SWEEP_COUNT && ret == NE_OK; n++) {
+        if (ne_get_status(reqs[n])->klass != 2) {
+            t_context("GET %d of `%s' failed: %s", n, path,
+                      ne_get_error(i_session));
+            ret = NE_ERROR;
+        } else if (lengths[n] != i_foo_len) {
+            t_context("GET %d of `%s' got %" NE_FMT_OFF_T " bytes, "
+                      "expected %" NE_FMT_OFF_T, n, path, lengths[n],
+                      i_foo_len);
+            ret = NE_ERROR;
+        }
+    }
+
+    for (n = 0; n < SWEEP_COUNT; n++)
+        ne_request_destroy(reqs[n]);
+
+    ne_set_pipelining(i_session, 0);
+
+    return ret ? FAIL : OK;
+}
+
+static int pipeline(void)
+{
+    char *path = ne_concat(i_path, "pipeline", NULL);
+    double serial, pipelined;
+
+    CALL(upload_foo("pipeline"));
+
+    CALL(sweep(path, 1, &serial));
+    CALL(sweep(path, 8, &pipelined));
+
+    bench_report("%d GETs: serial %.1f req/s, pipelined %.1f req/s",
+                 SWEEP_COUNT, SWEEP_COUNT / serial, SWEEP_COUNT / pipelined);
+
+    ne_delete(i_session, path);
+    free(path);
+    return OK;
+}
+
+/* Number of GET requests issued by the connection pool test. */
+#define POOL_COUNT (20)
+
+/* Fetch 'path' 'count' times, one request after another. */
+static int fetch_serial(const char *path, int count)
+{
+    int n;
+
+    for (n = 0; n < count; n++) {
+        ne_request *req = ne_request_create(i_session, "GET", path);
+        int ret = ne_request_dispatch(req);
+
+        if (ret != NE_OK || ne_get_status(req)->klass != 2) {
+            t_context("GET %d of `%s' failed: %s", n, path,
+                      ne_get_error(i_session));
+            ne_request_destroy(req);
+            return FAIL;
+        }
+        ne_request_destroy(req);
+    }
+
+    return OK;
+}
+
+#ifdef NE_HAVE_THREADS
+/* Number of threads used by the concurrent pool test. */
+#define POOL_THREADS (4)
+
+static void *fetch_thread(void *userdata)
+{
+    const char *path = userdata;
+    int n, failed = 0;
+
+    for (n = 0; n < POOL_COUNT; n++) {
+        ne_request *req = ne_request_create(i_session, "GET", path);
+
+        if (ne_request_dispatch(req) != NE_OK
+            || ne_get_status(req)->klass != 2)
+            failed++;
+        ne_request_destroy(req);
+    }
+
+    return failed ? userdata : NULL;
+}
+
+/* Fetch 'path' POOL_COUNT times from each of POOL_THREADS threads
+ * sharing the session, storing the elapsed time in *secs. */
+static int fetch_concurrent(char *path, double *secs)
+{
+    pthread_t threads[POOL_THREADS];
+    struct timeval start;
+    int n, failed = 0;
+
+    bench_start(&start);
+
+    for (n = 0; n < POOL_THREADS; n++)
+        ONN("could not create thread",
+            pthread_create(&threads[n], NULL, fetch_thread, path));
+
+    for (n = 0; n < POOL_THREADS; n++) {
+        void *result;
+
+        pthread_join(threads[n], &result);
+        if (result) failed++;
+    }
+
+    *secs = bench_elapsed(&start);
+
+    ONV(failed, ("GETs of `%s' failed in %d threads: %s", path, failed,
+                 ne_get_error(i_session)));
+
+    return OK;
+}
+#endif
+
+static int pool(void)
+{
+    char *path = ne_concat(i_path, "pool", NULL);
+    ne_pool_stats before, after;
+
+    CALL(upload_foo("pool"));
+
+    ne_close_connection(i_session);
+    ne_get_pool_stats(i_session, &before);
+
+    CALL(fetch_serial(path, POOL_COUNT));
+
+    ne_get_pool_stats(i_session, &after);
+
+    /* Only the first request should need a new connection, unless
+     * the server refuses to persist connections. */
+    if (after.misses - before.misses > 1) {
+        t_warning("%lu of %d GET requests needed a new connection",
+                  after.misses - before.misses, POOL_COUNT);
+    }
+
+    ONV(after.hits + after.misses - before.hits - before.misses 
+        != POOL_COUNT,
+        ("%lu connections used for %d requests",
+         after.hits + after.misses - before.hits - before.misses,
+         POOL_COUNT));
+
+#ifdef NE_HAVE_THREADS
+    {
+        double serial, concurrent;
+        struct timeval start;
+
+        bench_start(&start);
+        CALL(fetch_serial(path, POOL_COUNT * POOL_THREADS));
+        serial = bench_elapsed(&start);
+
+        ne_set_connection_pool(i_session, POOL_THREADS, 0);
+        ne_get_pool_stats(i_session, &before);
+        CALL(fetch_concurrent(path, &concurrent));
+        ne_get_pool_stats(i_session, &after);
+        ne_set_connection_pool(i_session, 1, 0);
+        ne_close_connection(i_session);
+
+        ONV(after.misses - before.misses > POOL_THREADS,
+            ("%lu connections opened by %d threads",
+             after.misses - before.misses, POOL_THREADS));
+
+        bench_report("%d GETs: serial %.1f req/s, %d connections %.1f req/s",
+                     POOL_COUNT * POOL_THREADS, 
+                     POOL_COUNT * POOL_THREADS / serial, POOL_THREADS,
+                     POOL_COUNT * POOL_THREADS / concurrent);
+    }
+#endif
+
+    ne_delete(i_session, path);
+    free(path);
+    return OK;
+}
+
+/* Dispatch requests in the session whilst another request is still
+ * open, as a connection pool limited to one connection must allow. */
+static int overlap(void)
+{
+    char *path = ne_concat(i_path, "overlap", NULL);
+    ne_pool_stats before, after;
+    ne_request *outer;
+
+    CALL(upload_foo("overlap"));
+
+    ne_get_pool_stats(i_session, &before);
+
+    outer = ne_request_create(i_session, "GET", path);
+    ONV(ne_begin_request(outer) != NE_OK,
+        ("outer GET failed: %s", ne_get_error(i_session)));
+    ONV(ne_discard_response(outer) != NE_OK,
+        ("outer GET response failed: %s", ne_get_error(i_session)));
+
+    CALL(fetch_serial(path, 2));
+
+    ONV(ne_end_request(outer) != NE_OK,
+        ("outer GET failed: %s", ne_get_error(i_session)));
+    ONV(ne_get_status(outer)->klass != 2,
+        ("outer GET failed: %s", ne_get_error(i_session)));
+    ne_request_destroy(outer);
+
+    ne_get_pool_stats(i_session, &after);
+
+    ONV(after.misses - before.misses > 1,
+        ("%lu connections opened for overlapping requests",
+         after.misses - before.misses));
+
+    ne_delete(i_session, path);
+    free(path);
+    return OK;
+}
+
+/* Number of requests driven at once by the multiplex test, and the
+ * number of timed rounds of requests. */
+#define MUX_COUNT (8)
+#define MUX_ROUNDS (10)
+
+/* Size of the resource fetched by the multiplex test. */
+#define MUX_SIZE (256 * 1024)
+
+/* Drive the 'count' requests in 'reqs' to completion from a single
+ * thread, stepping each request when its connection is ready. */
+static int step_all(ne_request **reqs, int count)
+{
+    int ready[MUX_COUNT], done[MUX_COUNT], left = count, n;
+
+    for (n = 0; n < count; n++)
+        ready[n] = 1, done[n] = 0;
+
+    while (left > 0) {
+        fd_set rdfds, wrfds;
+        struct timeval tv;
+        int maxfd = -1, timeout = -1;
+
+        FD_ZERO(&rdfds);
+        FD_ZERO(&wrfds);
+
+        for (n = 0; n < count; n++) {
+            int ret, fd, events;
+
+            if (done[n]) continue;
+
+            if (ready[n]) {
+                ret = ne_request_step(reqs[n]);
+                if (ret != NE_AGAIN) {
+                    ONV(ret != NE_OK, ("request %d failed: %s", n,
+                                       ne_get_error(ne_get_session(reqs[n]))));
+                    done[n] = 1;
+                    left--;
+                    continue;
+                }
+            }
+
+            fd = ne_request_fd(reqs[n]);
+            events = ne_request_events(reqs[n]);
+            ONV(fd < 0 || (events == 0 && ne_request_timeout(reqs[n]) < 0),
+                ("request %d awaits nothing (fd %d)", n, fd));
+
+            if (events & NE_SOCK_WANT_READ) FD_SET(fd, &rdfds);
+            if (events & NE_SOCK_WANT_WRITE) FD_SET(fd, &wrfds);
+            if (fd > maxfd) maxfd = fd;
+
+            ret = ne_request_timeout(reqs[n]);
+            if (ret >= 0 && (timeout < 0 || ret < timeout))
+                timeout = ret;
+        }
+
+        if (left == 0) break;
+
+        tv.tv_sec = timeout / 1000;
+        tv.tv_usec = (timeout % 1000) * 1000;
+        ONN("select failed", 
+            select(maxfd + 1, &rdfds, &wrfds, NULL, 
+                   timeout >= 0 ? &tv : NULL) < 0);
+
+        for (n = 0; n < count; n++) {
+            int fd = done[n] ? -1 : ne_request_fd(reqs[n]);
+            ready[n] = fd >= 0 
+                && (FD_ISSET(fd, &rdfds) || FD_ISSET(fd, &wrfds)
+                    || ne_request_timeout(reqs[n]) == 0);
+        }
+    }
+
+    return OK;
+}
+
+/* Drive several GETs at once from one thread and check each
+ * response.  The rate is reported beside that of the same GETs
+ * dispatched in turn, to show the cost of stepping requests rather
+ * than any speedup: over loopback, both are bound by the CPU. */
+static int multiplex(void)
+{
+    char *path = ne_concat(i_path, "mux", NULL);
+    char *body = ne_malloc(MUX_SIZE);
+    ne_request *reqs[MUX_COUNT];
+    off_t lengths[MUX_COUNT];
+    struct timeval start;
+    double serial, muxed;
+    int n, round;
+
+    memset(body, 'm', MUX_SIZE);
+    ne_set_connection_pool(i_session, MUX_COUNT, 0);
+
+    /* Upload the resource with a non-blocking request. */
+    reqs[0] = ne_request_create(i_session, "PUT", path);
+    ne_set_request_body_buffer(reqs[0], body, MUX_SIZE);
+    CALL(step_all(reqs, 1));
+    ONV(ne_get_status(reqs[0])->klass != 2,
+        ("PUT of `%s' failed: %s", path, ne_get_error(i_session)));
+    ne_request_destroy(reqs[0]);
+    free(body);
+
+    for (round = 0; round <= MUX_ROUNDS; round++) {
+        /* The first round opens the connections; time the rest. */
+        if (round == 1) bench_start(&start);
+
+        for (n = 0; n < MUX_COUNT; n++) {
+            reqs[n] = ne_request_create(i_session, "GET", path);
+            lengths[n] = 0;
+            ne_add_response_body_reader(reqs[n], ne_accept_2xx, count_body,
+                                        &lengths[n]);
+        }
+
+        CALL(step_all(reqs, MUX_COUNT));
+
+        for (n = 0; n < MUX_COUNT; n++) {
+            ONV(ne_get_status(reqs[n])->klass != 2,
+                ("GET %d of `%s' failed: %s", n, path, 
+                 ne_get_error(i_session)));
+            ONV(lengths[n] != MUX_SIZE,
+                ("GET %d of `%s' got %" NE_FMT_OFF_T " bytes, expected %d",
+                 n, path, lengths[n], MUX_SIZE));
+            ne_request_destroy(reqs[n]);
+        }
+    }
+    muxed = bench_elapsed(&start);
+
+    ne_set_connection_pool(i_session, 1, 0);
+    ne_close_connection(i_session);
+
+    bench_start(&start);
+    CALL(fetch_serial(path, MUX_COUNT * MUX_ROUNDS));
+    serial = bench_elapsed(&start);
+
+    bench_report("%d GETs: %.1f req/s stepped %d at once on one thread, "
+                 "%.1f req/s dispatched in turn", MUX_COUNT * MUX_ROUNDS, 
+                 MUX_COUNT * MUX_ROUNDS / muxed, MUX_COUNT,
+                 MUX_COUNT * MUX_ROUNDS / serial);
+
+    ne_delete(i_session, path);
+    free(path);
+    return OK;
+}
+
+/* Size of the body uploaded by the chunked test. */
+#define STREAM_SIZE (4 * 1024 * 1024)
+
+/* Body provider generating STREAM_SIZE bytes of a pattern, a few bytes
+ * at a time, as a program writing out a generated document would. */
+struct stream {
+    off_t offset;
+    int calls;
+};
+
+static ssize_t stream_body(void *userdata, char *buf, size_t buflen)
+{
+    struct stream *st = userdata;
+    size_t n, len = st->calls++ % 100 + 1;
+
+    if (buflen == 0) {
+        st->offset = 0;
+        st->calls = 0;
+        return 0;
+    }
+
+    if (len > buflen) len = buflen;
+    if (len > STREAM_SIZE - st->offset) len = STREAM_SIZE - st->offset;
+
+    for (n = 0; n < len; n++)
+        buf[n] = 'a' + (st->offset + n) % 26;
+    st->offset += len;
+
+    return len;
+}
+
+/* Body reader which checks the response body matches the pattern. */
+static int check_stream(void *userdata, const char *buf, size_t len)
+{
+    struct stream *st = userdata;
+    size_t n;
+
+    for (n = 0; n < len; n++)
+        if (buf[n] != 'a' + (st->offset + n) % 26)
+            return -1;
+    st->offset += len;
+    st->calls++;
+    return 0;
+}
+
+/* Upload the pattern to 'path' with a body of unknown length, using
+ * ne_request_dispatch or, if 'step' is non-zero, ne_request_step. */
+static int put_stream(const char *path, int step, struct stream *st)
+{
+    ne_request *req = ne_request_create(i_session, "PUT", path);
+    int ret;
+
+    ne_set_request_body_provider(req, -1, stream_body, st);
+
+    if (step) {
+        CALL(step_all(&req, 1));
+        ret = NE_OK;
+    } else {
+        ret = ne_request_dispatch(req);
+    }
+
+    ONV(ret || ne_get_status(req)->klass != 2,
+        ("chunked PUT of `%s' failed: %s", path, ne_get_error(i_session)));
+    ne_request_destroy(req);
+    return OK;
+}
+
+static int get_stream(const char *path)
+{
+    ne_request *req = ne_request_create(i_session, "GET", path);
+    struct stream st = {0};
+    int ret;
+
+    ne_add_response_body_reader(req, ne_accept_2xx, check_stream, &st);
+    ret = ne_request_dispatch(req);
+    
+    ONV(ret || ne_get_status(req)->klass != 2,
+        ("GET of `%s' failed: %s", path, ne_get_error(i_session)));
+    ONV(st.offset != STREAM_SIZE,
+        ("GET of `%s' got %" NE_FMT_OFF_T " bytes, expected %d", 
+         path, st.offset, STREAM_SIZE));
+    ne_request_destroy(req);
+    return OK;
+}
+
+static int chunked(void)
+{
+    char *path = ne_concat(i_path, "chunked", NULL);
+    struct stream st;
+    struct timeval start;
+    double streamed, spooled;
+    FILE *spool;
+    ssize_t len;
+    char buf[100];
+    int step;
+
+    for (step = 0; step < 2; step++) {
+        bench_start(&start);
+        CALL(put_stream(path, step, &st));
+        if (step == 0) streamed = bench_elapsed(&start);
+        CALL(get_stream(path));
+    }
+
+    /* Compare with spooling the body to a temporary file first, to
+     * learn its length. */
+    bench_start(&start);
+    spool = tmpfile();
+    ONN("could not create temporary file", spool == NULL);
+    stream_body(&st, buf, 0);
+    while ((len = stream_body(&st, buf, sizeof buf)) > 0)
+        fwrite(buf, len, 1, spool);
+    fflush(spool);
+    {
+        ne_request *req = ne_request_create(i_session, "PUT", path);
+        int ret;
+
+        ne_set_request_body_fd(req, fileno(spool), 0, STREAM_SIZE);
+        ret = ne_request_dispatch(req);
+        ONV(ret || ne_get_status(req)->klass != 2,
+            ("PUT of `%s' failed: %s", path, ne_get_error(i_session)));
+        ne_request_destroy(req);
+    }
+    fclose(spool);
+    spooled = bench_elapsed(&start);
+
+    bench_report("%d byte body in %d writes: chunked %.1f MB/s, "
+                 "spooled to a file %.1f MB/s", STREAM_SIZE, st.calls,
+                 STREAM_SIZE / streamed / 1048576.0, 
+                 STREAM_SIZE / spooled / 1048576.0);
+
+    ne_delete(i_session, path);
+    free(path);
+    return OK;
+}
+
+/* Hostname which should never resolve (RFC 2606). */
+#define BAD_HOSTNAME "nonesuch.invalid"
+
+static int resolver(void)
+{
+    struct timeval start;
+    double first, cached, bad;
+    ne_sock_addr *addr;
+
+    ne_addr_cache_flush();
+
+    bench_start(&start);
+    addr = ne_addr_resolve(i_hostname, 0);
+    first = bench_elapsed(&start);
+    ONV(ne_addr_result(addr), ("could not resolve `%s'", i_hostname));
+    ne_addr_destroy(addr);
+
+    /* A second lookup must be answered from the cache, and the
+     * cached result must outlive the address object. */
+    bench_start(&start);
+    addr = ne_addr_resolve(i_hostname, 0);
+    cached = bench_elapsed(&start);
+    ONV(ne_addr_result(addr), ("cached lookup of `%s' failed", i_hostname));
+    ONN("cached result has no addresses", ne_addr_first(addr) == NULL);
+    ne_addr_destroy(addr);
+
+    /* A failure is cached too if the name was found not to exist;
+     * not if the lookup failed for want of a DNS server. */
+    addr = ne_addr_resolve(BAD_HOSTNAME, 0);
+    ONN("bogus hostname resolved", ne_addr_result(addr) == 0);
+    ne_addr_destroy(addr);
+    bench_start(&start);
+    addr = ne_addr_resolve(BAD_HOSTNAME, 0);
+    bad = bench_elapsed(&start);
+    ONN("bogus hostname resolved again", ne_addr_result(addr) == 0);
+    ne_addr_destroy(addr);
+
+    bench_report("lookup of `%s' %.1fus, cached %.1fus, repeated failure "
+                 "%.1fus",
+                 i_hostname, first * 1e6, cached * 1e6, bad * 1e6);
+
+    ne_addr_cache_flush();
+    return OK;
+}
+
+static int resolve_async(void)
+{
+    ne_addr_query *query;
+    ne_sock_addr *addr;
+    ne_session *sess;
+    ne_request *req;
+    int fd;
+
+    ne_addr_cache_flush();
+
+    query = ne_addr_resolve_async(i_hostname, 0);
+    fd = ne_addr_query_fd(query);
+    if (fd >= 0) {
+        fd_set rdfds;
+
+        FD_ZERO(&rdfds);
+        FD_SET(fd, &rdfds);
+        ONN("select on query failed", 
+            select(fd + 1, &rdfds, NULL, NULL, NULL) != 1);
+    }
+    addr = ne_addr_query_finish(query);
+    ONV(ne_addr_result(addr), ("could not resolve `%s'", i_hostname));
+    ne_addr_destroy(addr);
+
+    if (strcmp(ne_get_scheme(i_session), "https") == 0) {
+        t_context("skipping request test for SSL server");
+        return SKIP;
+    }
+
+    /* A fresh session must look up the hostname without blocking. */
+    ne_addr_cache_flush();
+    sess = ne_session_create("http", i_hostname, i_port);
+    req = ne_request_create(sess, "OPTIONS", i_path);
+    CALL(step_all(&req, 1));
+    ONV(ne_get_status(req)->klass != 2,
+        ("OPTIONS on `%s' failed: %s", i_path, ne_get_error(sess)));
+    ne_request_destroy(req);
+    ne_session_destroy(sess);
+
+    /* A request stepped into its lookup can be finished blocking. */
+    ne_addr_cache_flush();
+    sess = ne_session_create("http", i_hostname, i_port);
+    req = ne_request_create(sess, "OPTIONS", i_path);
+    ONV(ne_request_step(req) != NE_AGAIN,
+        ("first step did not return NE_AGAIN: %s", ne_get_error(sess)));
+    ONV(ne_request_dispatch(req),
+        ("dispatch after a step failed: %s", ne_get_error(sess)));
+    ONV(ne_get_status(req)->klass != 2,
+        ("OPTIONS on `%s' after a step failed: %s", i_path, 
+         ne_get_error(sess)));
+    ne_request_destroy(req);
+    ne_session_destroy(sess);
+    
+    return OK;
+}
+
+/* A non-routable address (RFC 5737 TEST-NET-1), to which connection
+ * attempts either fail or hang. */
+static const unsigned char blackhole[4] = { 192, 0, 2, 1 };
+
+static int eyeballs(void)
+{
+    ne_socket *sock = ne_sock_create();
+    const ne_inet_addr *addrs[2];
+    ne_inet_addr *dead = ne_iaddr_make(ne_iaddr_ipv4, blackhole);
+    struct timeval start;
+    double secs;
+    int ret;
+
+    if (strcmp(ne_get_scheme(i_session), "https") == 0) {
+        t_context("skipping for SSL server");
+        return SKIP;
+    }
+
+    addrs[0] = dead;
+    addrs[1] = ne_addr_first(i_address);
+
+    bench_start(&start);
+    ret = ne_sock_connect_any(sock, addrs, 2, i_port, 250);
+    secs = bench_elapsed(&start);
+    ONS("connect", ret);
+    ONV(ret != 1, ("connected to address %d, expected 1", ret));
+    ONV(secs > 5, ("connect took %.1fs", secs));
+    ne_sock_close(sock);
+
+    /* No address accepts a connection. */
+    sock = ne_sock_create();
+    ONN("connected to nothing", 
+        ne_sock_connect_any(sock, addrs, 0, i_port, 250) >= 0);
+    ne_sock_close(sock);
+
+    ne_iaddr_free(dead);
+    bench_report("connect past an unreachable address in %.0fms", 
+                 secs * 1e3);
+    return OK;
+}
+
+/* Port on which the canned response server listens. */
+#define CANNED_PORT (7777)
+/* Number of responses parsed by the header parsing benchmark, and
+ * the number of requests pipelined at once. */
+#define HDR_RESPONSES (1000000)
+#define HDR_BATCH (100)
+
+/* A response with 20 header fields. */
+#define HDR_RESPONSE "HTTP/1.1 207 Multi-Status" EOL \
+    "Date: Mon, 06 Mar 2006 12:00:00 GMT" EOL \
+    "Server: Apache/2.0.55 (Unix) DAV/2 SVN/1.3.0" EOL \
+    "Last-Modified: Mon, 06 Mar 2006 11:59:00 GMT" EOL \
+    "ETag: \"2a5f4-1c2-8e1b3c00\"" EOL \
+    "Accept-Ranges: bytes" EOL \
+    "Cache-Control: private, max-age=0" EOL \
+    "Expires: Mon, 06 Mar 2006 12:00:00 GMT" EOL \
+    "Vary: Accept-Encoding" EOL \
+    "DAV: 1,2" EOL \
+    "DAV: <http://apache.org/dav/propset/fs/1>" EOL \
+    "MS-Author-Via: DAV" EOL \
+    "Allow: OPTIONS, GET, HEAD, PROPFIND, PROPPATCH, LOCK, UNLOCK" EOL \
+    "Content-Location: http://localhost/dav/" EOL \
+    "Content-Language: en" EOL \
+    "X-Powered-By: limeberry" EOL \
+    "X-Request-Id: 6f1c0a4e-2b7d-4c83-9f55-1d2e3a4b5c6d" EOL \
+    "Keep-Alive: timeout=15, max=100" EOL \
+    "Connection: Keep-Alive" EOL \
+    "Content-Type: text/xml; charset=\"utf-8\"" EOL \
+    "Content-Length: 0" EOL EOL
+
+/* Number of responses parsed by the header-heavy benchmark, and the
+ * number of header fields in each. */
+#define HEAVY_RESPONSES (100000)
+#define HEAVY_FIELDS (90)
+
+/* A canned response to be sent by serve_canned. */
+struct canned {
+    const char *response;
+    int count; /* number of times to send it */
+};
+
+/* Server which answers c->count requests with c->response. */
+static int serve_canned(ne_socket *sock, void *userdata)
+{
+    struct canned *c = userdata;
+    size_t len = strlen(c->response);
+    int n, flag = 1;
+
+    /* Send each response straight away; the client is pipelining. */
+    setsockopt(ne_sock_fd(sock), IPPROTO_TCP, TCP_NODELAY, 
+               &flag, sizeof flag);
+
+    /* don't log every request line. */
+    ne_debug_init(ne_debug_stream, 0);
+
+    for (n = 0; n < c->count; n++) {
+        CALL(discard_request(sock));
+        ONN("send failed", server_send(sock, c->response, len) < 0);
+    }
+
+    return OK;
+}
+
+/* Returns the CPU time used by this process, in seconds. */
+static double cpu_time(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+        + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+/* Spawn a server sending canned response 'c', and send it c->count
+ * requests, pipelined HDR_BATCH at a time using 'reqs'; the elapsed
+ * time is stored in *secs, and the CPU time used by the client in
+ * *cpu.  The requests are left for inspection, to be cleaned up by
+ * finish_canned. */
+static int dispatch_canned(struct canned *c, ne_request **reqs, 
+                           double *secs, double *cpu)
+{
+    ne_session *sess;
+    struct timeval start;
+    int n, mask = ne_debug_mask;
+
+    CALL(lookup_localhost());
+    CALL(spawn_server(CANNED_PORT, serve_canned, c));
+
+    sess = ne_session_create("http", "127.0.0.1", CANNED_PORT);
+    ne_set_pipelining(sess, HDR_BATCH);
+    for (n = 0; n < HDR_BATCH; n++)
+        reqs[n] = ne_request_create(sess, "PROPFIND", "/dav/");
+
+    /* don't log a message for each header field! */
+    ne_debug_init(ne_debug_stream, 0);
+    *cpu = cpu_time();
+    bench_start(&start);
+    for (n = 0; n < c->count / HDR_BATCH; n++) {
+        ONV(ne_pipeline_dispatch(sess, reqs, HDR_BATCH),
+            ("batch %d failed: %s", n, ne_get_error(sess)));
+    }
+    *secs = bench_elapsed(&start);
+    *cpu = cpu_time() - *cpu;
+    ne_debug_init(ne_debug_stream, mask);
+
+    ONV(ne_get_status(reqs[0])->code != 207, 
+        ("wrong status: %s", ne_get_error(sess)));
+    return OK;
+}
+
+/* Destroy the requests and session used by dispatch_canned. */
+static int finish_canned(ne_request **reqs)
+{
+    ne_session *sess = ne_get_session(reqs[0]);
+    int n;
+
+    for (n = 0; n < HDR_BATCH; n++)
+        ne_request_destroy(reqs[n]);
+    ne_session_destroy(sess);
+    return await_server();
+}
+
+/* Number of requests sent by the pipeline_window test, the size of
+ * each request body, and the size of the second response body. */
+#define WINDOW_REQUESTS (1000)
+#define WINDOW_BODY (8192)
+#define WINDOW_RESPONSE (16 * 1024 * 1024)
+
+/* Server which sends a large response to the second request before
+ * reading any more of the requests, so that a client which writes the
+ * whole pipeline before reading blocks for good.  (The first request
+ * is sent alone, before the server is known to be HTTP/1.1.) */
+static int serve_window(ne_socket *sock, void *userdata)
+{
+    static const char zeroes[65536];
+    struct timeval tv = { 10, 0 };
+    char head[100];
+    int n, off;
+
+    /* don't log every request. */
+    ne_debug_init(ne_debug_stream, 0);
+
+    /* Fail rather than hang, if the client stops reading. */
+    setsockopt(ne_sock_fd(sock), SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+
+    for (n = 0; n < WINDOW_REQUESTS; n++) {
+        CALL(discard_request(sock));
+        CALL(discard_body(sock));
+        if (n != 1) {
+            SEND_STRING(sock, "HTTP/1.1 207 Multi-Status" EOL 
+                        "Content-Length: 0" EOL EOL);
+            continue;
+        }
+        ne_snprintf(head, sizeof head, "HTTP/1.1 207 Multi-Status" EOL
+                    "Content-Length: %d" EOL EOL, WINDOW_RESPONSE);
+        ONN("send failed", SEND_STRING(sock, head) < 0);
+        for (off = 0; off < WINDOW_RESPONSE; off += sizeof zeroes)
+            ONN("send failed", 
+                server_send(sock, zeroes, sizeof zeroes) < 0);
+    }
+
+    return OK;
+}
+
+/* Pipeline requests with bodies to a server which stops reading while
+ * it writes a large response; the client must read that response
+ * before writing more than the socket buffers will hold. */
+static int pipeline_window(void)
+{
+    ne_request *reqs[WINDOW_REQUESTS];
+    ne_session *sess;
+    char *body = ne_calloc(WINDOW_BODY);
+    int n;
+
+    CALL(lookup_localhost());
+    CALL(spawn_server(CANNED_PORT, serve_window, NULL));
+
+    sess = ne_session_create("http", "127.0.0.1", CANNED_PORT);
+    ne_set_pipelining(sess, WINDOW_REQUESTS);
+    for (n = 0; n < WINDOW_REQUESTS; n++) {
+        reqs[n] = ne_request_create(sess, "PROPFIND", "/dav/");
+        ne_set_request_body_buffer(reqs[n], body, WINDOW_BODY);
+    }
+
+    ONV(ne_pipeline_dispatch(sess, reqs, WINDOW_REQUESTS),
+        ("pipelined dispatch failed: %s", ne_get_error(sess)));
+
+    for (n = 0; n < WINDOW_REQUESTS; n++)
+        ne_request_destroy(reqs[n]);
+    ne_session_destroy(sess);
+    ne_free(body);
+    return await_server();
+}
+
+/* Returns the number of response headers of 'req'. */
+static int count_headers(ne_request *req)
+{
+    const char *name, *value;
+    void *cursor = NULL;
+    int count = 0;
+
+    while ((cursor = ne_response_header_iterate(req, cursor, 
+                                                &name, &value)) != NULL)
+        count++;
+
+    return count;
+}
+
+static int header_parse(void)
+{
+    struct canned c = { HDR_RESPONSE, HDR_RESPONSES };
+    ne_request *reqs[HDR_BATCH];
+    const char *value;
+    double secs, cpu;
+    int count;
+
+    CALL(dispatch_canned(&c, reqs, &secs, &cpu));
+
+    value = ne_get_response_header(reqs[0], "Content-Type");
+    ONV(value == NULL || strcmp(value, "text/xml; charset=\"utf-8\"") != 0,
+        ("wrong Content-Type: %s", value ? value : "(none)"));
+    value = ne_get_response_header(reqs[HDR_BATCH - 1], "dav");
+    ONV(value == NULL 
+        || strcmp(value, "1,2, <http://apache.org/dav/propset/fs/1>") != 0,
+        ("DAV header not merged: %s", value ? value : "(none)"));
+    count = count_headers(reqs[0]);
+    ONV(count != 19, ("iterated over %d headers, expected 19", count));
+
+    CALL(finish_canned(reqs));
+
+    bench_report("%d responses with 20 header fields: %.0f responses/s, "
+                 "%.2fus client CPU each", HDR_RESPONSES, 
+                 HDR_RESPONSES / secs, cpu * 1e6 / HDR_RESPONSES);
+    return OK;
+}
+
+static int header_heavy(void)
+{
+    ne_buffer *resp = ne_buffer_create();
+    struct canned c;
+    ne_request *reqs[HDR_BATCH];
+    const char *value;
+    double secs, cpu;
+    int n, count;
+
+    /* A response with long header fields, some of them folded. */
+    ne_buffer_zappend(resp, "HTTP/1.1 207 Multi-Status" EOL);
+    for (n = 0; n < HEAVY_FIELDS - 2; n++) {
+        char name[40];
+
+        ne_snprintf(name, sizeof name, "X-Litmus-Field-%02d: ", n);
+        ne_buffer_concat(resp, name, 
+                         "value=\"6f1c0a4e-2b7d-4c83-9f55-1d2e3a4b5c6d\"",
+                         n % 10 ? EOL : EOL "\tfolded:" EOL, NULL);
+    }
+    ne_buffer_zappend(resp, "Content-Type: text/xml" EOL
+                      "Content-Length: 0" EOL EOL);
+
+    c.response = resp->data;
+    c.count = HEAVY_RESPONSES;
+    CALL(dispatch_canned(&c, reqs, &secs, &cpu));
+
+    count = count_headers(reqs[0]);
+    ONV(count != HEAVY_FIELDS, 
+        ("iterated over %d headers, expected %d", count, HEAVY_FIELDS));
+    value = ne_get_response_header(reqs[0], "x-litmus-field-10");
+    ONV(value == NULL || strcmp(value, "value=\"6f1c0a4e-2b7d-4c83-9f55-"
+                                "1d2e3a4b5c6d\" folded:") != 0,
+        ("folded header value was `%s'", value ? value : "(none)"));
+
+    CALL(finish_canned(reqs));
+
+    bench_report("%d responses of %" NE_FMT_SIZE_T " bytes with %d header "
+                 "fields: %.0f responses/s, %.2fus client CPU each", 
+                 HEAVY_RESPONSES, ne_buffer_size(resp), HEAVY_FIELDS,
+                 HEAVY_RESPONSES / secs, cpu * 1e6 / HEAVY_RESPONSES);
+    ne_buffer_destroy(resp);
+    return OK;
+}
+
+/* Size of the chunked response bodies decoded by the chunk_stream
+ * benchmark. */
+#define CHUNKED_SIZE (2 * 1024 * 1024)
+
+/* Build a response of CHUNKED_SIZE bytes of the stream_body pattern,
+ * in chunks of 'size' bytes, followed by a trailer. */
+static ne_buffer *build_chunks(size_t size)
+{
+    ne_buffer *buf = ne_buffer_create();
+    char *chunk = ne_malloc(size);
+    size_t off, n;
+
+    ne_buffer_zappend(buf, "HTTP/1.1 200 OK" EOL
+                      "Transfer-Encoding: chunked" EOL EOL);
+    for (off = 0; off < CHUNKED_SIZE; off += size) {
+        char line[20];
+
+        if (size > CHUNKED_SIZE - off) size = CHUNKED_SIZE - off;
+        for (n = 0; n < size; n++)
+            chunk[n] = 'a' + (off + n) % 26;
+        ne_snprintf(line, sizeof line, "%x" EOL, (unsigned int)size);
+        ne_buffer_zappend(buf, line);
+        ne_buffer_append(buf, chunk, size);
+        ne_buffer_zappend(buf, EOL);
+    }
+    ne_buffer_zappend(buf, "0" EOL "X-Trailer: done" EOL EOL);
+
+    ne_free(chunk);
+    return buf;
+}
+
+/* Server which sends the response held in buffer 'userdata'. */
+static int serve_buffer(ne_socket *sock, void *userdata)
+{
+    ne_buffer *buf = userdata;
+    int flag = 1;
+
+    setsockopt(ne_sock_fd(sock), IPPROTO_TCP, TCP_NODELAY, 
+               &flag, sizeof flag);
+
+    CALL(discard_request(sock));
+    ONN("send failed", server_send(sock, buf->data, 
+                                   ne_buffer_size(buf)) < 0);
+    return OK;
+}
+
+/* Fetch a chunked response made of chunks of 'size' bytes, storing
+ * the elapsed time in *secs and the number of blocks passed to the
+ * body reader in *blocks. */
+static int fetch_chunks(size_t size, double *secs, int *blocks)
+{
+    ne_session *sess;
+    ne_request *req;
+    struct stream st = {0};
+    struct timeval start;
+    ne_buffer *resp = build_chunks(size);
+    int ret, mask = ne_debug_mask;
+
+    CALL(spawn_server(CANNED_PORT, serve_buffer, resp));
+
+    sess = ne_session_create("http", "127.0.0.1", CANNED_PORT);
+    req = ne_request_create(sess, "GET", "/chunks");
+    ne_add_response_body_reader(req, ne_accept_2xx, check_stream, &st);
+
+    /* don't log every chunk. */
+    ne_debug_init(ne_debug_stream, 0);
+    bench_start(&start);
+    ret = ne_request_dispatch(req);
+    *secs = bench_elapsed(&start);
+    ne_debug_init(ne_debug_stream, mask);
+
+    ONV(ret || ne_get_status(req)->klass != 2,
+        ("GET of %" NE_FMT_SIZE_T " byte chunks failed: %s", 
+         size, ne_get_error(sess)));
+    ONV(st.offset != CHUNKED_SIZE,
+        ("got %" NE_FMT_OFF_T " bytes of %" NE_FMT_SIZE_T " byte chunks, "
+         "expected %d", st.offset, size, CHUNKED_SIZE));
+    ONN("trailer not read", 
+        ne_get_response_header(req, "X-Trailer") == NULL);
+    *blocks = st.calls;
+
+    ne_request_destroy(req);
+    ne_session_destroy(sess);
+    ne_buffer_destroy(resp);
+    return await_server();
+}
+
+static int chunk_stream(void)
+{
+    static const size_t sizes[] = { 1, 100, 65536 };
+    double secs[3];
+    int n, blocks[3];
+
+    CALL(lookup_localhost());
+
+    for (n = 0; n < 3; n++)
+        CALL(fetch_chunks(sizes[n], &secs[n], &blocks[n]));
+
+    bench_report("%d byte body in 1 byte chunks: %.1f MB/s in %d blocks, "
+                 "100 byte chunks: %.1f MB/s in %d blocks, 64KB chunks: "
+                 "%.1f MB/s in %d blocks", CHUNKED_SIZE,
+                 CHUNKED_SIZE / secs[0] / 1048576.0, blocks[0],
+                 CHUNKED_SIZE / secs[1] / 1048576.0, blocks[1],
+                 CHUNKED_SIZE / secs[2] / 1048576.0, blocks[2]);
+    return OK;
+}
+
+/* Chunk sizes which do not fit in an unsigned int, and must be
+ * rejected rather than wrap around. */
+static const char *const big_chunks[] = {
+    "100000000", "fffffffff", "1000000000000000000000001", NULL
+};
+
+static int chunk_oversize(void)
+{
+    ne_buffer *resp = ne_buffer_create();
+    ne_session *sess;
+    ne_request *req;
+    int n, ret;
+
+    CALL(lookup_localhost());
+
+    for (n = 0; big_chunks[n]; n++) {
+        ne_buffer_clear(resp);
+        ne_buffer_concat(resp, "HTTP/1.1 200 OK" EOL
+                         "Transfer-Encoding: chunked" EOL EOL,
+                         big_chunks[n], EOL "abc" EOL "0" EOL EOL, NULL);
+
+        CALL(spawn_server(CANNED_PORT, serve_buffer, resp));
+        sess = ne_session_create("http", "127.0.0.1", CANNED_PORT);
+        req = ne_request_create(sess, "GET", "/big");
+        ret = ne_request_dispatch(req);
+        ONV(ret == NE_OK, ("chunk size %s accepted", big_chunks[n]));
+        ONV(strstr(ne_get_error(sess), "chunk size") == NULL,
+            ("chunk size %s gave error: %s", big_chunks[n],
+             ne_get_error(sess)));
+        ne_request_destroy(req);
+        ne_session_destroy(sess);
+        CALL(await_server());
+    }
+
+    ne_buffer_destroy(resp);
+    return OK;
+}
+
+/* Number of lines in the body read by the borrow test. */
+#define BORROW_LINES (100000)
+
+/* Borrowing body reader which consumes only complete lines, each of
+ * which must hold the next line number. */
+static ssize_t borrow_lines(void *userdata, const char *buf, size_t len)
+{
+    int *line = userdata;
+    const char *start = buf, *lf;
+
+    while ((lf = memchr(start, '\n', buf + len - start)) != NULL) {
+        if (atoi(start) != *line) {
+            ne_set_error(i_session, "got line %d, expected %d", 
+                         atoi(start), *line);
+            return -1;
+        }
+        (*line)++;
+        start = lf + 1;
+    }
+    
+    return start - buf;
+}
+
+/* Fetch the response in buffer 'resp' from a child server, reading
+ * the body with borrow_lines. */
+static int fetch_lines(ne_buffer *resp)
+{
+    ne_session *sess;
+    ne_request *req;
+    int line = 0;
+
+    CALL(spawn_server(CANNED_PORT, serve_buffer, resp));
+
+    sess = ne_session_create("http", "127.0.0.1", CANNED_PORT);
+    req = ne_request_create(sess, "GET", "/lines");
+    ne_add_response_body_borrower(req, ne_accept_2xx, borrow_lines, &line);
+    ONV(ne_request_dispatch(req), 
+        ("GET of lines failed: %s", ne_get_error(sess)));
+    ONV(line != BORROW_LINES, 
+        ("read %d lines, expected %d", line, BORROW_LINES));
+
+    ne_request_destroy(req);
+    ne_session_destroy(sess);
+    return await_server();
+}
+
+static int borrow(void)
+{
+    ne_buffer *body = ne_buffer_create(), *resp = ne_buffer_create();
+    char line[100];
+    size_t off;
+    int n;
+
+    CALL(lookup_localhost());
+
+    for (n = 0; n < BORROW_LINES; n++) {
+        ne_snprintf(line, sizeof line, "%d\n", n);
+        ne_buffer_zappend(body, line);
+    }
+
+    /* Lines split across blocks must be passed again, whole. */
+    ne_snprintf(line, sizeof line, "HTTP/1.1 200 OK" EOL 
+                "Content-Length: %" NE_FMT_SIZE_T EOL EOL,
+                ne_buffer_size(body));
+    ne_buffer_zappend(resp, line);
+    ne_buffer_append(resp, body->data, ne_buffer_size(body));
+    CALL(fetch_lines(resp));
+
+    /* ...including when they are split across chunks. */
+    ne_buffer_clear(resp);
+    ne_buffer_zappend(resp, "HTTP/1.1 200 OK" EOL 
+                      "Transfer-Encoding: chunked" EOL EOL);
+    for (off = 0; off < ne_buffer_size(body); off += 7) {
+        size_t len = ne_buffer_size(body) - off;
+
+        if (len > 7) len = 7;
+        ne_snprintf(line, sizeof line, "%x" EOL, (unsigned int)len);
+        ne_buffer_zappend(resp, line);
+        ne_buffer_append(resp, body->data + off, len);
+        ne_buffer_zappend(resp, EOL);
+    }
+    ne_buffer_zappend(resp, "0" EOL EOL);
+    CALL(fetch_lines(resp));
+
+    ne_buffer_destroy(body);
+    ne_buffer_destroy(resp);
+    return OK;
+}
+
+/* Size of the multistatus response parsed by the big_propfind
+ * benchmark. */
+#define BIG_PROPFIND_SIZE (50 * 1024 * 1024)
+
+static const ne_propname big_props[] = {
+    { "DAV:", "getcontentlength" },
+    { "DAV:", "getlastmodified" },
+    { "DAV:", "getetag" },
+    { NULL }
+};
+
+/* Result callback counting the resources in a PROPFIND response. */
+static void count_results(void *userdata, const char *href,
+                          const ne_prop_result_set *set)
+{
+    int *count = userdata;
+
+    if (ne_propset_value(set, &big_props[0]) != NULL)
+        (*count)++;
+}
+
+static int big_propfind(void)
+{
+    ne_buffer *body = ne_buffer_create(), *resp = ne_buffer_create();
+    ne_session *sess;
+    struct timeval start;
+    char chunk[512];
+    double secs, cpu;
+    int n, count = 0, mask = ne_debug_mask;
+
+    CALL(lookup_localhost());
+
+    ne_buffer_zappend(body, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+                      "<D:multistatus xmlns:D=\"DAV:\">\n");
+    for (n = 0; ne_buffer_size(body) < BIG_PROPFIND_SIZE; n++) {
+        ne_snprintf(chunk, sizeof chunk,
+            "<D:response><D:href>/dav/big/resource-%08d.txt</D:href>\n"
+            "<D:propstat><D:prop>\n"
+            "<D:getcontentlength>%d</D:getcontentlength>\n"
+            "<D:getlastmodified>Mon, 06 Mar 2006 12:00:00 GMT"
+            "</D:getlastmodified>\n"
+            "<D:getetag>\"%x-1c2-8e1b3c00\"</D:getetag>\n"
+            "</D:prop><D:status>HTTP/1.1 200 OK</D:status></D:propstat>\n"
+            "</D:response>\n", n, n * 7, n);
+        ne_buffer_zappend(body, chunk);
+    }
+    ne_buffer_zappend(body, "</D:multistatus>\n");
+
+    ne_snprintf(chunk, sizeof chunk, "HTTP/1.1 207 Multi-Status" EOL 
+                "Content-Type: text/xml; charset=\"utf-8\"" EOL
+                "Content-Length: %" NE_FMT_SIZE_T EOL EOL,
+                ne_buffer_size(body));
+    ne_buffer_zappend(resp, chunk);
+    ne_buffer_append(resp, body->data, ne_buffer_size(body));
+    ne_buffer_destroy(body);
+
+    CALL(spawn_server(CANNED_PORT, serve_buffer, resp));
+
+    sess = ne_session_create("http", "127.0.0.1", CANNED_PORT);
+
+    /* don't log every element. */
+    ne_debug_init(ne_debug_stream, 0);
+    cpu = cpu_time();
+    bench_start(&start);
+    ONV(ne_simple_propfind(sess, "/dav/big/", NE_DEPTH_ONE, big_props,
+                           count_results, &count),
+        ("PROPFIND failed: %s", ne_get_error(sess)));
+    secs = bench_elapsed(&start);
+    cpu = cpu_time() - cpu;
+    ne_debug_init(ne_debug_stream, mask);
+
+    ONV(count != n, ("got %d resources, expected %d", count, n));
+
+    bench_report("%d resources in %" NE_FMT_SIZE_T " bytes: %.1f MB/s, "
+                 "%.2fs client CPU", n, ne_buffer_size(resp), 
+                 ne_buffer_size(resp) / secs / 1048576.0, cpu);
+
+    ne_session_destroy(sess);
+    ne_buffer_destroy(resp);
+    return await_server();
+}
+
+/* Number of responses in the multistatus body parsed by the
+ * propfind_stream test, and the prefix of their hrefs. */
+#define STREAM_RESPONSES (200000)
+#define STREAM_HREF "/dav/big/resource-"
+
+/* Properties requested by the propfind_stream test; each resource
+ * has the first three, and lacks displayname. */
+static const ne_propname stream_props[] = {
+    { "DAV:", "getcontentlength" },
+    { "DAV:", "getlastmodified" },
+    { "DAV:", "getetag" },
+    { "DAV:", "displayname" },
+    { NULL }
+};
+
+/* Build a 207 response with 'count' responses. */
+static ne_buffer *build_multistatus(int count)
+{
+    ne_buffer *body = ne_buffer_create(), *resp = ne_buffer_create();
+    char chunk[640];
+    int n;
+
+    ne_buffer_zappend(body, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+                      "<D:multistatus xmlns:D=\"DAV:\">\n");
+    for (n = 0; n < count; n++) {
+        ne_snprintf(chunk, sizeof chunk,
+            "<D:response><D:href>" STREAM_HREF "%08d.txt</D:href>\n"
+            "<D:propstat><D:prop>\n"
+            "<D:getcontentlength>%d</D:getcontentlength>\n"
+            "<D:getlastmodified>Mon, 06 Mar 2006 12:00:00 GMT"
+            "</D:getlastmodified>\n"
+            "<D:getetag>\"%x-1c2-8e1b3c00\"</D:getetag>\n"
+            "</D:prop><D:status>HTTP/1.1 200 OK</D:status></D:propstat>\n"
+            "<D:propstat><D:prop><D:displayname/></D:prop>\n"
+            "<D:status>HTTP/1.1 404 Not Found</D:status></D:propstat>\n"
+            "</D:response>\n", n, n * 7, n);
+        ne_buffer_zappend(body, chunk);
+    }
+    ne_buffer_zappend(body, "</D:multistatus>\n");
+
+    ne_snprintf(chunk, sizeof chunk, "HTTP/1.1 207 Multi-Status" EOL 
+                "Content-Type: text/xml; charset=\"utf-8\"" EOL
+                "Content-Length: %" NE_FMT_SIZE_T EOL EOL,
+                ne_buffer_size(body));
+    ne_buffer_zappend(resp, chunk);
+    ne_buffer_append(resp, body->data, ne_buffer_size(body));
+    ne_buffer_destroy(body);
+    return resp;
+}
+
+/* State for the results callbacks of the propfind_stream test: the
+ * number of properties seen, the number of calls after which to
+ * abort (or zero), and a description of the first mismatch. */
+struct streamed {
+    int count, abort_after;
+    char error[256];
+};
+
+/* Check property number 'count' of the results, which should be
+ * 'pname' of resource 'href' with given 'value' and 'status'. */
+static void check_streamed(struct streamed *st, const char *href,
+                           const ne_propname *pname, const char *value,
+                           const ne_status *status)
+{
+    int n = st->count / 4, which = st->count % 4;
+    const ne_propname *want = &stream_props[which];
+
+    st->count++;
+    if (st->error[0]) return;
+
+    if (strncmp(href, STREAM_HREF, strlen(STREAM_HREF)) 
+        || atoi(href + strlen(STREAM_HREF)) != n) {
+        ne_snprintf(st->error, sizeof st->error, 
+                    "property %d has href %s", st->count, href);
+    } else if (strcmp(pname->name, want->name)
+               || !pname->nspace || strcmp(pname->nspace, want->nspace)) {
+        ne_snprintf(st->error, sizeof st->error, 
+                    "property %d of %s is {%s}%s not %s", which, href,
+                    pname->nspace ? pname->nspace : "", pname->name,
+                    want->name);
+    } else if (which == 3 ? (value || !status || status->code != 404)
+               : (!value || !status || status->code != 200)) {
+        ne_snprintf(st->error, sizeof st->error, 
+                    "%s of %s has value %s, status %d", want->name, href,
+                    value ? value : "(none)", status ? status->code : 0);
+    } else if (which == 0 && atoi(value) != n * 7) {
+        ne_snprintf(st->error, sizeof st->error, 
+                    "getcontentlength of %s is %s", href, value);
+    }
+}
+
+static int stream_result(void *userdata, const char *href,
+                         const ne_propname *pname, const char *value,
+                         const ne_status *status)
+{
+    struct streamed *st = userdata;
+
+    check_streamed(st, href, pname, value, status);
+    return st->count == st->abort_after;
+}
+
+static void set_result(void *userdata, const char *href,
+                       const ne_prop_result_set *set)
+{
+    struct streamed *st = userdata;
+    int n;
+
+    /* Check the properties in the order requested. */
+    for (n = 0; n < 4; n++) {
+        const ne_propname *pname = &stream_props[n];
+
+        check_streamed(st, href, pname, ne_propset_value(set, pname),
+                       ne_propset_status(set, pname));
+    }
+}
+
+/* Fetch the multistatus 'resp' using the result set interface if
+ * 'stream' is zero, else the streaming interface; storing the client
+ * CPU time used in *cpu and the number of properties found in
+ * st->count. */
+static int fetch_multistatus(ne_buffer *resp, int stream, 
+                             struct streamed *st, double *cpu)
+{
+    ne_session *sess;
+    int ret, mask = ne_debug_mask;
+
+    CALL(spawn_server(CANNED_PORT, serve_buffer, resp));
+    sess = ne_session_create("http", "127.0.0.1", CANNED_PORT);
+
+    /* don't log every element. */
+    ne_debug_init(ne_debug_stream, 0);
+    *cpu = cpu_time();
+    if (stream)
+        ret = ne_simple_propfind_stream(sess, "/dav/big/", NE_DEPTH_ONE, 
+                                        stream_props, stream_result, st);
+    else
+        ret = ne_simple_propfind(sess, "/dav/big/", NE_DEPTH_ONE,
+                                 stream_props, set_result, st);
+    *cpu = cpu_time() - *cpu;
+    ne_debug_init(ne_debug_stream, mask);
+
+    if (st->abort_after) {
+        ONN("PROPFIND not aborted by callback", ret != NE_ERROR);
+    } else {
+        ONV(ret, ("PROPFIND failed: %s", ne_get_error(sess)));
+    }
+    ONV(st->error[0], ("%s PROPFIND: %s", stream ? "streamed" : "result set",
+                       st->error));
+    
+    ne_session_destroy(sess);
+    return await_server();
+}
+
+/* Check the streaming PROPFIND interface, and compare its cost to
+ * building result sets. */
+static int propfind_stream(void)
+{
+    ne_buffer *resp;
+    struct streamed st;
+    double sets, streamed;
+
+    CALL(lookup_localhost());
+
+    /* The callback can abort the PROPFIND. */
+    resp = build_multistatus(10);
+    memset(&st, 0, sizeof st);
+    st.abort_after = 6;
+    CALL(fetch_multistatus(resp, 1, &st, &streamed));
+    ONV(st.count != 6, ("%d properties after abort, expected 6", st.count));
+    ne_buffer_destroy(resp);
+
+    resp = build_multistatus(STREAM_RESPONSES);
+
+    memset(&st, 0, sizeof st);
+    CALL(fetch_multistatus(resp, 0, &st, &sets));
+    ONV(st.count != STREAM_RESPONSES * 4,
+        ("%d properties in result sets, expected %d", st.count, 
+         STREAM_RESPONSES * 4));
+
+    memset(&st, 0, sizeof st);
+    CALL(fetch_multistatus(resp, 1, &st, &streamed));
+    ONV(st.count != STREAM_RESPONSES * 4,
+        ("%d properties streamed, expected %d", st.count, 
+         STREAM_RESPONSES * 4));
+
+    bench_report("%d responses in %" NE_FMT_SIZE_T " bytes: result sets "
+                 "%.2fs client CPU, streamed %.2fs", STREAM_RESPONSES, 
+                 ne_buffer_size(resp), sets, streamed);
+
+    ne_buffer_destroy(resp);
+    return OK;
+}
+
+/* A document exercising namespace scoping, and the elements it
+ * should produce. */
+#define NAMES_DOC "<?xml version=\"1.0\"?>\n" \
+    "<a:root xmlns:a=\"urn:a\" xmlns=\"urn:default\">" \
+    "<child/><a:x xmlns:a=\"urn:b\"><a:y/></a:x><a:z a:attr=\"v\"/>" \
+    "<c xmlns=\"\"><d/></c><e/></a:root>"
+#define NAMES_RESULT "{urn:a}root {urn:default}child {urn:b}x {urn:b}y " \
+    "{urn:a}z {}c {}d {urn:default}e "
+
+/* Number of lookups timed by the xml_names test. */
+#define MAPID_COUNT (2000000)
+
+struct names {
+    ne_xml_parser *parser;
+    ne_buffer *buf;
+};
+
+/* Start-element callback accepting every element, noting its name
+ * and checking the names are interned. */
+static int names_startelm(void *userdata, int parent,
+                          const char *nspace, const char *name,
+                          const char **atts)
+{
+    struct names *n = userdata;
+    const char *attr;
+
+    if (ne_xml_intern(n->parser, nspace) != nspace
+        || ne_xml_intern(n->parser, name) != name) {
+        ne_buffer_concat(n->buf, "(not interned) ", NULL);
+    }
+
+    ne_buffer_concat(n->buf, "{", nspace, "}", name, " ", NULL);
+
+    attr = ne_xml_get_attr(n->parser, atts, "urn:a", "attr");
+    if (strcmp(name, "z") == 0 && (attr == NULL || strcmp(attr, "v")))
+        ne_buffer_concat(n->buf, "(no attr) ", NULL);
+
+    return 1;
+}
+
+/* Parse 'doc' noting its elements in 'buf'; returns the parse
+ * result. */
+static int parse_names(const char *doc, ne_buffer *buf, char *error,
+                       size_t errlen)
+{
+    struct names n;
+    int ret;
+
+    n.parser = ne_xml_create();
+    n.buf = buf;
+    ne_xml_push_handler(n.parser, names_startelm, NULL, NULL, &n);
+    ret = ne_xml_parse(n.parser, doc, strlen(doc));
+    if (ret == 0)
+        ret = ne_xml_parse(n.parser, "", 0);
+    ne_snprintf(error, errlen, "%s", ne_xml_get_error(n.parser));
+    ne_xml_destroy(n.parser);
+    return ret;
+}
+
+static const struct ne_xml_idmap names_map[] = {
+    { "DAV:", "multistatus", 1 }, { "DAV:", "response", 2 },
+    { "DAV:", "responsedescription", 3 }, { "DAV:", "href", 4 },
+    { "DAV:", "propstat", 5 }, { "DAV:", "prop", 6 },
+    { "DAV:", "status", 7 }, { "DAV:", "lockdiscovery", 8 },
+    { "DAV:", "activelock", 9 }, { "DAV:", "lockscope", 10 },
+    { "DAV:", "locktype", 11 }, { "DAV:", "depth", 12 },
+    { "DAV:", "owner", 13 }, { "DAV:", "timeout", 14 },
+    { "DAV:", "locktoken", 15 }, { "DAV:", "lockinfo", 16 },
+    { "DAV:", "write", 17 }, { "DAV:", "exclusive", 18 },
+    { "DAV:", "shared", 19 }, { "urn:other", "href", 20 },
+    { "DAV:", "href", 21 } /* duplicate: never found */
+};
+
+/* Number of distinct element names in the document parsed to check
+ * that interned names are discarded once out of use. */
+#define SWEEP_NAMES (20000)
+
+struct sweep {
+    const char *nspace, *qspace; /* interned before the parse */
+    int count, depth;
+    char error[200];
+};
+
+/* Start-element callback for the sweep document: elements e<N> with
+ * a child q:c<N> each. */
+static int sweep_startelm(void *userdata, int parent,
+                          const char *nspace, const char *name,
+                          const char **atts)
+{
+    struct sweep *sw = userdata;
+    char expect[40];
+
+    if (sw->depth == 1) {
+        ne_snprintf(expect, sizeof expect, "e%d", sw->count);
+        if (nspace != sw->nspace || strcmp(name, expect))
+            ne_snprintf(sw->error, sizeof sw->error, "got {%s}%s for %s",
+                        nspace, name, expect);
+    } else if (sw->depth == 2) {
+        ne_snprintf(expect, sizeof expect, "c%d", sw->count);
+        if (nspace != sw->qspace || strcmp(name, expect))
+            ne_snprintf(sw->error, sizeof sw->error, "got {%s}%s for %s",
+                        nspace, name, expect);
+    }
+    sw->depth++;
+    return 1;
+}
+
+static int sweep_endelm(void *userdata, int state,
+                        const char *nspace, const char *name)
+{
+    struct sweep *sw = userdata;
+
+    if (--sw->depth == 1)
+        sw->count++;
+    else if (sw->depth == 0 && (strcmp(name, "r") || nspace != sw->nspace))
+        ne_snprintf(sw->error, sizeof sw->error, "root ended as {%s}%s",
+                    nspace, name);
+    return 0;
+}
+
+/* Parse a document with many more distinct names than the parser
+ * keeps interned, checking the names passed to the callbacks. */
+static int parse_sweep(void)
+{
+    ne_buffer *doc = ne_buffer_create();
+    ne_xml_parser *parser = ne_xml_create();
+    struct sweep sw;
+    int n, ret;
+
+    ne_buffer_czappend(doc, "<r xmlns=\"urn:sweep\" xmlns:q=\"urn:q\">");
+    for (n = 0; n < SWEEP_NAMES; n++) {
+        char elm[100];
+
+        ne_snprintf(elm, sizeof elm, "<e%d q:a=\"v\"><q:c%d/></e%d>",
+                    n, n, n);
+        ne_buffer_zappend(doc, elm);
+    }
+    ne_buffer_czappend(doc, "</r>");
+
+    memset(&sw, 0, sizeof sw);
+    sw.nspace = ne_xml_intern(parser, "urn:sweep");
+    sw.qspace = ne_xml_intern(parser, "urn:q");
+    ne_xml_push_handler(parser, sweep_startelm, NULL, sweep_endelm, &sw);
+    ret = ne_xml_parse(parser, doc->data, ne_buffer_size(doc));
+    if (ret == 0)
+        ret = ne_xml_parse(parser, "", 0);
+
+    ONV(ret, ("parse failed: %s", ne_xml_get_error(parser)));
+    ONV(sw.error[0], ("%s", sw.error));
+    ONV(sw.count != SWEEP_NAMES, ("%d elements parsed, expected %d",
+                                  sw.count, SWEEP_NAMES));
+    ONN("interned string changed",
+        ne_xml_intern(parser, "urn:sweep") != sw.nspace);
+
+    ne_xml_destroy(parser);
+    ne_buffer_destroy(doc);
+    return OK;
+}
+
+/* Check that a parser's index of a map is not used for a different
+ * map allocated at the same address. */
+static int remap(void)
+{
+    static const char *const other[] = { "one", "two", "three", "four", 
+                                         "five", "six" };
+    ne_xml_parser *parser = ne_xml_create();
+    struct ne_xml_idmap *map;
+    size_t n, len = NE_XML_MAPLEN(names_map);
+    int id;
+
+    map = ne_malloc(sizeof names_map);
+    memcpy(map, names_map, sizeof names_map);
+    id = ne_xml_parser_mapid(parser, map, len, "DAV:", "status");
+    ONV(id != 7, ("status mapped to %d", id));
+    ne_free(map);
+
+    map = ne_malloc(sizeof names_map);
+    for (n = 0; n < len; n++) {
+        map[n].nspace = "urn:other";
+        map[n].name = other[n % 6];
+        map[n].id = 100 + n;
+    }
+    id = ne_xml_parser_mapid(parser, map, len, "urn:other", "three");
+    ONV(id != 102, ("three mapped to %d in another map", id));
+    id = ne_xml_parser_mapid(parser, map, len, "DAV:", "status");
+    ONV(id != 0, ("status mapped to %d in another map", id));
+    ne_free(map);
+
+    ne_xml_destroy(parser);
+    return OK;
+}
+
+/* Check namespace resolution and name interning in the XML parser,
+ * and the lookup of names in an idmap. */
+static int xml_names(void)
+{
+    ne_buffer *buf = ne_buffer_create();
+    ne_xml_parser *parser;
+    char error[512];
+    struct timeval start;
+    double hashed, scanned;
+    size_t n;
+    int sum;
+
+    ONV(parse_names(NAMES_DOC, buf, error, sizeof error),
+        ("parse failed: %s", error));
+    ONV(strcmp(buf->data, NAMES_RESULT),
+        ("got elements `%s', expected `%s'", buf->data, NAMES_RESULT));
+
+    /* A prefix is undeclared outside the element declaring it. */
+    ne_buffer_clear(buf);
+    ONN("undeclared prefix accepted",
+        parse_names("<r><x xmlns:q=\"urn:q\"/><q:y/></r>", buf,
+                    error, sizeof error) == 0);
+    ONV(strstr(error, "undeclared namespace prefix") == NULL,
+        ("unexpected error: %s", error));
+    ne_buffer_destroy(buf);
+
+    CALL(parse_sweep());
+    CALL(remap());
+
+    parser = ne_xml_create();
+    for (n = 0; n < NE_XML_MAPLEN(names_map) - 1; n++) {
+        int id = ne_xml_parser_mapid(parser, names_map, 
+                                     NE_XML_MAPLEN(names_map),
+                                     names_map[n].nspace, names_map[n].name);
+        ONV(id != names_map[n].id, ("{%s}%s mapped to %d not %d",
+                                    names_map[n].nspace, names_map[n].name,
+                                    id, names_map[n].id));
+    }
+    ONN("unknown name mapped",
+        ne_xml_parser_mapid(parser, names_map, NE_XML_MAPLEN(names_map), 
+                            "urn:other", "prop") != 0);
+
+    bench_start(&start);
+    for (n = 0, sum = 0; n < MAPID_COUNT; n++) {
+        const struct ne_xml_idmap *m = &names_map[n % 20];
+        sum += ne_xml_parser_mapid(parser, names_map, 
+                                   NE_XML_MAPLEN(names_map),
+                                   m->nspace, m->name);
+    }
+    hashed = bench_elapsed(&start);
+    ne_xml_destroy(parser);
+
+    bench_start(&start);
+    for (n = 0; n < MAPID_COUNT; n++) {
+        const struct ne_xml_idmap *m = &names_map[n % 20];
+        sum -= ne_xml_mapid(names_map, NE_XML_MAPLEN(names_map),
+                            m->nspace, m->name);
+    }
+    scanned = bench_elapsed(&start);
+    ONN("lookups differ", sum != 0);
+
+    bench_report("%d lookups in a %d entry map: hashed %.1fM/s, "
+                 "scanned %.1fM/s", MAPID_COUNT, 
+                 (int)NE_XML_MAPLEN(names_map), MAPID_COUNT / hashed / 1e6,
+                 MAPID_COUNT / scanned / 1e6);
+
+    return OK;
+}
+
+/* Depth of nesting, and number of responses in each document, parsed
+ * by the xml_stack test. */
+#define STACK_DEPTH (1000)
+#define STACK_RESPONSES (50000)
+
+/* Namespaces of the properties in the "manyns" document, as used by
+ * the props suite's propmanyns test. */
+static const char *stack_ns[10] = {
+    "alpha", "beta", "gamma", "delta", "epsilon", 
+    "zeta", "eta", "theta", "iota", "kappa"
+};    
+
+struct stacked {
+    ne_xml_parser *parser;
+    int depth, count;
+    char error[256];
+};
+
+/* Handler for the nested document: each element declares prefix 'a'
+ * bound to a URI giving its depth, and a default namespace for its
+ * child 'b'; check both resolve correctly at either end. */
+static int nested_startelm(void *userdata, int parent,
+                           const char *nspace, const char *name,
+                           const char **atts)
+{
+    struct stacked *st = userdata;
+    char uri[32];
+
+    ne_snprintf(uri, sizeof uri, "urn:%s:%d", 
+                name[0] == 'b' ? "b" : "a", parent);
+    if (strcmp(nspace, uri) && !st->error[0])
+        ne_snprintf(st->error, sizeof st->error, "{%s}%s at depth %d",
+                    nspace, name, parent);
+    return parent + 1;
+}
+
+static int nested_endelm(void *userdata, int state,
+                         const char *nspace, const char *name)
+{
+    nested_startelm(userdata, state - 1, nspace, name, NULL);
+    return 0;
+}
+
+/* Handler for the multistatus documents: counts the properties,
+ * checking those of the manyns document are in the right
+ * namespaces. */
+static int props_startelm(void *userdata, int parent,
+                          const char *nspace, const char *name,
+                          const char **atts)
+{
+    struct stacked *st = userdata;
+
+    if (parent != NE_207_STATE_PROP) 
+        return NE_XML_DECLINE;
+
+    if (strcmp(name, "somename") == 0 
+        && strcmp(nspace, stack_ns[st->count % 10]) && !st->error[0])
+        ne_snprintf(st->error, sizeof st->error, "property %d is {%s}%s",
+                    st->count, nspace, name);
+    st->count++;
+    return NE_207_STATE_TOP;
+}
+
+static void *stacked_response(void *userdata, const char *href)
+{
+    return userdata;
+}
+
+/* Parse 'doc' in blocks as if read from the network, using the
+ * handlers for the nested document if 'nested' is non-zero, or else
+ * a 207 parser; stores the CPU time taken in *cpu. */
+static int parse_stacked(const ne_buffer *doc, int nested, 
+                         struct stacked *st, double *cpu)
+{
+    ne_xml_parser *p = ne_xml_create();
+    ne_207_parser *p207 = NULL;
+    size_t off;
+    int ret = 0, mask = ne_debug_mask;
+
+    st->parser = p;
+    if (nested) {
+        ne_xml_push_handler(p, nested_startelm, NULL, nested_endelm, st);
+    } else {
+        p207 = ne_207_create(p, st);
+        ne_207_set_response_handlers(p207, stacked_response, NULL);
+        ne_xml_push_handler(p, props_startelm, NULL, NULL, st);
+    }
+
+    /* don't log every element. */
+    ne_debug_init(ne_debug_stream, 0);
+    *cpu = cpu_time();
+    for (off = 0; off < ne_buffer_size(doc) && ret == 0; off += 8192) {
+        size_t len = ne_buffer_size(doc) - off;
+
+        if (len > 8192) len = 8192;
+        ret = ne_xml_parse(p, doc->data + off, len);
+    }
+    if (ret == 0) ret = ne_xml_parse(p, "", 0);
+    *cpu = cpu_time() - *cpu;
+    ne_debug_init(ne_debug_stream, mask);
+
+    ONV(ret, ("parse failed: %s", ne_xml_get_error(p)));
+    ONV(st->error[0], ("wrong element %s", st->error));
+
+    if (p207) ne_207_destroy(p207);
+    ne_xml_destroy(p);
+    return OK;
+}
+
+/* Check the XML parser's element stack with deeply nested namespace
+ * scopes, and time the parsing of multistatus documents. */
+static int xml_stack(void)
+{
+    ne_buffer *doc = ne_buffer_create(), *big;
+    struct stacked st;
+    char chunk[256];
+    const char *body;
+    double manyns, multi;
+    int n, m;
+
+    for (n = 0; n < STACK_DEPTH; n++) {
+        ne_snprintf(chunk, sizeof chunk, "<a:e xmlns:a=\"urn:a:%d\" "
+                    "xmlns=\"urn:b:%d\">", n, n + 1);
+        ne_buffer_zappend(doc, chunk);
+    }
+    for (n = 0; n < STACK_DEPTH; n++)
+        ne_buffer_zappend(doc, "<b/></a:e>");
+    memset(&st, 0, sizeof st);
+    CALL(parse_stacked(doc, 1, &st, &manyns));
+
+    /* A multistatus response in the style of a PROPFIND after the
+     * props suite's propmanyns test. */
+    ne_buffer_clear(doc);
+    ne_buffer_zappend(doc, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+                      "<D:multistatus xmlns:D=\"DAV:\">\n");
+    for (n = 0; n < STACK_RESPONSES; n++) {
+        ne_snprintf(chunk, sizeof chunk, "<D:response><D:href>"
+                    "/dav/litmus/prop%d</D:href>\n<D:propstat><D:prop>\n",
+                    n);
+        ne_buffer_zappend(doc, chunk);
+        for (m = 0; m < 10; m++) {
+            ne_snprintf(chunk, sizeof chunk, "<ns%d:somename xmlns:ns%d=\"%s\">"
+                        "manynsvalue</ns%d:somename>\n", m, m, stack_ns[m], m);
+            ne_buffer_zappend(doc, chunk);
+        }
+        ne_buffer_zappend(doc, "</D:prop><D:status>HTTP/1.1 200 OK</D:status>"
+                          "</D:propstat>\n</D:response>\n");
+    }
+    ne_buffer_zappend(doc, "</D:multistatus>\n");
+
+    memset(&st, 0, sizeof st);
+    CALL(parse_stacked(doc, 0, &st, &manyns));
+    ONV(st.count != STACK_RESPONSES * 10,
+        ("%d properties in manyns document, expected %d", st.count,
+         STACK_RESPONSES * 10));
+
+    /* The multistatus body used by the propfind_stream test. */
+    big = build_multistatus(STREAM_RESPONSES);
+    body = strstr(big->data, EOL EOL) + 4;
+    ne_buffer_clear(doc);
+    ne_buffer_zappend(doc, body);
+    ne_buffer_destroy(big);
+    memset(&st, 0, sizeof st);
+    CALL(parse_stacked(doc, 0, &st, &multi));
+    ONV(st.count != STREAM_RESPONSES * 4,
+        ("%d properties in multistatus, expected %d", st.count,
+         STREAM_RESPONSES * 4));
+
+    bench_report("%d responses with 10 namespaces: %.0f responses/s; "
+                 "%d responses in %" NE_FMT_SIZE_T " bytes: %.1f MB/s",
+                 STACK_RESPONSES, STACK_RESPONSES / manyns,
+                 STREAM_RESPONSES, ne_buffer_size(doc),
+                 ne_buffer_size(doc) / multi / 1048576.0);
+
+    ne_buffer_destroy(doc);
+    return OK;
+}
+
+/* Server for the stale test: the first connection answers 'count'
+ * requests with 'response', and then either closes, or if 'linger' is
+ * non-zero, waits for the client to close it; later connections
+ * answer one request with IDLE_RESPONSE. */
+struct idle {
+    const char *response;
+    int count, linger;
+    int conns; /* connections accepted so far, in the child */
+};
+
+#define IDLE_RESPONSE "HTTP/1.1 200 OK" EOL "Content-Length: 0" EOL EOL
+
+static int serve_idle(ne_socket *sock, void *userdata)
+{
+    struct idle *idle = userdata;
+    char buf[BUFSIZ];
+    int n;
+
+    if (idle->conns++) {
+        CALL(discard_request(sock));
+        SEND_STRING(sock, IDLE_RESPONSE);
+        return OK;
+    }
+
+    for (n = 0; n < idle->count; n++) {
+        CALL(discard_request(sock));
+        SEND_STRING(sock, idle->response);
+    }
+
+    if (idle->linger)
+        while (ne_sock_read(sock, buf, sizeof buf) > 0)
+            /* nothing */;
+
+    return OK;
+}
+
+/* Send 'count' GET requests in session 'sess'. */
+static int get_idle(ne_session *sess, int count)
+{
+    while (count--) {
+        ne_request *req = ne_request_create(sess, "GET", "/idle");
+        int ret = ne_request_dispatch(req);
+
+        ONV(ret || ne_get_status(req)->klass != 2,
+            ("GET failed: %s", ne_get_error(sess)));
+        ne_request_destroy(req);
+    }
+    return OK;
+}
+
+static int stale(void)
+{
+    struct idle idle = { IDLE_RESPONSE, 2, 0, 0 };
+    ne_session *sess;
+    ne_pool_stats stats;
+    int n;
+
+    CALL(lookup_localhost());
+
+    /* A connection which the server has closed while it was idle is
+     * noticed before it is reused. */
+    CALL(spawn_server_repeat(CANNED_PORT, serve_idle, &idle, 3));
+    sess = ne_session_create("http", "127.0.0.1", CANNED_PORT);
+    CALL(get_idle(sess, 2));
+    /* Give the server's FIN time to arrive. */
+    for (n = 0; n < 100; n++)
+        minisleep();
+    CALL(get_idle(sess, 1));
+
+    ne_get_pool_stats(sess, &stats);
+    ONV(stats.hits != 1 || stats.misses != 2 || stats.stale != 1,
+        ("closed connection: %lu reused, %lu opened, %lu stale; "
+         "expected 1, 2, 1", stats.hits, stats.misses, stats.stale));
+    ne_session_destroy(sess);
+    CALL(reap_server());
+
+    /* A connection which the server is about to time out, per its
+     * Keep-Alive header, is not reused. */
+    idle.response = "HTTP/1.1 200 OK" EOL "Keep-Alive: timeout=2, max=100" EOL
+        "Content-Length: 0" EOL EOL;
+    idle.count = 1;
+    idle.linger = 1;
+    CALL(spawn_server_repeat(CANNED_PORT, serve_idle, &idle, 3));
+    sess = ne_session_create("http", "127.0.0.1", CANNED_PORT);
+    CALL(get_idle(sess, 1));
+    sleep(1);
+    CALL(get_idle(sess, 1));
+
+    ne_get_pool_stats(sess, &stats);
+    ONV(stats.hits != 0 || stats.misses != 2 || stats.stale != 1,
+        ("timed out connection: %lu reused, %lu opened, %lu stale; "
+         "expected 0, 2, 1", stats.hits, stats.misses, stats.stale));
+    ne_session_destroy(sess);
+    return reap_server();
+}
+
+/* Size of the request bodies sent by the expect100_wait test. */
+#define EXPECT_SIZE (64 * 1024)
+/* 100-continue timeout used by the expect100_wait test, in ms. */
+#define EXPECT_TIMEOUT (200)
+
+static void pause_msec(int msec)
+{
+    struct timeval tv;
+
+    tv.tv_sec = msec / 1000;
+    tv.tv_usec = (msec % 1000) * 1000;
+    select(0, NULL, NULL, NULL, &tv);
+}
+
+/* Server for the expect100_wait test: answers each of 'count'
+ * requests, sending a 100-continue first if 'honour' is non-zero and
+ * the request has an Expect header, and returning 'final' before
+ * reading the body if non-NULL.  If 'honour' is 2, the 100-continue
+ * comes only after twice EXPECT_TIMEOUT, and a body which arrived
+ * before it is refused unless this is the first request.  The
+ * response says whether the request had an Expect header. */
+struct expect {
+    int count, honour;
+    const char *final;
+};
+
+static int got_expect;
+
+static void note_expect(char *value)
+{
+    got_expect = 1;
+}
+
+static int serve_expect(ne_socket *sock, void *userdata)
+{
+    struct expect *e = userdata;
+    int n;
+
+    want_header = "Expect";
+    got_header = note_expect;
+
+    for (n = 0; n < e->count; n++) {
+        got_expect = 0;
+        CALL(discard_request(sock));
+
+        if (e->final) {
+            SEND_STRING(sock, e->final);
+            continue;
+        }
+
+        if (got_expect && e->honour == 2) {
+            size_t len;
+
+            pause_msec(2 * EXPECT_TIMEOUT);
+            ne_sock_buffered(sock, &len);
+            if (n > 0 && (len > 0 || ne_sock_wait_timeout(
+                              sock, NE_SOCK_WANT_READ, 0) == 0)) {
+                SEND_STRING(sock, "HTTP/1.1 400 Body Before Continue" EOL
+                            "Content-Length: 0" EOL 
+                            "Connection: close" EOL EOL);
+                return OK;
+            }
+        }
+        if (got_expect && e->honour)
+            SEND_STRING(sock, "HTTP/1.1 100 Continue" EOL EOL);
+        CALL(discard_body(sock));
+        SEND_STRING(sock, got_expect 
+                    ? "HTTP/1.1 201 Created" EOL "X-Expect: yes" EOL
+                    "Content-Length: 0" EOL EOL
+                    : "HTTP/1.1 201 Created" EOL "X-Expect: no" EOL
+                    "Content-Length: 0" EOL EOL);
+    }
+
+    return OK;
+}
+
+/* Body provider for put_expect: EXPECT_SIZE bytes, counting the
+ * blocks read in the int at userdata. */
+static ssize_t expect_body(void *userdata, char *buf, size_t buflen)
+{
+    static size_t offset;
+    int *calls = userdata;
+    size_t len = EXPECT_SIZE - offset;
+
+    if (buflen == 0) {
+        offset = 0;
+        *calls = 0;
+        return 0;
+    }
+
+    if (len > buflen) len = buflen;
+    memset(buf, 'x', len);
+    offset += len;
+    if (len) (*calls)++;
+
+    return len;
+}
+
+/* PUT a body with 100-continue in session 'sess', using
+ * ne_request_step if 'step' is non-zero; stores the elapsed time in
+ * *secs, whether the server saw an Expect header in *expected, and
+ * the number of times the body was read in *reads. */
+static int put_expect(ne_session *sess, int step, int code,
+                      double *secs, int *expected, int *reads)
+{
+    ne_request *req = ne_request_create(sess, "PUT", "/expect");
+    struct timeval start;
+    const char *value;
+    int ret = NE_OK;
+
+    *reads = 0;
+    ne_set_request_expect100(req, 1);
+    ne_set_request_body_provider(req, EXPECT_SIZE, expect_body, reads);
+
+    bench_start(&start);
+    if (step) 
+        CALL(step_all(&req, 1));
+    else
+        ret = ne_request_dispatch(req);
+    *secs = bench_elapsed(&start);
+
+    ONV(ret || ne_get_status(req)->code != code,
+        ("PUT got %d not %d: %s", ne_get_status(req)->code, code,
+         ne_get_error(sess)));
+    value = ne_get_response_header(req, "X-Expect");
+    *expected = value && strcmp(value, "yes") == 0;
+
+    ne_request_destroy(req);
+    return OK;
+}
+
+static int expect100_wait(void)
+{
+    struct expect e = { 3, 0, NULL };
+    ne_session *sess;
+    double first, later, secs;
+    int step, expected, reads;
+
+    CALL(lookup_localhost());
+
+    for (step = 0; step < 2; step++) {
+        /* A server which ignores Expect: the body is sent after the
+         * timeout, each time, and the Expect header is kept. */
+        e.honour = 0;
+        CALL(spawn_server(CANNED_PORT, serve_expect, &e));
+        sess = ne_session_create("http", "127.0.0.1", CANNED_PORT);
+        ne_set_expect100_timeout(sess, EXPECT_TIMEOUT);
+
+        CALL(put_expect(sess, step, 201, &first, &expected, &reads));
+        ONV(!expected, ("first PUT did not send an Expect header"));
+        ONV(first < EXPECT_TIMEOUT / 2000.0 || first > 5,
+            ("first PUT took %.3fs, expected %.3fs", first, 
+             EXPECT_TIMEOUT / 1000.0));
+        CALL(put_expect(sess, step, 201, &later, &expected, &reads));
+        ONV(!expected, ("second PUT did not send an Expect header"));
+        CALL(put_expect(sess, step, 201, &later, &expected, &reads));
+        ONV(later < EXPECT_TIMEOUT / 2000.0 || later > 5,
+            ("later PUT took %.3fs, expected %.3fs", later, 
+             EXPECT_TIMEOUT / 1000.0));
+        ne_session_destroy(sess);
+        CALL(await_server());
+
+        /* A server which sends the 100-continue late: once seen,
+         * later requests wait for it. */
+        e.honour = 2;
+        CALL(spawn_server(CANNED_PORT, serve_expect, &e));
+        sess = ne_session_create("http", "127.0.0.1", CANNED_PORT);
+        ne_set_expect100_timeout(sess, EXPECT_TIMEOUT);
+        CALL(put_expect(sess, step, 201, &secs, &expected, &reads));
+        CALL(put_expect(sess, step, 201, &secs, &expected, &reads));
+        ONV(!expected, ("PUT after a late 100-continue had no Expect"));
+        CALL(put_expect(sess, step, 201, &secs, &expected, &reads));
+        ne_session_destroy(sess);
+        CALL(await_server());
+
+        /* A server which honours it. */
+        e.honour = 1;
+        CALL(spawn_server(CANNED_PORT, serve_expect, &e));
+        sess = ne_session_create("http", "127.0.0.1", CANNED_PORT);
+        ne_set_expect100_timeout(sess, EXPECT_TIMEOUT);
+        CALL(put_expect(sess, step, 201, &secs, &expected, &reads));
+        ONV(!expected, ("PUT did not send an Expect header"));
+        ONV(secs > EXPECT_TIMEOUT / 2000.0,
+            ("PUT to honouring server took %.3fs", secs));
+        CALL(put_expect(sess, step, 201, &secs, &expected, &reads));
+        ONV(!expected, ("second PUT did not send an Expect header"));
+        CALL(put_expect(sess, step, 201, &secs, &expected, &reads));
+        ne_session_destroy(sess);
+        CALL(await_server());
+    }
+
+    /* A request which is refused is not sent. */
+    e.count = 1;
+    e.final = "HTTP/1.1 401 Unauthorized" EOL "Content-Length: 0" EOL 
+        "Connection: close" EOL EOL;
+    CALL(spawn_server(CANNED_PORT, serve_expect, &e));
+    sess = ne_session_create("http", "127.0.0.1", CANNED_PORT);
+    ne_set_expect100_timeout(sess, EXPECT_TIMEOUT);
+    CALL(put_expect(sess, 0, 401, &secs, &expected, &reads));
+    ONV(reads != 0, ("body read %d times for refused PUT", reads));
+    ne_session_destroy(sess);
+    CALL(await_server());
+
+    bench_report("PUT to a server ignoring 100-continue: first %.0fms, "
+                 "then %.0fms", first * 1e3, later * 1e3);
+    return OK;
+}
+
+/* Local files used by the resumable test: the file uploaded, the
+ * checkpoint, and the segments staged by the server. */
+#define RESUMABLE_FILE "resumable.tmp"
+#define RESUMABLE_CHECKPOINT "resumable.ckpt"
+#define RESUMABLE_STAGED "resumable.staged"
+
+/* Size of the file uploaded by the resumable test, and of each
+ * segment. */
+#define RESUMABLE_SIZE (1000000 + 123)
+#define RESUMABLE_SEGMENT (65536)
+
+/* Server for the resumable test, which stages segments in
+ * RESUMABLE_STAGED so that a second server process can resume the
+ * upload.  Drops the connection part-way through segment number
+ * 'drop', unless negative; if 'resumed' is non-zero, expects the
+ * client first to ask how much is staged, then to carry on from
+ * there.  If 'reply' is non-NULL, the query is answered with that
+ * response instead. */
+struct resumable {
+    int drop, resumed;
+    const char *reply;
+};
+
+/* Byte at offset 'n' of the file uploaded by the resumable test. */
+#define RESUMABLE_BYTE(n) ((char)('a' + (n) % 23))
+
+static char *got_content_range;
+
+static void note_content_range(char *value)
+{
+    got_content_range = ne_strdup(value);
+}
+
+/* Sends a response with status 'code', giving the staged range. */
+static int send_staged(ne_socket *sock, int code, long staged)
+{
+    char buf[256];
+
+    if (staged > 0)
+        ne_snprintf(buf, sizeof buf, "HTTP/1.1 %d Staged" EOL
+                    "Range: bytes=0-%ld" EOL "Content-Length: 0" EOL EOL,
+                    code, staged - 1);
+    else
+        ne_snprintf(buf, sizeof buf, "HTTP/1.1 %d Staged" EOL
+                    "Content-Length: 0" EOL EOL, code);
+
+    return server_send(sock, buf, strlen(buf)) ? FAIL : OK;
+}
+
+static int serve_resumable(ne_socket *sock, void *userdata)
+{
+    struct resumable *r = userdata;
+    int n;
+
+    want_header = "Content-Range";
+    got_header = note_content_range;
+
+    for (n = 0; ; n++) {
+        long first, last, total, staged, i;
+        struct stat st;
+        char *body;
+        FILE *f;
+
+        got_content_range = NULL;
+        CALL(discard_request(sock));
+        ONN("no Content-Range header", got_content_range == NULL);
+
+        staged = stat(RESUMABLE_STAGED, &st) ? 0 : (long)st.st_size;
+
+        if (strncmp(got_content_range, "bytes */", 8) == 0) {
+            ONV(!r->resumed || n != 0, ("unexpected query %d", n));
+            ne_free(got_content_range);
+            if (r->reply) {
+                SEND_STRING(sock, r->reply);
+                return OK;
+            }
+            CALL(send_staged(sock, 202, staged));
+            continue;
+        }
+
+        ONV(sscanf(got_content_range, "bytes %ld-%ld/%ld", 
+                   &first, &last, &total) != 3,
+            ("bad Content-Range: %s", got_content_range));
+        ne_free(got_content_range);
+        ONV(clength != last - first + 1, 
+            ("Content-Length %d for %ld bytes", clength, last - first + 1));
+        ONV(r->resumed && n == 0, ("upload resumed without a query"));
+        ONV(r->resumed && n == 1 && first != staged,
+            ("upload resumed at %ld not %ld", first, staged));
+
+        if (first != staged) {
+            CALL(discard_body(sock));
+            CALL(send_staged(sock, 416, staged));
+            continue;
+        }
+
+        body = ne_malloc(clength);
+        if (n == r->drop) {
+            ne_sock_fullread(sock, body, clength / 2);
+            ne_free(body);
+            return OK;
+        }
+        ONN("could not read segment", 
+            ne_sock_fullread(sock, body, clength) != 0);
+
+        f = fopen(RESUMABLE_STAGED, first == 0 ? "wb" : "ab");
+        ONN("could not stage segment", 
+            f == NULL || fwrite(body, clength, 1, f) != 1 || fclose(f));
+        ne_free(body);
+
+        if (last + 1 < total) {
+            CALL(send_staged(sock, 202, last + 1));
+            continue;
+        }
+
+        /* Last segment: check the whole upload. */
+        f = fopen(RESUMABLE_STAGED, "rb");
+        ONN("could not open staged upload", f == NULL);
+        for (i = 0; i < total; i++) {
+            if (getc(f) != (unsigned char)RESUMABLE_BYTE(i)) break;
+        }
+        fclose(f);
+        ONV(i < total, ("staged upload differs at byte %ld", i));
+        
+        SEND_STRING(sock, "HTTP/1.1 201 Created" EOL 
+                    "Content-Length: 0" EOL EOL);
+        return OK;
+    }
+}
+
+/* Answers to the query for the staged range which a resumed upload
+ * must reject. */
+static const char *const bad_staged[] = {
+    "HTTP/1.1 200 OK" EOL "Content-Length: 0" EOL EOL,
+    "HTTP/1.1 204 No Content" EOL EOL,
+    "HTTP/1.1 202 Staged" EOL "Range: bytes=0-" EOL 
+    "Content-Length: 0" EOL EOL,
+    "HTTP/1.1 202 Staged" EOL "Range: bytes=0-12x" EOL 
+    "Content-Length: 0" EOL EOL,
+    NULL
+};
+
+/* Upload a file with ne_put_resumable, dropping the connection part
+ * way through, and check that the second attempt resumes it. */
+static int resumable(void)
+{
+    struct resumable r = { 5, 0, NULL };
+    ne_session *sess;
+    char buf[4096];
+    int fd, n, ret;
+
+    CALL(lookup_localhost());
+
+    fd = open(RESUMABLE_FILE, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    ONV(fd < 0, ("could not create %s", RESUMABLE_FILE));
+    for (n = 0; n < RESUMABLE_SIZE; n++) {
+        buf[n % sizeof buf] = RESUMABLE_BYTE(n);
+        if (n % sizeof buf == sizeof buf - 1 || n == RESUMABLE_SIZE - 1)
+            ONN("could not write file",
+                write(fd, buf, n % sizeof buf + 1) != n % sizeof buf + 1);
+    }
+    unlink(RESUMABLE_CHECKPOINT);
+    unlink(RESUMABLE_STAGED);
+
+    CALL(spawn_server(CANNED_PORT, serve_resumable, &r));
+    sess = ne_session_create("http", "127.0.0.1", CANNED_PORT);
+    ret = ne_put_resumable(sess, "/upload", fd, RESUMABLE_SEGMENT, 
+                           RESUMABLE_CHECKPOINT);
+    ONN("first attempt succeeded", ret == NE_OK);
+    ne_session_destroy(sess);
+    CALL(await_server());
+
+    ONN("no checkpoint after first attempt", 
+        access(RESUMABLE_CHECKPOINT, F_OK) != 0);
+
+    r.drop = -1;
+    r.resumed = 1;
+
+    for (n = 0; bad_staged[n]; n++) {
+        r.reply = bad_staged[n];
+        CALL(spawn_server(CANNED_PORT, serve_resumable, &r));
+        sess = ne_session_create("http", "127.0.0.1", CANNED_PORT);
+        ret = ne_put_resumable(sess, "/upload", fd, RESUMABLE_SEGMENT, 
+                               RESUMABLE_CHECKPOINT);
+        ONV(ret == NE_OK, ("upload resumed after bad reply %d", n));
+        ne_session_destroy(sess);
+        CALL(await_server());
+        ONV(access(RESUMABLE_CHECKPOINT, F_OK) != 0,
+            ("checkpoint lost after bad reply %d", n));
+    }
+
+    r.reply = NULL;
+    CALL(spawn_server(CANNED_PORT, serve_resumable, &r));
+    sess = ne_session_create("http", "127.0.0.1", CANNED_PORT);
+    ret = ne_put_resumable(sess, "/upload", fd, RESUMABLE_SEGMENT, 
+                           RESUMABLE_CHECKPOINT);
+    ONV(ret != NE_OK, ("resumed upload failed: %s", ne_get_error(sess)));
+    ne_session_destroy(sess);
+    CALL(await_server());
+
+    ONN("checkpoint left after upload",
+        access(RESUMABLE_CHECKPOINT, F_OK) == 0);
+
+    close(fd);
+    unlink(RESUMABLE_FILE);
+    unlink(RESUMABLE_STAGED);
+    return OK;
+}
+
+/* Delays in milliseconds by which the timings server holds back the
+ * response head, and then the response body. */
+#define TIMING_HEAD (100)
+#define TIMING_BODY (50)
+
+/* Serve two requests over one connection, delaying each response. */
+static int serve_slowly(ne_socket *sock, void *userdata)
+{
+    int n;
+
+    for (n = 0; n < 2; n++) {
+        CALL(discard_request(sock));
+        pause_msec(TIMING_HEAD);
+        SEND_STRING(sock, "HTTP/1.1 200 OK" EOL "Content-Length: 5" EOL EOL);
+        pause_msec(TIMING_BODY);
+        SEND_STRING(sock, "hello");
+    }
+
+    return OK;
+}
+
+/* Dispatch a GET request and check the order of its timings; the
+ * server's delays must appear between sending the request and
+ * receiving the first byte, and between the headers and the end of
+ * the body.  If 'fresh' is non-zero, a new connection is expected. */
+static int get_timed(ne_session *sess, int fresh)
+{
+    ne_request *req = ne_request_create(sess, "GET", "/slow");
+    const ne_request_timings *t = ne_get_request_timings(req);
+    double start;
+
+    ONN("timings set before dispatch", t->sent != -1 || t->body != -1);
+    ONV(ne_request_dispatch(req) || ne_get_status(req)->klass != 2,
+        ("GET failed: %s", ne_get_error(sess)));
+
+    if (fresh) {
+        ONV(t->lookup < 0 || t->connect < t->lookup,
+            ("lookup %.6f, connect %.6f", t->lookup, t->connect));
+        start = t->connect;
+    } else {
+        ONV(t->lookup != -1 || t->connect != -1,
+            ("lookup %.6f, connect %.6f for reused connection",
+             t->lookup, t->connect));
+        start = 0;
+    }
+    ONV(t->handshake != -1, ("handshake %.6f without SSL", t->handshake));
+    ONV(t->sent < start, ("sent %.6f before %.6f", t->sent, start));
+    ONV(t->first_byte - t->sent < TIMING_HEAD / 1000.0 * 0.9,
+        ("first byte %.6f not delayed after request sent %.6f",
+         t->first_byte, t->sent));
+    ONV(t->headers < t->first_byte,
+        ("headers %.6f before first byte %.6f", t->headers, t->first_byte));
+    ONV(t->body - t->headers < TIMING_BODY / 1000.0 * 0.9,
+        ("body %.6f not delayed after headers %.6f", t->body, t->headers));
+
+    ne_request_destroy(req);
+    return OK;
+}
+
+/* Check the per-request timings for a new and a reused connection. */
+static int timings(void)
+{
+    ne_session *sess;
+
+    CALL(lookup_localhost());
+    CALL(spawn_server(CANNED_PORT, serve_slowly, NULL));
+    sess = ne_session_create("http", "127.0.0.1", CANNED_PORT);
+    CALL(get_timed(sess, 1));
+    CALL(get_timed(sess, 0));
+    ne_session_destroy(sess);
+    return await_server();
+}
+
+/* File to which the trace test dumps the trace rings, the size of
+ * the rings, and the size of response body and number of messages
+ * used to compare the cost of tracing with writing to the debug
+ * stream. */
+#define TRACE_FILE "debug.trace"
+#define TRACE_RING (1024 * 1024)
+#define TRACE_BODY (4 * 1024 * 1024)
+#define TRACE_COUNT (200000)
+
+/* A message using most kinds of conversion. */
+#define TRACE_FORMAT "int %d, unsigned %5u, long %-4ld|, size_t %" \
+    NE_FMT_SIZE_T ", hex %#x, char %c, short %hd, double %08.3f %e, " \
+    "strings [%s] [%10.3s] [%-*.*s], pointer %p, 100%%\n"
+#define TRACE_ARGS -42, 7u, 123456789L, (size_t)65536, 255, 'z', \
+    (short)-3, 3.14159, 6.02e23, "hello", "truncated", 6, 2, "abcdef", \
+    (void *)&trace_dummy
+
+static int trace_dummy;
+
+/* Read the contents of stream 'f' into 'buf'. */
+static void read_stream(FILE *f, ne_buffer *buf)
+{
+    char block[BUFSIZ];
+    size_t len;
+
+    rewind(f);
+    ne_buffer_clear(buf);
+    while ((len = fread(block, 1, sizeof block, f)) > 0)
+        ne_buffer_append(buf, block, len);
+}
+
+/* Dump the trace rings to TRACE_FILE, and decode it into 'buf'. */
+static int decode_trace(ne_buffer *buf)
+{
+    int fd = open(TRACE_FILE, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    FILE *f;
+
+    ONV(fd < 0, ("could not create %s", TRACE_FILE));
+    ONN("could not dump trace", ne_debug_dump(fd));
+    lseek(fd, 0, SEEK_SET);
+    f = tmpfile();
+    ONN("could not create temporary file", f == NULL);
+    ONN("could not decode trace", ne_debug_decode(fd, f));
+    close(fd);
+    unlink(TRACE_FILE);
+    read_stream(f, buf);
+    fclose(f);
+    return OK;
+}
+
+/* Fetch the response 'resp' from serve_buffer, storing the elapsed
+ * time in *secs. */
+static int fetch_traced(ne_buffer *resp, double *secs)
+{
+    ne_session *sess;
+    ne_request *req;
+    struct timeval start;
+    int ret;
+
+    CALL(spawn_server(CANNED_PORT, serve_buffer, resp));
+    sess = ne_session_create("http", "127.0.0.1", CANNED_PORT);
+    req = ne_request_create(sess, "GET", "/traced");
+    bench_start(&start);
+    ret = ne_request_dispatch(req);
+    *secs = bench_elapsed(&start);
+    ONV(ret || ne_get_status(req)->klass != 2,
+        ("GET failed: %s", ne_get_error(sess)));
+    ne_request_destroy(req);
+    ne_session_destroy(sess);
+    return await_server();
+}
+
+/* Build a response with a body of 'size' bytes. */
+static ne_buffer *traced_response(size_t size)
+{
+    ne_buffer *resp = ne_buffer_create();
+    char *body = ne_malloc(size), head[100];
+    size_t n;
+
+    for (n = 0; n < size; n++)
+        body[n] = 'a' + n % 26;
+    ne_snprintf(head, sizeof head, "HTTP/1.1 200 OK" EOL "Content-Length: %"
+                NE_FMT_SIZE_T EOL EOL, size);
+    ne_buffer_zappend(resp, head);
+    ne_buffer_append(resp, body, size);
+    ne_free(body);
+    return resp;
+}
+
+#ifdef NE_HAVE_THREADS
+#define TRACE_THREADS (4)
+#define TRACE_MESSAGES (200)
+
+static void *trace_thread(void *userdata)
+{
+    int n, id = *(int *)userdata;
+
+    for (n = 0; n < TRACE_MESSAGES; n++)
+        NE_DEBUG(NE_DBG_HTTP, "thread %d message %d\n", id, n);
+    return NULL;
+}
+
+/* Check that the messages of several threads are all kept, each
+ * thread's in order. */
+static int trace_threads(ne_buffer *got)
+{
+    pthread_t threads[TRACE_THREADS];
+    int ids[TRACE_THREADS], last[TRACE_THREADS], n, count = 0;
+    const char *line;
+
+    ne_debug_trace(TRACE_RING);
+    for (n = 0; n < TRACE_THREADS; n++) {
+        ids[n] = n;
+        last[n] = -1;
+        ONN("could not create thread",
+            pthread_create(&threads[n], NULL, trace_thread, &ids[n]));
+    }
+    for (n = 0; n < TRACE_THREADS; n++)
+        pthread_join(threads[n], NULL);
+    CALL(decode_trace(got));
+
+    for (line = got->data; *line; line = strchr(line, '\n') + 1) {
+        int id, msg;
+
+        ONV(sscanf(line, "thread %d message %d", &id, &msg) != 2
+            || id < 0 || id >= TRACE_THREADS,
+            ("unexpected line in trace: %.40s", line));
+        ONV(msg != last[id] + 1, ("thread %d message %d follows %d",
+                                  id, msg, last[id]));
+        last[id] = msg;
+        count++;
+    }
+    ONV(count != TRACE_THREADS * TRACE_MESSAGES,
+        ("%d messages traced, expected %d", count,
+         TRACE_THREADS * TRACE_MESSAGES));
+    return OK;
+}
+#endif
+
+static int trace_checks(FILE *stream, int mask)
+{
+    ne_buffer *expect = ne_buffer_create(), *got = ne_buffer_create();
+    ne_buffer *small = traced_response(1000), *large;
+    char buf[512];
+    const char *line;
+    double secs[3], msgs[2];
+    struct timeval start;
+    FILE *f;
+    int n, first = -1, prev = -1;
+
+    /* Messages are formatted as vfprintf would. */
+    ONN("could not enable tracing", ne_debug_trace(TRACE_RING));
+    ne_snprintf(buf, sizeof buf, TRACE_FORMAT, TRACE_ARGS);
+    ne_buffer_zappend(expect, buf);
+    NE_DEBUG(NE_DBG_HTTP, TRACE_FORMAT, TRACE_ARGS);
+    CALL(decode_trace(got));
+    ONV(strcmp(got->data, expect->data),
+        ("decoded `%s', expected `%s'", got->data, expect->data));
+
+    /* The trace of a request matches what is written to the debug
+     * stream, apart from the timings which will differ.  A first
+     * fetch puts the address in the resolver cache for both. */
+    ne_debug_trace(0);
+    ne_debug_init(NULL, 0);
+    CALL(fetch_traced(small, &secs[0]));
+    f = tmpfile();
+    ONN("could not create temporary file", f == NULL);
+    ne_debug_trace(0);
+    ne_debug_init(f, mask & ~NE_DBG_TIMING);
+    CALL(fetch_traced(small, &secs[0]));
+    read_stream(f, expect);
+    fclose(f);
+    ne_debug_init(stream, mask & ~NE_DBG_TIMING);
+    ne_debug_trace(TRACE_RING);
+    CALL(fetch_traced(small, &secs[0]));
+    CALL(decode_trace(got));
+    ONV(strcmp(got->data, expect->data),
+        ("decoded trace of %" NE_FMT_SIZE_T " bytes differs from %"
+         NE_FMT_SIZE_T " bytes of debug output", ne_buffer_size(got),
+         ne_buffer_size(expect)));
+    ne_debug_init(stream, mask);
+
+    /* Once the ring is full, the oldest messages are lost. */
+    ONN("small ring rejected", ne_debug_trace(4096));
+    ONN("tiny ring accepted", ne_debug_trace(100) == 0);
+    for (n = 0; n < 1000; n++)
+        NE_DEBUG(NE_DBG_HTTP, "message %d of %s\n", n, "wrap-around");
+    CALL(decode_trace(got));
+    for (line = got->data; *line; line = strchr(line, '\n') + 1) {
+        ONV(sscanf(line, "message %d of wrap-around", &n) != 1,
+            ("unexpected line in trace: %.40s", line));
+        ONV(prev != -1 && n != prev + 1, 
+            ("message %d follows %d", n, prev));
+        if (first == -1) first = n;
+        prev = n;
+    }
+    ONV(first <= 0 || prev != 999, 
+        ("trace held messages %d to %d", first, prev));
+
+#ifdef NE_HAVE_THREADS
+    CALL(trace_threads(got));
+#endif
+
+    /* Compare the cost of tracing many small messages, and a large
+     * response body. */
+    f = tmpfile();
+    ONN("could not create temporary file", f == NULL);
+    ne_debug_trace(0);
+    ne_debug_init(f, mask);
+    bench_start(&start);
+    for (n = 0; n < TRACE_COUNT; n++)
+        NE_DEBUG(NE_DBG_HTTP, "[hdr] %s: %s\n", "Content-Length", "1234");
+    msgs[0] = bench_elapsed(&start);
+    fclose(f);
+    ne_debug_init(stream, mask);
+    ne_debug_trace(TRACE_RING);
+    bench_start(&start);
+    for (n = 0; n < TRACE_COUNT; n++)
+        NE_DEBUG(NE_DBG_HTTP, "[hdr] %s: %s\n", "Content-Length", "1234");
+    msgs[1] = bench_elapsed(&start);
+
+    large = traced_response(TRACE_BODY);
+    ne_debug_trace(0);
+    ne_debug_init(stream, 0);
+    CALL(fetch_traced(large, &secs[0]));
+    f = tmpfile();
+    ONN("could not create temporary file", f == NULL);
+    ne_debug_init(f, mask);
+    CALL(fetch_traced(large, &secs[1]));
+    fclose(f);
+    ne_debug_init(stream, mask);
+    ne_debug_trace(TRACE_RING);
+    CALL(fetch_traced(large, &secs[2]));
+    ne_debug_trace(0);
+
+    bench_report("%d messages: debug stream %.0f/s, trace ring %.0f/s; "
+                 "%d byte body: no debugging %.1f MB/s, debug stream "
+                 "%.1f MB/s, trace ring %.1f MB/s", TRACE_COUNT,
+                 TRACE_COUNT / msgs[0], TRACE_COUNT / msgs[1], TRACE_BODY,
+                 TRACE_BODY / secs[0] / 1048576,
+                 TRACE_BODY / secs[1] / 1048576, 
+                 TRACE_BODY / secs[2] / 1048576);
+
+    ne_buffer_destroy(large);
+    ne_buffer_destroy(small);
+    ne_buffer_destroy(expect);
+    ne_buffer_destroy(got);
+    return OK;
+}
+
+/* Check the binary trace of debug output, and compare its cost to
+ * writing debug output to a stream. */
+static int trace(void)
+{
+    FILE *stream = ne_debug_stream;
+    int ret, mask = ne_debug_mask;
+
+    CALL(lookup_localhost());
+    ret = trace_checks(stream, mask);
+    ne_debug_trace(0);
+    ne_debug_init(stream, mask);
+    return ret;
+}
+
+/* Rate limit in bytes per second and burst size used by the
+ * ratelimit test, the size of the resource transferred, and the
+ * tolerance allowed in the achieved rate. */
+#define RATE_LIMIT (512 * 1024)
+#define RATE_BURST (16 * 1024)
+#define RATE_SIZE (256 * 1024)
+#define RATE_TOLERANCE (0.2)
+
+/* Response body reader which counts the bytes read, noting the time
+ * taken to read the whole body. */
+struct rated {
+    off_t count;
+    struct timeval *start;
+    double done;
+};
+
+static int rated_body(void *userdata, const char *buf, size_t len)
+{
+    struct rated *r = userdata;
+
+    r->count += len;
+    if (r->count == RATE_SIZE && len)
+        r->done = bench_elapsed(r->start);
+    return 0;
+}
+
+/* Fail if 'bytes' transferred after the burst in 'secs' seconds are
+ * not within the tolerance of the rate limit. */
+static int check_rate(const char *what, double bytes, double secs,
+                      double *rate)
+{
+    *rate = (bytes - RATE_BURST) / secs;
+    ONV(*rate > RATE_LIMIT * (1 + RATE_TOLERANCE)
+        || *rate < RATE_LIMIT * (1 - RATE_TOLERANCE),
+        ("%s at %.0f bytes/s, limited to %d", what, *rate, RATE_LIMIT));
+    return OK;
+}
+
+/* Check that uploads and downloads keep to a rate limit, and that
+ * two sessions sharing a limiter divide it fairly. */
+static int ratelimit(void)
+{
+    char *path = ne_concat(i_path, "rate", NULL);
+    char *body = ne_malloc(RATE_SIZE);
+    ne_ratelimit *up = ne_ratelimit_create(RATE_LIMIT, RATE_BURST),
+        *down = ne_ratelimit_create(RATE_LIMIT, RATE_BURST);
+    ne_request *reqs[2];
+    struct rated rated[2];
+    struct timeval start;
+    double secs, uprate, downrate, sharedrate;
+    int n, ret;
+
+    memset(body, 'r', RATE_SIZE);
+
+    /* Upload at the limited rate. */
+    ne_set_rate_limit(i_session, up, NULL);
+    reqs[0] = ne_request_create(i_session, "PUT", path);
+    ne_set_request_body_buffer(reqs[0], body, RATE_SIZE);
+    bench_start(&start);
+    ret = ne_request_dispatch(reqs[0]);
+    secs = bench_elapsed(&start);
+    ONV(ret || ne_get_status(reqs[0])->klass != 2,
+        ("PUT of `%s' failed: %s", path, ne_get_error(i_session)));
+    ne_request_destroy(reqs[0]);
+    CALL(check_rate("upload", RATE_SIZE, secs, &uprate));
+
+    /* Download at the limited rate. */
+    ne_set_rate_limit(i_session, NULL, down);
+    reqs[0] = ne_request_create(i_session, "GET", path);
+    rated[0].count = 0;
+    rated[0].start = &start;
+    ne_add_response_body_reader(reqs[0], ne_accept_2xx, rated_body, 
+                                &rated[0]);
+    bench_start(&start);
+    ret = ne_request_dispatch(reqs[0]);
+    secs = bench_elapsed(&start);
+    ONV(ret || ne_get_status(reqs[0])->klass != 2,
+        ("GET of `%s' failed: %s", path, ne_get_error(i_session)));
+    ONV(rated[0].count != RATE_SIZE,
+        ("GET got %" NE_FMT_OFF_T " bytes, expected %d", 
+         rated[0].count, RATE_SIZE));
+    ne_request_destroy(reqs[0]);
+    CALL(check_rate("download", RATE_SIZE, secs, &downrate));
+
+    /* Two sessions sharing the limiter each get half of it, and so
+     * finish at about the same time. */
+    ne_set_rate_limit(i_session2, NULL, down);
+    for (n = 0; n < 2; n++) {
+        reqs[n] = ne_request_create(n ? i_session2 : i_session, "GET", path);
+        rated[n].count = 0;
+        rated[n].start = &start;
+        rated[n].done = 0;
+        ne_add_response_body_reader(reqs[n], ne_accept_2xx, rated_body,
+                                    &rated[n]);
+    }
+    bench_start(&start);
+    CALL(step_all(reqs, 2));
+    secs = bench_elapsed(&start);
+    for (n = 0; n < 2; n++) {
+        ONV(ne_get_status(reqs[n])->klass != 2 || rated[n].count != RATE_SIZE,
+            ("shared GET %d of `%s' failed: %s", n, path,
+             ne_get_error(ne_get_session(reqs[n]))));
+        ne_request_destroy(reqs[n]);
+    }
+    CALL(check_rate("shared download", 2 * RATE_SIZE, secs, &sharedrate));
+    ONV(rated[0].done - rated[1].done > secs * RATE_TOLERANCE
+        || rated[1].done - rated[0].done > secs * RATE_TOLERANCE,
+        ("shared downloads finished after %.3fs and %.3fs",
+         rated[0].done, rated[1].done));
+
+    ne_set_rate_limit(i_session, NULL, NULL);
+    ne_set_rate_limit(i_session2, NULL, NULL);
+    ne_ratelimit_destroy(up);
+    ne_ratelimit_destroy(down);
+
+    bench_report("limit %d bytes/s: upload %.0f bytes/s, download %.0f "
+                 "bytes/s, shared by 2 sessions %.0f bytes/s",
+                 RATE_LIMIT, uprate, downrate, sharedrate);
+
+    ne_delete(i_session, path);
+    free(path);
+    free(body);
+    return OK;
+}
+
+/* Port, certificate and number of reconnections used by the
+ * ssl_resume test, which runs "openssl s_server" as a stand-in
+ * server. */
+#define SSL_PORT (7778)
+#define SSL_CERT "ssl-resume.pem"
+#define SSL_ROUNDS (20)
+
+static int accept_any_cert(void *userdata, int failures,
+                           const ne_ssl_certificate *cert)
+{
+    return 0;
+}
+
+/* GET "/" in session 'sess' on a new connection. */
+static int ssl_get(ne_session *sess)
+{
+    ne_request *req = ne_request_create(sess, "GET", "/");
+    int ret = ne_request_dispatch(req);
+
+    if (ret == NE_OK && ne_get_status(req)->klass != 2)
+        ret = NE_ERROR;
+    ne_request_destroy(req);
+    ne_close_connection(sess);
+    return ret;
+}
+
+/* Reconnect repeatedly to an SSL server, checking that the cached
+ * SSL session is resumed rather than a full handshake performed. */
+static int ssl_resume(void)
+{
+    ne_session *sess;
+    ne_pool_stats before, after;
+    struct timeval start;
+    double secs;
+    pid_t pid;
+    int n, ret;
+
+    if (!ne_has_support(NE_FEATURE_SSL)) {
+        t_context("SSL support not compiled in");
+        return SKIP;
+    }
+    
+    if (system("openssl req -x509 -newkey rsa:2048 -nodes -days 1 "
+               "-subj /CN=localhost -keyout " SSL_CERT " -out " SSL_CERT
+               " >/dev/null 2>&1") != 0) {
+        t_context("could not create certificate with openssl");
+        return SKIP;
+    }
+
+    pid = fork();
+    if (pid == 0) {
+        execlp("openssl", "openssl", "s_server", "-quiet", "-www",
+               "-accept", "7778", "-cert", SSL_CERT, NULL);
+        _exit(1);
+    }
+    ONN("fork failed", pid < 0);
+
+    sess = ne_session_create("https", "127.0.0.1", SSL_PORT);
+    ne_ssl_set_verify(sess, accept_any_cert, NULL);
+
+    /* Wait for the server to start listening. */
+    for (n = 0; (ret = ssl_get(sess)) == NE_CONNECT && n < 100; n++)
+        minisleep();
+
+    ne_get_pool_stats(sess, &before);
+    bench_start(&start);
+    for (n = 0; ret == NE_OK && n < SSL_ROUNDS; n++)
+        ret = ssl_get(sess);
+    secs = bench_elapsed(&start);
+    ne_get_pool_stats(sess, &after);
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    unlink(SSL_CERT);
+
+    ONV(ret != NE_OK, ("GET failed: %s", ne_get_error(sess)));
+    ONV(before.handshakes == 0, ("no full handshake on first connection"));
+    ONV(after.resumed - before.resumed < SSL_ROUNDS - 1,
+        ("%lu of %d connections resumed the SSL session",
+         after.resumed - before.resumed, SSL_ROUNDS));
+
+    bench_report("%d reconnections: %lu resumed, %lu full handshakes, "
+                 "%.2fms each", SSL_ROUNDS, after.resumed - before.resumed,
+                 after.handshakes - before.handshakes, 
+                 secs * 1e3 / SSL_ROUNDS);
+
+    ne_session_destroy(sess);
+    return OK;
+}
+
 ne_test tests[] = {
     INIT_TESTS,
 
     T(expect100),
+    T(writev_empty),
+    T(pipeline),
+    T(pipeline_window),
+    T(pool),
+    T(overlap),
+    T(multiplex),
+    T(chunked),
+    T(resolver),
+    T(resolve_async),
+    T(eyeballs),
+    T(header_parse),
+    T(header_heavy),
+    T(chunk_stream),
+    T(chunk_oversize),
+    T(borrow),
+    T(big_propfind),
+    T(propfind_stream),
+    T(xml_names),
+    T(xml_stack),
+    T(stale),
+    T(expect100_wait),
+    T(resumable),
+    T(timings),
+    T(trace),
+    T(ratelimit),
+    T(ssl_resume),
 
     FINISH_TESTS
 };
@@ -26,15 +26,20 @@
 #include <fcntl.h>
 #include <assert.h>
 #include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
 
 #ifdef HAVE_STDINT_H
 #include <stdint.h>
 #endif
 
 #include "ne_request.h"
+#include "ne_basic.h"
 
 #include "tests.h"
 #include "common.h"
+#include "child.h"
 
 #ifndef INT64_C
 #define INT64_C(x) x ## LL
@@ -111,17 +116,115 @@ static int large_put(void)
     return OK;
 }
 
-static int large_get(void)
+/* Name of the local file used as an fd-backed request body. */
+#define FD_FILENAME "largefile.tmp"
+
+/* Body provider which copies the request body from a file descriptor
+ * through the request layer's buffer. */
+static ssize_t fd_provider(void *userdata, char *buffer, size_t buflen)
+{
+    int fd = *(int *)userdata;
+
+    if (buflen == 0)
+        return lseek(fd, 0, SEEK_SET) == 0 ? 0 : -1;
+
+    return read(fd, buffer, buflen);
+}
+
+/* PUT the contents of 'fd' to the large file, using a body provider
+ * if 'copy' is non-zero, else ne_set_request_body_fd; stores the
+ * elapsed time in *secs. */
+static int put_fd(int fd, int copy, double *secs)
+{
+    ne_request *req = ne_request_create(i_session, "PUT", path);
+    struct timeval start;
+    int ret;
+
+    if (copy) {
+#ifdef NE_LFS
+        ne_set_request_body_provider64(req, TOTALSIZE, fd_provider, &fd);
+#else
+        ne_set_request_body_provider(req, TOTALSIZE, fd_provider, &fd);
+#endif
+    } else {
+#ifdef NE_LFS
+        ne_set_request_body_fd64(req, fd, 0, TOTALSIZE);
+#else
+        ne_set_request_body_fd(req, fd, 0, TOTALSIZE);
+#endif
+    }
+
+    bench_start(&start);
+    ret = ne_request_dispatch(req);
+    *secs = bench_elapsed(&start);
+
+    ONNREQ("large PUT request from file", 
+           ret || ne_get_status(req)->klass != 2);
+
+    ne_request_destroy(req);
+
+    return OK;
+}
+
+static int large_put_fd(void)
+{
+    int fd, n, flags = O_RDWR | O_CREAT | O_TRUNC;
+    double copied, direct;
+
+#ifdef O_LARGEFILE
+    flags |= O_LARGEFILE;
+#endif
+
+    fd = open(FD_FILENAME, flags, 0600);
+    ONV(fd < 0, ("could not create %s: %s", FD_FILENAME, strerror(errno)));
+
+    for (n = 0; n < NUMBLOCKS; n++) {
+        if (write(fd, block, BLOCKSIZE) != BLOCKSIZE) {
+            t_context("could not write %s: %s", FD_FILENAME, strerror(errno));
+            close(fd);
+            unlink(FD_FILENAME);
+            return FAIL;
+        }
+    }
+
+    n = put_fd(fd, 1, &copied);
+    if (n == OK) n = put_fd(fd, 0, &direct);
+
+    close(fd);
+    unlink(FD_FILENAME);
+
+    if (n == OK)
+        bench_report("copied %.1f MB/s, zero-copy %.1f MB/s",
+                     TOTALSIZE / copied / 1048576.0, 
+                     TOTALSIZE / direct / 1048576.0);
+
+    return n;
+}
+
+/* Size of the enlarged socket read buffer used by large_get. */
+#define LARGE_RDBUFSIZ (65536)
+
+/* GET the large file using socket read buffer size 'bufsize',
+ * storing the number of read system calls per megabyte in *rate. */
+static int get_large(size_t bufsize, double *rate)
 {
-    ne_request *req = ne_request_create(i_session, "GET", path);
+    ne_request *req;
     char buffer[BLOCKSIZE], origin[BLOCKSIZE * 2];
     long long progress = 0;
     ssize_t offset = 0;
     ssize_t bytes;
+    unsigned long calls;
 
     memcpy(origin, block, BLOCKSIZE);
     memcpy(origin + BLOCKSIZE, block, BLOCKSIZE);
 
+    /* Use a new connection, so that it has the given buffer size. */
+    ne_close_connection(i_session);
+    ne_set_read_buffer_size(i_session, bufsize);
+    calls = ne_get_read_calls(i_session);
+
+    req = ne_request_create(i_session, "GET", path);
+
     ONNREQ("begin large GET request", ne_begin_request(req));
 
     ONNREQ("failed GET request", ne_get_status(req)->klass != 2);
@@ -138,15 +241,256 @@ static int large_get(void)
     ONNREQ("end large GET request", ne_end_request(req));
 
     ne_request_destroy(req);
+
+    ne_close_connection(i_session);
+    ne_set_read_buffer_size(i_session, 0);
+    calls = ne_get_read_calls(i_session) - calls;
+
+    *rate = calls / (progress / 1048576.0);
+
+    return OK;
+}
+
+static int large_get(void)
+{
+    double before, after;
+
+    CALL(get_large(0, &before));
+    CALL(get_large(LARGE_RDBUFSIZ, &after));
+
+    bench_report("read syscalls per MB: %.1f with default buffer, "
+                 "%.1f with %d byte buffer", before, after, LARGE_RDBUFSIZ);
+
+    return OK;
+}
+
+/* Name of the local file written by large_get_parallel. */
+#define PARALLEL_FILENAME "largefile.get"
+
+/* Number of connections used by large_get_parallel. */
+#define PARALLEL_CONNS (4)
+
+/* GET the large file into a local file over 'count' connections, or
+ * with a single ne_get if 'count' is zero, then check its contents;
+ * stores the elapsed time of the GET in *secs. */
+static int get_parallel(unsigned int count, double *secs)
+{
+    int fd, ret, flags = O_RDWR | O_CREAT | O_TRUNC;
+    char buffer[BLOCKSIZE];
+    struct timeval start;
+    long long n;
+
+#ifdef O_LARGEFILE
+    flags |= O_LARGEFILE;
+#endif
+
+    fd = open(PARALLEL_FILENAME, flags, 0600);
+    ONV(fd < 0, ("could not create %s: %s", PARALLEL_FILENAME, 
+                 strerror(errno)));
+
+    ne_set_connection_pool(i_session, count ? count : 1, 0);
+
+    bench_start(&start);
+    if (count)
+        ret = ne_get_range_parallel(i_session, path, fd, count);
+    else
+        ret = ne_get(i_session, path, fd);
+    *secs = bench_elapsed(&start);
+
+    ne_close_connection(i_session);
+    ne_set_connection_pool(i_session, 1, 0);
+
+    if (ret == NE_OK && lseek(fd, 0, SEEK_SET) == 0) {
+        for (n = 0; n < NUMBLOCKS; n++) {
+            if (read(fd, buffer, BLOCKSIZE) != BLOCKSIZE
+                || memcmp(buffer, block, BLOCKSIZE))
+                break;
+        }
+        if (n < NUMBLOCKS || read(fd, buffer, 1) != 0) {
+            t_context("%s differs from the resource at block %" 
+                      NE_FMT_LONG_LONG, PARALLEL_FILENAME, n);
+            ret = -1;
+        }
+    }
+    else if (ret != NE_OK) {
+        t_context("GET failed: %s", ne_get_error(i_session));
+    }
+
+    close(fd);
+    unlink(PARALLEL_FILENAME);
+
+    return ret == NE_OK ? OK : FAIL;
+}
+
+static int large_get_parallel(void)
+{
+    double single, parallel;
+
+    CALL(get_parallel(0, &single));
+    CALL(get_parallel(PARALLEL_CONNS, &parallel));
+
+    bench_report("one connection %.1f MB/s, %d connections %.1f MB/s",
+                 TOTALSIZE / single / 1048576.0, PARALLEL_CONNS,
+                 TOTALSIZE / parallel / 1048576.0);
+
+    return OK;
+}
+
+/* Length of the resource served by serve_changed. */
+#define CHANGED_SIZE (1024 * 1024)
+
+/* Range request header received by serve_changed. */
+static char *got_range;
+
+static void note_range(char *value)
+{
+    got_range = ne_strdup(value);
+}
+
+/* Server for parallel_changed: answers a HEAD request with one
+ * entity tag, and ranged GETs with another, as if the resource
+ * changed after the HEAD. */
+static int serve_changed(ne_socket *sock, void *userdata)
+{
+    long start, end;
+    char head[256];
+
+    got_range = NULL;
+    want_header = "Range";
+    got_header = note_range;
+    CALL(discard_request(sock));
+
+    if (got_range == NULL) {
+        ne_snprintf(head, sizeof head, "HTTP/1.1 200 OK\r\n"
+                    "Content-Length: %d\r\nETag: \"before\"\r\n"
+                    "Connection: close\r\n\r\n", CHANGED_SIZE);
+        server_send(sock, head, strlen(head));
+        return OK;
+    }
+
+    ONV(sscanf(got_range, "bytes=%ld-%ld", &start, &end) != 2,
+        ("bad Range header: %s", got_range));
+    ne_free(got_range);
+
+    ne_snprintf(head, sizeof head, "HTTP/1.1 206 Partial Content\r\n"
+                "Content-Range: bytes %ld-%ld/%d\r\n"
+                "Content-Length: %ld\r\nETag: \"after\"\r\n"
+                "Connection: close\r\n\r\n", start, end, CHANGED_SIZE,
+                end - start + 1);
+    server_send(sock, head, strlen(head));
+    while (start <= end) {
+        long len = end - start + 1 > BLOCKSIZE ? BLOCKSIZE : end - start + 1;
+        if (server_send(sock, block, len)) break;
+        start += len;
+    }
+
     return OK;
 }
 
+/* A parallel GET of a resource which changes part-way through fails. */
+static int parallel_changed(void)
+{
+    ne_session *sess;
+    int fd, ret;
+
+    CALL(lookup_localhost());
+    /* Serve the HEAD and the first ranged GET only; the client
+     * abandons the other connections when the first range fails. */
+    CALL(spawn_server_repeat(7777, serve_changed, NULL, 3));
+
+    fd = open(PARALLEL_FILENAME, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    ONV(fd < 0, ("could not create %s: %s", PARALLEL_FILENAME, 
+                 strerror(errno)));
+
+    sess = ne_session_create("http", "127.0.0.1", 7777);
+    ne_set_connection_pool(sess, PARALLEL_CONNS, 0);
+    ret = ne_get_range_parallel(sess, "/changed", fd, PARALLEL_CONNS);
+    
+    close(fd);
+    unlink(PARALLEL_FILENAME);
+
+    ONV(ret != NE_ERROR, ("parallel GET of changed resource gave %d: %s",
+                          ret, ne_get_error(sess)));
+    ONV(strstr(ne_get_error(sess), "changed") == NULL,
+        ("unexpected error: %s", ne_get_error(sess)));
+
+    ne_session_destroy(sess);
+    return reap_server();
+}
+
+/* Server for parallel_ignored: answers every request with the whole
+ * resource, ignoring any Range header. */
+static int serve_ignored(ne_socket *sock, void *userdata)
+{
+    long sent = 0;
+    char head[256];
+
+    CALL(discard_request(sock));
+
+    ne_snprintf(head, sizeof head, "HTTP/1.1 200 OK\r\n"
+                "Content-Length: %d\r\nETag: \"same\"\r\n"
+                "Connection: close\r\n\r\n", CHANGED_SIZE);
+    server_send(sock, head, strlen(head));
+    /* The body is sent for a HEAD request too; the client closes the
+     * connection without reading it. */
+    while (sent < CHANGED_SIZE) {
+        if (server_send(sock, block, BLOCKSIZE)) break;
+        sent += BLOCKSIZE;
+    }
+
+    return OK;
+}
+
+/* A parallel GET from a server which ignores the Range header falls
+ * back to a single GET of the whole resource. */
+static int parallel_ignored(void)
+{
+    ne_session *sess;
+    char buf[BLOCKSIZE];
+    off_t total = 0;
+    ssize_t len;
+    int fd, ret;
+
+    CALL(lookup_localhost());
+    /* Serve the HEAD, the ranged GET, and the GET which replaces it. */
+    CALL(spawn_server_repeat(7777, serve_ignored, NULL, 4));
+
+    fd = open(PARALLEL_FILENAME, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    ONV(fd < 0, ("could not create %s: %s", PARALLEL_FILENAME, 
+                 strerror(errno)));
+
+    sess = ne_session_create("http", "127.0.0.1", 7777);
+    ret = ne_get_range_parallel(sess, "/ignored", fd, PARALLEL_CONNS);
+    ONV(ret != NE_OK, ("parallel GET gave %d: %s", ret, ne_get_error(sess)));
+
+    ONN("could not rewind file", lseek(fd, 0, SEEK_SET) != 0);
+    while ((len = read(fd, buf, sizeof buf)) > 0) {
+        ONV(memcmp(buf, block, len),
+            ("file differs from resource in block at %" NE_FMT_OFF_T,
+             total));
+        total += len;
+    }
+    close(fd);
+    unlink(PARALLEL_FILENAME);
+
+    ONV(total != CHANGED_SIZE, 
+        ("file is %" NE_FMT_OFF_T " bytes, expected %d",
+         total, CHANGED_SIZE));
+
+    ne_session_destroy(sess);
+    return reap_server();
+}
+
 ne_test tests[] = {
     INIT_TESTS,
     T(init_largefile),
 
     T(large_put),    
+    T(large_put_fd),
     T(large_get),
+    T(large_get_parallel),
+    T(parallel_changed),
+    T(parallel_ignored),
 
     FINISH_TESTS
 };
@@ -0,0 +1,65 @@
+/* 
+   litmus: decode a binary trace of neon debug output
+   Copyright (C) 2001-2004, Joe Orton <joe@manyfish.co.uk>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+  
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+  
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* Usage: tracedump [FILE...]
+ *
+ * Writes the messages held in each trace FILE (or standard input)
+ * written by ne_debug_dump, to standard output in the format of
+ * debug.log. */
+
+#include "config.h"
+
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include <ne_utils.h>
+#include <ne_trace.h>
+
+int main(int argc, char *argv[])
+{
+    int n, ret = 0;
+
+    if (argc < 2)
+        return ne_debug_decode(STDIN_FILENO, stdout) ? 1 : 0;
+
+    for (n = 1; n < argc; n++) {
+        int fd = open(argv[n], O_RDONLY);
+
+        if (fd < 0) {
+            fprintf(stderr, "tracedump: %s: %s\n", argv[n], strerror(errno));
+            ret = 1;
+            continue;
+        }
+        if (ne_debug_decode(fd, stdout)) {
+            fprintf(stderr, "tracedump: %s: trace is corrupt or "
+                    "unreadable\n", argv[n]);
+            ret = 1;
+        }
+        close(fd);
+    }
+
+    return ret;
+}
@@ -43,6 +43,7 @@
 
 #include "ne_string.h"
 #include "ne_utils.h"
+#include "ne_trace.h"
 #include "ne_socket.h"
 
 #include "tests.h"
@@ -98,7 +99,7 @@ void t_warning(const char *str, ...)
 
 #define TEST_DEBUG \
 (NE_DBG_HTTP | NE_DBG_SOCKET | NE_DBG_HTTPBODY | NE_DBG_HTTPAUTH | \
- NE_DBG_LOCKS | NE_DBG_XMLPARSE | NE_DBG_XML | NE_DBG_SSL)
+ NE_DBG_LOCKS | NE_DBG_XMLPARSE | NE_DBG_XML | NE_DBG_SSL | NE_DBG_TIMING)
 
 #define W(m) do { if (write(0, m, strlen(m)) < 0) exit(99); } while(0)
 
@@ -132,6 +133,7 @@ static void parent_segv(int signo)
 
 void in_child(void)
 {
+    ne_debug_trace(0);
     ne_debug_init(child_debug, TEST_DEBUG);    
     NE_DEBUG(TEST_DEBUG, "**** Child forked for test %s ****\n", test_name);
     signal(SIGSEGV, child_segv);